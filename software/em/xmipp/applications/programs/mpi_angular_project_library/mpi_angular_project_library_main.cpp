@@ -173,11 +173,11 @@ public:
         start=end;
         std::cerr<<" setsampling rank= "<<rank<<std::endl;
 #endif
-        //true -> half_sphere
-        mysampling.computeSamplingPoints(false,max_tilt_angle,min_tilt_angle);
-        mysampling.SL.readSymmetryFile(fn_sym);
-        //store symmetry matrices, this is faster than computing them each time
-        mysampling.fillLRRepository();
+        // We first sample The  whole sphere
+        // Then we remove point redundant due to sampling symmetry
+        // use old symmetry, this is geometric does not use L_R
+        // Only rank 0 writes the sampling cache
+        computeNonRedundantSampling(rank == 0);
 
 #ifdef  DEBUGTIME
 
@@ -187,11 +187,6 @@ public:
         std::cerr<<" compute sampling points rank= "<<rank<<std::endl;
 #endif
 
-        // We first sample The  whole sphere
-        // Then we remove point redundant due to sampling symmetry
-        // use old symmetry, this is geometric does not use L_R
-        mysampling.removeRedundantPoints(symmetry, sym_order);
-
         //=========================
         //======================
         //recompute symmetry with neigh symmetry
@@ -79,6 +79,32 @@ bool CL2DAssignmentComparator(const CL2DAssignment& d1, const CL2DAssignment& d2
   return d1.objId < d2.objId;
 }
 
+/* CL2DImagePolar ---------------------------------------------------- */
+CL2DImagePolar::CL2DImagePolar()
+{
+    plans = NULL;
+}
+
+CL2DImagePolar::~CL2DImagePolar()
+{
+    delete plans;
+}
+
+void CL2DImagePolar::compute(const MultidimArray<double> &I)
+{
+    // Same rings as in fitBasic
+    normalizedPolarFourierTransform(I, polarFourierI, true,
+                                    XSIZE(I) / 5, XSIZE(I) / 2-2, plans, 1);
+    if (prm->mirrorImages)
+    {
+        MultidimArray<double> Imirror = I;
+        Imirror.selfReverseX();
+        Imirror.setXmippOrigin();
+        normalizedPolarFourierTransform(Imirror, polarFourierImirror, true,
+                                        XSIZE(I) / 5, XSIZE(I) / 2-2, plans, 1);
+    }
+}
+
 /* CL2DClass basics ---------------------------------------------------- */
 CL2DClass::CL2DClass()
 {
@@ -209,7 +235,7 @@ void CL2DClass::transferUpdate(bool centerReference)
 //#define DEBUG
 //#define DEBUG_MORE
 void CL2DClass::fitBasic(MultidimArray<double> &I, CL2DAssignment &result,
-                         bool reverse)
+                         bool reverse, const double *initialRot)
 {
     if (reverse)
     {
@@ -273,10 +299,16 @@ void CL2DClass::fitBasic(MultidimArray<double> &I, CL2DAssignment &result,
 			// Rotate then shift
 			if (bestRotRS > ROTATE_THRESHOLD)
 			{
-				normalizedPolarFourierTransform(IauxRS, polarFourierI, true,
-												XSIZE(P) / 5, XSIZE(P) / 2-2, plans, 1);
+				if (i == 0 && initialRot != NULL)
+					// IauxRS is still the input image, whose rotation was precomputed
+					bestRotRS = *initialRot;
+				else
+				{
+					normalizedPolarFourierTransform(IauxRS, polarFourierI, true,
+													XSIZE(P) / 5, XSIZE(P) / 2-2, plans, 1);
 
-				bestRotRS = best_rotation(polarFourierP, polarFourierI, rotAux);
+					bestRotRS = best_rotation(polarFourierP, polarFourierI, rotAux);
+				}
 				rotation2DMatrix(bestRotRS, R);
 				M3x3_BY_M3x3(ARS,R,ARS);
 				applyGeometry(LINEAR, IauxRS, I, ARS, IS_NOT_INV, WRAP);
@@ -408,7 +440,18 @@ void CL2DClass::fitBasic(MultidimArray<double> &I, CL2DAssignment &result,
 #undef DEBUG
 #undef DEBUG_MORE
 
-void CL2DClass::fit(MultidimArray<double> &I, CL2DAssignment &result)
+void CL2DClass::initialRotation(const CL2DImagePolar &polarI, CL2DInitialRotation &rot)
+{
+    rot.direct = rot.mirror = 0;
+    if (currentListImg.size() == 0)
+        return;
+    rot.direct = best_rotation(polarFourierP, polarI.polarFourierI, rotAux);
+    if (prm->mirrorImages)
+        rot.mirror = best_rotation(polarFourierP, polarI.polarFourierImirror, rotAux);
+}
+
+void CL2DClass::fit(MultidimArray<double> &I, CL2DAssignment &result,
+                    const CL2DInitialRotation *initialRot)
 {
     if (currentListImg.size() == 0)
         return;
@@ -416,7 +459,8 @@ void CL2DClass::fit(MultidimArray<double> &I, CL2DAssignment &result)
     // Try this image
     MultidimArray<double> Idirect = I;
     CL2DAssignment resultDirect;
-    fitBasic(Idirect, resultDirect);
+    fitBasic(Idirect, resultDirect, false,
+             initialRot == NULL ? NULL : &(initialRot->direct));
 
     // Try its mirror
 	CL2DAssignment resultMirror;
@@ -424,7 +468,8 @@ void CL2DClass::fit(MultidimArray<double> &I, CL2DAssignment &result)
     if (prm->mirrorImages)
     {
     	Imirror=I;
-		fitBasic(Imirror, resultMirror, true);
+		fitBasic(Imirror, resultMirror, true,
+		         initialRot == NULL ? NULL : &(initialRot->mirror));
     }
     else
     	resultMirror.corr=-1e38;
@@ -543,157 +588,160 @@ void CL2D::shareAssignments(bool shareAssignment, bool shareUpdates,
     // Share code updates
     if (shareUpdates)
     {
-        std::vector<CL2DAssignment> auxList;
-        std::vector<double> auxList2;
-        int Q = P.size();
-        for (int q = 0; q < Q; q++)
-        {
-            MPI_Allreduce(MPI_IN_PLACE, MULTIDIM_ARRAY(P[q]->Pupdate),
-                          MULTIDIM_SIZE(P[q]->Pupdate), MPI_DOUBLE, MPI_SUM,
-                          MPI_COMM_WORLD);
-
-            // Share nextClassCorr and nextNonClassCorr
-            std::vector<double> receivedNonClassCorr;
-            std::vector<CL2DAssignment> receivedNextListImage;
-            int listSize;
-            for (size_t rank = 0; rank < prm->node->size; rank++)
-            {
-                if (rank == prm->node->rank)
-                {
-                    listSize = P[q]->nextListImg.size();
-                    MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                    MPI_Bcast(&(P[q]->nextListImg[0]),
-                              P[q]->nextListImg.size() * sizeof(CL2DAssignment),
-                              MPI_CHAR, rank, MPI_COMM_WORLD);
-                    if (shareNonCorr)
-                    {
-                        listSize = P[q]->nextNonClassCorr.size();
-                        MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                        MPI_Bcast(&(P[q]->nextNonClassCorr[0]),
-                                  P[q]->nextNonClassCorr.size(), MPI_DOUBLE,
-                                  rank, MPI_COMM_WORLD);
-                    }
-                }
-                else
-                {
-                    MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                    auxList.resize(listSize);
-                    MPI_Bcast(&(auxList[0]), listSize * sizeof(CL2DAssignment),
-                              MPI_CHAR, rank, MPI_COMM_WORLD);
-                    receivedNextListImage.reserve(
-                        receivedNextListImage.size() + listSize);
-                    for (int j = 0; j < listSize; j++)
-                        receivedNextListImage.push_back(auxList[j]);
-                    if (shareNonCorr)
-                    {
-                        MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                        auxList2.resize(listSize);
-                        MPI_Bcast(&(auxList2[0]), listSize, MPI_DOUBLE, rank,
-                                  MPI_COMM_WORLD);
-                        receivedNonClassCorr.reserve(
-                            receivedNonClassCorr.size() + listSize);
-                        for (int j = 0; j < listSize; j++)
-                            receivedNonClassCorr.push_back(auxList2[j]);
-                    }
-                }
-            }
-            // This is important to ensure that all nodes have all images in the same order
-            std::sort(receivedNextListImage.begin(),receivedNextListImage.end(),CL2DAssignmentComparator);
-
-            // Copy the received elements
-            listSize = receivedNextListImage.size();
-            P[q]->nextListImg.reserve(P[q]->nextListImg.size() + listSize);
-            for (int j = 0; j < listSize; j++)
-                P[q]->nextListImg.push_back(receivedNextListImage[j]);
-            listSize = receivedNonClassCorr.size();
-            P[q]->nextNonClassCorr.reserve(
-                P[q]->nextNonClassCorr.size() + listSize);
-            for (int j = 0; j < listSize; j++)
-                P[q]->nextNonClassCorr.push_back(receivedNonClassCorr[j]);
-        }
-
+        shareClassUpdates(P, shareNonCorr);
         transferUpdates();
     }
 }
 
-void CL2D::shareSplitAssignments(Matrix1D<int> &assignment, CL2DClass *node1,
-                                 CL2DClass *node2) const
+void CL2D::shareClassUpdates(const std::vector<CL2DClass *> &nodes,
+                             bool shareNonCorr) const
 {
-    // Share assignment
-    int imax = VEC_XSIZE(assignment);
-    MPI_Allreduce(MPI_IN_PLACE, MATRIX1D_ARRAY(assignment), imax, MPI_INT,
-                  MPI_MAX, MPI_COMM_WORLD);
+    int Q = nodes.size();
+    int nprocs = prm->node->size;
+    int rank = prm->node->rank;
 
-    // Share code updates
-    std::vector<CL2DAssignment> auxList;
-    std::vector<double> auxList2;
-    CL2DClass *node = NULL;
-    for (int q = 0; q < 2; q++)
+    // Gather the list sizes of all nodes in a single collective
+    std::vector<int> localSizes(2 * Q), allSizes(2 * Q * nprocs);
+    for (int q = 0; q < Q; q++)
     {
-        if (q == 0)
-            node = node1;
-        else
-            node = node2;
-        MPI_Allreduce(MPI_IN_PLACE, MULTIDIM_ARRAY(node->Pupdate),
-                      MULTIDIM_SIZE(node->Pupdate), MPI_DOUBLE, MPI_SUM,
-                      MPI_COMM_WORLD);
+        localSizes[2 * q] = nodes[q]->nextListImg.size();
+        localSizes[2 * q + 1] = shareNonCorr ? nodes[q]->nextNonClassCorr.size() : 0;
+    }
+    MPI_Allgather(&(localSizes[0]), 2 * Q, MPI_INT, &(allSizes[0]), 2 * Q,
+                  MPI_INT, MPI_COMM_WORLD);
 
-        // Share nextClassCorr and nextNonClassCorr
-        std::vector<double> receivedNonClassCorr;
+    // Sum the updates of the classes that have received images in any node.
+    // The updates of the rest of classes are zero everywhere.
+    std::vector<int> changed;
+    size_t totalSize = 0;
+    for (int q = 0; q < Q; q++)
+    {
+        size_t listSize = 0;
+        for (int r = 0; r < nprocs; r++)
+            listSize += allSizes[2 * Q * r + 2 * q];
+        if (listSize > 0)
+        {
+            changed.push_back(q);
+            totalSize += MULTIDIM_SIZE(nodes[q]->Pupdate);
+        }
+    }
+    if (totalSize > 0)
+    {
+        std::vector<double> buffer(totalSize);
+        double *ptr = &(buffer[0]);
+        for (size_t i = 0; i < changed.size(); i++)
+        {
+            const MultidimArray<double> &Pupdate = nodes[changed[i]]->Pupdate;
+            memcpy(ptr, MULTIDIM_ARRAY(Pupdate), MULTIDIM_SIZE(Pupdate) * sizeof(double));
+            ptr += MULTIDIM_SIZE(Pupdate);
+        }
+        for (size_t offset = 0; offset < totalSize; offset += INT_MAX)
+        {
+            int chunk = (int) XMIPP_MIN(totalSize - offset, (size_t) INT_MAX);
+            MPI_Allreduce(MPI_IN_PLACE, &(buffer[offset]), chunk, MPI_DOUBLE,
+                          MPI_SUM, MPI_COMM_WORLD);
+        }
+        ptr = &(buffer[0]);
+        for (size_t i = 0; i < changed.size(); i++)
+        {
+            MultidimArray<double> &Pupdate = nodes[changed[i]]->Pupdate;
+            memcpy(MULTIDIM_ARRAY(Pupdate), ptr, MULTIDIM_SIZE(Pupdate) * sizeof(double));
+            ptr += MULTIDIM_SIZE(Pupdate);
+        }
+    }
+
+    // Share nextListImg and nextNonClassCorr, all classes together
+    std::vector<int> listCounts(nprocs), listDispls(nprocs),
+        corrCounts(nprocs), corrDispls(nprocs);
+    int listTotal = 0, corrTotal = 0;
+    for (int r = 0; r < nprocs; r++)
+    {
+        int listSize = 0, corrSize = 0;
+        for (int q = 0; q < Q; q++)
+        {
+            listSize += allSizes[2 * Q * r + 2 * q];
+            corrSize += allSizes[2 * Q * r + 2 * q + 1];
+        }
+        listCounts[r] = listSize * sizeof(CL2DAssignment);
+        listDispls[r] = listTotal * sizeof(CL2DAssignment);
+        listTotal += listSize;
+        corrCounts[r] = corrSize;
+        corrDispls[r] = corrTotal;
+        corrTotal += corrSize;
+    }
+
+    std::vector<CL2DAssignment> localList, allLists(XMIPP_MAX(listTotal, 1));
+    for (int q = 0; q < Q; q++)
+        localList.insert(localList.end(), nodes[q]->nextListImg.begin(),
+                         nodes[q]->nextListImg.end());
+    localList.resize(XMIPP_MAX(localList.size(), (size_t) 1));
+    MPI_Allgatherv(&(localList[0]), listCounts[rank], MPI_CHAR, &(allLists[0]),
+                   &(listCounts[0]), &(listDispls[0]), MPI_CHAR, MPI_COMM_WORLD);
+
+    std::vector<double> localCorr, allCorr(XMIPP_MAX(corrTotal, 1));
+    if (shareNonCorr)
+    {
+        for (int q = 0; q < Q; q++)
+            localCorr.insert(localCorr.end(), nodes[q]->nextNonClassCorr.begin(),
+                             nodes[q]->nextNonClassCorr.end());
+        localCorr.resize(XMIPP_MAX(localCorr.size(), (size_t) 1));
+        MPI_Allgatherv(&(localCorr[0]), corrCounts[rank], MPI_DOUBLE, &(allCorr[0]),
+                       &(corrCounts[0]), &(corrDispls[0]), MPI_DOUBLE, MPI_COMM_WORLD);
+    }
+
+    // Append the elements received from the other nodes, in rank order
+    std::vector<size_t> listOffset(nprocs), corrOffset(nprocs);
+    for (int r = 0; r < nprocs; r++)
+    {
+        listOffset[r] = listDispls[r] / sizeof(CL2DAssignment);
+        corrOffset[r] = corrDispls[r];
+    }
+    for (int q = 0; q < Q; q++)
+    {
         std::vector<CL2DAssignment> receivedNextListImage;
-        int listSize;
-        for (size_t rank = 0; rank < prm->node->size; rank++)
+        std::vector<double> receivedNonClassCorr;
+        for (int r = 0; r < nprocs; r++)
         {
-            if (rank == prm->node->rank)
-            {
-                // Transmit node 1 next list of images
-                listSize = node->nextListImg.size();
-                MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                MPI_Bcast(&(node->nextListImg[0]),
-                          node->nextListImg.size() * sizeof(CL2DAssignment),
-                          MPI_CHAR, rank, MPI_COMM_WORLD);
-                // Transmit node 1 non class corr
-                listSize = node->nextNonClassCorr.size();
-                MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                MPI_Bcast(&(node->nextNonClassCorr[0]),
-                          node->nextNonClassCorr.size(), MPI_DOUBLE, rank,
-                          MPI_COMM_WORLD);
-            }
-            else
+            int listSize = allSizes[2 * Q * r + 2 * q];
+            int corrSize = allSizes[2 * Q * r + 2 * q + 1];
+            if (r != rank)
             {
-                // Receive node 1 next list of images
-                MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                auxList.resize(listSize);
-                MPI_Bcast(&(auxList[0]), listSize * sizeof(CL2DAssignment),
-                          MPI_CHAR, rank, MPI_COMM_WORLD);
-                receivedNextListImage.reserve(
-                    receivedNextListImage.size() + listSize);
-                for (int j = 0; j < listSize; j++)
-                    receivedNextListImage.push_back(auxList[j]);
-                // Receive node 1 non class corr
-                MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                auxList2.resize(listSize);
-                MPI_Bcast(&(auxList2[0]), listSize, MPI_DOUBLE, rank,
-                          MPI_COMM_WORLD);
-                receivedNonClassCorr.reserve(
-                    receivedNonClassCorr.size() + listSize);
-                for (int j = 0; j < listSize; j++)
-                    receivedNonClassCorr.push_back(auxList2[j]);
+                receivedNextListImage.insert(receivedNextListImage.end(),
+                                             allLists.begin() + listOffset[r],
+                                             allLists.begin() + listOffset[r] + listSize);
+                receivedNonClassCorr.insert(receivedNonClassCorr.end(),
+                                            allCorr.begin() + corrOffset[r],
+                                            allCorr.begin() + corrOffset[r] + corrSize);
             }
+            listOffset[r] += listSize;
+            corrOffset[r] += corrSize;
         }
         // This is important to ensure that all nodes have all images in the same order
         std::sort(receivedNextListImage.begin(),receivedNextListImage.end(),CL2DAssignmentComparator);
 
         // Copy the received elements
-        listSize = receivedNextListImage.size();
-        node->nextListImg.reserve(node->nextListImg.size() + listSize);
-        for (int j = 0; j < listSize; j++)
-            node->nextListImg.push_back(receivedNextListImage[j]);
-        listSize = receivedNonClassCorr.size();
-        node->nextNonClassCorr.reserve(node->nextNonClassCorr.size() + listSize);
-        for (int j = 0; j < listSize; j++)
-            node->nextNonClassCorr.push_back(receivedNonClassCorr[j]);
+        nodes[q]->nextListImg.insert(nodes[q]->nextListImg.end(),
+                                     receivedNextListImage.begin(),
+                                     receivedNextListImage.end());
+        nodes[q]->nextNonClassCorr.insert(nodes[q]->nextNonClassCorr.end(),
+                                          receivedNonClassCorr.begin(),
+                                          receivedNonClassCorr.end());
     }
+}
+
+void CL2D::shareSplitAssignments(Matrix1D<int> &assignment, CL2DClass *node1,
+                                 CL2DClass *node2) const
+{
+    // Share assignment
+    int imax = VEC_XSIZE(assignment);
+    MPI_Allreduce(MPI_IN_PLACE, MATRIX1D_ARRAY(assignment), imax, MPI_INT,
+                  MPI_MAX, MPI_COMM_WORLD);
+
+    // Share code updates
+    std::vector<CL2DClass *> nodes;
+    nodes.push_back(node1);
+    nodes.push_back(node2);
+    shareClassUpdates(nodes, true);
 
     node1->transferUpdate();
     node2->transferUpdate();
@@ -755,7 +803,12 @@ void CL2D::initialize(MetaData &_SF,
     if (prm->node->rank == 1)
         init_progress_bar(Nimgs);
     Image<double> I;
-    MultidimArray<double> Iaux, Ibest;
+    MultidimArray<double> Iaux;
+    std::vector< MultidimArray<double> > Ialigned;
+    std::vector<CL2DAssignment> assignments;
+    std::vector<int> allCodes;
+    for (int q = 0; q < prm->Ncodes0; q++)
+        allCodes.push_back(q);
     bool oldUseCorrelation = prm->useCorrelation;
     prm->useCorrelation = true; // Since we cannot make the assignment before calculating sigma
     CL2DAssignment bestAssignment;
@@ -787,19 +840,17 @@ void CL2D::initialize(MetaData &_SF,
             {
                 bestAssignment.corr = 0;
                 q = -1;
+                fitCandidates(I(), allCodes, Ialigned, assignments);
                 for (int qp = 0; qp < prm->Ncodes0; qp++)
                 {
-                    Iaux = I();
-                    P[qp]->fit(Iaux, assignment);
-                    if (assignment.corr > bestAssignment.corr)
+                    if (assignments[qp].corr > bestAssignment.corr)
                     {
-                        bestAssignment = assignment;
-                        Ibest = Iaux;
+                        bestAssignment.copyAlignment(assignments[qp]);
                         q = qp;
                     }
                 }
                 if (q != -1)
-                    P[q]->updateProjection(Ibest, bestAssignment);
+                    P[q]->updateProjection(Ialigned[q], bestAssignment);
             }
             SF->setValue(MDL_REF, q + 1, objId);
             if (idx % 100 == 0 && prm->node->rank == 1)
@@ -920,6 +971,36 @@ void CL2D::write(const FileName &fnODir, const FileName &fnRoot, int level) cons
     }
 }
 
+void CL2D::fitCandidates(const MultidimArray<double> &I,
+                         const std::vector<int> &candidates,
+                         std::vector< MultidimArray<double> > &Ialigned,
+                         std::vector<CL2DAssignment> &assignments)
+{
+    size_t imax = candidates.size();
+    Ialigned.resize(imax);
+    assignments.resize(imax);
+
+    // Rotational correlation with all candidates from a single
+    // polar Fourier transform of the image
+    bool precomputed = prm->alignImages && imax > 0;
+    if (precomputed)
+    {
+        polarI.compute(I);
+        initialRot.resize(imax);
+        for (size_t i = 0; i < imax; i++)
+            P[candidates[i]]->initialRotation(polarI, initialRot[i]);
+    }
+
+    // Refine the alignment with each candidate
+    for (size_t i = 0; i < imax; i++)
+    {
+        Ialigned[i] = I;
+        assignments[i] = CL2DAssignment();
+        P[candidates[i]]->fit(Ialigned[i], assignments[i],
+                              precomputed ? &initialRot[i] : NULL);
+    }
+}
+
 //#define DEBUG
 void CL2D::lookNode(MultidimArray<double> &I, int oldnode, int &newnode,
                     CL2DAssignment &bestAssignment)
@@ -929,12 +1010,12 @@ void CL2D::lookNode(MultidimArray<double> &I, int oldnode, int &newnode,
 #endif
 	int Q = P.size();
     int bestq = -1;
-    MultidimArray<double> bestImg, Iaux;
+    MultidimArray<double> bestImg;
     Matrix1D<double> corrList;
     corrList.resizeNoCopy(Q);
-    CL2DAssignment assignment;
     bestAssignment.likelihood = bestAssignment.corr = 0;
     size_t objId = bestAssignment.objId;
+    std::vector<int> candidates;
     for (int q = 0; q < Q; q++)
     {
         // Check if q is neighbour of the oldnode
@@ -969,21 +1050,29 @@ void CL2D::lookNode(MultidimArray<double> &I, int oldnode, int &newnode,
         else
             proceed = true;
 
-		if (proceed) {
-			// Try this image
-			Iaux = I;
-			P[q]->fit(Iaux, assignment);
-			VEC_ELEM(corrList,q) = assignment.corr;
+		if (proceed)
+			candidates.push_back(q);
+	}
+
+    // Fit the image against all candidates
+    std::vector< MultidimArray<double> > Ialigned;
+    std::vector<CL2DAssignment> assignments;
+    fitCandidates(I, candidates, Ialigned, assignments);
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+    	int q = candidates[i];
+    	const CL2DAssignment &assignment = assignments[i];
+		VEC_ELEM(corrList,q) = assignment.corr;
 #ifdef DEBUG
 	std::cout << "   Proceeding with node " << q << " corr=" << assignment.corr << std::endl;
 #endif
-			if ((!prm->classicalMultiref && assignment.likelihood > bestAssignment.likelihood) ||
-				(prm->classicalMultiref && assignment.corr > bestAssignment.corr) ||
-				 prm->classifyAllImages && bestAssignment.corr==0) {
-				bestq = q;
-				bestImg = Iaux;
-				bestAssignment = assignment;
-			}
+		if ((!prm->classicalMultiref && assignment.likelihood > bestAssignment.likelihood) ||
+			(prm->classicalMultiref && assignment.corr > bestAssignment.corr) ||
+			 prm->classifyAllImages && bestAssignment.corr==0) {
+			bestq = q;
+			bestImg = Ialigned[i];
+			bestAssignment = assignment;
 		}
 	}
 
@@ -0,0 +1,168 @@
+/***************************************************************************
+ *
+ * Authors:     agent (agent@local)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <data/xmipp_program.h>
+#include <data/xmipp_funcs.h>
+#include <data/xmipp_threads.h>
+
+/** Distributor with the previous behaviour: fixed blocks under a mutex */
+class LockedTaskDistributor: public ThreadTaskDistributor
+{
+public:
+    LockedTaskDistributor(size_t nTasks, size_t bSize): ThreadTaskDistributor(nTasks, bSize)
+    {}
+    bool getTasks(size_t &first, size_t &last)
+    {
+        return ParallelTaskDistributor::getTasks(first, last);
+    }
+};
+
+/** Data shared by the benchmark threads */
+struct ThreadBenchmarkData
+{
+    ParallelTaskDistributor * distributor;
+    const std::vector<double> * costs;
+    Mutex mutex;
+    double result;
+};
+
+class ProgThreadPerformanceTest: public XmippProgram
+{
+protected:
+    size_t nTasks, blockSize;
+    int maxThreads;
+    double workUnit, skew;
+
+    void defineParams()
+    {
+        addUsageLine("Measure the scaling of the thread task distributors.");
+        addUsageLine("+The same synthetic tasks are processed with 1, 2, 4, ... threads");
+        addUsageLine("+with the mutex based distribution of fixed blocks and with the");
+        addUsageLine("+lock free distribution with fixed, guided and cost guided blocks.");
+        addUsageLine("+The cost of the tasks grows towards both ends of the task list,");
+        addUsageLine("+like particles close to the border of a micrograph.");
+        addParamsLine("  [--tasks <n=100000>]      : Number of tasks");
+        addParamsLine("  [--block <n=16>]          : Block size (minimum block size for guided)");
+        addParamsLine("  [--max_threads <n=128>]   : Maximum number of threads");
+        addParamsLine("  [--work <n=200>]          : Iterations of the cheapest task");
+        addParamsLine("  [--skew <s=10>]           : The most expensive task costs 1+skew times the cheapest one");
+        addExampleLine("xmipp_thread_performance_test --tasks 1000000 --max_threads 64");
+    }
+
+    void readParams()
+    {
+        nTasks = getIntParam("--tasks");
+        blockSize = getIntParam("--block");
+        if (nTasks < 1 || blockSize < 1 || blockSize > nTasks)
+            REPORT_ERROR(ERR_ARG_INCORRECT, "There should be at least one task and 1 <= block <= tasks");
+        maxThreads = getIntParam("--max_threads");
+        workUnit = getDoubleParam("--work");
+        skew = getDoubleParam("--skew");
+    }
+
+    static void processTasks(ThreadArgument &thArg)
+    {
+        ThreadBenchmarkData * data = (ThreadBenchmarkData *) thArg.data;
+        const std::vector<double> &costs = *(data->costs);
+        size_t first, last;
+        double sum = 0;
+        while (data->distributor->getTasks(first, last))
+            for (size_t t = first; t <= last; ++t)
+            {
+                // Just waste some cpu cycles
+                size_t iterations = (size_t) costs[t];
+                double x = t;
+                for (size_t i = 0; i < iterations; ++i)
+                    x = x * 0.999999 + 1.0;
+                sum += x;
+            }
+        // Keep the work from being optimized away
+        data->mutex.lock();
+        data->result += sum;
+        data->mutex.unlock();
+    }
+
+    /** Time in ms of processing all tasks with the given threads */
+    size_t measure(ParallelTaskDistributor &td, int nThreads, const std::vector<double> &costs)
+    {
+        ThreadBenchmarkData data;
+        data.distributor = &td;
+        data.costs = &costs;
+        data.result = 0;
+        ThreadManager manager(nThreads);
+        Timer t;
+        t.tic();
+        manager.run(processTasks, &data);
+        return t.elapsed();
+    }
+
+    void run()
+    {
+        std::vector<double> costs(nTasks);
+        for (size_t t = 0; t < nTasks; ++t)
+        {
+            double r = 2.0 * t / XMIPP_MAX(nTasks - 1, 1) - 1; // from -1 to 1
+            costs[t] = workUnit * (1 + skew * r * r * r * r);
+        }
+
+        std::cout << "threads    locked  lockfree    guided  guided+costs (ms, speedup)" << std::endl;
+        size_t ref[4] = {0, 0, 0, 0};
+        for (int nThreads = 1; nThreads <= maxThreads; nThreads *= 2)
+        {
+            LockedTaskDistributor locked(nTasks, blockSize);
+            ThreadTaskDistributor lockFree(nTasks, blockSize);
+            ThreadTaskDistributor guided(nTasks, blockSize);
+            guided.setGuided(nThreads);
+            ThreadTaskDistributor guidedCosts(nTasks, blockSize);
+            guidedCosts.setGuided(nThreads);
+            guidedCosts.setTaskCosts(costs);
+
+            size_t times[4];
+            times[0] = measure(locked, nThreads, costs);
+            times[1] = measure(lockFree, nThreads, costs);
+            times[2] = measure(guided, nThreads, costs);
+            times[3] = measure(guidedCosts, nThreads, costs);
+
+            std::cout << formatString("%7d", nThreads);
+            for (int i = 0; i < 4; ++i)
+            {
+                if (nThreads == 1)
+                    ref[i] = XMIPP_MAX(times[i], 1);
+                std::cout << formatString("  %6lu %5.1fx", (unsigned long) times[i],
+                                          (double) ref[i] / XMIPP_MAX(times[i], 1));
+            }
+            std::cout << std::endl;
+        }
+    }
+}
+;//end of class ProgThreadPerformanceTest
+
+/* MAIN -------------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    ProgThreadPerformanceTest program;
+    program.read(argc, argv);
+    return program.tryRun();
+}
@@ -73,6 +73,11 @@ public:
         addParamsLine("                                     :++ Implemented according to JGM Schavemaker, MJT Reinders, JJ Gerbrands,");
         addParamsLine("                                     :++ E Backer. Image sharpening by morphological filtering. Pattern Recognition");
         addParamsLine("                                     :++ 33: 997-1012 (2000)");
+        addParamsLine("             dilation <s=1> : Maximum in a box of size 2s+1");
+        addParamsLine("             erosion <s=1>  : Minimum in a box of size 2s+1");
+        addParamsLine("             closing <s=1>  : Dilation+Erosion");
+        addParamsLine("             opening <s=1>  : Erosion+Dilation");
+        addParamsLine("                            :+ The box is flat, so its cost does not depend on its size");
         addParamsLine("[--neigh2D+ <n=Neigh8>] : Neighbourhood in 2D.");
         addParamsLine("          where <n>");
         addParamsLine("                 Neigh4");
@@ -89,6 +94,7 @@ public:
         addParamsLine("[--count+ <c=0>]: Minimum required neighbors with distinct value.");
         addParamsLine("     requires --binaryOperation;");
         addExampleLine("xmipp_transform_morphology -i binaryVolume.vol --binaryOperation dilation");
+        addExampleLine("xmipp_transform_morphology -i volume.vol --grayOperation opening 5");
     }
 
     void readParams()
@@ -138,6 +144,18 @@ public:
                 width=getDoubleParam("--grayOperation",1);
                 strength=getDoubleParam("--grayOperation",2);
             }
+            else
+            {
+                if (strOperation=="dilation")
+                    operation = DILATION;
+                else if (strOperation=="erosion")
+                    operation = EROSION;
+                else if (strOperation=="closing")
+                    operation = CLOSING;
+                else if (strOperation=="opening")
+                    operation = OPENING;
+                size = getIntParam("--grayOperation",1);
+            }
         }
     }
 
@@ -175,6 +193,8 @@ public:
             << "Neighbourhood2D=" << neig2D << std::endl
             << "Neighbourhood3D=" << neig3D << std::endl
             << "Count=" << count << std::endl;
+        else if (operation!=SHARPENING)
+            std::cout << "Box size=" << 2*size+1 << std::endl;
     }
     void processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut)
     {
@@ -186,6 +206,12 @@ public:
             std::cout << "Initially the image has " << img().sum()
             << " pixels set to 1\n";
         bool isVolume=ZSIZE(img())>1;
+        if (!binaryOperation && operation!=SHARPENING)
+        {
+            grayOperation(img(), imgOut(), isVolume);
+            imgOut.write(fnImgOut);
+            return;
+        }
         switch (operation)
         {
         case DILATION:
@@ -238,6 +264,34 @@ public:
             std::cout << "Finally the image has " << imgOut().sum() << " pixels set to 1\n";
         imgOut.write(fnImgOut);
     }
+
+    /* Gray dilation, erosion, opening or closing with a flat box */
+    void grayOperation(const MultidimArray<double> &in, MultidimArray<double> &out, bool isVolume)
+    {
+        MultidimArray<double> box, aux;
+        if (isVolume)
+            box.initZeros(2*size+1,2*size+1,2*size+1);
+        else
+            box.initZeros(2*size+1,2*size+1);
+        box.setXmippOrigin();
+        switch (operation)
+        {
+        case DILATION:
+            dilate3D(in, box, out);
+            break;
+        case EROSION:
+            erode3D(in, box, out);
+            break;
+        case OPENING:
+            erode3D(in, box, aux);
+            dilate3D(aux, box, out);
+            break;
+        case CLOSING:
+            dilate3D(in, box, aux);
+            erode3D(aux, box, out);
+            break;
+        }
+    }
 };
 
 int main(int argc, char **argv)
@@ -2,6 +2,7 @@
 #include <data/filters.h>
 #include <data/xmipp_fftw.h>
 #include <data/multidim_array.h>
+#include <data/transformations.h>
 #include <iostream>
 #include <gtest/gtest.h>
 // MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
@@ -108,6 +109,58 @@ TEST_F( FftwTest, fft_IDX2DIGFREQ)
     EXPECT_EQ(-1.0/256.0,w);
 }
 
+TEST_F( FftwTest, shiftInFourier)
+{
+    MultidimArray<double> I(32,32), expected;
+    I.setXmippOrigin();
+    FOR_ALL_ELEMENTS_IN_ARRAY2D(I)
+    A2D_ELEM(I,i,j) = exp(-((i-3.)*(i-3.)+0.5*(j+2.)*(j+2.))/18.);
+
+    // With integer shifts the real space translation is exact
+    translate(1, expected, I, vectorR2(3, -2), WRAP);
+
+    MultidimArray< std::complex<double> > FFTI;
+    FourierTransformer transformer;
+    transformer.FourierTransform(I, FFTI, false);
+    shiftInFourier(FFTI, XSIZE(I), 3, -2);
+    transformer.inverseFourierTransform();
+    EXPECT_TRUE(I.equal(expected, 1e-10));
+
+    // The same tables can be applied to several transforms
+    MultidimArray<double> I2 = I;
+    transformer.FourierTransform(I2, FFTI, false);
+    FourierShiftTables tables;
+    tables.initialize(XSIZE(I2), YSIZE(I2), 1, -3, 2);
+    tables.apply(FFTI);
+    transformer.inverseFourierTransform();
+    translate(1, expected, I, vectorR2(-3, 2), WRAP);
+    EXPECT_TRUE(I2.equal(expected, 1e-10));
+}
+
+TEST_F( FftwTest, rotateInFourier)
+{
+    // Blob in an image padded twice
+    MultidimArray<double> I(64,64), expected, rotated;
+    I.setXmippOrigin();
+    FOR_ALL_ELEMENTS_IN_ARRAY2D(I)
+    A2D_ELEM(I,i,j) = exp(-((i-3.)*(i-3.)+0.5*(j+2.)*(j+2.))/18.);
+
+    MultidimArray< std::complex<double> > FFTI, FFTrotated;
+    FourierTransformer transformer;
+    transformer.FourierTransform(I, FFTI, true);
+
+    rotateInFourier(FFTI, FFTrotated, XSIZE(I), 0);
+    rotated.resizeNoCopy(I);
+    transformer.inverseFourierTransform(FFTrotated, rotated);
+    EXPECT_TRUE(rotated.equal(I, 1e-10));
+
+    rotateInFourier(FFTI, FFTrotated, XSIZE(I), 30);
+    transformer.inverseFourierTransform(FFTrotated, rotated);
+    rotated.setXmippOrigin();
+    rotate(3, expected, I, 30, DONT_WRAP);
+    EXPECT_TRUE(rotated.equal(expected, 0.05));
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
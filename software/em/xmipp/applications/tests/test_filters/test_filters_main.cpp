@@ -1,5 +1,6 @@
 #include <data/xmipp_image.h>
 #include <data/filters.h>
+#include <data/morphology.h>
 #include <data/xmipp_fftw.h>
 #include <iostream>
 #include <gtest/gtest.h>
@@ -198,6 +199,181 @@ TEST_F( FiltersTest, regionGrowing3DEqualValue)
     EXPECT_DOUBLE_EQ(result,1.);
 
 }
+TEST_F( FiltersTest, applyFilterByTiles)
+{
+    FileName fnIn, fnOut;
+    fnIn.initUniqueName("/tmp/temp_XXXXXX");
+    fnOut.initUniqueName("/tmp/temp_XXXXXX");
+    fnIn = fnIn + ":spi";
+    fnOut = fnOut + ":spi";
+
+    // Image whose size is not a multiple of the tile size
+    Image<double> I;
+    I().initZeros(90, 100);
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(I())
+    DIRECT_A2D_ELEM(I(), i, j) = (7 * i + 13 * j + i * j) % 31;
+    I.write(fnIn);
+
+    MedianFilter filter;
+    applyFilterByTiles(filter, fnIn, fnOut, 32, 3);
+
+    // The same as filtering the whole image
+    Image<double> Iwhole, Itiles;
+    Iwhole.read(fnIn);
+    filter.apply(Iwhole());
+    Itiles.read(fnOut);
+    ASSERT_TRUE(Itiles().sameShape(Iwhole()));
+    int differences = 0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Iwhole())
+    if (DIRECT_MULTIDIM_ELEM(Iwhole(), n) != DIRECT_MULTIDIM_ELEM(Itiles(), n))
+        ++differences;
+    EXPECT_EQ(0, differences);
+
+    fnIn.removeFileFormat().deleteFile();
+    fnOut.removeFileFormat().deleteFile();
+}
+TEST_F( FiltersTest, distanceTransform)
+{
+    // A few points in an image, the distances are compared to the
+    // distance to the closest point computed by brute force
+    MultidimArray<int> in(23, 31), outL1;
+    MultidimArray<double> outEuclidean;
+    DIRECT_A2D_ELEM(in, 2, 3) = 1;
+    DIRECT_A2D_ELEM(in, 20, 5) = 1;
+    DIRECT_A2D_ELEM(in, 11, 28) = 1;
+    distanceTransform(in, outL1);
+    euclideanDistanceTransform(in, outEuclidean);
+
+    int differencesL1 = 0, differencesEuclidean = 0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(in)
+    {
+        int bestL1 = XSIZE(in) + YSIZE(in);
+        double bestEuclidean = 1e30;
+        for (size_t ii = 0; ii < YSIZE(in); ++ii)
+            for (size_t jj = 0; jj < XSIZE(in); ++jj)
+                if (DIRECT_A2D_ELEM(in, ii, jj))
+                {
+                    int di = ii - i, dj = jj - j;
+                    bestL1 = XMIPP_MIN(bestL1, ABS(di) + ABS(dj));
+                    bestEuclidean = XMIPP_MIN(bestEuclidean, sqrt((double)(di * di + dj * dj)));
+                }
+        if (DIRECT_A2D_ELEM(outL1, i, j) != bestL1)
+            ++differencesL1;
+        if (fabs(DIRECT_A2D_ELEM(outEuclidean, i, j) - bestEuclidean) > 1e-9)
+            ++differencesEuclidean;
+    }
+    EXPECT_EQ(0, differencesL1);
+    EXPECT_EQ(0, differencesEuclidean);
+
+    // With wrapping, the left border is next to the right one
+    MultidimArray<int> column(3, 10);
+    DIRECT_A2D_ELEM(column, 1, 0) = 1;
+    distanceTransform(column, outL1, true);
+    EXPECT_EQ(1, DIRECT_A2D_ELEM(outL1, 1, 9));
+    EXPECT_EQ(5, DIRECT_A2D_ELEM(outL1, 1, 5));
+    EXPECT_EQ(2, DIRECT_A2D_ELEM(outL1, 0, 9));
+}
+TEST_F( FiltersTest, euclideanDistanceTransform3D)
+{
+    // Same as above for a volume
+    MultidimArray<int> in(11, 13, 9);
+    MultidimArray<double> out;
+    DIRECT_A3D_ELEM(in, 1, 2, 3) = 1;
+    DIRECT_A3D_ELEM(in, 9, 11, 1) = 1;
+    DIRECT_A3D_ELEM(in, 5, 0, 8) = 1;
+    euclideanDistanceTransform(in, out);
+
+    int differences = 0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(in)
+    {
+        double best = 1e30;
+        for (size_t kk = 0; kk < ZSIZE(in); ++kk)
+            for (size_t ii = 0; ii < YSIZE(in); ++ii)
+                for (size_t jj = 0; jj < XSIZE(in); ++jj)
+                    if (DIRECT_A3D_ELEM(in, kk, ii, jj))
+                    {
+                        int dk = kk - k, di = ii - i, dj = jj - j;
+                        best = XMIPP_MIN(best, sqrt((double)(dk * dk + di * di + dj * dj)));
+                    }
+        if (fabs(DIRECT_A3D_ELEM(out, k, i, j) - best) > 1e-9)
+            ++differences;
+    }
+    EXPECT_EQ(0, differences);
+}
+TEST_F( FiltersTest, flatMorphology3D)
+{
+    // The separable dilation and erosion with a flat box are compared to
+    // the maximum and minimum in the box, clipped at the borders
+    MultidimArray<double> in(10, 12, 14), box(3, 5, 7), dilated, eroded;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(in)
+    DIRECT_MULTIDIM_ELEM(in, n) = (n * 37 + (n * n) % 13) % 29;
+    double c = 0.5;
+    box.initConstant(c);
+    box.setXmippOrigin();
+    dilate3D(in, box, dilated);
+    erode3D(in, box, eroded);
+
+    double minval = in.computeMin(), maxval = in.computeMax();
+    int differences = 0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(in)
+    {
+        double maxLocal = -1e30, minLocal = 1e30;
+        for (int kk = (int)k + STARTINGZ(box); kk <= (int)k + FINISHINGZ(box); ++kk)
+            for (int ii = (int)i + STARTINGY(box); ii <= (int)i + FINISHINGY(box); ++ii)
+                for (int jj = (int)j + STARTINGX(box); jj <= (int)j + FINISHINGX(box); ++jj)
+                    if (kk >= 0 && kk < (int)ZSIZE(in) && ii >= 0 && ii < (int)YSIZE(in) &&
+                        jj >= 0 && jj < (int)XSIZE(in))
+                    {
+                        maxLocal = XMIPP_MAX(maxLocal, DIRECT_A3D_ELEM(in, kk, ii, jj) + c);
+                        minLocal = XMIPP_MIN(minLocal, DIRECT_A3D_ELEM(in, kk, ii, jj) - c);
+                    }
+        if (DIRECT_A3D_ELEM(dilated, k, i, j) != XMIPP_MIN(maxLocal, maxval))
+            ++differences;
+        if (DIRECT_A3D_ELEM(eroded, k, i, j) != XMIPP_MAX(minLocal, minval))
+            ++differences;
+    }
+    EXPECT_EQ(0, differences);
+}
+TEST_F( FiltersTest, rankFilter)
+{
+    // Compare with the sorted values of the window, clipped at the borders,
+    // for an image and a volume
+    for (int dim = 2; dim <= 3; ++dim)
+    {
+        MultidimArray<double> in(dim == 3 ? 9 : 1, 13, 17), out;
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(in)
+        DIRECT_MULTIDIM_ELEM(in, n) = (n * 37 + (n * n) % 11) % 23 + 0.25;
+        int radius = 2;
+        double percentile = 30;
+        ThreadPool pool(3);
+        rankFilter(in, out, radius, percentile, &pool);
+
+        int radiusZ = dim == 3 ? radius : 0;
+        int differences = 0;
+        std::vector<double> window;
+        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(in)
+        {
+            window.clear();
+            for (int kk = (int)k - radiusZ; kk <= (int)k + radiusZ; ++kk)
+                for (int ii = (int)i - radius; ii <= (int)i + radius; ++ii)
+                    for (int jj = (int)j - radius; jj <= (int)j + radius; ++jj)
+                        if (kk >= 0 && kk < (int)ZSIZE(in) && ii >= 0 && ii < (int)YSIZE(in) &&
+                            jj >= 0 && jj < (int)XSIZE(in))
+                            window.push_back(DIRECT_A3D_ELEM(in, kk, ii, jj));
+            std::sort(window.begin(), window.end());
+            double expected = window[(int)(percentile / 100 * (window.size() - 1) + 0.5)];
+            if (DIRECT_A3D_ELEM(out, k, i, j) != expected)
+                ++differences;
+        }
+        EXPECT_EQ(0, differences);
+
+        // Without threads
+        MultidimArray<double> outSerial;
+        rankFilter(in, outSerial, radius, percentile);
+        EXPECT_TRUE(out.equal(outSerial, 0.));
+    }
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
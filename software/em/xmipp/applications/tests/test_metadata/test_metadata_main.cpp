@@ -1324,6 +1324,57 @@ TEST_F( MetadataTest, ReadWrite)
     unlink(sfn);
 }
 
+TEST_F( MetadataTest, ReadWriteBuffer)
+{
+    MetaData md, auxMetadata;
+    std::vector<double> vd;
+    std::vector<size_t> vs;
+    vd.push_back(1.5);
+    vd.push_back(-2.25);
+    vs.push_back(7);
+    for (int i = 0; i < 3; ++i)
+    {
+        size_t id = md.addObject();
+        md.setValue(MDL_IMAGE, formatString("%06d@images with \"quotes\".stk", i), id);
+        md.setValue(MDL_ANGLE_ROT, i / 3., id);
+        md.setValue(MDL_REF, -i, id);
+        md.setValue(MDL_ITEM_ID, (size_t)i, id);
+        md.setValue(MDL_FLIP, i % 2 == 0, id);
+        md.setValue(MDL_CLASSIFICATION_DATA, vd, id);
+        md.setValue(MDL_NEIGHBORS, vs, id);
+    }
+    std::vector<char> buffer;
+    md.writeBuffer(buffer);
+    auxMetadata.readBuffer(&buffer[0], buffer.size());
+    EXPECT_EQ(md, auxMetadata);
+    EXPECT_EQ(md.getActiveLabels(), auxMetadata.getActiveLabels());
+    double rot;
+    auxMetadata.getValue(MDL_ANGLE_ROT, rot, auxMetadata.lastObject());
+    EXPECT_EQ(2 / 3., rot); //no precision lost
+
+    //Same result as going through a file
+    mDsource.writeBuffer(buffer);
+    auxMetadata.readBuffer(&buffer[0], buffer.size());
+    char sfn[32] = "";
+    strncpy(sfn, "/tmp/testWrite_XXXXXX", sizeof sfn);
+    if (mkstemp(sfn)==-1)
+    	REPORT_ERROR(ERR_IO_NOTOPEN,"Cannot create temporary file");
+    mDsource.write(sfn);
+    md.read(sfn);
+    EXPECT_EQ(md, auxMetadata);
+    unlink(sfn);
+
+    //Empty metadata keeps its labels
+    md.clear();
+    md.addLabel(MDL_X);
+    md.writeBuffer(buffer);
+    auxMetadata.readBuffer(&buffer[0], buffer.size());
+    EXPECT_TRUE(auxMetadata.isEmpty());
+    EXPECT_TRUE(auxMetadata.containsLabel(MDL_X));
+    buffer.resize(buffer.size() - 1);
+    EXPECT_THROW(auxMetadata.readBuffer(&buffer[0], buffer.size()), XmippError);
+}
+
 TEST_F( MetadataTest, WriteIntermediateBlock)
 {
     //read metadata block between another two
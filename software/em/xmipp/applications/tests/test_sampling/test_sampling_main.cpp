@@ -145,11 +145,33 @@ TEST_F(SamplingTest, saveReadSamplingFile)
     s.readSamplingFile(fn, true, true);
     EXPECT_EQ(mysampling, s);
     fn.deleteFile();
+    ((FileName)(fn + "_sampling.cache")).deleteFile();
     fn = fn + "_sampling.xmd";
     fn.deleteFile();
     XMIPP_CATCH
 }
 
+TEST_F(SamplingTest, saveReadSamplingCache)
+{
+    XMIPP_TRY
+    FileName fn;
+    fn.initUniqueName("/tmp/temp_XXXXXX");
+    mysampling.computeNeighbors();
+    mysampling.saveSamplingCache(fn, "i3h", true);
+    EXPECT_TRUE(mysampling.isValidSamplingCache(fn, "i3h"));
+    EXPECT_FALSE(mysampling.isValidSamplingCache(fn, "c1"));
+    Sampling s;
+    s.readSamplingCache(fn, true, true);
+    EXPECT_EQ(mysampling, s);
+    EXPECT_EQ(mysampling.sampling_points_angles, s.sampling_points_angles);
+    EXPECT_EQ(mysampling.exp_data_fileNames, s.exp_data_fileNames);
+    EXPECT_EQ(mysampling.exp_data_projection_direction_by_L_R,
+              s.exp_data_projection_direction_by_L_R);
+    EXPECT_FALSE(s.isValidSamplingCache(fn + "_missing", "i3h"));
+    fn.deleteFile();
+    XMIPP_CATCH
+}
+
 TEST_F(SamplingTest, computeNeighborsI3H)
 {
     XMIPP_TRY
@@ -3,6 +3,7 @@
 #include <data/xmipp_image.h>
 #include <data/filters.h>
 #include <data/transformations.h>
+#include <reconstruction/tomo_extract_subvolume.h>
 
 #include <gtest/gtest.h>
 // MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
@@ -250,6 +251,132 @@ TEST_F(TransformationTest, str2TransformationMatrix)
 
 }
 
+// Volume with some structure and a rotation plus a shift for the 3D tests
+static void geometry3DInput(MultidimArray<double> &V, Matrix2D<double> &A)
+{
+    V.resize(16, 18, 21);
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(V)
+    DIRECT_A3D_ELEM(V, k, i, j) = sin(0.7 * j + 0.3 * i * k) + cos(0.2 * i * j - 0.5 * k);
+    Euler_angles2matrix(31.5, 57.2, -12.8, A, true);
+    MAT_ELEM(A, 0, 3) = 1.3;
+    MAT_ELEM(A, 1, 3) = -0.6;
+    MAT_ELEM(A, 2, 3) = 2.1;
+}
+
+TEST_F(TransformationTest, applyGeometry3DThreads)
+{
+    MultidimArray<double> V, serial, threaded;
+    Matrix2D<double> A;
+    geometry3DInput(V, A);
+    int degrees[3] = {LINEAR, BSPLINE3, BSPLINE2};
+    for (int d = 0; d < 3; ++d)
+        for (int wrap = 0; wrap < 2; ++wrap)
+        {
+            setGeometryThreads(1);
+            serial.clear();
+            applyGeometry(degrees[d], serial, V, A, IS_NOT_INV, wrap, 0.25);
+            setGeometryThreads(4);
+            threaded.clear();
+            applyGeometry(degrees[d], threaded, V, A, IS_NOT_INV, wrap, 0.25);
+            ASSERT_TRUE(SAME_SHAPE3D(serial, threaded));
+            size_t differences = 0;
+            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(serial)
+            if (DIRECT_MULTIDIM_ELEM(serial, n) != DIRECT_MULTIDIM_ELEM(threaded, n))
+                ++differences;
+            EXPECT_EQ((size_t)0, differences) << "Spline degree " << degrees[d] << " wrap " << wrap;
+        }
+    setGeometryThreads(1);
+}
+
+TEST_F(TransformationTest, applyGeometry3DBSpline)
+{
+    MultidimArray<double> V, Vout, coeffs;
+    Matrix2D<double> A;
+    geometry3DInput(V, A);
+    setGeometryThreads(3);
+    applyGeometry(BSPLINE3, Vout, V, A, IS_NOT_INV, DONT_WRAP);
+    setGeometryThreads(1);
+
+    // Interpolate each voxel independently
+    produceSplineCoefficients(BSPLINE3, coeffs, V);
+    int cen_x = XSIZE(V) / 2, cen_y = YSIZE(V) / 2, cen_z = ZSIZE(V) / 2;
+    STARTINGX(coeffs) = -cen_x;
+    STARTINGY(coeffs) = -cen_y;
+    STARTINGZ(coeffs) = -cen_z;
+    Matrix2D<double> Ainv = A.inv();
+    double limit = 1e-6;
+    size_t compared = 0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Vout)
+    {
+        double x = (double)j - cen_x, y = (double)i - cen_y, z = (double)k - cen_z;
+        double xp = MAT_ELEM(Ainv, 0, 0) * x + MAT_ELEM(Ainv, 0, 1) * y + MAT_ELEM(Ainv, 0, 2) * z + MAT_ELEM(Ainv, 0, 3);
+        double yp = MAT_ELEM(Ainv, 1, 0) * x + MAT_ELEM(Ainv, 1, 1) * y + MAT_ELEM(Ainv, 1, 2) * z + MAT_ELEM(Ainv, 1, 3);
+        double zp = MAT_ELEM(Ainv, 2, 0) * x + MAT_ELEM(Ainv, 2, 1) * y + MAT_ELEM(Ainv, 2, 2) * z + MAT_ELEM(Ainv, 2, 3);
+        double dx = XMIPP_MIN(xp + cen_x, XSIZE(V) - cen_x - 1 - xp);
+        double dy = XMIPP_MIN(yp + cen_y, YSIZE(V) - cen_y - 1 - yp);
+        double dz = XMIPP_MIN(zp + cen_z, ZSIZE(V) - cen_z - 1 - zp);
+        double dmin = XMIPP_MIN(dx, XMIPP_MIN(dy, dz));
+        if (fabs(dmin) < limit)
+            continue; // Too close to the border to know if it is inside
+        double expected = dmin > 0 ? coeffs.interpolatedElementBSpline3D(xp, yp, zp, 3) : 0.;
+        EXPECT_NEAR(expected, DIRECT_A3D_ELEM(Vout, k, i, j), 1e-9);
+        ++compared;
+    }
+    EXPECT_GT(compared, NZYXSIZE(Vout) / 2);
+}
+
+TEST_F(TransformationTest, bSpline3DDegree3)
+{
+    MultidimArray<double> V, coeffs;
+    Matrix2D<double> A;
+    geometry3DInput(V, A);
+    produceSplineCoefficients(BSPLINE3, coeffs, V);
+    coeffs.setXmippOrigin();
+    // Including points out of the volume, where the coefficients are mirrored
+    for (double z = -9.5; z < 9.5; z += 0.73)
+        for (double y = -10.2; y < 10.2; y += 0.61)
+            for (double x = -12; x < 12; x += 0.5)
+                EXPECT_EQ(coeffs.interpolatedElementBSpline3D(x, y, z, 3),
+                          coeffs.interpolatedElementBSpline3D_Degree3(x, y, z));
+}
+
+TEST_F(TransformationTest, applyGeometryStack)
+{
+    MultidimArray<double> stack(7, 1, 24, 26), coeffs, out;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(stack)
+    DIRECT_MULTIDIM_ELEM(stack, n) = sin(0.37 * n) + 0.01 * (n % 13);
+    stack.setXmippOrigin();
+    std::vector< Matrix2D<double> > A(NSIZE(stack));
+    for (size_t n = 0; n < A.size(); ++n)
+    {
+        rotation2DMatrix(17.3 * n + 2.1, A[n]);
+        MAT_ELEM(A[n], 0, 2) = 0.4 * n - 1.2;
+        MAT_ELEM(A[n], 1, 2) = 0.7 - 0.3 * n;
+    }
+
+    setGeometryThreads(3);
+    produceSplineCoefficientsStack(BSPLINE3, coeffs, stack);
+    int degrees[2] = {LINEAR, BSPLINE3};
+    for (int d = 0; d < 2; ++d)
+    {
+        applyGeometryStack(degrees[d], out, stack, A, IS_NOT_INV, DONT_WRAP, 0., &coeffs);
+        ASSERT_EQ(NSIZE(stack), NSIZE(out));
+        MultidimArray<double> img, expected;
+        for (size_t n = 0; n < NSIZE(stack); ++n)
+        {
+            img.aliasImageInStack(stack, n);
+            expected.clear();
+            applyGeometry(degrees[d], expected, img, A[n], IS_NOT_INV, DONT_WRAP);
+            size_t differences = 0;
+            FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(expected)
+            if (DIRECT_A2D_ELEM(expected, i, j) != DIRECT_NZYX_ELEM(out, n, 0, i, j))
+                ++differences;
+            EXPECT_EQ((size_t)0, differences) << "Image " << n << " spline degree " << degrees[d];
+        }
+    }
+    setGeometryThreads(1);
+}
+
 /*
 
 
@@ -262,6 +389,46 @@ DEBUG_JM: A:
          0          0          0          1
  */
 
+TEST_F(TransformationTest, extractSubvolume)
+{
+    // A subvolume translated inside a window must be the same as the
+    // window of the translated volume
+    MultidimArray<double> V(64, 64, 64);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(V)
+    DIRECT_MULTIDIM_ELEM(V, n) = ((n * 37 + (n * n) % 101) % 53) / 53.;
+    V.setXmippOrigin();
+
+    ProgTomoExtractSubvolume prm;
+    prm.vol.setDatatype(DT_Double);
+    MultidimArray<double> *pV;
+    prm.vol().getMultidimArrayPointer(pV);
+    *pV = V;
+    prm.vol().setXmippOrigin();
+    prm.x0 = FIRST_XMIPP_INDEX(21);
+    prm.xF = LAST_XMIPP_INDEX(21);
+
+    Matrix1D<double> shift(3);
+    VECTOR_R3(shift, 3.3, -2.6, 1.45);
+    MultidimArray<double> subvolume, expected;
+    prm.extractSubvolume(shift, subvolume);
+    translate(BSPLINE3, expected, V, shift);
+    expected.selfWindow(prm.x0, prm.x0, prm.x0, prm.xF, prm.xF, prm.xF);
+    ASSERT_TRUE(subvolume.sameShape(expected));
+    EXPECT_TRUE(subvolume.equal(expected, 1e-6));
+
+    // A box crossing the border of the volume is padded with zeros
+    VECTOR_R3(shift, 25, 0, 0);
+    prm.extractSubvolume(shift, subvolume);
+    int differences = 0;
+    FOR_ALL_ELEMENTS_IN_ARRAY3D(subvolume)
+    {
+        double value = (j - 25 >= STARTINGX(V)) ? A3D_ELEM(V, k, i, j - 25) : 0.;
+        if (A3D_ELEM(subvolume, k, i, j) != value)
+            ++differences;
+    }
+    EXPECT_EQ(0, differences);
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -24,9 +24,12 @@
  ***************************************************************************/
 
 #include "filters.h"
-#include <list>
+#include <vector>
+#include <algorithm>
 #include "morphology.h"
 #include "wavelet.h"
+#include "xmipp_image_generic.h"
+#include "xmipp_threads.h"
 
 /* Subtract background ---------------------------------------------------- */
 void substractBackgroundPlane(MultidimArray<double> &I)
@@ -327,64 +330,75 @@ typedef struct
 }
 Coordinate2D;
 
+/* Take the next element of an array based queue (elements are added with
+   push_back). The part already taken is discarded from time to time, so
+   the array only grows with the front of the region, not with the region. */
+template <class T>
+inline T popQueue(std::vector<T> &queue, size_t &head)
+{
+    T value=queue[head++];
+    if (head>1024 && 2*head>queue.size())
+    {
+        queue.erase(queue.begin(),queue.begin()+head);
+        head=0;
+    }
+    return value;
+}
+
+/* Neighbours of a pixel, the first 4 are the 4-neighbourhood */
+static const int neighbours2D[8][2]=
+    {
+        {0,-1}, {0,1}, {-1,0}, {1,0}, {-1,-1}, {-1,1}, {1,-1}, {1,1}
+    };
+
 void regionGrowing2D(const MultidimArray<double> &I_in,
                      MultidimArray<double> &I_out, int i, int j, float stop_colour,
                      float filling_colour, bool less, int neighbourhood)
 {
     I_in.checkDimension(2);
 
-    std::list<Coordinate2D> iNeighbours; /* A list for neighbour pixels */
-    int iCurrenti, iCurrentj; /* Coordinates of the current pixel considered */
+    std::vector<Coordinate2D> iNeighbours; /* A queue for neighbour pixels */
+    size_t head=0;
+    int nNeighbours=(neighbourhood==8) ? 8 : 4;
 
     /* First task is copying the input image into the output one */
     I_out = I_in;
 
     /**** Then the region growing is done ****/
-    /* Insert at the beginning of the list the seed coordinates */
+    /* Insert the seed coordinates */
     Coordinate2D coord;
     coord.ii = i;
     coord.jj = j;
-    iNeighbours.push_front(coord);
+    iNeighbours.push_back(coord);
 
     /* Fill the seed coordinates */
     A2D_ELEM(I_out, i, j) = filling_colour;
 
-    while (!iNeighbours.empty())
+    while (head<iNeighbours.size())
     {
         /* Take the current pixel to explore */
-        coord = iNeighbours.front();
-        iNeighbours.pop_front();
-        iCurrenti = coord.ii;
-        iCurrentj = coord.jj;
-
-#define CHECK_POINT(i,j) \
-    { \
-  int I=i; \
-        int J=j; \
-  if (INSIDEXY(I_out,J,I))  { \
-   double pixel=A2D_ELEM(I_out,I,J);\
-   if (pixel!=filling_colour) \
-    if ((less && pixel < stop_colour) || \
-     (!less && pixel > stop_colour)) { \
-     coord.ii=I; \
-     coord.jj=J; \
-     A2D_ELEM (I_out,coord.ii,coord.jj)=filling_colour; \
-     iNeighbours.push_front(coord); \
-    } \
-  } \
-    }
-
-        /* Make the exploration of the pixel's neighbours */
-        CHECK_POINT(iCurrenti, iCurrentj - 1);
-        CHECK_POINT(iCurrenti, iCurrentj + 1);
-        CHECK_POINT(iCurrenti - 1, iCurrentj);
-        CHECK_POINT(iCurrenti + 1, iCurrentj);
-        if (neighbourhood == 8)
+        Coordinate2D current=popQueue(iNeighbours,head);
+
+        /* Make the exploration of the pixel's neighbours. If the pixel has
+         a value lower than stop_colour, it is filled with filling colour and
+         added to the queue for exploring its neighbours */
+        for (int n=0; n<nNeighbours; n++)
         {
-            CHECK_POINT(iCurrenti - 1, iCurrentj - 1);
-            CHECK_POINT(iCurrenti - 1, iCurrentj + 1);
-            CHECK_POINT(iCurrenti + 1, iCurrentj - 1);
-            CHECK_POINT(iCurrenti + 1, iCurrentj + 1);
+            int I=current.ii+neighbours2D[n][0];
+            int J=current.jj+neighbours2D[n][1];
+            if (INSIDEXY(I_out,J,I))
+            {
+                double &pixel=A2D_ELEM(I_out,I,J);
+                if (pixel!=filling_colour)
+                    if ((less && pixel < stop_colour) ||
+                        (!less && pixel > stop_colour))
+                    {
+                        pixel=filling_colour;
+                        coord.ii=I;
+                        coord.jj=J;
+                        iNeighbours.push_back(coord);
+                    }
+            }
         }
     }
 }
@@ -398,87 +412,80 @@ typedef struct
 }
 Coordinate3D;
 
+/* Offsets (k,i,j) of the 26 neighbours of a voxel */
+static const int neighbours3D[26][3]=
+    {
+        {0,0,-1}, {0,0,1}, {0,-1,0}, {0,1,0}, {-1,0,0}, {1,0,0},
+        {0,-1,-1}, {0,-1,1}, {0,1,-1}, {0,1,1},
+        {-1,0,-1}, {-1,0,1}, {1,0,-1}, {1,0,1},
+        {-1,-1,0}, {-1,1,0}, {1,-1,0}, {1,1,0},
+        {-1,-1,-1}, {-1,-1,1}, {-1,1,-1}, {-1,1,1},
+        {1,-1,-1}, {1,-1,1}, {1,1,-1}, {1,1,1}
+    };
+
 void regionGrowing3D(const MultidimArray<double> &V_in,
                      MultidimArray<double> &V_out, int k, int i, int j, float stop_colour,
                      float filling_colour, bool less)
 {
     V_in.checkDimension(3);
 
-    std::list<Coordinate3D> iNeighbours; /* A list for neighbour voxels */
-    int iCurrentk, iCurrenti, iCurrentj; /* Coordinates of the current voxel considered */
+    std::vector<Coordinate3D> iNeighbours; /* A queue for neighbour voxels */
+    size_t head=0;
 
     /* First task is copying the input volume into the output one */
     V_out = V_in;
 
+    /* The queue works with direct (0-based) coordinates */
+    int Zdim=ZSIZE(V_out), Ydim=YSIZE(V_out), Xdim=XSIZE(V_out);
+    double *ptrOut=MULTIDIM_ARRAY(V_out);
+    long int offset[26];
+    for (int n=0; n<26; n++)
+        offset[n]=(neighbours3D[n][0]*Ydim+neighbours3D[n][1])*(long int)Xdim+
+                  neighbours3D[n][2];
+
     /**** Then the region growing is done in output volume ****/
-    /* Insert at the beginning of the list the seed coordinates */
+    /* Insert the seed coordinates */
     Coordinate3D coord;
-    coord.ii = i;
-    coord.jj = j;
-    coord.kk = k;
-    iNeighbours.push_front(coord);
+    coord.ii = i-STARTINGY(V_out);
+    coord.jj = j-STARTINGX(V_out);
+    coord.kk = k-STARTINGZ(V_out);
+    iNeighbours.push_back(coord);
 
     /* Fill the seed coordinates */
     A3D_ELEM(V_out, k, i, j) = filling_colour;
 
-    while (!iNeighbours.empty())
+    while (head<iNeighbours.size())
     {
-        /* Take the current pixel to explore */
-        coord = iNeighbours.front();
-        iNeighbours.pop_front();
-        iCurrenti = coord.ii;
-        iCurrentj = coord.jj;
-        iCurrentk = coord.kk;
-
-        /* a macro for doing exploration of a voxel. If the voxel has a value
-         lower than stop_colour, its filled with filling colour and added to the
-         list for exploring its neighbours */
-#define CHECK_POINT_3D(k,i,j) \
- {\
-     int I=i; \
-        int J=j; \
-        int K=k; \
-  if (INSIDEXYZ(V_out,J,I,K))  { \
-   double voxel=A3D_ELEM(V_out,K,I,J); \
-   if (voxel!=filling_colour) \
-    if ((less && voxel < stop_colour)|| \
-     (!less &&voxel > stop_colour)) { \
-     coord.ii=I; \
-     coord.jj=J; \
-     coord.kk=K; \
-     A3D_ELEM (V_out,coord.kk,coord.ii,coord.jj)=filling_colour; \
-     iNeighbours.push_front(coord); \
-    } \
-  }\
- }
-
-        /* Make the exploration of the pixel neighbours */
-        CHECK_POINT_3D(iCurrentk, iCurrenti, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti - 1, iCurrentj);
-        CHECK_POINT_3D(iCurrentk, iCurrenti - 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti - 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti + 1, iCurrentj);
-        CHECK_POINT_3D(iCurrentk, iCurrenti + 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti + 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti, iCurrentj);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti - 1, iCurrentj);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti - 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti - 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti + 1, iCurrentj);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti + 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti + 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti, iCurrentj);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti - 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti - 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti - 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti + 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti + 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti + 1, iCurrentj + 1);
+        /* Take the current voxel to explore */
+        Coordinate3D current=popQueue(iNeighbours,head);
+        double *ptrCurrent=ptrOut+((long int)current.kk*Ydim+current.ii)*Xdim+current.jj;
+        bool interior=current.kk>0 && current.kk<Zdim-1 &&
+                      current.ii>0 && current.ii<Ydim-1 &&
+                      current.jj>0 && current.jj<Xdim-1;
+
+        /* Make the exploration of the voxel neighbours. If the voxel has a
+         value lower than stop_colour, it is filled with filling colour and
+         added to the queue for exploring its neighbours */
+        for (int n=0; n<26; n++)
+        {
+            int K=current.kk+neighbours3D[n][0];
+            int I=current.ii+neighbours3D[n][1];
+            int J=current.jj+neighbours3D[n][2];
+            if (interior || (K>=0 && K<Zdim && I>=0 && I<Ydim && J>=0 && J<Xdim))
+            {
+                double &voxel=ptrCurrent[offset[n]];
+                if (voxel!=filling_colour)
+                    if ((less && voxel < stop_colour) ||
+                        (!less && voxel > stop_colour))
+                    {
+                        voxel=filling_colour;
+                        coord.ii=I;
+                        coord.jj=J;
+                        coord.kk=K;
+                        iNeighbours.push_back(coord);
+                    }
+            }
+        }
     }
 }
 
@@ -487,147 +494,162 @@ void regionGrowing3DEqualValue(const MultidimArray<double> &V_in, MultidimArray<
 {
     V_in.checkDimension(3);
 
-    std::list<Coordinate3D> iNeighbours; /* A list for neighbour voxels */
-    int iCurrentk, iCurrenti, iCurrentj; /* Coordinates of the current voxel considered */
+    std::vector<Coordinate3D> iNeighbours; /* A queue for neighbour voxels */
+    size_t head=0;
 
     /* First task is copying the input volume into the output one */
     V_out.resizeNoCopy(V_in);
     V_out.initConstant(1);
 
     /**** Then the region growing is done in output volume ****/
-    /* Insert at the beginning of the list the seed coordinates */
+    /* Insert the seed coordinates */
     Coordinate3D coord;
     coord.ii = STARTINGY(V_in);
     coord.jj = STARTINGX(V_in);
     coord.kk = STARTINGZ(V_in);
-    iNeighbours.push_front(coord);
+    iNeighbours.push_back(coord);
 
     /* Fill the seed coordinates */
     double bgColor = A3D_ELEM(V_in, STARTINGZ(V_in), STARTINGY(V_in), STARTINGX(V_in));
     A3D_ELEM(V_out, STARTINGZ(V_out), STARTINGY(V_out), STARTINGX(V_out)) = 0;
 
-    while (!iNeighbours.empty())
+    while (head<iNeighbours.size())
     {
-        /* Take the current pixel to explore */
-        coord = iNeighbours.front();
-        iNeighbours.pop_front();
-        iCurrenti = coord.ii;
-        iCurrentj = coord.jj;
-        iCurrentk = coord.kk;
-
-        /* a macro for doing exploration of a voxel. If the voxel has a value
-         lower than stop_colour, its filled with filling colour and added to the
-         list for exploring its neighbours */
-#undef CHECK_POINT_3D
-#define CHECK_POINT_3D(k,i,j) \
- {\
-        int I=i; \
-        int J=j; \
-        int K=k; \
-  if (INSIDEXYZ(V_out,J,I,K))  { \
-   double voxel=A3D_ELEM(V_in,K,I,J); \
-   if (A3D_ELEM(V_in,K,I,J)==bgColor && A3D_ELEM(V_out,K,I,J)==1) { \
-     coord.ii=I; \
-     coord.jj=J; \
-     coord.kk=K; \
-     A3D_ELEM (V_out,coord.kk,coord.ii,coord.jj)=filling_value; \
-     iNeighbours.push_front(coord); \
-    } \
-  }\
- }\
-
-        /* Make the exploration of the pixel neighbours */
-        CHECK_POINT_3D(iCurrentk, iCurrenti, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti - 1, iCurrentj);
-        CHECK_POINT_3D(iCurrentk, iCurrenti - 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti - 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti + 1, iCurrentj);
-        CHECK_POINT_3D(iCurrentk, iCurrenti + 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk, iCurrenti + 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti, iCurrentj);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti - 1, iCurrentj);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti - 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti - 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti + 1, iCurrentj);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti + 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk - 1, iCurrenti + 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti, iCurrentj);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti - 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti - 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti - 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti + 1, iCurrentj + 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti + 1, iCurrentj - 1);
-        CHECK_POINT_3D(iCurrentk + 1, iCurrenti + 1, iCurrentj + 1);
+        /* Take the current voxel to explore */
+        Coordinate3D current=popQueue(iNeighbours,head);
+
+        /* Make the exploration of the voxel neighbours. The voxels with the
+         same value as the seed are filled and added to the queue */
+        for (int n=0; n<26; n++)
+        {
+            int K=current.kk+neighbours3D[n][0];
+            int I=current.ii+neighbours3D[n][1];
+            int J=current.jj+neighbours3D[n][2];
+            if (INSIDEXYZ(V_out,J,I,K))
+                if (A3D_ELEM(V_in,K,I,J)==bgColor && A3D_ELEM(V_out,K,I,J)==1)
+                {
+                    A3D_ELEM(V_out,K,I,J)=filling_value;
+                    coord.ii=I;
+                    coord.jj=J;
+                    coord.kk=K;
+                    iNeighbours.push_back(coord);
+                }
+        }
     }
 }
 
+/* L1 distance to the closest zero along a line of distances. Each sample
+   is updated from its predecessor in both directions. If wrap, the line is
+   a circle and each direction is run twice so that the distances go
+   around the end of the line. */
+static void distanceTransformL1Line(int *d, int N, bool wrap, int stride)
+{
+    int passes=wrap ? 2 : 1;
+    for (int pass=0; pass<passes; pass++)
+        for (int j=(pass==0) ? 1 : 0; j<N; j++)
+        {
+            int previous=d[((j==0) ? N-1 : j-1)*stride]+1;
+            if (d[j*stride]>previous)
+                d[j*stride]=previous;
+        }
+    for (int pass=0; pass<passes; pass++)
+        for (int j=(pass==0) ? N-2 : N-1; j>=0; j--)
+        {
+            int next=d[((j==N-1) ? 0 : j+1)*stride]+1;
+            if (d[j*stride]>next)
+                d[j*stride]=next;
+        }
+}
 
 void distanceTransform(const MultidimArray<int> &in, MultidimArray<int> &out,
                        bool wrap)
 {
-    std::list<int> toExplore; /* A list of points to explore */
-
     in.checkDimension(2);
 
     out.resize(in);
     out.initConstant(XSIZE(in) + YSIZE(in));
 
-#define CHECK_POINT_DIST(i,j,proposedDistance) \
-    { \
-        int ip=i; \
-        int jp=j; \
-        if (wrap) \
-        { \
-            ip=intWRAP(ip,STARTINGY(out),FINISHINGY(out));\
-            jp=intWRAP(jp,STARTINGX(out),FINISHINGX(out));\
-        } \
-        if (ip>=STARTINGY(out) && ip<=FINISHINGY(out) && \
-            jp>=STARTINGX(out) && jp<=FINISHINGX(out)) \
-            if (out(ip,jp)>proposedDistance) \
-            { \
-                out(ip,jp)=proposedDistance; \
-                toExplore.push_back(ip); \
-                toExplore.push_back(jp); \
-                toExplore.push_back(proposedDistance); \
-            } \
-    }
-
     // Look for all elements in the binary mask and set the corresponding
     // distance to 0
-    FOR_ALL_ELEMENTS_IN_ARRAY2D(in)
-    if (in(i, j))
-    {
-        out(i, j) = 0;
-        CHECK_POINT_DIST(i-1, j, 1);
-        CHECK_POINT_DIST(i+1, j, 1);
-        CHECK_POINT_DIST(i, j-1, 1);
-        CHECK_POINT_DIST(i, j+1, 1);
-    }
-
-    while (!toExplore.empty())
-    {
-        int i = toExplore.front();
-        toExplore.pop_front();
-        int j = toExplore.front();
-        toExplore.pop_front();
-        int proposedDistance = toExplore.front();
-        toExplore.pop_front();
-
-        if (proposedDistance == out(i, j))
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(in)
+    if (DIRECT_MULTIDIM_ELEM(in,n))
+        DIRECT_MULTIDIM_ELEM(out,n) = 0;
+
+    // The L1 distance is separable, first along the rows and then along
+    // the columns
+    int Xdim=XSIZE(out), Ydim=YSIZE(out);
+    for (int i=0; i<Ydim; i++)
+        distanceTransformL1Line(&DIRECT_A2D_ELEM(out,i,0),Xdim,wrap,1);
+    for (int j=0; j<Xdim; j++)
+        distanceTransformL1Line(&DIRECT_A2D_ELEM(out,0,j),Ydim,wrap,Xdim);
+}
+
+/* Squared Euclidean distance transform of a sampled function along a line.
+   Lower envelope of parabolas, P. Felzenszwalb, D. Huttenlocher. Distance
+   transforms of sampled functions. Theory of Computing 8: 415-428 (2012).
+   v and z must have N and N+1 elements. */
+static void squaredDistanceLine(double *f, int N, int stride, double *d, int *v, double *z)
+{
+    const double inf=1e30;
+    int k=0;
+    v[0]=0;
+    z[0]=-inf;
+    z[1]=inf;
+    for (int q=1; q<N; q++)
+    {
+        double fq=f[q*stride]+q*q;
+        int p=v[k];
+        double s=(fq-(f[p*stride]+p*p))/(2*(q-p));
+        while (s<=z[k])
         {
-            // If this is the current distance (i.e., it has not
-            // been supersceded by a later value
-            CHECK_POINT_DIST(i-1, j, proposedDistance+1);
-            CHECK_POINT_DIST(i+1, j, proposedDistance+1);
-            CHECK_POINT_DIST(i, j-1, proposedDistance+1);
-            CHECK_POINT_DIST(i, j+1, proposedDistance+1);
+            k--;
+            p=v[k];
+            s=(fq-(f[p*stride]+p*p))/(2*(q-p));
         }
-    }
+        k++;
+        v[k]=q;
+        z[k]=s;
+        z[k+1]=inf;
+    }
+    k=0;
+    for (int q=0; q<N; q++)
+    {
+        while (z[k+1]<q)
+            k++;
+        int dq=q-v[k];
+        d[q]=dq*dq+f[v[k]*stride];
+    }
+    for (int q=0; q<N; q++)
+        f[q*stride]=d[q];
+}
+
+void euclideanDistanceTransform(const MultidimArray<int> &in, MultidimArray<double> &out)
+{
+    int Xdim=XSIZE(in), Ydim=YSIZE(in), Zdim=ZSIZE(in);
+    double far=(double)Xdim*Xdim+(double)Ydim*Ydim+(double)Zdim*Zdim;
+    out.initZeros(in);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(in)
+    if (!DIRECT_MULTIDIM_ELEM(in,n))
+        DIRECT_MULTIDIM_ELEM(out,n)=far;
+
+    int maxDim=XMIPP_MAX(XMIPP_MAX(Xdim,Ydim),Zdim);
+    std::vector<double> d(maxDim), z(maxDim+1);
+    std::vector<int> v(maxDim);
+    int sliceSize=YXSIZE(in);
+    for (int k=0; k<Zdim; k++)
+        for (int i=0; i<Ydim; i++)
+            squaredDistanceLine(&DIRECT_A3D_ELEM(out,k,i,0),Xdim,1,&d[0],&v[0],&z[0]);
+    if (Ydim>1)
+        for (int k=0; k<Zdim; k++)
+            for (int j=0; j<Xdim; j++)
+                squaredDistanceLine(&DIRECT_A3D_ELEM(out,k,0,j),Ydim,Xdim,&d[0],&v[0],&z[0]);
+    if (Zdim>1)
+        for (int i=0; i<Ydim; i++)
+            for (int j=0; j<Xdim; j++)
+                squaredDistanceLine(&DIRECT_A3D_ELEM(out,0,i,j),Zdim,sliceSize,&d[0],&v[0],&z[0]);
+
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(out)
+    DIRECT_MULTIDIM_ELEM(out,n)=sqrt(XMIPP_MIN(DIRECT_MULTIDIM_ELEM(out,n),far));
 }
 
 /* Label image ------------------------------------------------------------ */
@@ -2744,22 +2766,25 @@ void centerImageTranslationally(MultidimArray<double> &I, CorrelationAux &aux)
     Ixy.selfReverseY();
     Ixy.setXmippOrigin();
 
+    // The transform of I is shared by the three shifts and the final
+    // (wrapping) translation, which is applied as a phase ramp
+    FourierTransformer transformer;
+    MultidimArray< std::complex<double> > FFTI;
+    transformer.FourierTransform(I, FFTI, false);
+
     double meanShiftX = 0, meanShiftY = 0, shiftX, shiftY;
-    bestNonwrappingShift(I, Ix, meanShiftX, meanShiftY, aux);
-    bestNonwrappingShift(I, Iy, shiftX, shiftY, aux);
+    bestNonwrappingShift(I, FFTI, Ix, meanShiftX, meanShiftY, aux);
+    bestNonwrappingShift(I, FFTI, Iy, shiftX, shiftY, aux);
     meanShiftX += shiftX;
     meanShiftY += shiftY;
-    bestNonwrappingShift(I, Ixy, shiftX, shiftY, aux);
+    bestNonwrappingShift(I, FFTI, Ixy, shiftX, shiftY, aux);
     meanShiftX += shiftX;
     meanShiftY += shiftY;
     meanShiftX /= 3;
     meanShiftY /= 3;
 
-    Matrix1D<double> shift(2);
-    VECTOR_R2(shift, -meanShiftX, -meanShiftY);
-    MultidimArray<double> aux2 = I;
-    translate(3, I, aux2, shift);
-    //I.selfTranslateBSpline(3,shift);
+    shiftInFourier(FFTI, XSIZE(I), -meanShiftX, -meanShiftY);
+    transformer.inverseFourierTransform();
 }
 
 /* Center rotationally ----------------------------------------------------- */
@@ -2838,7 +2863,8 @@ void centerImage(MultidimArray<double> &I, CorrelationAux &aux,
         Ixy.setXmippOrigin();
 
         double meanShiftX = 0, meanShiftY = 0, shiftX, shiftY, Nx = 0, Ny = 0;
-        bestNonwrappingShift(Iaux, Ix, shiftX, shiftY, aux);
+        aux.transformer1.FourierTransform(Iaux, aux.FFT1, false);
+        bestNonwrappingShift(Iaux, aux.FFT1, Ix, shiftX, shiftY, aux);
 #ifdef DEBUG
 
         ImageXmipp save;
@@ -2857,7 +2883,7 @@ void centerImage(MultidimArray<double> &I, CorrelationAux &aux,
             meanShiftY += shiftY;
             Ny++;
         }
-        bestNonwrappingShift(Iaux, Iy, shiftX, shiftY, aux);
+        bestNonwrappingShift(Iaux, aux.FFT1, Iy, shiftX, shiftY, aux);
 #ifdef DEBUG
 
         save()=Iy;
@@ -2875,7 +2901,7 @@ void centerImage(MultidimArray<double> &I, CorrelationAux &aux,
             meanShiftY += shiftY;
             Ny++;
         }
-        bestNonwrappingShift(Iaux, Ixy, shiftX, shiftY, aux);
+        bestNonwrappingShift(Iaux, aux.FFT1, Ixy, shiftX, shiftY, aux);
 #ifdef DEBUG
 
         save()=Ixy;
@@ -3062,6 +3088,225 @@ void forceDWTSparsity(MultidimArray<double> &V, double eps)
     selfScaleToSize(BSPLINE3,V,size0, size0, size0);
 }
 
+/* Rank filter ------------------------------------------------------------- */
+#define RANK_LEVELS 65536
+
+/* Histogram of the levels in the window. The coarse histogram groups
+   2^shift levels (about the square root of the number of levels) and the
+   coarse bin of the element of a given rank is tracked from one pixel to
+   the next, so that it moves little. Then the fine levels of that bin are
+   scanned. */
+struct RankHistogram
+{
+    std::vector<int> fine, coarse;
+    int shift;
+    int bin, below; // Current coarse bin and number of elements below it
+
+    RankHistogram(int Nlevels)
+    {
+        shift = 0;
+        while ((1 << (2 * shift)) < Nlevels)
+            shift++;
+        fine.resize(Nlevels, 0);
+        coarse.resize((Nlevels >> shift) + 1, 0);
+        bin = below = 0;
+    }
+
+    void add(int v)
+    {
+        fine[v]++;
+        coarse[v >> shift]++;
+        if ((v >> shift) < bin)
+            below++;
+    }
+
+    void remove(int v)
+    {
+        fine[v]--;
+        coarse[v >> shift]--;
+        if ((v >> shift) < bin)
+            below--;
+    }
+
+    /* Level of the k-th element (0-based), k must be smaller than the
+       number of elements */
+    int select(int k)
+    {
+        while (below > k)
+            below -= coarse[--bin];
+        while (below + coarse[bin] <= k)
+            below += coarse[bin++];
+        int level = bin << shift;
+        int accumulated = below + fine[level];
+        while (accumulated <= k)
+            accumulated += fine[++level];
+        return level;
+    }
+};
+
+struct RankFilterData
+{
+    const MultidimArray<double> * in;
+    const std::vector<double> * bounds;
+    std::vector<unsigned short> * levels;
+    const std::vector<double> * values;
+    MultidimArray<double> * out;
+    int radius, radiusZ;
+    double percentile;
+};
+
+// Level of each pixel, each task is a line along X
+static void threadRankLevels(size_t first, size_t last, int thread_id, void * data)
+{
+    RankFilterData * d = (RankFilterData *) data;
+    const std::vector<double> &bounds = *(d->bounds);
+    size_t Xdim = XSIZE(*(d->in));
+    for (size_t n = first * Xdim; n < (last + 1) * Xdim; ++n)
+        (*(d->levels))[n] = std::upper_bound(bounds.begin(), bounds.end(),
+                                             DIRECT_MULTIDIM_ELEM(*(d->in), n)) - bounds.begin() - 1;
+}
+
+// Each task is a line along X
+static void threadRankFilter(size_t first, size_t last, int thread_id, void * data)
+{
+    RankFilterData * d = (RankFilterData *) data;
+    MultidimArray<double> &out = *(d->out);
+    const std::vector<unsigned short> &levels = *(d->levels);
+    int Xdim = XSIZE(out), Ydim = YSIZE(out), Zdim = ZSIZE(out);
+    int r = d->radius;
+    RankHistogram histogram(d->values->size());
+    for (size_t line = first; line <= last; ++line)
+    {
+        int k = line / Ydim, i = line % Ydim;
+        int k0 = XMIPP_MAX(k - d->radiusZ, 0), kF = XMIPP_MIN(k + d->radiusZ, Zdim - 1);
+        int i0 = XMIPP_MAX(i - r, 0), iF = XMIPP_MIN(i + r, Ydim - 1);
+        int count = 0;
+
+        // Add (sign=1) or remove (sign=-1) the column x of the window
+#define RANK_COLUMN(x, sign) \
+        for (int kk = k0; kk <= kF; ++kk) \
+            for (int ii = i0; ii <= iF; ++ii) \
+            { \
+                int v = levels[((size_t)kk * Ydim + ii) * Xdim + (x)]; \
+                if (sign > 0) \
+                    histogram.add(v); \
+                else \
+                    histogram.remove(v); \
+            } \
+        count += sign * (kF - k0 + 1) * (iF - i0 + 1);
+
+        for (int x = 0; x < XMIPP_MIN(r, Xdim); ++x)
+        {
+            RANK_COLUMN(x, 1);
+        }
+        for (int j = 0; j < Xdim; ++j)
+        {
+            if (j + r < Xdim)
+            {
+                RANK_COLUMN(j + r, 1);
+            }
+            if (j - r - 1 >= 0)
+            {
+                RANK_COLUMN(j - r - 1, -1);
+            }
+            int rank = (int)(d->percentile / 100 * (count - 1) + 0.5);
+            DIRECT_A3D_ELEM(out, k, i, j) = (*(d->values))[histogram.select(rank)];
+        }
+
+        // Empty the histogram for the next line
+        for (int x = XMIPP_MAX(Xdim - r - 1, 0); x < Xdim; ++x)
+        {
+            RANK_COLUMN(x, -1);
+        }
+#undef RANK_COLUMN
+    }
+}
+
+void rankFilter(const MultidimArray<double> &in, MultidimArray<double> &out,
+                int radius, double percentile, ThreadPool * pool)
+{
+    if (radius < 0 || percentile < 0 || percentile > 100)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "rankFilter: the radius must be non negative and the percentile in [0,100]");
+    if (NSIZE(in) > 1)
+        REPORT_ERROR(ERR_MULTIDIM_DIM, "rankFilter: the input must be a single image or volume");
+
+    // Levels of the input values. They are exact if there are at most
+    // RANK_LEVELS different values, otherwise each level has about the
+    // same number of pixels and it is represented by its middle value.
+    size_t N = MULTIDIM_SIZE(in);
+    std::vector<unsigned short> levels(N);
+    std::vector<double> bounds, values;
+    RankFilterData data;
+    data.in = &in;
+    data.bounds = &bounds;
+    data.levels = &levels;
+    data.values = &values;
+    data.out = &out;
+    data.radius = radius;
+    data.radiusZ = ZSIZE(in) > 1 ? radius : 0;
+    data.percentile = percentile;
+    size_t Nlines = ZSIZE(in) * YSIZE(in);
+
+    // Integer values (e.g. counts) in a short range do not need sorting
+    double minval, maxval;
+    in.computeDoubleMinMax(minval, maxval);
+    bool integer = maxval - minval < RANK_LEVELS;
+    for (size_t n = 0; integer && n < N; ++n)
+        integer = DIRECT_MULTIDIM_ELEM(in, n) == floor(DIRECT_MULTIDIM_ELEM(in, n));
+    if (integer)
+    {
+        for (double v = minval; v <= maxval; v += 1)
+            values.push_back(v);
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(in)
+        levels[n] = (unsigned short)(DIRECT_MULTIDIM_ELEM(in, n) - minval);
+    }
+    else
+    {
+        std::vector<double> sorted(MULTIDIM_ARRAY(in), MULTIDIM_ARRAY(in) + N);
+        std::sort(sorted.begin(), sorted.end());
+        size_t different = 1;
+        for (size_t n = 1; n < N; ++n)
+            if (sorted[n] != sorted[n - 1])
+                ++different;
+        if (different <= RANK_LEVELS)
+        {
+            bounds.reserve(different);
+            for (size_t n = 0; n < N; ++n)
+                if (n == 0 || sorted[n] != sorted[n - 1])
+                    bounds.push_back(sorted[n]);
+            values = bounds;
+        }
+        else
+        {
+            std::vector<size_t> firstIndex;
+            for (size_t l = 0; l < RANK_LEVELS; ++l)
+            {
+                size_t index = (l * N) / RANK_LEVELS;
+                if (bounds.empty() || sorted[index] > bounds.back())
+                {
+                    // First element with this value
+                    index = std::lower_bound(sorted.begin(), sorted.end(), sorted[index]) - sorted.begin();
+                    bounds.push_back(sorted[index]);
+                    firstIndex.push_back(index);
+                }
+            }
+            firstIndex.push_back(N);
+            for (size_t l = 0; l < bounds.size(); ++l)
+                values.push_back(sorted[(firstIndex[l] + firstIndex[l + 1] - 1) / 2]);
+        }
+        if (pool != NULL)
+            pool->parallelFor(Nlines, 16, threadRankLevels, &data);
+        else
+            threadRankLevels(0, Nlines - 1, 0, &data);
+    }
+
+    out.resizeNoCopy(in);
+    if (pool != NULL)
+        pool->parallelFor(Nlines, 16, threadRankFilter, &data);
+    else
+        threadRankFilter(0, Nlines - 1, 0, &data);
+}
+
 /////////////// FILTERS IMPLEMENTATIONS /////////////////
 
 /** Define the parameters for use inside an Xmipp program */
@@ -3172,6 +3417,13 @@ void BackgroundFilter::readParams(XmippProgram * program)
 }
 
 /** Apply the filter to an image or volume*/
+int BackgroundFilter::tileHalo() const
+{
+    if (type == ROLLINGBALL && radius <= 10)
+        return 2 * radius + 1;
+    return -1;
+}
+
 void BackgroundFilter::apply(MultidimArray<double> &img)
 {
     switch (type)
@@ -3192,19 +3444,31 @@ void MedianFilter::defineParams(XmippProgram * program)
     program->addParamsLine("== Median ==");
     program->addParamsLine("  [ --median ]            : Use median filter.");
     program->addParamsLine("         alias -m; ");
+    program->addParamsLine("  [ --median_radius <r=1> ] : Radius of the window, 3x3 for 1.");
+    program->addParamsLine("                          : Except for the 3x3 median of images, the window is clipped at the borders.");
+    program->addParamsLine("  [ --percentile <p=50> ] : Percentile of the window (0 minimum, 50 median, 100 maximum).");
 }
 
 /** Read from program command line */
 void MedianFilter::readParams(XmippProgram * program)
-{ //Do nothing by now
+{
+    radius = program->getIntParam("--median_radius");
+    percentile = program->getDoubleParam("--percentile");
 }
 
 /** Apply the filter to an image or volume*/
 void MedianFilter::apply(MultidimArray<double> &img)
 {
-    static MultidimArray<double> tmp;
-    tmp = img;
-    medianFilter3x3(tmp, img);
+    MultidimArray<double> tmp = img;
+    if (radius == 1 && percentile == 50 && ZSIZE(img) == 1)
+        medianFilter3x3(tmp, img);
+    else if (numThreads > 1)
+    {
+        threadPool.setNumberOfThreads(numThreads);
+        rankFilter(tmp, img, radius, percentile, &threadPool);
+    }
+    else
+        rankFilter(tmp, img, radius, percentile);
 }
 
 /** Define the parameters for use inside an Xmipp program */
@@ -3316,3 +3580,88 @@ void BasisFilter::apply(MultidimArray<double> &img)
     img = result;
 }
 
+/* Filter by tiles --------------------------------------------------------- */
+struct FilterTilesData
+{
+    XmippFilter * filter;
+    const ImageGeneric * in;
+    ImageGeneric * out;
+    size_t xdim, ydim, zdim;
+    int tileSize, halo;
+    size_t tilesX, tilesY;
+};
+
+// Each task is a tile
+static void threadFilterTiles(size_t first, size_t last, int thread_id, void * data)
+{
+    FilterTilesData * d = (FilterTilesData *) data;
+    MultidimArray<double> tile;
+    for (size_t t = first; t <= last; ++t)
+    {
+        // Core of the tile and core with the halo, clipped to the input
+        int kx = t % d->tilesX;
+        int ky = (t / d->tilesX) % d->tilesY;
+        int kz = t / (d->tilesX * d->tilesY);
+        int x0 = kx * d->tileSize, xF = XMIPP_MIN(x0 + d->tileSize, (int)d->xdim) - 1;
+        int y0 = ky * d->tileSize, yF = XMIPP_MIN(y0 + d->tileSize, (int)d->ydim) - 1;
+        int z0 = 0, zF = 0, hz0 = 0, hzF = 0;
+        if (d->zdim > 1)
+        {
+            z0 = kz * d->tileSize;
+            zF = XMIPP_MIN(z0 + d->tileSize, (int)d->zdim) - 1;
+            hz0 = XMIPP_MAX(z0 - d->halo, 0);
+            hzF = XMIPP_MIN(zF + d->halo, (int)d->zdim - 1);
+        }
+        int hx0 = XMIPP_MAX(x0 - d->halo, 0), hxF = XMIPP_MIN(xF + d->halo, (int)d->xdim - 1);
+        int hy0 = XMIPP_MAX(y0 - d->halo, 0), hyF = XMIPP_MIN(yF + d->halo, (int)d->ydim - 1);
+
+        (*(d->in))()._window(tile, hz0, hy0, hx0, hzF, hyF, hxF);
+        STARTINGX(tile) = STARTINGY(tile) = STARTINGZ(tile) = 0;
+        d->filter->apply(tile);
+        if (XSIZE(tile) != (size_t)(hxF - hx0 + 1) || YSIZE(tile) != (size_t)(hyF - hy0 + 1) ||
+            ZSIZE(tile) != (size_t)(hzF - hz0 + 1))
+            REPORT_ERROR(ERR_MULTIDIM_SIZE, "applyFilterByTiles: the filter changed the size of the tile");
+
+        // The tiles do not overlap in the output
+        for (int k = z0; k <= zF; ++k)
+            for (int i = y0; i <= yF; ++i)
+                for (int j = x0; j <= xF; ++j)
+                    d->out->setPixel(0, k, i, j, DIRECT_A3D_ELEM(tile, k - hz0, i - hy0, j - hx0));
+    }
+}
+
+void applyFilterByTiles(XmippFilter &filter, const FileName &fnIn,
+                        const FileName &fnOut, int tileSize, int numThreads)
+{
+    int halo = filter.tileHalo();
+    if (halo < 0)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "applyFilterByTiles: this filter cannot be applied by tiles");
+    if (tileSize < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "applyFilterByTiles: the tile size must be positive");
+
+    ImageGeneric in, out;
+    in.read(fnIn, DATA, ALL_IMAGES, true);
+    size_t xdim, ydim, zdim, ndim;
+    in.getDimensions(xdim, ydim, zdim, ndim);
+    if (ndim != 1)
+        REPORT_ERROR(ERR_MULTIDIM_DIM, "applyFilterByTiles: the input must be a single image or volume");
+    out.setDatatype(DT_Float);
+    out.mapFile2Write(xdim, ydim, zdim, fnOut, fnIn == fnOut);
+
+    FilterTilesData data;
+    data.filter = &filter;
+    data.in = &in;
+    data.out = &out;
+    data.xdim = xdim;
+    data.ydim = ydim;
+    data.zdim = zdim;
+    data.tileSize = tileSize;
+    data.halo = halo;
+    data.tilesX = (xdim + tileSize - 1) / tileSize;
+    data.tilesY = (ydim + tileSize - 1) / tileSize;
+    size_t tilesZ = (zdim + tileSize - 1) / tileSize;
+
+    ThreadPool pool(numThreads);
+    pool.parallelFor(data.tilesX * data.tilesY * tilesZ, 1, threadFilterTiles, &data);
+    out.write(fnOut);
+}
@@ -29,12 +29,14 @@
 #define LOG2 0.693147181
 
 #include <queue>
+#include <algorithm>
 #include "xmipp_image.h"
 #include "numerical_tools.h"
 #include "histogram.h"
 #include "xmipp_program.h"
 #include "mask.h"
 #include "polar.h"
+#include "xmipp_threads.h"
 
 /// @defgroup Filters Filters
 /// @ingroup DataLibrary
@@ -134,12 +136,29 @@ void regionGrowing3DEqualValue(const MultidimArray<double> &V_in,
 /** L1 distance transform
   * @ingroup Filters
   *
+  * Distance of each pixel to the closest non-zero pixel of in. The
+  * transform is separable, so it is computed along rows and columns in
+  * linear time. If there is no non-zero pixel, the distance is
+  * XSIZE(in)+YSIZE(in).
+  *
   * If wrap is set, the image borders are wrapped around.
   * This is useful if the image coordinates represent angles
   */
 void distanceTransform(const MultidimArray<int> &in,
                        MultidimArray<int> &out, bool wrap=false);
 
+/** Euclidean distance transform
+  * @ingroup Filters
+  *
+  * Exact Euclidean distance (in pixels) of each pixel (voxel) of an image
+  * or volume to the closest non-zero element of in. It is computed
+  * separably along X, Y and Z in linear time (Felzenszwalb and
+  * Huttenlocher, 2012). If there is no non-zero element, the distance is
+  * the length of the diagonal of the array.
+  */
+void euclideanDistanceTransform(const MultidimArray<int> &in,
+                                MultidimArray<double> &out);
+
 /** Label a binary image
  * @ingroup Filters
  *
@@ -1262,6 +1281,30 @@ void medianFilter3x3(MultidimArray< T >&m, MultidimArray< T >& out)
     STARTINGY(m) = STARTINGY(out) = backup_startingy;
 }
 
+/** Rank filter
+ * @ingroup Filters
+ *
+ * Each pixel (voxel) of out is the given percentile (50 for the median,
+ * 0 for the minimum, 100 for the maximum) of the values of in in a
+ * square (cubic) window of side 2*radius+1 around it. At the borders the
+ * window is clipped to the image. The window slides along X with a
+ * histogram of the values (Huang, Perreault and Hebert), so the cost
+ * per pixel grows with the side of the window and not with its area.
+ * If a thread pool is given, the lines are distributed among its threads.
+ *
+ * The histogram has 65536 levels. If the input has more different values,
+ * the levels are the quantiles of the input and the result is the middle
+ * value of the level of the percentile. These levels depend on the whole
+ * input, so filtering parts of it (e.g. by tiles) does not give exactly the
+ * same result as filtering all of it.
+ * @code
+ * ThreadPool pool(8);
+ * rankFilter(gain, gainMedian, 2, 50, &pool);
+ * @endcode
+ */
+void rankFilter(const MultidimArray<double> &in, MultidimArray<double> &out,
+                int radius, double percentile = 50, ThreadPool * pool = NULL);
+
 /** Mumford-Shah smoothing
  * @ingroup Filters
  *
@@ -1407,8 +1450,7 @@ void boundMedianFilter(MultidimArray< T > &V, const MultidimArray<char> &mask, i
 {
     bool badRemaining;
     T neighbours[125];
-    T aux;
-    int N = 0, index;
+    int N = 0;
 
     do
     {
@@ -1420,44 +1462,39 @@ void boundMedianFilter(MultidimArray< T > &V, const MultidimArray<char> &mask, i
             N = 0;
             for (int kk=-2; kk<=2; kk++)
             {
-            	size_t kkk=k+kk;
+                size_t kkk=k+kk;
                 if (kkk<0 || kkk>=ZSIZE(V))
                     continue;
                 for (int ii=-2; ii<=2; ii++)
                 {
-                	size_t iii=i+ii;
+                    size_t iii=i+ii;
                     if (iii<0 || iii>=YSIZE(V))
                         continue;
                     for (int jj=-2; jj<=2; jj++)
                     {
-                    	size_t jjj=j+jj;
+                        size_t jjj=j+jj;
                         if (jjj<0 || jjj>=XSIZE(V))
                             continue;
 
                         if (DIRECT_A3D_ELEM(mask, kkk, iii, jjj) == 0)
-                        {
-                            index = N++;
-                            neighbours[index] = DIRECT_A3D_ELEM(V, kkk,iii,jjj);
-                            //insertion sort
-                            while (index > 0 && neighbours[index-1] > neighbours[index])
-                            {
-                                SWAP(neighbours[index-1], neighbours[index], aux);
-                                --index;
-                            }
-                        }
+                            neighbours[N++] = DIRECT_A3D_ELEM(V, kkk,iii,jjj);
                     }
                 }
-                if (N == 0)
-                    badRemaining = true;
-                else
+            }
+            if (N == 0)
+                badRemaining = true;
+            else
+            {
+                // Only the middle elements are needed, not the whole sort
+                std::nth_element(neighbours, neighbours + N/2, neighbours + N);
+                if (N % 2 == 0)
                 {
-                    //std::sort(neighbours.begin(),neighbours.end());
-                    if (N % 2 == 0)
-                        DIRECT_A3D_ELEM(V, k, i, j) = (T)(0.5*(neighbours[N/2-1]+ neighbours[N/2]));
-                    else
-                        DIRECT_A3D_ELEM(V, k, i, j) = neighbours[N/2];
-                    DIRECT_A3D_ELEM(mask, k, i, j) = false;
+                    T lower = *std::max_element(neighbours, neighbours + N/2);
+                    DIRECT_A3D_ELEM(V, k, i, j) = (T)(0.5*(lower + neighbours[N/2]));
                 }
+                else
+                    DIRECT_A3D_ELEM(V, k, i, j) = neighbours[N/2];
+                DIRECT_A3D_ELEM(mask, k, i, j) = false;
             }
         }
     }
@@ -1540,8 +1577,37 @@ public:
     virtual void show()
     {}
     ;
+
+    /** Halo needed to apply the filter by tiles.
+     * The filtered value of a pixel must not depend on the pixels
+     * farther than the halo, and apply must be reentrant, so that
+     * several tiles are filtered at the same time.
+     * A negative value (default) means that the filter needs the whole
+     * image and it cannot be applied by tiles.
+     */
+    virtual int tileHalo() const
+    {
+        return -1;
+    }
 };
 
+/** Apply a filter to a large image or volume by tiles.
+ * The input is mapped to memory (or read, if its format cannot be mapped)
+ * and the output is created as a mapped file. Images are divided in square
+ * tiles and volumes in cubic tiles of tileSize pixels. Each tile is read
+ * with a halo of filter.tileHalo() pixels (clipped at the borders of the
+ * input), filtered, and only its core is written to the output. So the
+ * result is the same as filtering the whole image (see the tileHalo of each
+ * filter), with a memory of about numThreads tiles besides the pages of the
+ * mapped files.
+ * @code
+ * MedianFilter filter;
+ * applyFilterByTiles(filter, "micrograph.mrc", "filtered.mrc", 1024, 8);
+ * @endcode
+ */
+void applyFilterByTiles(XmippFilter &filter, const FileName &fnIn,
+                        const FileName &fnOut, int tileSize, int numThreads = 1);
+
 /** Some concrete filters */
 
 
@@ -1576,6 +1642,11 @@ public:
     void readParams(XmippProgram * program);
     /** Apply the filter to an image or volume*/
     void apply(MultidimArray<double> &img);
+    /** Pixel by pixel */
+    int tileHalo() const
+    {
+        return 0;
+    }
 };
 
 class BackgroundFilter: public XmippFilter
@@ -1592,17 +1663,50 @@ public:
     void readParams(XmippProgram * program);
     /** Apply the filter to an image or volume*/
     void apply(MultidimArray<double> &img);
+    /** Only the rolling ball without shrinking (radius<=10) is local:
+     * the background depends on the pixels at less than two diameters
+     * of the ball. Larger balls resample the background to the size
+     * of the image.
+     */
+    int tileHalo() const;
 };
 
 class MedianFilter: public XmippFilter
 {
 public:
+    /** Radius of the window, 1 for 3x3 */
+    int radius;
+    /** Percentile of the window, 50 for the median */
+    double percentile;
+    /** Number of threads.
+     * Leave it to 1 when the filter is applied by tiles, the tiles are
+     * already filtered in parallel.
+     */
+    int numThreads;
+
+    MedianFilter()
+    {
+        radius = 1;
+        percentile = 50;
+        numThreads = 1;
+    }
     /** Define the parameters for use inside an Xmipp program */
     static void defineParams(XmippProgram * program);
     /** Read from program command line */
     void readParams(XmippProgram * program);
     /** Apply the filter to an image or volume*/
     void apply(MultidimArray<double> &img);
+    /** Neighbourhood of the window.
+     * The result by tiles is the same as for the whole image, except for
+     * images with more than 65536 different values (see rankFilter).
+     */
+    int tileHalo() const
+    {
+        return radius;
+    }
+private:
+    // Threads of rankFilter, kept from one image to the next
+    ThreadPool threadPool;
 };
 
 class DiffusionFilter: public XmippFilter
@@ -34,6 +34,7 @@ ProgImageResize::~ProgImageResize()
 void ProgImageResize::defineParams()
 {
     each_image_produces_an_output = true;
+    allow_threads = true;
     save_metadata_stack = true;
     keep_input_columns = true;
     allow_apply_geo = true;
@@ -185,6 +186,7 @@ void ProgImageResize::preProcess()
 void ProgImageResize::processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut)
 {
     double aux;
+    ImageGeneric img, imgOut;
     if (apply_geo)
     {
         SCALE_SHIFT(MDL_SHIFT_X, XX(resizeFactor));
@@ -30,6 +30,7 @@
 #include "metadata.h"
 #include "xmipp_image.h"
 #include "xmipp_program_sql.h"
+#include "xmipp_profile.h"
 
 // Get the blocks available
 void getBlocksInMetaDataFile(const FileName &inFile, StringVector& blockList)
@@ -183,6 +184,7 @@ void MetaData::copyMetadata(const MetaData &md, bool copyObjects)
 
 bool MetaData::setValue(const MDObject &mdValueIn, size_t id)
 {
+    XMIPP_PROFILE("metadata_set_value");
     if (id == BAD_OBJID)
     {
         REPORT_ERROR(ERR_MD_NOACTIVE, "setValue: please provide objId other than -1");
@@ -202,6 +204,7 @@ bool MetaData::setValueCol(const MDObject &mdValueIn)
 
 bool MetaData::getValue(MDObject &mdValueOut, size_t id) const
 {
+    XMIPP_PROFILE("metadata_get_value");
     if (!containsLabel(mdValueOut.label))
         return false;
 
@@ -306,6 +309,7 @@ void 	MetaData::finalizeGetRow(void) const
 
 bool MetaData::getRow(MDRow &row, size_t id) const
 {
+    XMIPP_PROFILE("metadata_get_row");
     row.clear();
     for (std::vector<MDLabel>::const_iterator it = activeLabels.begin(); it != activeLabels.end(); ++it)
     {
@@ -892,6 +896,7 @@ bool MetaData::containsObject(const MDQuery &query)
 
 void MetaData::write(const FileName &_outFile, WriteModeMetaData mode) const
 {
+    XMIPP_PROFILE("metadata_write");
     String blockName;
     FileName outFile;
     FileName extFile;
@@ -1068,6 +1073,195 @@ void MetaData::print() const
     write(std::cout);
 }
 
+/* Helpers to copy plain values in and out of a binary buffer */
+template <typename T>
+inline void appendToBuffer(std::vector<char> &buffer, const T &value)
+{
+    const char *p = (const char *) &value;
+    buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+inline void appendToBuffer(std::vector<char> &buffer, const std::vector<T> &values)
+{
+    appendToBuffer(buffer, values.size());
+    if (!values.empty())
+    {
+        const char *p = (const char *) &values[0];
+        buffer.insert(buffer.end(), p, p + values.size() * sizeof(T));
+    }
+}
+
+#define CHECK_BUFFER(n) if (iter + (n) > end) \
+    REPORT_ERROR(ERR_MD, "MetaData::readBuffer: buffer is truncated");
+
+template <typename T>
+inline void extractFromBuffer(const char *&iter, const char *end, T &value)
+{
+    CHECK_BUFFER(sizeof(T));
+    memcpy(&value, iter, sizeof(T));
+    iter += sizeof(T);
+}
+
+template <typename T>
+inline void extractFromBuffer(const char *&iter, const char *end, std::vector<T> &values)
+{
+    size_t n;
+    extractFromBuffer(iter, end, n);
+    CHECK_BUFFER(n * sizeof(T));
+    values.resize(n);
+    if (n > 0)
+        memcpy(&values[0], iter, n * sizeof(T));
+    iter += n * sizeof(T);
+}
+
+void MetaData::writeBuffer(std::vector<char> &buffer) const
+{
+    std::vector<MDLabel> labels;
+    for (size_t i = 0; i < activeLabels.size(); i++)
+        if (activeLabels[i] != MDL_STAR_COMMENT)
+            labels.push_back(activeLabels[i]);
+
+    buffer.clear();
+    appendToBuffer(buffer, (int)_isColumnFormat);
+    appendToBuffer(buffer, labels.size());
+    for (size_t i = 0; i < labels.size(); i++)
+        appendToBuffer(buffer, (int)labels[i]);
+    appendToBuffer(buffer, size());
+
+    if (labels.empty())
+        return;
+
+    std::vector<MDObject> mdValues;
+    myMDSql->initializeSelect(true, labels);
+    FOR_ALL_OBJECTS_IN_METADATA(*this)
+    {
+        mdValues.clear();
+        bindValue(__iter.objId);
+        myMDSql->getObjectsValues(labels, &mdValues);
+        for (size_t i = 0; i < mdValues.size(); i++)
+        {
+            const ObjectData &data = mdValues[i].data;
+            switch (mdValues[i].type)
+            {
+            case LABEL_BOOL:
+                appendToBuffer(buffer, (char)data.boolValue);
+                break;
+            case LABEL_INT:
+                appendToBuffer(buffer, data.intValue);
+                break;
+            case LABEL_SIZET:
+                appendToBuffer(buffer, data.longintValue);
+                break;
+            case LABEL_DOUBLE:
+                appendToBuffer(buffer, data.doubleValue);
+                break;
+            case LABEL_STRING:
+                appendToBuffer(buffer, data.stringValue->size());
+                buffer.insert(buffer.end(), data.stringValue->begin(), data.stringValue->end());
+                break;
+            case LABEL_VECTOR_DOUBLE:
+                appendToBuffer(buffer, *data.vectorValue);
+                break;
+            case LABEL_VECTOR_SIZET:
+                appendToBuffer(buffer, *data.vectorValueLong);
+                break;
+            default:
+                REPORT_ERROR(ERR_MD_BADTYPE, formatString("MetaData::writeBuffer: cannot serialize label %s",
+                             MDL::label2Str(labels[i]).c_str()));
+            }
+        }
+    }
+    myMDSql->finalizePreparedStmt();
+}
+
+void MetaData::readBuffer(const char *buffer, size_t bufferSize)
+{
+    const char *iter = buffer, *end = buffer + bufferSize;
+    int isColumnFormat, label;
+    size_t nLabels, nRows;
+
+    clear();
+    extractFromBuffer(iter, end, isColumnFormat);
+    _isColumnFormat = isColumnFormat;
+    extractFromBuffer(iter, end, nLabels);
+    std::vector<MDLabel> labels(nLabels);
+    for (size_t i = 0; i < nLabels; i++)
+    {
+        extractFromBuffer(iter, end, label);
+        if (!MDL::isValidLabel((MDLabel)label))
+            REPORT_ERROR(ERR_MD_BADLABEL, "MetaData::readBuffer: invalid label in buffer");
+        labels[i] = (MDLabel)label;
+    }
+    extractFromBuffer(iter, end, nRows);
+    if (nRows == 0 || nLabels == 0)
+    {
+        for (size_t i = 0; i < nLabels; i++)
+            addLabel(labels[i]);
+        return;
+    }
+
+    MDRow row;
+    std::vector<MDObject> values;
+    for (size_t i = 0; i < nLabels; i++)
+        values.push_back(MDObject(labels[i]));
+
+    bool firstRow = true;
+    for (size_t n = 0; n < nRows; n++)
+    {
+        for (size_t i = 0; i < nLabels; i++)
+        {
+            ObjectData &data = values[i].data;
+            switch (values[i].type)
+            {
+            case LABEL_BOOL:
+                {
+                    char c;
+                    extractFromBuffer(iter, end, c);
+                    data.boolValue = c;
+                }
+                break;
+            case LABEL_INT:
+                extractFromBuffer(iter, end, data.intValue);
+                break;
+            case LABEL_SIZET:
+                extractFromBuffer(iter, end, data.longintValue);
+                break;
+            case LABEL_DOUBLE:
+                extractFromBuffer(iter, end, data.doubleValue);
+                break;
+            case LABEL_STRING:
+                {
+                    size_t length;
+                    extractFromBuffer(iter, end, length);
+                    CHECK_BUFFER(length);
+                    data.stringValue->assign(iter, length);
+                    iter += length;
+                }
+                break;
+            case LABEL_VECTOR_DOUBLE:
+                extractFromBuffer(iter, end, *data.vectorValue);
+                break;
+            case LABEL_VECTOR_SIZET:
+                extractFromBuffer(iter, end, *data.vectorValueLong);
+                break;
+            default:
+                REPORT_ERROR(ERR_MD_BADTYPE, "MetaData::readBuffer: unexpected label type");
+            }
+            row.setValue(values[i]);
+        }
+        if (firstRow)
+        {
+            if (!initAddRow(row))
+                REPORT_ERROR(ERR_MD_SQL, "MetaData::readBuffer: cannot prepare insertion");
+            firstRow = false;
+        }
+        if (!execAddRow(row))
+            REPORT_ERROR(ERR_MD_SQL, "MetaData::readBuffer: cannot insert row");
+    }
+    finalizeAddRow();
+}
+
 
 void MetaData::write(std::ostream &os,const String &blockName, WriteModeMetaData mode ) const
 {
@@ -1430,6 +1624,7 @@ void MetaData::read(const FileName &_filename,
                     const std::vector<MDLabel> *desiredLabels,
                     bool decomposeStack)
 {
+    XMIPP_PROFILE("metadata_read");
     String blockName;
     FileName inFile;
 
@@ -822,6 +822,19 @@ public:
     void write(std::ostream &os, const String & blockName="",WriteModeMetaData mode=MD_OVERWRITE) const;
     void print() const;
 
+    /** Write metadata to a binary memory buffer.
+     * The buffer contains the active labels followed by the values of
+     * each row in native binary format, so no precision is lost. It is
+     * meant to exchange metadatas between processes of the same run
+     * (see readBuffer), not as a file format.
+     */
+    void writeBuffer(std::vector<char> &buffer) const;
+
+    /** Read metadata from a buffer produced by writeBuffer.
+     * The previous content of the metadata is removed.
+     */
+    void readBuffer(const char *buffer, size_t bufferSize);
+
     /** Append data lines to file.
      * This function can be used to add new data to
      * an existing metadata. Now should be used with
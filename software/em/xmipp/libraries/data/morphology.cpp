@@ -458,12 +458,104 @@ void opening3D(const MultidimArray<double> &in, MultidimArray<double> &out, int
 }
 
 // Grey operations ---------------------------------------------------------
+/* Check if all the values of the structuring element are the same */
+static bool isFlatStructuringElement(const MultidimArray<double> &structuringElement)
+{
+    double value=DIRECT_MULTIDIM_ELEM(structuringElement,0);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(structuringElement)
+    if (DIRECT_MULTIDIM_ELEM(structuringElement,n)!=value)
+        return false;
+    return true;
+}
+
+template <bool maximum>
+inline double extremeValue(double a, double b)
+{
+    return maximum ? XMIPP_MAX(a,b) : XMIPP_MIN(a,b);
+}
+
+/* Running maximum (or minimum) of a line in the window [j+x0,j+xF].
+   The window is clipped at the ends of the line. van Herk/Gil-Werman
+   algorithm, it takes 3 comparisons per sample whatever the window size.
+   buffer must have at least 3*(N+xF-x0) elements. */
+template <bool maximum>
+void runningExtreme(double *line, int N, int x0, int xF, double *buffer)
+{
+    int w=xF-x0+1;
+    int L=N+w-1;
+    double *q=buffer, *g=buffer+L, *h=buffer+2*L;
+    double outside=maximum ? -1e308 : 1e308;
+    for (int t=0; t<L; t++)
+    {
+        int j=t+x0;
+        q[t]=(j>=0 && j<N) ? line[j] : outside;
+    }
+    for (int t=0; t<L; t++)
+        g[t]=(t%w==0) ? q[t] : extremeValue<maximum>(g[t-1],q[t]);
+    for (int t=L-1; t>=0; t--)
+        h[t]=(t%w==w-1 || t==L-1) ? q[t] : extremeValue<maximum>(h[t+1],q[t]);
+    for (int j=0; j<N; j++)
+        line[j]=extremeValue<maximum>(h[j],g[j+w-1]);
+}
+
+/* Maximum (or minimum) in a box, applied separably along X, Y and Z */
+template <bool maximum>
+void boxExtreme3D(const MultidimArray<double> &in,
+                  const MultidimArray<double> &structuringElement,
+                  MultidimArray<double> &out)
+{
+    out=in;
+    int Xdim=XSIZE(out), Ydim=YSIZE(out), Zdim=ZSIZE(out);
+    int maxDim=XMIPP_MAX(XMIPP_MAX(Xdim,Ydim),Zdim);
+    int maxW=XMIPP_MAX(XMIPP_MAX(XSIZE(structuringElement),YSIZE(structuringElement)),
+                       ZSIZE(structuringElement));
+    std::vector<double> line(maxDim), buffer(3*(maxDim+maxW));
+
+    if (XSIZE(structuringElement)>1)
+        for (int k=0; k<Zdim; k++)
+            for (int i=0; i<Ydim; i++)
+                runningExtreme<maximum>(&DIRECT_A3D_ELEM(out,k,i,0),Xdim,
+                                        STARTINGX(structuringElement),
+                                        FINISHINGX(structuringElement),&buffer[0]);
+    if (YSIZE(structuringElement)>1)
+        for (int k=0; k<Zdim; k++)
+            for (int j=0; j<Xdim; j++)
+            {
+                for (int i=0; i<Ydim; i++)
+                    line[i]=DIRECT_A3D_ELEM(out,k,i,j);
+                runningExtreme<maximum>(&line[0],Ydim,STARTINGY(structuringElement),
+                                        FINISHINGY(structuringElement),&buffer[0]);
+                for (int i=0; i<Ydim; i++)
+                    DIRECT_A3D_ELEM(out,k,i,j)=line[i];
+            }
+    if (ZSIZE(structuringElement)>1)
+        for (int i=0; i<Ydim; i++)
+            for (int j=0; j<Xdim; j++)
+            {
+                for (int k=0; k<Zdim; k++)
+                    line[k]=DIRECT_A3D_ELEM(out,k,i,j);
+                runningExtreme<maximum>(&line[0],Zdim,STARTINGZ(structuringElement),
+                                        FINISHINGZ(structuringElement),&buffer[0]);
+                for (int k=0; k<Zdim; k++)
+                    DIRECT_A3D_ELEM(out,k,i,j)=line[k];
+            }
+}
+
 void dilate3D(const MultidimArray<double> &in,
               const MultidimArray<double> &structuringElement,
               MultidimArray<double> &out)
 {
-    out.initZeros(in);
     double maxval=in.computeMax();
+    if (isFlatStructuringElement(structuringElement))
+    {
+        // max(in+c)=max(in)+c, so the box can be done separably
+        double c=A3D_ELEM(structuringElement,0,0,0);
+        boxExtreme3D<true>(in,structuringElement,out);
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(out)
+        DIRECT_MULTIDIM_ELEM(out,n)=XMIPP_MIN(DIRECT_MULTIDIM_ELEM(out,n)+c,maxval);
+        return;
+    }
+    out.initZeros(in);
     for (size_t kk=0; kk<ZSIZE(out); kk++)
         for (size_t ii=0; ii<YSIZE(out); ii++)
             for (size_t jj=0; jj<XSIZE(out); jj++)
@@ -493,8 +585,16 @@ void erode3D(const MultidimArray<double> &in,
               const MultidimArray<double> &structuringElement,
               MultidimArray<double> &out)
 {
-    out.initZeros(in);
     double minval=in.computeMin();
+    if (isFlatStructuringElement(structuringElement))
+    {
+        double c=A3D_ELEM(structuringElement,0,0,0);
+        boxExtreme3D<false>(in,structuringElement,out);
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(out)
+        DIRECT_MULTIDIM_ELEM(out,n)=XMIPP_MAX(DIRECT_MULTIDIM_ELEM(out,n)-c,minval);
+        return;
+    }
+    out.initZeros(in);
     for (size_t kk=0; kk<ZSIZE(out); kk++)
         for (size_t ii=0; ii<YSIZE(out); ii++)
             for (size_t jj=0; jj<XSIZE(out); jj++)
@@ -109,13 +109,17 @@ void opening3D(const MultidimArray<double> &in, MultidimArray<double> &out, int
                int count, int size);
 
 /** Gray dilation.
-    The structuring element must be centered at 0. */
+    The structuring element must be centered at 0. If all its values are
+    the same (a flat box), the dilation is computed separably with the
+    van Herk/Gil-Werman algorithm, whose cost does not depend on the size
+    of the box. */
 void dilate3D(const MultidimArray<double> &in,
               const MultidimArray<double> &structuringElement,
               MultidimArray<double> &out);
 
 /** Gray erosion.
-    The structuring element must be centered at 0. */
+    The structuring element must be centered at 0. Flat boxes are
+    computed as in the dilation. */
 void erode3D(const MultidimArray<double> &in,
               const MultidimArray<double> &structuringElement,
               MultidimArray<double> &out);
@@ -2988,6 +2988,60 @@ public:
         return (T) columns;
     }
 
+    /** Interpolates the value of the nth 3D matrix M at the point (x,y,z) knowing
+     * that this image is a set of cubic B-spline coefficients.
+     *
+     * (x,y,z) are in logical coordinates. The result is the same as the one of
+     * interpolatedElementBSpline3D(x,y,z,3), but the weights and the mirrored
+     * indexes of each axis are computed only once.
+     */
+    inline T interpolatedElementBSpline3D_Degree3(double x, double y, double z) const
+    {
+        // Logical to physical
+        z -= STARTINGZ(*this);
+        y -= STARTINGY(*this);
+        x -= STARTINGX(*this);
+
+        int l1 = (int)ceil(x - 2);
+        int m1 = (int)ceil(y - 2);
+        int n1 = (int)ceil(z - 2);
+
+        int Xdim=(int)XSIZE(*this);
+        int Ydim=(int)YSIZE(*this);
+        int Zdim=(int)ZSIZE(*this);
+
+        int equivalent_l[4], equivalent_m[4], equivalent_n[4];
+        double weight_l[4], weight_m[4], weight_n[4];
+        for (int idx = 0; idx < 4; idx++)
+        {
+            int l = l1 + idx;
+            equivalent_l[idx] = (l < 0) ? -l - 1 : ((l >= Xdim) ? 2 * Xdim - l - 1 : l);
+            BSPLINE03(weight_l[idx], x - (double) l);
+            int m = m1 + idx;
+            equivalent_m[idx] = (m < 0) ? -m - 1 : ((m >= Ydim) ? 2 * Ydim - m - 1 : m);
+            BSPLINE03(weight_m[idx], y - (double) m);
+            int n = n1 + idx;
+            equivalent_n[idx] = (n < 0) ? -n - 1 : ((n >= Zdim) ? 2 * Zdim - n - 1 : n);
+            BSPLINE03(weight_n[idx], z - (double) n);
+        }
+
+        double zyxsum = 0.0;
+        for (int nn = 0; nn < 4; nn++)
+        {
+            double yxsum = 0.0;
+            for (int mm = 0; mm < 4; mm++)
+            {
+                const T *ref = &DIRECT_A3D_ELEM(*this, equivalent_n[nn], equivalent_m[mm], 0);
+                double xsum = 0.0;
+                for (int ll = 0; ll < 4; ll++)
+                    xsum += (double) ref[equivalent_l[ll]] * weight_l[ll];
+                yxsum += xsum * weight_m[mm];
+            }
+            zyxsum += yxsum * weight_n[nn];
+        }
+        return (T) zyxsum;
+    }
+
 	/** Interpolates the value of the nth 1D vector M at the point (x) knowing
      * that this vector is a set of B-spline coefficients
      *
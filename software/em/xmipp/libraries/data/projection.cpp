@@ -1221,6 +1221,35 @@ void project_Crystal_Volume(
 }
 #undef DEBUG
 
+/* Footprint table ------------------------------------------------------- */
+void FootprintTable::init(const ImageOver &blobprint, const ImageOver &blobprint2)
+{
+    const MultidimArray<double> &mblobprint = blobprint();
+    const MultidimArray<double> &mblobprint2 = blobprint2();
+    Ustep = blobprint.Ustep();
+    Vstep = blobprint.Vstep();
+    if (Ustep <= 0 || Vstep <= 0)
+        REPORT_ERROR(ERR_VALUE_INCORRECT,
+                     "FootprintTable::init: the footprint must be oversampled in U and V");
+    U0 = STARTINGX(mblobprint);
+    V0 = STARTINGY(mblobprint);
+    int Xdim = XSIZE(mblobprint);
+    int Ydim = YSIZE(mblobprint);
+    Nu = (Xdim + Ustep - 1) / Ustep;
+    Nv = (Ydim + Vstep - 1) / Vstep;
+
+    size_t size = (size_t)Ustep * Vstep * Nv * Nu;
+    footprint.assign(size, 0.);
+    footprint2.assign(size, 0.);
+    for (int v = 0; v < Ydim; ++v)
+        for (int u = 0; u < Xdim; ++u)
+        {
+            size_t idx = offset(V0 + v, U0 + u);
+            footprint[idx] = DIRECT_A3D_ELEM(mblobprint, 0, v, u);
+            footprint2[idx] = DIRECT_A3D_ELEM(mblobprint2, 0, v, u);
+        }
+}
+
 /* Count equations in a grid volume --------------------------------------- */
 void count_eqs_in_projection(GridVolumeT<int> &GVNeq,
                              const Basis &basis, Projection &read_proj)
@@ -194,6 +194,45 @@ public:
                                    const Matrix1D<double> &sinplane);
 };
 
+/** Footprint table.
+   The blob footprint is an oversampled image: two consecutive pixels of a
+   projection use two samples of the footprint that are Ustep() apart. This
+   table reorders the footprint (and its square) so that, for each of the
+   subpixel positions of the blob center, the samples used by consecutive
+   pixels of a projection row are contiguous in memory. This way the
+   footprint of a basis can be splatted onto a projection row (or the
+   correction gathered from it) with a simple loop that the compiler
+   vectorizes.
+   */
+class FootprintTable
+{
+public:
+    /// Oversampling of the footprint in U and V
+    int Ustep, Vstep;
+    /// Number of samples of each subpixel position in U and V
+    int Nu, Nv;
+    /// First logical index of the footprint in U and V
+    int U0, V0;
+    /// Reordered footprint
+    std::vector<double> footprint;
+    /// Reordered square of the footprint
+    std::vector<double> footprint2;
+
+public:
+    /** Build the table from a 2D footprint and its square.
+        Ustep and Vstep must be greater than 0. */
+    void init(const ImageOver &blobprint, const ImageOver &blobprint2);
+
+    /** Offset of the footprint sample (foot_V, foot_U) in the table.
+        The sample (foot_V+m*Vstep, foot_U+n*Ustep) is at offset+m*Nu+n. */
+    inline size_t offset(int foot_V, int foot_U) const
+    {
+        int v = foot_V - V0;
+        int u = foot_U - U0;
+        return (((size_t)((v % Vstep) * Ustep + u % Ustep) * Nv + v / Vstep) * Nu) + u / Ustep;
+    }
+};
+
 /** Structure for threaded projections.
    This structure contains all the information needed by a thread
    working on the projecting/backprojecting of a projection. This is
@@ -356,12 +395,82 @@ void project_Crystal_Volume(GridVolume &vol, const Basis &basis,
          the footprint coordinates are computed outside the inner
          loop, but you have to use the sampling rate instead to
          move over the oversampled image.
+   Case: footprint table
+         for 2D blob footprints the footprint is reordered (see
+         FootprintTable) so that each row of the footprint of a basis
+         is contiguous and it is splatted onto the projection row with
+         a loop without branches that can be vectorized.
 */
 
 //#define DEBUG_LITTLE
 //#define DEBUG
 const int ART_PIXEL_SUBSAMPLING = 2;
 
+/* Footprint kernels ------------------------------------------------------- */
+// Kernels used by project_SimpleGrid with the FootprintTable. They work on
+// a run of n pixels of a projection row, a and a2 are the footprint and its
+// square for those pixels, and mask (if not NULL) is the corresponding
+// run of the mask. The operations are done in the same order as in the
+// pixel by pixel loop so that the results are exactly the same.
+
+// Forward projection of a basis with the given value
+inline void footprintSplatRun(double *proj, double *norm_proj,
+                              const double *a, const double *a2,
+                              double value, double norm_weight,
+                              const int *mask, int n)
+{
+    if (mask == NULL)
+        for (int m = 0; m < n; ++m)
+        {
+            proj[m] += value * a[m];
+            norm_proj[m] += a2[m] * norm_weight;
+        }
+    else
+        for (int m = 0; m < n; ++m)
+            if (mask[m] >= 0.5)
+            {
+                proj[m] += value * a[m];
+                norm_proj[m] += a2[m] * norm_weight;
+            }
+}
+
+// Backprojection: accumulate the correction of a basis in vol_corr, N_eq is
+// increased with the number of non null footprint samples
+inline void footprintGatherRun(const double *corr, const double *a,
+                               const int *mask, int n,
+                               double &vol_corr, int &N_eq)
+{
+    double sum = vol_corr;
+    int count = 0;
+    if (mask == NULL)
+        for (int m = 0; m < n; ++m)
+        {
+            sum += corr[m] * a[m];
+            count += (a[m] != 0);
+        }
+    else
+        for (int m = 0; m < n; ++m)
+            if (mask[m] >= 0.5)
+            {
+                sum += corr[m] * a[m];
+                count += (a[m] != 0);
+            }
+    vol_corr = sum;
+    N_eq += count;
+}
+
+// Number of pixels of the run that are not masked
+inline int footprintCountRun(const int *mask, int n)
+{
+    if (mask == NULL)
+        return n;
+    int count = 0;
+    for (int m = 0; m < n; ++m)
+        if (mask[m] >= 0.5)
+            count++;
+    return count;
+}
+
 /** Threaded projection for simple grids
 */
 template <class T>
@@ -605,6 +714,14 @@ void project_SimpleGrid(Image<T> *vol, const SimpleGrid *grid,
     // Check if in VSSNR
     bool VSSNR_mode = (ray_length == basis->maxLength());
 
+    // Footprint table for 2D blob footprints
+    FootprintTable footprintTable;
+    bool useFootprintTable = basis->type == Basis::blobs && !isVolPSF &&
+                             !VSSNR_mode && M == NULL &&
+                             Usampling > 0 && Vsampling > 0;
+    if (useFootprintTable)
+        footprintTable.init(basis->blobprint, basis->blobprint2);
+
 #ifdef DEBUG_LITTLE
 
     int condition;
@@ -741,221 +858,270 @@ void project_SimpleGrid(Image<T> *vol, const SimpleGrid *grid,
                         // Effectively project this basis
                         // N_eq=(YY_corner2-YY_corner1+1)*(XX_corner2-XX_corner1+1);
                         N_eq = 0;
-                        foot_V = foot_V1;
-                        for (int y = YY_corner1; y <= YY_corner2; y++)
+                        if (useFootprintTable)
                         {
-                            foot_U = foot_U1;
-                            for (int x = XX_corner1; x <= XX_corner2; x++)
+                            // Splat the footprint row by row
+                            int n = XX_corner2 - XX_corner1 + 1;
+                            size_t offset = footprintTable.offset(foot_V1, foot_U1);
+                            const double *a = &(footprintTable.footprint[offset]);
+                            const double *a2 = &(footprintTable.footprint2[offset]);
+                            bool splat = false;
+                            double value = 0, norm_weight = 0;
+                            if (FORW)
+                                switch (eq_mode)
+                                {
+                                case CAVARTK:
+                                case ARTK:
+                                    value = VOLVOXEL(*vol, k, i, j);
+                                    norm_weight = 1;
+                                    splat = true;
+                                    break;
+                                case CAVK:
+                                    value = VOLVOXEL(*vol, k, i, j);
+                                    norm_weight = N_eq;
+                                    splat = true;
+                                    break;
+                                case CAV:
+                                    value = VOLVOXEL(*vol, k, i, j);
+                                    norm_weight = VOLVOXEL(*VNeq, k, i, j);
+                                    splat = true;
+                                    break;
+                                }
+                            for (int y = YY_corner1; y <= YY_corner2; y++)
                             {
-                                if (!((mask != NULL) && A2D_ELEM(*mask,y,x)<0.5))
+                                const int *maskRow = (mask == NULL) ? NULL :
+                                                     &A2D_ELEM(*mask, y, XX_corner1);
+                                if (!FORW)
+                                    footprintGatherRun(&IMGPIXEL(*norm_proj, y, XX_corner1),
+                                                       a, maskRow, n, vol_corr, N_eq);
+                                else if (splat)
+                                    footprintSplatRun(&IMGPIXEL(*proj, y, XX_corner1),
+                                                      &IMGPIXEL(*norm_proj, y, XX_corner1),
+                                                      a, a2, value, norm_weight, maskRow, n);
+                                else if (eq_mode == COUNT_EQ)
+                                    VOLVOXEL(*vol, k, i, j) += footprintCountRun(maskRow, n);
+                                a += footprintTable.Nu;
+                                a2 += footprintTable.Nu;
+                            }
+                        }
+                        else
+                        {
+                            foot_V = foot_V1;
+                            for (int y = YY_corner1; y <= YY_corner2; y++)
+                            {
+                                foot_U = foot_U1;
+                                for (int x = XX_corner1; x <= XX_corner2; x++)
                                 {
-#ifdef DEBUG
-                                    if (condition)
+                                    if (!((mask != NULL) && A2D_ELEM(*mask,y,x)<0.5))
                                     {
-                                        std::cout << "Position in projection (" << x << ","
-                                        << y << ") ";
-                                        double y, x;
-                                        if (basis->type == Basis::blobs)
+#ifdef DEBUG
+                                        if (condition)
                                         {
-                                            std::cout << "in footprint ("
-                                            << foot_U << "," << foot_V << ")";
-                                            IMG2OVER(basis->blobprint, foot_V, foot_U, y, x);
-                                            std::cout << " (d= " << sqrt(y*y + x*x) << ") ";
-                                            fflush(stdout);
+                                            std::cout << "Position in projection (" << x << ","
+                                            << y << ") ";
+                                            double y, x;
+                                            if (basis->type == Basis::blobs)
+                                            {
+                                                std::cout << "in footprint ("
+                                                << foot_U << "," << foot_V << ")";
+                                                IMG2OVER(basis->blobprint, foot_V, foot_U, y, x);
+                                                std::cout << " (d= " << sqrt(y*y + x*x) << ") ";
+                                                fflush(stdout);
+                                            }
                                         }
-                                    }
 #endif
-                                    double a, a2;
-                                    // Check if volumetric interpolation (i.e., SSNR)
-                                    if (VSSNR_mode)
-                                    {
-                                        // This is the VSSNR case
-                                        // Get the pixel position in the universal coordinate
-                                        // system
-                                        SPEED_UP_temps012;
-                                        VECTOR_R3(prjPix, x, y, z);
-                                        M3x3_BY_V3x1(prjPix, proj->eulert, prjPix);
-                                        V3_MINUS_V3(prjPix, prjPix, univ_position);
-                                        a = basis->valueAt(prjPix);
-                                        a2 = a * a;
-                                    }
-                                    else
-                                    {
-                                        // This is normal reconstruction from projections
-                                        if (basis->type == Basis::blobs)
+                                        double a, a2;
+                                        // Check if volumetric interpolation (i.e., SSNR)
+                                        if (VSSNR_mode)
                                         {
-                                            // Projection of a blob
-                                            a = VOLVOXEL(basis->blobprint, foot_W, foot_V, foot_U);
-                                            a2 = VOLVOXEL(basis->blobprint2, foot_W, foot_V, foot_U);
-
+                                            // This is the VSSNR case
+                                            // Get the pixel position in the universal coordinate
+                                            // system
+                                            SPEED_UP_temps012;
+                                            VECTOR_R3(prjPix, x, y, z);
+                                            M3x3_BY_V3x1(prjPix, proj->eulert, prjPix);
+                                            V3_MINUS_V3(prjPix, prjPix, univ_position);
+                                            a = basis->valueAt(prjPix);
+                                            a2 = a * a;
                                         }
                                         else
                                         {
-                                            // Projection of other bases
-                                            // If the basis is big enough, then
-                                            // it is not necessary to integrate at several
-                                            // places. Big enough is being greater than
-                                            // 1.41 which is the maximum separation
-                                            // between two pixels
-                                            if (XX_footprint_size > 1.41)
+                                            // This is normal reconstruction from projections
+                                            if (basis->type == Basis::blobs)
+                                            {
+                                                // Projection of a blob
+                                                a = VOLVOXEL(basis->blobprint, foot_W, foot_V, foot_U);
+                                                a2 = VOLVOXEL(basis->blobprint2, foot_W, foot_V, foot_U);
+
+                                            }
+                                            else
                                             {
-                                                // Get the pixel in universal coordinates
-                                                SPEED_UP_temps012;
-                                                VECTOR_R3(prjPix, x, y, 0);
-                                                // Express the point in a local coordinate system
-                                                M3x3_BY_V3x1(prjPix, proj->eulert, prjPix);
+                                                // Projection of other bases
+                                                // If the basis is big enough, then
+                                                // it is not necessary to integrate at several
+                                                // places. Big enough is being greater than
+                                                // 1.41 which is the maximum separation
+                                                // between two pixels
+                                                if (XX_footprint_size > 1.41)
+                                                {
+                                                    // Get the pixel in universal coordinates
+                                                    SPEED_UP_temps012;
+                                                    VECTOR_R3(prjPix, x, y, 0);
+                                                    // Express the point in a local coordinate system
+                                                    M3x3_BY_V3x1(prjPix, proj->eulert, prjPix);
 #ifdef DEBUG
 
-                                                if (condition)
-                                                    std::cout << " in volume coord ("
-                                                    << prjPix.transpose() << ")";
+                                                    if (condition)
+                                                        std::cout << " in volume coord ("
+                                                        << prjPix.transpose() << ")";
 #endif
 
-                                                V3_MINUS_V3(prjPix, prjPix, univ_position);
+                                                    V3_MINUS_V3(prjPix, prjPix, univ_position);
 #ifdef DEBUG
 
-                                                if (condition)
-                                                    std::cout << " in voxel coord ("
-                                                    << prjPix.transpose() << ")";
+                                                    if (condition)
+                                                        std::cout << " in voxel coord ("
+                                                        << prjPix.transpose() << ")";
 #endif
 
-                                                a = basis->projectionAt(prjDir, prjPix);
-                                                a2 = a * a;
-                                            }
-                                            else
-                                            {
-                                                // If the basis is too small (of the
-                                                // range of the voxel), then it is
-                                                // necessary to sample in a few places
-                                                const double p0 = 1.0 / (2 * ART_PIXEL_SUBSAMPLING) - 0.5;
-                                                const double pStep = 1.0 / ART_PIXEL_SUBSAMPLING;
-                                                const double pAvg = 1.0 / (ART_PIXEL_SUBSAMPLING * ART_PIXEL_SUBSAMPLING);
-                                                int ii, jj;
-                                                double px, py;
-                                                a = 0;
+                                                    a = basis->projectionAt(prjDir, prjPix);
+                                                    a2 = a * a;
+                                                }
+                                                else
+                                                {
+                                                    // If the basis is too small (of the
+                                                    // range of the voxel), then it is
+                                                    // necessary to sample in a few places
+                                                    const double p0 = 1.0 / (2 * ART_PIXEL_SUBSAMPLING) - 0.5;
+                                                    const double pStep = 1.0 / ART_PIXEL_SUBSAMPLING;
+                                                    const double pAvg = 1.0 / (ART_PIXEL_SUBSAMPLING * ART_PIXEL_SUBSAMPLING);
+                                                    int ii, jj;
+                                                    double px, py;
+                                                    a = 0;
 #ifdef DEBUG
 
-                                                if (condition)
-                                                    std::cout << std::endl;
+                                                    if (condition)
+                                                        std::cout << std::endl;
 #endif
 
-                                                for (ii = 0, px = p0; ii < ART_PIXEL_SUBSAMPLING; ii++, px += pStep)
-                                                    for (jj = 0, py = p0; jj < ART_PIXEL_SUBSAMPLING; jj++, py += pStep)
-                                                    {
+                                                    for (ii = 0, px = p0; ii < ART_PIXEL_SUBSAMPLING; ii++, px += pStep)
+                                                        for (jj = 0, py = p0; jj < ART_PIXEL_SUBSAMPLING; jj++, py += pStep)
+                                                        {
 #ifdef DEBUG
-                                                        if (condition)
-                                                            std::cout << "    subsampling (" << ii << ","
-                                                            << jj << ") ";
+                                                            if (condition)
+                                                                std::cout << "    subsampling (" << ii << ","
+                                                                << jj << ") ";
 #endif
 
-                                                        SPEED_UP_temps012;
-                                                        // Get the pixel in universal coordinates
-                                                        VECTOR_R3(prjPix, x + px, y + py, 0);
-                                                        // Express the point in a local coordinate system
-                                                        M3x3_BY_V3x1(prjPix, proj->eulert, prjPix);
+                                                            SPEED_UP_temps012;
+                                                            // Get the pixel in universal coordinates
+                                                            VECTOR_R3(prjPix, x + px, y + py, 0);
+                                                            // Express the point in a local coordinate system
+                                                            M3x3_BY_V3x1(prjPix, proj->eulert, prjPix);
 #ifdef DEBUG
 
-                                                        if (condition)
-                                                            std::cout << " in volume coord ("
-                                                            << prjPix.transpose() << ")";
+                                                            if (condition)
+                                                                std::cout << " in volume coord ("
+                                                                << prjPix.transpose() << ")";
 #endif
 
-                                                        V3_MINUS_V3(prjPix, prjPix, univ_position);
+                                                            V3_MINUS_V3(prjPix, prjPix, univ_position);
 #ifdef DEBUG
 
-                                                        if (condition)
-                                                            std::cout << " in voxel coord ("
-                                                            << prjPix.transpose() << ")";
+                                                            if (condition)
+                                                                std::cout << " in voxel coord ("
+                                                                << prjPix.transpose() << ")";
 #endif
 
-                                                        a += basis->projectionAt(prjDir, prjPix);
+                                                            a += basis->projectionAt(prjDir, prjPix);
 #ifdef DEBUG
 
-                                                        if (condition)
-                                                            std::cout << " partial a="
-                                                            << basis->projectionAt(prjDir, prjPix)
-                                                            << std::endl;
+                                                            if (condition)
+                                                                std::cout << " partial a="
+                                                                << basis->projectionAt(prjDir, prjPix)
+                                                                << std::endl;
 #endif
 
-                                                    }
-                                                a *= pAvg;
-                                                a2 = a * a;
+                                                        }
+                                                    a *= pAvg;
+                                                    a2 = a * a;
 #ifdef DEBUG
 
-                                                if (condition)
-                                                    std::cout << "   Finally ";
+                                                    if (condition)
+                                                        std::cout << "   Finally ";
 #endif
 
+                                                }
                                             }
                                         }
-                                    }
 #ifdef DEBUG
-                                    if (condition)
-                                        std::cout << "=" << a << " , " << a2;
+                                        if (condition)
+                                            std::cout << "=" << a << " , " << a2;
 #endif
 
-                                    if (FORW)
-                                    {
-                                        switch (eq_mode)
+                                        if (FORW)
                                         {
-                                        case CAVARTK:
-                                        case ARTK:
-                                            IMGPIXEL(*proj, y, x) += VOLVOXEL(*vol, k, i, j) * a;
-                                            IMGPIXEL(*norm_proj, y, x) += a2;
-                                            if (M != NULL)
+                                            switch (eq_mode)
                                             {
-                                                int py, px;
-                                                (*proj)().toPhysical(y, x, py, px);
-                                                int number_of_pixel = py * XSIZE((*proj)()) + px;
-                                                dMij(*M, number_of_pixel, number_of_basis) = a;
+                                            case CAVARTK:
+                                            case ARTK:
+                                                IMGPIXEL(*proj, y, x) += VOLVOXEL(*vol, k, i, j) * a;
+                                                IMGPIXEL(*norm_proj, y, x) += a2;
+                                                if (M != NULL)
+                                                {
+                                                    int py, px;
+                                                    (*proj)().toPhysical(y, x, py, px);
+                                                    int number_of_pixel = py * XSIZE((*proj)()) + px;
+                                                    dMij(*M, number_of_pixel, number_of_basis) = a;
+                                                }
+                                                break;
+                                            case CAVK:
+                                                IMGPIXEL(*proj, y, x) += VOLVOXEL(*vol, k, i, j) * a;
+                                                IMGPIXEL(*norm_proj, y, x) += a2 * N_eq;
+                                                break;
+                                            case COUNT_EQ:
+                                                VOLVOXEL(*vol, k, i, j)++;
+                                                break;
+                                            case CAV:
+                                                IMGPIXEL(*proj, y, x) += VOLVOXEL(*vol, k, i, j) * a;
+                                                IMGPIXEL(*norm_proj, y, x) += a2 *
+                                                                              VOLVOXEL(*VNeq, k, i, j);
+                                                break;
                                             }
-                                            break;
-                                        case CAVK:
-                                            IMGPIXEL(*proj, y, x) += VOLVOXEL(*vol, k, i, j) * a;
-                                            IMGPIXEL(*norm_proj, y, x) += a2 * N_eq;
-                                            break;
-                                        case COUNT_EQ:
-                                            VOLVOXEL(*vol, k, i, j)++;
-                                            break;
-                                        case CAV:
-                                            IMGPIXEL(*proj, y, x) += VOLVOXEL(*vol, k, i, j) * a;
-                                            IMGPIXEL(*norm_proj, y, x) += a2 *
-                                                                          VOLVOXEL(*VNeq, k, i, j);
-                                            break;
-                                        }
 
 #ifdef DEBUG
-                                        if (condition)
-                                        {
-                                            std::cout << " proj= " << IMGPIXEL(*proj, y, x)
-                                            << " norm_proj=" << IMGPIXEL(*norm_proj, y, x) << std::endl;
-                                            std::cout.flush();
-                                        }
+                                            if (condition)
+                                            {
+                                                std::cout << " proj= " << IMGPIXEL(*proj, y, x)
+                                                << " norm_proj=" << IMGPIXEL(*norm_proj, y, x) << std::endl;
+                                                std::cout.flush();
+                                            }
 #endif
 
-                                    }
-                                    else
-                                    {
-                                        vol_corr += IMGPIXEL(*norm_proj, y, x) * a;
-                                        if (a != 0)
-                                            N_eq++;
+                                        }
+                                        else
+                                        {
+                                            vol_corr += IMGPIXEL(*norm_proj, y, x) * a;
+                                            if (a != 0)
+                                                N_eq++;
 #ifdef DEBUG
 
-                                        if (condition)
-                                        {
-                                            std::cout << " corr_img= " << IMGPIXEL(*norm_proj, y, x)
-                                            << " correction=" << vol_corr << std::endl;
-                                            std::cout.flush();
-                                        }
+                                            if (condition)
+                                            {
+                                                std::cout << " corr_img= " << IMGPIXEL(*norm_proj, y, x)
+                                                << " correction=" << vol_corr << std::endl;
+                                                std::cout.flush();
+                                            }
 #endif
 
+                                        }
                                     }
+                                    // Prepare for next operation
+                                    foot_U += Usampling;
                                 }
-                                // Prepare for next operation
-                                foot_U += Usampling;
-                            }
-                            foot_V += Vsampling;
-                        } // Project this basis
+                                foot_V += Vsampling;
+                            } // Project this basis
+                        }
 
                         if (!FORW)
                         {
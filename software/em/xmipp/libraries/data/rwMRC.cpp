@@ -566,12 +566,15 @@ int ImageBase::writeMRC(size_t select_img, bool isStack, int mode, const String
     else // To set in the header that the file is a volume not a stack
         header->ispg = 1;
 
-    //locking
+    // Lock only when the header changes, writers replacing different
+    // images of an existing stack do not overlap
+    bool writeHeader = !isStack || replaceNsize < nDimHeader;
     FileLock flock;
-    flock.lock(fimg);
+    if (writeHeader)
+        flock.lock(fimg);
 
     // Write header when needed
-    if(!isStack || replaceNsize < nDimHeader)
+    if(writeHeader)
     {
         if ( swapWrite )
             swapPage((char *) header, MRCSIZE - 800, DT_Float);
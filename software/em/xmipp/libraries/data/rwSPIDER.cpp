@@ -484,15 +484,21 @@ int  ImageBase::writeSPIDER(size_t select_img, bool isStack, int mode)
         writeMainHeaderReplace=true;
     }
 
-    //locking the file
+    bool writeMainHeader = mode == WRITE_OVERWRITE ||
+                           mode == WRITE_APPEND ||
+                           writeMainHeaderReplace ||
+                           newNsize > replaceNsize; //header must change
+
+    // Lock the file only if the main header changes. Replacing images in
+    // an existing stack (e.g. several MPI nodes writing to the same output
+    // stack) only touches the bytes of those images, so there is no need
+    // to serialize the writers
     FileLock flock;
-    flock.lock(fimg);
+    if (writeMainHeader)
+        flock.lock(fimg);
 
     // Write main header
-    if( mode == WRITE_OVERWRITE ||
-        mode == WRITE_APPEND ||
-        writeMainHeaderReplace ||
-        newNsize > replaceNsize) //header must change
+    if (writeMainHeader)
     {
         if ( swapWrite )
             swapPage((char *) header, SPIDERSIZE - 180, DT_Float);
@@ -22,6 +22,9 @@
  *  All comments concerning this program package may be sent to the
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include "sampling.h"
 #include "matrix2d.h"
 
@@ -1484,10 +1487,252 @@ void Sampling::createAsymUnitFile(const FileName &docfilename)
     DF.write(tmp_filename);
 }
 
+/* Binary sampling cache ---------------------------------------------------
+   The cache is a header followed by blocks of 8 byte items, so that it can be
+   memory mapped and copied straight into the Sampling vectors:
+     index of the non redundant points (size_t)
+     non redundant angles and vectors (3 doubles each)
+     whole sphere angles and vectors (3 doubles each, optional)
+     neighbor list offsets (nNeighborLists+1 size_t) and neighbors (size_t)
+     experimental directions multiplied by L and R (3 doubles each)
+     experimental image names ('\0' terminated strings)
+*/
+#define SAMPLING_CACHE_MAGIC "XMPSMPLC"
+#define SAMPLING_CACHE_VERSION 1
+#define SAMPLING_CACHE_SYMLEN 32
+
+struct SamplingCacheHeader
+{
+    char     magic[8];
+    size_t   version;
+    double   samplingRateRad;
+    double   cosNeighborhoodRadius;
+    char     symmetry[SAMPLING_CACHE_SYMLEN];
+    size_t   numberSamplesAsymmetricUnit;
+    size_t   nPoints;
+    size_t   nSphere;
+    size_t   nNeighborLists;
+    size_t   nNeighbors;
+    size_t   nExpLR;
+    size_t   fileNamesBytes;
+};
+
+static void writeCacheVectors(FILE *fh, const std::vector <Matrix1D<double> > &v)
+{
+    double aux[3];
+    for (size_t i = 0; i < v.size(); ++i)
+    {
+        aux[0] = XX(v[i]);
+        aux[1] = YY(v[i]);
+        aux[2] = ZZ(v[i]);
+        fwrite(aux, sizeof(double), 3, fh);
+    }
+}
+
+static const char * readCacheVectors(const char *ptr, size_t n,
+                                     std::vector <Matrix1D<double> > &v)
+{
+    const double *aux = (const double *) ptr;
+    v.resize(n);
+    for (size_t i = 0; i < n; ++i, aux += 3)
+    {
+        Matrix1D<double> &vi = v[i];
+        vi.resizeNoCopy(3);
+        XX(vi) = aux[0];
+        YY(vi) = aux[1];
+        ZZ(vi) = aux[2];
+    }
+    return (const char *) aux;
+}
+
+void Sampling::saveSamplingCache(const FileName &fn_cache, const String &symmetry,
+                                 bool write_sampling_sphere) const
+{
+    SamplingCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SAMPLING_CACHE_MAGIC, 8);
+    header.version = SAMPLING_CACHE_VERSION;
+    header.samplingRateRad = sampling_rate_rad;
+    header.cosNeighborhoodRadius = cos_neighborhood_radius;
+    strncpy(header.symmetry, symmetry.c_str(), SAMPLING_CACHE_SYMLEN - 1);
+    header.numberSamplesAsymmetricUnit = numberSamplesAsymmetricUnit;
+    header.nPoints = no_redundant_sampling_points_index.size();
+    if (no_redundant_sampling_points_angles.size() != header.nPoints ||
+        no_redundant_sampling_points_vector.size() != header.nPoints)
+        REPORT_ERROR(ERR_VALUE_INCORRECT, "Sampling::saveSamplingCache: non redundant "
+                     "angles, vectors and indexes do not have the same size");
+    if (write_sampling_sphere)
+    {
+        header.nSphere = sampling_points_angles.size();
+        if (sampling_points_vector.size() != header.nSphere)
+            REPORT_ERROR(ERR_VALUE_INCORRECT, "Sampling::saveSamplingCache: sphere "
+                         "angles and vectors do not have the same size");
+    }
+    header.nNeighborLists = my_neighbors.size();
+    for (size_t i = 0; i < my_neighbors.size(); ++i)
+        header.nNeighbors += my_neighbors[i].size();
+    header.nExpLR = exp_data_projection_direction_by_L_R.size();
+    for (size_t i = 0; i < exp_data_fileNames.size(); ++i)
+        header.fileNamesBytes += exp_data_fileNames[i].size() + 1;
+
+    // Write in a temporary file and rename it, so that concurrent readers
+    // never map a partially written cache
+    FileName fn_tmp = formatString("%s.%d.tmp", fn_cache.c_str(), (int)getpid());
+    FILE *fh = fopen(fn_tmp.c_str(), "wb");
+    if (fh == NULL)
+        REPORT_ERROR(ERR_IO_NOWRITE, "Sampling::saveSamplingCache: cannot open " + fn_tmp);
+    fwrite(&header, sizeof(header), 1, fh);
+    if (header.nPoints > 0)
+        fwrite(&no_redundant_sampling_points_index[0], sizeof(size_t), header.nPoints, fh);
+    writeCacheVectors(fh, no_redundant_sampling_points_angles);
+    writeCacheVectors(fh, no_redundant_sampling_points_vector);
+    if (header.nSphere > 0)
+    {
+        writeCacheVectors(fh, sampling_points_angles);
+        writeCacheVectors(fh, sampling_points_vector);
+    }
+    size_t offset = 0;
+    fwrite(&offset, sizeof(size_t), 1, fh);
+    for (size_t i = 0; i < header.nNeighborLists; ++i)
+    {
+        offset += my_neighbors[i].size();
+        fwrite(&offset, sizeof(size_t), 1, fh);
+    }
+    for (size_t i = 0; i < header.nNeighborLists; ++i)
+        if (!my_neighbors[i].empty())
+            fwrite(&my_neighbors[i][0], sizeof(size_t), my_neighbors[i].size(), fh);
+    writeCacheVectors(fh, exp_data_projection_direction_by_L_R);
+    for (size_t i = 0; i < exp_data_fileNames.size(); ++i)
+        fwrite(exp_data_fileNames[i].c_str(), 1, exp_data_fileNames[i].size() + 1, fh);
+    if (ferror(fh))
+    {
+        fclose(fh);
+        unlink(fn_tmp.c_str());
+        REPORT_ERROR(ERR_IO_NOWRITE, "Sampling::saveSamplingCache: cannot write " + fn_tmp);
+    }
+    fclose(fh);
+    if (rename(fn_tmp.c_str(), fn_cache.c_str()) != 0)
+        REPORT_ERROR(ERR_IO_NOWRITE, "Sampling::saveSamplingCache: cannot rename " +
+                     fn_tmp + " to " + fn_cache);
+}
+
+/* Size in bytes of the cache described by the header */
+static size_t samplingCacheSize(const SamplingCacheHeader &header)
+{
+    return sizeof(SamplingCacheHeader) +
+           header.nPoints * (sizeof(size_t) + 6 * sizeof(double)) +
+           header.nSphere * 6 * sizeof(double) +
+           (header.nNeighborLists + 1 + header.nNeighbors) * sizeof(size_t) +
+           header.nExpLR * 3 * sizeof(double) +
+           header.fileNamesBytes;
+}
+
+/* Read and check the header of a sampling cache */
+static bool readSamplingCacheHeader(const FileName &fn_cache, SamplingCacheHeader &header)
+{
+    if (!fn_cache.exists())
+        return false;
+    FILE *fh = fopen(fn_cache.c_str(), "rb");
+    if (fh == NULL)
+        return false;
+    bool ok = fread(&header, sizeof(header), 1, fh) == 1;
+    fclose(fh);
+    header.symmetry[SAMPLING_CACHE_SYMLEN - 1] = '\0';
+    return ok &&
+           memcmp(header.magic, SAMPLING_CACHE_MAGIC, 8) == 0 &&
+           header.version == SAMPLING_CACHE_VERSION &&
+           samplingCacheSize(header) == fn_cache.getFileSize();
+}
+
+bool Sampling::isValidSamplingCache(const FileName &fn_cache, const String &symmetry) const
+{
+    SamplingCacheHeader header;
+    return readSamplingCacheHeader(fn_cache, header) &&
+           XMIPP_EQUAL_REAL(header.samplingRateRad, sampling_rate_rad) &&
+           XMIPP_EQUAL_REAL(header.cosNeighborhoodRadius, cos_neighborhood_radius) &&
+           symmetry == header.symmetry;
+}
+
+void Sampling::readSamplingCache(const FileName &fn_cache, bool read_vectors,
+                                 bool read_sampling_sphere)
+{
+    size_t size = fn_cache.getFileSize();
+    if (size < sizeof(SamplingCacheHeader))
+        REPORT_ERROR(ERR_IO_SIZE, "Sampling::readSamplingCache: file too small " + fn_cache);
+    int fd = open(fn_cache.c_str(), O_RDONLY);
+    if (fd == -1)
+        REPORT_ERROR(ERR_IO_NOTOPEN, "Sampling::readSamplingCache: cannot open " + fn_cache);
+    char *map = (char *) mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        REPORT_ERROR(ERR_MEM_BADREQUEST, "Sampling::readSamplingCache: cannot map " + fn_cache);
+
+    const SamplingCacheHeader &header = *((const SamplingCacheHeader *) map);
+    if (memcmp(header.magic, SAMPLING_CACHE_MAGIC, 8) != 0 ||
+        header.version != SAMPLING_CACHE_VERSION ||
+        samplingCacheSize(header) != size)
+    {
+        munmap(map, size);
+        REPORT_ERROR(ERR_IO, "Sampling::readSamplingCache: " + fn_cache +
+                     " is not a valid sampling cache of version " +
+                     integerToString(SAMPLING_CACHE_VERSION));
+    }
+    if (read_sampling_sphere && header.nSphere == 0)
+    {
+        munmap(map, size);
+        REPORT_ERROR(ERR_IO, "Sampling::readSamplingCache: " + fn_cache +
+                     " was saved without the sampling sphere");
+    }
+
+    sampling_rate_rad = header.samplingRateRad;
+    cos_neighborhood_radius = header.cosNeighborhoodRadius;
+    numberSamplesAsymmetricUnit = header.numberSamplesAsymmetricUnit;
+
+    const char *ptr = map + sizeof(SamplingCacheHeader);
+    const size_t *index = (const size_t *) ptr;
+    no_redundant_sampling_points_index.assign(index, index + header.nPoints);
+    ptr += header.nPoints * sizeof(size_t);
+    ptr = readCacheVectors(ptr, header.nPoints, no_redundant_sampling_points_angles);
+    if (read_vectors)
+        ptr = readCacheVectors(ptr, header.nPoints, no_redundant_sampling_points_vector);
+    else
+        ptr += header.nPoints * 3 * sizeof(double);
+    if (read_sampling_sphere)
+    {
+        ptr = readCacheVectors(ptr, header.nSphere, sampling_points_angles);
+        if (read_vectors)
+            ptr = readCacheVectors(ptr, header.nSphere, sampling_points_vector);
+        else
+            ptr += header.nSphere * 3 * sizeof(double);
+    }
+    else
+        ptr += header.nSphere * 6 * sizeof(double);
+
+    const size_t *offsets = (const size_t *) ptr;
+    const size_t *neighbors = offsets + header.nNeighborLists + 1;
+    my_neighbors.resize(header.nNeighborLists);
+    for (size_t i = 0; i < header.nNeighborLists; ++i)
+        my_neighbors[i].assign(neighbors + offsets[i], neighbors + offsets[i + 1]);
+    ptr = (const char *) (neighbors + header.nNeighbors);
+    ptr = readCacheVectors(ptr, header.nExpLR, exp_data_projection_direction_by_L_R);
+
+    exp_data_fileNames.clear();
+    const char *end = ptr + header.fileNamesBytes;
+    while (ptr < end)
+    {
+        exp_data_fileNames.push_back(ptr);
+        ptr += exp_data_fileNames.back().size() + 1;
+    }
+
+    if (munmap(map, size) == -1)
+        REPORT_ERROR(ERR_MEM_NOTDEALLOC, "Sampling::readSamplingCache: cannot unmap " + fn_cache);
+}
+
 #define FN_SAMPLING_NEI(base) formatString("neighbors@%s_sampling.xmd", base.c_str())
 #define FN_SAMPLING_PROJ(base) formatString("projectionDirections@%s_sampling.xmd", base.c_str())
 #define FN_SAMPLING_EXTRA(base) formatString("extra@%s_sampling.xmd", base.c_str())
 #define FN_SAMPLING_SPHERE(base) formatString("projectionDirectionsSphere@%s_sampling.xmd", base.c_str())
+#define FN_SAMPLING_CACHE(base) formatString("%s_sampling.cache", base.c_str())
 
 void Sampling::saveSamplingFile(const FileName &fn_base, bool write_vectors, bool write_sampling_sphere)
 {
@@ -1575,6 +1820,12 @@ void Sampling::saveSamplingFile(const FileName &fn_base, bool write_vectors, boo
 
     }
 
+    //Binary copy of the same information, so that readers do not parse the metadata
+    if (no_redundant_sampling_points_vector.size() == no_redundant_sampling_points_index.size() &&
+        (!write_sampling_sphere || sampling_points_vector.size() == sampling_points_angles.size()))
+        saveSamplingCache(FN_SAMPLING_CACHE(fn_base), "", write_sampling_sphere);
+    else
+        unlink(FN_SAMPLING_CACHE(fn_base).c_str());
 }
 
 //angle conventions changed by test not
@@ -1585,6 +1836,23 @@ void Sampling::readSamplingFile(const FileName &fn_base,
 		bool read_vectors,
 		bool read_sampling_sphere)
 {
+    //Use the binary cache if it was written together with the metadata
+    FileName fn_cache = FN_SAMPLING_CACHE(fn_base);
+    SamplingCacheHeader header;
+    if (readSamplingCacheHeader(fn_cache, header) &&
+        (header.nSphere > 0 || !read_sampling_sphere))
+    {
+        struct stat cache_status, md_status;
+        FileName fn_md = FN_SAMPLING_EXTRA(fn_base);
+        if (stat(fn_cache.c_str(), &cache_status) == 0 &&
+            stat(fn_md.removeBlockName().c_str(), &md_status) == 0 &&
+            cache_status.st_mtime >= md_status.st_mtime)
+        {
+            readSamplingCache(fn_cache, read_vectors, read_sampling_sphere);
+            return;
+        }
+    }
+
     //Read extra info
     MetaData md(FN_SAMPLING_EXTRA(fn_base));
     size_t id = md.firstObject();
@@ -215,6 +215,27 @@ public:
     */
     void readSamplingFile(const FileName &infilename,bool read_vectors=true, bool read_sampling_sphere = false);
 
+    /** Save the sampling in a binary, versioned cache file.
+     * The cache stores the non redundant sampling points, the whole sphere
+     * (if write_sampling_sphere), the neighbors and the experimental
+     * directions multiplied by L and R. The sampling rate, the neighborhood
+     * and the symmetry are stored as the key of the cache.
+     * saveSamplingFile writes a cache next to the metadata file and
+     * readSamplingFile uses it when it is up to date.
+    */
+    void saveSamplingCache(const FileName &fn_cache, const String &symmetry = "",
+                           bool write_sampling_sphere = false) const;
+
+    /** Read a sampling cache. The file is memory mapped.
+    */
+    void readSamplingCache(const FileName &fn_cache, bool read_vectors = true,
+                           bool read_sampling_sphere = false);
+
+    /** True if fn_cache is a sampling cache computed with the current
+     * sampling rate and neighborhood and the given symmetry.
+    */
+    bool isValidSamplingCache(const FileName &fn_cache, const String &symmetry) const;
+
     /** remove all those points that are further away from experimental data
         than neighborhood_radius_rad */
     void removePointsFarAwayFromExperimentalData();
@@ -37,6 +37,7 @@ void ProgTransformGeometry::defineParams()
     save_metadata_stack = true;
     keep_input_columns = true;
     allow_apply_geo = true;
+    allow_threads = true;
     mdVol = false;
     XmippMetadataProgram::defineParams();
     //usage
@@ -101,6 +102,8 @@ void ProgTransformGeometry::readParams()
     else if (degree == "linear")
         splineDegree = LINEAR;
     flip = checkParam("--flip");
+    matrixStr = checkParam("--matrix") ? getParam("--matrix") : "";
+    writeMatrix = checkParam("--write_matrix");
 
     /** In most cases output "-o" is a metadata with the new geometry keeping the names of input images
      *  so we set the flags to keep the same image names in the output metadata
@@ -195,11 +198,14 @@ void ProgTransformGeometry::preProcess()
 void ProgTransformGeometry::processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut)
 {
 
-    if (checkParam("--matrix"))
+    // Local copies, several images may be processed at the same time
+    Matrix2D<double> B, T;
+    ImageGeneric img, imgOut;
+
+    if (!matrixStr.empty())
     {
       // In this case we are directly reading the transformation matrix
       // from the arguments passed
-      matrixStr = getParam("--matrix");
       string2TransformationMatrix(matrixStr, T);
     }
     else
@@ -213,7 +219,7 @@ void ProgTransformGeometry::processImage(const FileName &fnImg, const FileName &
       T = A * B;
     }
 
-    if (checkParam("--write_matrix"))
+    if (writeMatrix)
         std::cerr << T << std::endl;
 
     if (applyTransform || fnImg != fnImgOut)
@@ -44,9 +44,8 @@ public:
 
 protected:
     int             splineDegree, dim;
-    bool            applyTransform, inverse, wrap, isVol, flip, mdVol;
-    Matrix2D<double> R, A, B, T;
-    ImageGeneric img, imgOut;
+    bool            applyTransform, inverse, wrap, isVol, flip, mdVol, writeMatrix;
+    Matrix2D<double> R, A;
     String matrixStr; // To read directly the matrix
 
     void defineParams();
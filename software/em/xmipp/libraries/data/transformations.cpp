@@ -481,6 +481,18 @@ bool	getLoopRange( double value, double min, double max, double delta, int loopL
 	return(validRange);
 }
 
+static ThreadPool geometryThreadPool;
+
+void setGeometryThreads(int numberOfThreads)
+{
+    geometryThreadPool.setNumberOfThreads(XMIPP_MAX(numberOfThreads, 1));
+}
+
+ThreadPool & getGeometryThreadPool()
+{
+    return geometryThreadPool;
+}
+
 // Special case for complex numbers
 template<>
 void applyGeometry(int SplineDegree,
@@ -37,6 +37,7 @@
 #include "multidim_array_generic.h"
 #include "geometry.h"
 #include "metadata.h"
+#include "xmipp_threads.h"
 #define IS_INV true
 #define IS_NOT_INV false
 #define DONT_WRAP false
@@ -58,6 +59,16 @@ void geo2TransformationMatrix(const MDRow &imageHeader, Matrix2D<double> &A,
 
 bool getLoopRange( double value, double min, double max, double delta, int loopLimit, int &minIter, int &maxIter);
 
+/** Number of threads of the geometrical transformations of volumes.
+ * applyGeometry (and so rotate, translate, ...) distributes the slices of
+ * the output volume among these threads. By default 1, i.e., no threads.
+ * It should not be changed while a transformation is running.
+ */
+void setGeometryThreads(int numberOfThreads);
+
+/** Thread pool of the geometrical transformations of volumes */
+ThreadPool & getGeometryThreadPool();
+
 /** Retrieve the matrix from an string representation
  * Valid formats are:
  * [[1, 0, 0, 0], [0, 1, 0, 0], [0, 0, 1, 0], [0, 0, 0, 1]]
@@ -201,6 +212,189 @@ void scale3DMatrix(const Matrix1D< double >& sc, Matrix2D< double > &m,
 #define BSPLINE3 3
 #define BSPLINE4 4
 
+/** Data of a 3D geometrical transformation shared by the threads of applyGeometry.
+ * @ingroup GeometricalTransformations
+ */
+template<typename T1, typename T>
+struct ApplyGeometry3DData
+{
+    MultidimArray<T> * V2;
+    const MultidimArray<T1> * V1;
+    const MultidimArray<double> * Bcoeffs;
+    const Matrix2D<double> * A; // Already inverted
+    int SplineDegree;
+    bool wrap;
+    T outside;
+};
+
+/** Apply a 3D geometrical transformation to the slices first to last of
+ * the output volume.
+ * @ingroup GeometricalTransformations
+ *
+ * This is the loop of applyGeometry for volumes. The position in the input
+ * volume is updated incrementally along each row, and the cubic B-spline
+ * weights of each axis are computed once per voxel.
+ */
+template<typename T1, typename T>
+void applyGeometry3DSlices(size_t first, size_t last, int thread_id, void * data)
+{
+    ApplyGeometry3DData<T1, T> &geo = *((ApplyGeometry3DData<T1, T> *) data);
+    MultidimArray<T> &V2 = *geo.V2;
+    const MultidimArray<T1> &V1 = *geo.V1;
+    const MultidimArray<double> *Bcoeffs = geo.Bcoeffs;
+    const Matrix2D<double> &Aref = *geo.A;
+    int SplineDegree = geo.SplineDegree;
+    bool wrap = geo.wrap;
+    T outside = geo.outside;
+
+    size_t m1, n1, o1, m2, n2, o2;
+    double x, y, z, xp, yp, zp;
+    double wx, wy, wz;
+    double Aref00=MAT_ELEM(Aref,0,0);
+    double Aref10=MAT_ELEM(Aref,1,0);
+    double Aref20=MAT_ELEM(Aref,2,0);
+
+    // Find center of MultidimArray
+    double cen_z = (int)(V2.zdim / 2);
+    double cen_y = (int)(V2.ydim / 2);
+    double cen_x = (int)(V2.xdim / 2);
+    double cen_zp = (int)(V1.zdim / 2);
+    double cen_yp = (int)(V1.ydim / 2);
+    double cen_xp = (int)(V1.xdim / 2);
+    double minxp = -cen_xp;
+    double minyp = -cen_yp;
+    double minzp = -cen_zp;
+    double maxxp = V1.xdim - cen_xp - 1;
+    double maxyp = V1.ydim - cen_yp - 1;
+    double maxzp = V1.zdim - cen_zp - 1;
+
+    // Now we go from the output MultidimArray to the input MultidimArray, ie, for any
+    // voxel in the output MultidimArray we calculate which are the corresponding
+    // ones in the original MultidimArray, make an interpolation with them and put
+    // this value at the output voxel
+    for (size_t k = first; k <= last; k++)
+        for (size_t i = 0; i < V2.ydim; i++)
+        {
+            // Calculate position of the beginning of the row in the output
+            // MultidimArray
+            x = -cen_x;
+            y = i - cen_y;
+            z = k - cen_z;
+
+            // Calculate this position in the input image according to the
+            // geometrical transformation they are related by
+            // coords_output(=x,y) = A * coords_input (=xp,yp)
+            xp = x * MAT_ELEM(Aref, 0, 0) + y * MAT_ELEM(Aref, 0, 1) + z * MAT_ELEM(Aref, 0, 2) + MAT_ELEM(Aref, 0, 3);
+            yp = x * MAT_ELEM(Aref, 1, 0) + y * MAT_ELEM(Aref, 1, 1) + z * MAT_ELEM(Aref, 1, 2) + MAT_ELEM(Aref, 1, 3);
+            zp = x * MAT_ELEM(Aref, 2, 0) + y * MAT_ELEM(Aref, 2, 1) + z * MAT_ELEM(Aref, 2, 2) + MAT_ELEM(Aref, 2, 3);
+
+            T * rowV2 = &dAkij(V2, k, i, 0);
+            // Compute the next point inside the input volume at the end of
+            // each iteration
+            for (size_t j = 0; j < V2.xdim; j++, xp += Aref00, yp += Aref10, zp += Aref20)
+            {
+                // If the point is outside the volume, apply a periodic
+                // extension of the volume, what exits by one side enters by
+                // the other
+                bool x_isOut = XMIPP_RANGE_OUTSIDE(xp, minxp, maxxp);
+                bool y_isOut = XMIPP_RANGE_OUTSIDE(yp, minyp, maxyp);
+                bool z_isOut = XMIPP_RANGE_OUTSIDE(zp, minzp, maxzp);
+
+                if (wrap)
+                {
+                    if (x_isOut)
+                        xp = realWRAP(xp, minxp - 0.5, maxxp + 0.5);
+
+                    if (y_isOut)
+                        yp = realWRAP(yp, minyp - 0.5, maxyp + 0.5);
+
+                    if (z_isOut)
+                        zp = realWRAP(zp, minzp - 0.5, maxzp + 0.5);
+                }
+                else if (x_isOut || y_isOut || z_isOut)
+                {
+                    rowV2[j] = outside;
+                    continue;
+                }
+
+                if (SplineDegree == 1)
+                {
+                    // Linear interpolation
+
+                    // Calculate the integer position in input volume, be
+                    // careful that it is not the nearest but the one at the
+                    // top left corner of the interpolation square. Ie,
+                    // (0.7,0.7) would give (0,0)
+                    // Calculate also weights for point m1+1,n1+1
+                    wx = xp + cen_xp;
+                    m1 = (int) wx;
+                    wx = wx - m1;
+                    m2 = m1 + 1;
+                    wy = yp + cen_yp;
+                    n1 = (int) wy;
+                    wy = wy - n1;
+                    n2 = n1 + 1;
+                    wz = zp + cen_zp;
+                    o1 = (int) wz;
+                    wz = wz - o1;
+                    o2 = o1 + 1;
+
+                    // Perform interpolation
+                    // if wx == 0 means that the rightest point is useless for
+                    // this interpolation, and even it might not be defined if
+                    // m1=xdim-1
+                    // The same can be said for wy.
+                    double wx_1=1-wx;
+                    double wy_1=1-wy;
+                    double wz_1=1-wz;
+                    bool useM2 = wx != 0 && m2 < V1.xdim;
+
+                    double aux1=wz_1 * wy_1;
+                    double aux2=aux1*wx_1;
+                    double tmp  =  aux2 * DIRECT_A3D_ELEM(V1, o1, n1, m1);
+
+                    if (useM2)
+                        tmp += (aux1-aux2)* DIRECT_A3D_ELEM(V1, o1, n1, m2);
+
+                    if (wy != 0 && n2 < V1.ydim)
+                    {
+                        aux1=wz_1 * wy;
+                        aux2=aux1*wx_1;
+                        tmp += aux2 * DIRECT_A3D_ELEM(V1, o1, n2, m1);
+                        if (useM2)
+                            tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o1, n2, m2);
+                    }
+
+                    if (wz != 0 && o2 < V1.zdim)
+                    {
+                        aux1=wz * wy_1;
+                        aux2=aux1*wx_1;
+                        tmp += aux2 * DIRECT_A3D_ELEM(V1, o2, n1, m1);
+                        if (useM2)
+                            tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o2, n1, m2);
+                        if (wy != 0 && n2 < V1.ydim)
+                        {
+                            aux1=wz * wy;
+                            aux2=aux1*wx_1;
+                            tmp += aux2 * DIRECT_A3D_ELEM(V1, o2, n2, m1);
+                            if (useM2)
+                                tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o2, n2, m2);
+                        }
+                    }
+
+                    rowV2[j] = (T)tmp;
+                }
+                else if (SplineDegree==0)
+                    rowV2[j]=(T)A3D_ELEM(V1,(int)trunc(zp),(int)trunc(yp),(int)trunc(xp));
+                else if (SplineDegree==3)
+                    rowV2[j] = (T) Bcoeffs->interpolatedElementBSpline3D_Degree3(xp, yp, zp);
+                else
+                    // B-spline interpolation
+                    rowV2[j] = (T) Bcoeffs->interpolatedElementBSpline3D(xp, yp, zp, SplineDegree);
+            }
+        }
+}
+
 /** Applies a geometrical transformation.
  * @ingroup GeometricalTransformations
  *
@@ -555,41 +749,9 @@ void applyGeometry(int SplineDegree,
     else
     {
         // 3D transformation
-    	size_t m1, n1, o1, m2, n2, o2;
-        double x, y, z, xp, yp, zp;
-        double minxp, minyp, maxxp, maxyp, minzp, maxzp;
-        double cen_x, cen_y, cen_z, cen_xp, cen_yp, cen_zp;
-        double wx, wy, wz;
-        double Aref00=MAT_ELEM(Aref,0,0);
-        double Aref10=MAT_ELEM(Aref,1,0);
-        double Aref20=MAT_ELEM(Aref,2,0);
-
-        // Find center of MultidimArray
-        cen_z = (int)(V2.zdim / 2);
-        cen_y = (int)(V2.ydim / 2);
-        cen_x = (int)(V2.xdim / 2);
-        cen_zp = (int)(V1.zdim / 2);
-        cen_yp = (int)(V1.ydim / 2);
-        cen_xp = (int)(V1.xdim / 2);
-        minxp = -cen_xp;
-        minyp = -cen_yp;
-        minzp = -cen_zp;
-        maxxp = V1.xdim - cen_xp - 1;
-        maxyp = V1.ydim - cen_yp - 1;
-        maxzp = V1.zdim - cen_zp - 1;
-
-#ifdef DEBUG
-
-        std::cout << "Geometry 2 center=("
-        << cen_z  << "," << cen_y  << "," << cen_x  << ")\n"
-        << "Geometry 1 center=("
-        << cen_zp << "," << cen_yp << "," << cen_xp << ")\n"
-        << "           min=("
-        << minzp  << "," << minyp  << "," << minxp  << ")\n"
-        << "           max=("
-        << maxzp  << "," << maxyp  << "," << maxxp  << ")\n"
-        ;
-#endif
+        double cen_zp = (int)(V1.zdim / 2);
+        double cen_yp = (int)(V1.ydim / 2);
+        double cen_xp = (int)(V1.xdim / 2);
 
         if (SplineDegree > 1)
         {
@@ -601,202 +763,27 @@ void applyGeometry(int SplineDegree,
         		produceSplineCoefficients(SplineDegree, Bcoeffs, V1); //Bcoeffs is a single image
         		BcoeffsToUse = &Bcoeffs;
         	}
-            STARTINGX(*BcoeffsToUse) = (int) minxp;
-            STARTINGY(*BcoeffsToUse) = (int) minyp;
-            STARTINGZ(*BcoeffsToUse) = (int) minzp;
+            STARTINGX(*BcoeffsToUse) = (int) -cen_xp;
+            STARTINGY(*BcoeffsToUse) = (int) -cen_yp;
+            STARTINGZ(*BcoeffsToUse) = (int) -cen_zp;
         }
 
-        // Now we go from the output MultidimArray to the input MultidimArray, ie, for any
-        // voxel in the output MultidimArray we calculate which are the corresponding
-        // ones in the original MultidimArray, make an interpolation with them and put
-        // this value at the output voxel
-
-        // V2 is not initialised to 0 because all its pixels are rewritten
-        for (size_t k = 0; k < V2.zdim; k++)
-            for (size_t i = 0; i < V2.ydim; i++)
-            {
-                // Calculate position of the beginning of the row in the output
-                // MultidimArray
-                x = -cen_x;
-                y = i - cen_y;
-                z = k - cen_z;
-
-                // Calculate this position in the input image according to the
-                // geometrical transformation they are related by
-                // coords_output(=x,y) = A * coords_input (=xp,yp)
-                xp = x * MAT_ELEM(Aref, 0, 0) + y * MAT_ELEM(Aref, 0, 1) + z * MAT_ELEM(Aref, 0, 2) + MAT_ELEM(Aref, 0, 3);
-                yp = x * MAT_ELEM(Aref, 1, 0) + y * MAT_ELEM(Aref, 1, 1) + z * MAT_ELEM(Aref, 1, 2) + MAT_ELEM(Aref, 1, 3);
-                zp = x * MAT_ELEM(Aref, 2, 0) + y * MAT_ELEM(Aref, 2, 1) + z * MAT_ELEM(Aref, 2, 2) + MAT_ELEM(Aref, 2, 3);
-
-                for (size_t j = 0; j < V2.xdim; j++)
-                {
-                    bool interp;
-                    double tmp;
-
-#ifdef DEBUG
-
-                    bool show_debug = false;
-                    if ((i == 0 && j == 0 && k == 0) ||
-                        (i == V2.ydim - 1 && j == V2.xdim - 1 && k == V2.zdim - 1))
-                        show_debug = true;
-
-                    if (show_debug)
-                        std::cout << "(x,y,z)-->(xp,yp,zp)= "
-                        << "(" << x  << "," << y  << "," << z  << ") "
-                        << "(" << xp << "," << yp << "," << zp << ")\n";
-#endif
-
-                    // If the point is outside the volume, apply a periodic
-                    // extension of the volume, what exits by one side enters by
-                    // the other
-                    interp  = true;
-                    bool x_isOut = XMIPP_RANGE_OUTSIDE(xp, minxp, maxxp);
-                    bool y_isOut = XMIPP_RANGE_OUTSIDE(yp, minyp, maxyp);
-                    bool z_isOut = XMIPP_RANGE_OUTSIDE(zp, minzp, maxzp);
-
-                    if (wrap)
-                    {
-                        if (x_isOut)
-                            xp = realWRAP(xp, minxp - 0.5, maxxp + 0.5);
-
-                        if (y_isOut)
-                            yp = realWRAP(yp, minyp - 0.5, maxyp + 0.5);
-
-                        if (z_isOut)
-                            zp = realWRAP(zp, minzp - 0.5, maxzp + 0.5);
-                    }
-                    else if (x_isOut || y_isOut || z_isOut)
-                        interp = false;
-
-                    if (interp)
-                    {
-                        if (SplineDegree == 1)
-                        {
-                            // Linear interpolation
-
-                            // Calculate the integer position in input volume, be
-                            // careful that it is not the nearest but the one at the
-                            // top left corner of the interpolation square. Ie,
-                            // (0.7,0.7) would give (0,0)
-                            // Calculate also weights for point m1+1,n1+1
-                            wx = xp + cen_xp;
-                            m1 = (int) wx;
-                            wx = wx - m1;
-                            m2 = m1 + 1;
-                            wy = yp + cen_yp;
-                            n1 = (int) wy;
-                            wy = wy - n1;
-                            n2 = n1 + 1;
-                            wz = zp + cen_zp;
-                            o1 = (int) wz;
-                            wz = wz - o1;
-                            o2 = o1 + 1;
-
-#ifdef DEBUG
-
-                            if (show_debug)
-                            {
-                                std::cout << "After wrapping(xp,yp,zp)= "
-                                << "(" << xp << "," << yp << "," << zp << ")\n";
-                                std::cout << "(m1,n1,o1)-->(m2,n2,o2)="
-                                << "(" << m1 << "," << n1 << "," << o1 << ") "
-                                << "(" << m2 << "," << n2 << "," << o2 << ")\n";
-                                std::cout << "(wx,wy,wz)="
-                                << "(" << wx << "," << wy << "," << wz << ")\n";
-                            }
-#endif
-
-                            // Perform interpolation
-                            // if wx == 0 means that the rightest point is useless for
-                            // this interpolation, and even it might not be defined if
-                            // m1=xdim-1
-                            // The same can be said for wy.
-                            double wx_1=1-wx;
-                            double wy_1=1-wy;
-                            double wz_1=1-wz;
-
-                            double aux1=wz_1 * wy_1;
-                            double aux2=aux1*wx_1;
-                            tmp  =  aux2 * DIRECT_A3D_ELEM(V1, o1, n1, m1);
-
-                            if (wx != 0 && m2 < V1.xdim)
-                                tmp += (aux1-aux2)* DIRECT_A3D_ELEM(V1, o1, n1, m2);
-
-                            if (wy != 0 && n2 < V1.ydim)
-                            {
-                                aux1=wz_1 * wy;
-                                aux2=aux1*wx_1;
-                                tmp += aux2 * DIRECT_A3D_ELEM(V1, o1, n2, m1);
-                                if (wx != 0 && m2 < V1.xdim)
-                                    tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o1, n2, m2);
-                            }
-
-                            if (wz != 0 && o2 < V1.zdim)
-                            {
-                                aux1=wz * wy_1;
-                                aux2=aux1*wx_1;
-                                tmp += aux2 * DIRECT_A3D_ELEM(V1, o2, n1, m1);
-                                if (wx != 0 && m2 < V1.xdim)
-                                    tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o2, n1, m2);
-                                if (wy != 0 && n2 < V1.ydim)
-                                {
-                                    aux1=wz * wy;
-                                    aux2=aux1*wx_1;
-                                    tmp += aux2 * DIRECT_A3D_ELEM(V1, o2, n2, m1);
-                                    if (wx != 0 && m2 < V1.xdim)
-                                        tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o2, n2, m2);
-                                }
-                            }
-
-#ifdef DEBUG
-                            if (show_debug)
-                                std::cout <<
-                                "tmp1=" << DIRECT_A3D_ELEM(V1, o1, n1, m1) << " "
-                                << (T)(wz_1 *wy_1 *wx_1 * DIRECT_A3D_ELEM(V1, o1, n1, m1))
-                                << std::endl <<
-                                "tmp2=" << DIRECT_A3D_ELEM(V1, o1, n1, m2) << " "
-                                << (T)(wz_1 *wy_1 * wx * DIRECT_A3D_ELEM(V1, o1, n1, m2))
-                                << std::endl <<
-                                "tmp3=" << DIRECT_A3D_ELEM(V1, o1, n2, m1) << " "
-                                << (T)(wz_1 * wy *wx_1 * DIRECT_A3D_ELEM(V1, o1, n2, m1))
-                                << std::endl <<
-                                "tmp4=" << DIRECT_A3D_ELEM(V1, o1, n2, m2) << " "
-                                << (T)(wz_1 * wy * wx * DIRECT_A3D_ELEM(V1, o2, n1, m1))
-                                << std::endl <<
-                                "tmp6=" << DIRECT_A3D_ELEM(V1, o2, n1, m2) << " "
-                                << (T)(wz * wy_1 * wx * DIRECT_A3D_ELEM(V1, o2, n1, m2))
-                                << std::endl <<
-                                "tmp7=" << DIRECT_A3D_ELEM(V1, o2, n2, m1) << " "
-                                << (T)(wz * wy *wx_1 * DIRECT_A3D_ELEM(V1, o2, n2, m1))
-                                << std::endl <<
-                                "tmp8=" << DIRECT_A3D_ELEM(V1, o2, n2, m2) << " "
-                                << (T)(wz * wy * wx * DIRECT_A3D_ELEM(V1, o2, n2, m2))
-                                << std::endl <<
-                                "tmp= " << tmp << std::endl;
-#endif
-
-                            dAkij(V2 , k, i, j) = (T)tmp;
-                        }
-                        else if (SplineDegree==0)
-						{
-							dAkij(V2, k, i, j)=(T)A3D_ELEM(V1,(int)trunc(zp),(int)trunc(yp),(int)trunc(xp));
-						}
-                        else
-                        {
-                            // B-spline interpolation
-                            dAkij(V2, k, i, j) =
-                                (T) BcoeffsToUse->interpolatedElementBSpline3D(xp, yp, zp, SplineDegree);
-                        }
-                    }
-                    else
-                        dAkij(V2, k, i, j) = outside;
-
-                    // Compute new point inside input image
-                    xp += Aref00;
-                    yp += Aref10;
-                    zp += Aref20;
-                }
-            }
+        // The slices of the output volume are independent, so they are
+        // distributed among the threads of the geometry pool (if any)
+        ApplyGeometry3DData<T1, T> data;
+        data.V2 = &V2;
+        data.V1 = &V1;
+        data.Bcoeffs = BcoeffsToUse;
+        data.A = &Aref;
+        data.SplineDegree = SplineDegree;
+        data.wrap = wrap;
+        data.outside = outside;
+
+        ThreadPool &pool = getGeometryThreadPool();
+        if (pool.getNumberOfThreads() > 1 && V2.zdim > 1)
+            pool.parallelFor(V2.zdim, 1, applyGeometry3DSlices<T1, T>, &data);
+        else
+            applyGeometry3DSlices<T1, T>(0, V2.zdim - 1, 0, &data);
     }
 }
 
@@ -829,6 +816,155 @@ void selfApplyGeometry(int SplineDegree,
     applyGeometry(SplineDegree, V1, aux, A, inv, wrap, outside);
 }
 
+/** Data of a stack transformation shared by the threads of applyGeometryStack.
+ * @ingroup GeometricalTransformations
+ */
+template<typename T>
+struct ApplyGeometryStackData
+{
+    int SplineDegree;
+    MultidimArray<T> * Vout;
+    const MultidimArray<T> * Vin;
+    const std::vector< Matrix2D<double> > * A;
+    bool inv;
+    bool wrap;
+    T outside;
+    MultidimArray<double> * Bcoeffs;
+};
+
+/** Transform the images first to last of a stack.
+ * @ingroup GeometricalTransformations
+ *
+ * This is the thread function of applyGeometryStack.
+ */
+template<typename T>
+void applyGeometryStackImages(size_t first, size_t last, int thread_id, void * data)
+{
+    ApplyGeometryStackData<T> &geo = *((ApplyGeometryStackData<T> *) data);
+    const std::vector< Matrix2D<double> > &A = *geo.A;
+    MultidimArray<T> imgIn, imgOut;
+    MultidimArray<double> coeffs, *coeffsPtr = NULL;
+    for (size_t n = first; n <= last; ++n)
+    {
+        imgIn.aliasImageInStack(*geo.Vin, n);
+        imgOut.aliasImageInStack(*geo.Vout, n);
+        STARTINGX(imgIn) = STARTINGX(imgOut) = STARTINGX(*geo.Vin);
+        STARTINGY(imgIn) = STARTINGY(imgOut) = STARTINGY(*geo.Vin);
+        if (geo.Bcoeffs != NULL && geo.SplineDegree > 1)
+        {
+            coeffs.aliasImageInStack(*geo.Bcoeffs, n);
+            coeffsPtr = &coeffs;
+        }
+        applyGeometry(geo.SplineDegree, imgOut, imgIn, A.size() == 1 ? A[0] : A[n],
+                      geo.inv, geo.wrap, geo.outside, coeffsPtr);
+    }
+}
+
+/** Compute the B-spline coefficients of the images first to last of a stack.
+ * @ingroup GeometricalTransformations
+ *
+ * This is the thread function of produceSplineCoefficientsStack.
+ */
+template<typename T>
+void produceSplineCoefficientsStackImages(size_t first, size_t last, int thread_id, void * data)
+{
+    ApplyGeometryStackData<T> &geo = *((ApplyGeometryStackData<T> *) data);
+    MultidimArray<T> img;
+    MultidimArray<double> coeffs;
+    for (size_t n = first; n <= last; ++n)
+    {
+        img.aliasImageInStack(*geo.Vin, n);
+        produceSplineCoefficients(geo.SplineDegree, coeffs, img);
+        memcpy(&DIRECT_NZYX_ELEM(*geo.Bcoeffs, n, 0, 0, 0), MULTIDIM_ARRAY(coeffs),
+               YXSIZE(coeffs) * sizeof(double));
+    }
+}
+
+/** Block of images of each task of the stack transformations */
+inline size_t geometryStackBlock(size_t nImages)
+{
+    return XMIPP_MAX(1, nImages / (16 * getGeometryThreadPool().getNumberOfThreads()));
+}
+
+/** Produce the B-spline coefficients of all the images of a stack.
+ * @ingroup GeometricalTransformations
+ *
+ * coeffs is a stack with the coefficients of each image, computed with the
+ * threads of the geometry pool (see setGeometryThreads). It can be given to
+ * applyGeometryStack to transform the same stack several times without
+ * computing the coefficients again.
+ */
+template<typename T>
+void produceSplineCoefficientsStack(int SplineDegree,
+                                    MultidimArray< double > &coeffs,
+                                    const MultidimArray< T > &V)
+{
+    if (ZSIZE(V) != 1)
+        REPORT_ERROR(ERR_MULTIDIM_DIM, "produceSplineCoefficientsStack: only valid for stacks of images");
+    coeffs.resizeNoCopy(NSIZE(V), 1, YSIZE(V), XSIZE(V));
+    STARTINGX(coeffs) = STARTINGX(V);
+    STARTINGY(coeffs) = STARTINGY(V);
+
+    ApplyGeometryStackData<T> data;
+    data.SplineDegree = SplineDegree;
+    data.Vin = &V;
+    data.Bcoeffs = &coeffs;
+    getGeometryThreadPool().parallelFor(NSIZE(V), geometryStackBlock(NSIZE(V)),
+                                        produceSplineCoefficientsStackImages<T>, &data);
+}
+
+/** Applies a geometrical transformation to each image of a stack.
+ * @ingroup GeometricalTransformations
+ *
+ * Image n of Vout is image n of Vin transformed by A[n] (or by A[0] if
+ * there is only one matrix), with the same conventions as applyGeometry.
+ * The images are distributed among the threads of the geometry pool (see
+ * setGeometryThreads). If Bcoeffs is given, it must contain the B-spline
+ * coefficients of the stack (see produceSplineCoefficientsStack), so that
+ * they are not computed for each image.
+ *
+ * @code
+ * setGeometryThreads(8);
+ * std::vector< Matrix2D<double> > A(NSIZE(stack));
+ * for (size_t n = 0; n < A.size(); ++n)
+ *     rotation2DMatrix(psi[n], A[n]);
+ * applyGeometryStack(BSPLINE3, alignedStack, stack, A, IS_NOT_INV, WRAP);
+ * @endcode
+ */
+template<typename T>
+void applyGeometryStack(int SplineDegree,
+                        MultidimArray<T> &Vout,
+                        const MultidimArray<T> &Vin,
+                        const std::vector< Matrix2D<double> > &A, bool inv,
+                        bool wrap, T outside = 0, MultidimArray<double> *Bcoeffs = NULL)
+{
+    if (ZSIZE(Vin) != 1)
+        REPORT_ERROR(ERR_MULTIDIM_DIM, "applyGeometryStack: only valid for stacks of images");
+    if (A.size() != 1 && A.size() != NSIZE(Vin))
+        REPORT_ERROR(ERR_ARG_INCORRECT, "applyGeometryStack: there should be one matrix per image");
+    if (Bcoeffs != NULL && SplineDegree > 1 &&
+        (NSIZE(*Bcoeffs) != NSIZE(Vin) || !SAME_SHAPE2D(*Bcoeffs, Vin)))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE, "applyGeometryStack: the spline coefficients do not match the stack");
+    if (&Vout == &Vin)
+        REPORT_ERROR(ERR_VALUE_INCORRECT, "applyGeometryStack: Input array cannot be the same as output array");
+
+    Vout.resizeNoCopy(Vin);
+    STARTINGX(Vout) = STARTINGX(Vin);
+    STARTINGY(Vout) = STARTINGY(Vin);
+
+    ApplyGeometryStackData<T> data;
+    data.SplineDegree = SplineDegree;
+    data.Vout = &Vout;
+    data.Vin = &Vin;
+    data.A = &A;
+    data.inv = inv;
+    data.wrap = wrap;
+    data.outside = outside;
+    data.Bcoeffs = Bcoeffs;
+    getGeometryThreadPool().parallelFor(NSIZE(Vin), geometryStackBlock(NSIZE(Vin)),
+                                        applyGeometryStackImages<T>, &data);
+}
+
 //Special cases for complex arrays
 template<>
 void applyGeometry(int SplineDegree,
@@ -28,6 +28,7 @@
 #include "args.h"
 #include <string.h>
 #include <pthread.h>
+#include "xmipp_profile.h"
 
 static pthread_mutex_t fftw_plan_mutex = PTHREAD_MUTEX_INITIALIZER;
 bool	planCreated=false;
@@ -246,6 +247,7 @@ void FourierTransformer::setFourier(const MultidimArray<std::complex<double> > &
 // Transform ---------------------------------------------------------------
 void FourierTransformer::Transform(int sign)
 {
+    XMIPP_PROFILE("fftw_execute");
     if (sign == FFTW_FORWARD)
     {
         fftw_execute(fPlanForward);
@@ -974,3 +976,112 @@ void randomizePhases(MultidimArray<double> &Min, double wRandom)
     }
 	transformer.inverseFourierTransform();
 }
+
+// Ramp of one axis, index i of the transform corresponds to FFT_IDX2DIGFREQ
+static void computeShiftRamp(std::vector< std::complex<double> > &ramp,
+                             size_t n, size_t size, double shift)
+{
+    ramp.resize(n);
+    double freq, s, c;
+    for (size_t i = 0; i < n; ++i)
+    {
+        FFT_IDX2DIGFREQ(i, size, freq);
+        sincos(-2 * PI * freq * shift, &s, &c);
+        ramp[i] = std::complex<double>(c, s);
+    }
+}
+
+void FourierShiftTables::initialize(size_t xdim, size_t ydim, size_t zdim,
+                                    double shiftX, double shiftY, double shiftZ)
+{
+    computeShiftRamp(rampX, xdim / 2 + 1, xdim, shiftX);
+    computeShiftRamp(rampY, ydim, ydim, shiftY);
+    computeShiftRamp(rampZ, zdim, zdim, shiftZ);
+}
+
+void FourierShiftTables::apply(MultidimArray< std::complex<double> > &F) const
+{
+    if (XSIZE(F) != rampX.size() || YSIZE(F) != rampY.size() || ZSIZE(F) != rampZ.size())
+        REPORT_ERROR(ERR_MULTIDIM_SIZE, "FourierShiftTables: the transform does not match the tables");
+    for (size_t n = 0; n < NSIZE(F); ++n)
+    {
+        std::complex<double> *ptr = &DIRECT_NZYX_ELEM(F, n, 0, 0, 0);
+        for (size_t k = 0; k < ZSIZE(F); ++k)
+            for (size_t i = 0; i < YSIZE(F); ++i)
+            {
+                std::complex<double> rampZY = rampZ[k] * rampY[i];
+                for (size_t j = 0; j < XSIZE(F); ++j, ++ptr)
+                    *ptr *= rampZY * rampX[j];
+            }
+    }
+}
+
+void shiftInFourier(MultidimArray< std::complex<double> > &F, size_t xdim,
+                    double shiftX, double shiftY, double shiftZ)
+{
+    FourierShiftTables tables;
+    tables.initialize(xdim, YSIZE(F), ZSIZE(F), shiftX, shiftY, shiftZ);
+    tables.apply(F);
+}
+
+// Coefficient of integer frequency (kx,ky) of the transform of a real image,
+// the negative kx are obtained from the Hermitian symmetry
+static inline std::complex<double> hermitianCoefficient(const MultidimArray< std::complex<double> > &F,
+        int xdim, int kx, int ky)
+{
+    bool conjugate = kx < 0;
+    if (conjugate)
+    {
+        kx = -kx;
+        ky = -ky;
+    }
+    int ydim = (int)YSIZE(F);
+    if (kx > xdim / 2 || abs(ky) > ydim / 2)
+        return 0.;
+    std::complex<double> value = DIRECT_A2D_ELEM(F, ky < 0 ? ky + ydim : ky, kx);
+    return conjugate ? conj(value) : value;
+}
+
+void rotateInFourier(const MultidimArray< std::complex<double> > &Fin,
+                     MultidimArray< std::complex<double> > &Fout,
+                     size_t xdim, double ang)
+{
+    Fin.checkDimension(2);
+    if (XSIZE(Fin) != xdim / 2 + 1)
+        REPORT_ERROR(ERR_MULTIDIM_SIZE, "rotateInFourier: xdim does not match the transform");
+    size_t ydim = YSIZE(Fin);
+
+    // Move the rotation center (the logical origin) to the origin of the transform
+    MultidimArray< std::complex<double> > Fcentered = Fin;
+    FourierShiftTables center;
+    center.initialize(xdim, ydim, 1, -(int)(xdim / 2), -(int)(ydim / 2));
+    center.apply(Fcentered);
+
+    // The coefficient at frequency k comes from frequency A^t k, where A
+    // is the rotation matrix of rotation2DMatrix
+    double c, s;
+    sincos(DEG2RAD(ang), &s, &c);
+    Fout.initZeros(Fin);
+    for (size_t i = 0; i < ydim; ++i)
+    {
+        double ky = (i <= ydim / 2) ? (double)i : (double)i - ydim;
+        for (size_t j = 0; j < XSIZE(Fin); ++j)
+        {
+            // Frequencies of the input in Fourier indexes
+            double fx = (double)j / xdim, fy = ky / ydim;
+            double x = (c * fx - s * fy) * xdim;
+            double y = (s * fx + c * fy) * ydim;
+            int x0 = (int)floor(x), y0 = (int)floor(y);
+            double wx = x - x0, wy = y - y0;
+            DIRECT_A2D_ELEM(Fout, i, j) =
+                (1 - wy) * ((1 - wx) * hermitianCoefficient(Fcentered, xdim, x0, y0) +
+                            wx * hermitianCoefficient(Fcentered, xdim, x0 + 1, y0)) +
+                wy * ((1 - wx) * hermitianCoefficient(Fcentered, xdim, x0, y0 + 1) +
+                      wx * hermitianCoefficient(Fcentered, xdim, x0 + 1, y0 + 1));
+        }
+    }
+
+    // And back to the center of the image
+    center.initialize(xdim, ydim, 1, (int)(xdim / 2), (int)(ydim / 2));
+    center.apply(Fout);
+}
@@ -28,6 +28,7 @@
 #define __XmippFFTW_H
 
 #include <complex>
+#include <vector>
 #include "fftw3.h"
 #include "multidim_array.h"
 #include "multidim_array_generic.h"
@@ -683,5 +684,64 @@ void adaptSpectrum(MultidimArray<double> &Min,
  * @ingroup FourierOperations
 */
 void randomizePhases(MultidimArray<double> &Min, double wRandom);
+
+/** Phase ramps of a shift in Fourier space.
+ * @ingroup FourierOperations
+ *
+ * Shifting an array by (shiftX,shiftY,shiftZ) pixels, wrapping around its
+ * borders, is the same as multiplying its Fourier transform by
+ * exp(-2*pi*i*(fx*shiftX+fy*shiftY+fz*shiftZ)), where (fx,fy,fz) are
+ * digital frequencies. The ramp is separable, so only one table per axis
+ * is computed for each shift and the tables can be applied to many
+ * transforms (e.g. all the images shifted by the same amount).
+ *
+ * @code
+ * FourierShiftTables shift;
+ * shift.initialize(XSIZE(I), YSIZE(I), 1, 2.5, -1.3);
+ * transformer.FourierTransform(I, FI, false);
+ * shift.apply(FI);
+ * transformer.inverseFourierTransform(); // I is now shifted
+ * @endcode
+ */
+class FourierShiftTables
+{
+public:
+    /// Ramp for each Fourier index of each axis
+    std::vector< std::complex<double> > rampX, rampY, rampZ;
+
+    /** Compute the tables for a real space array of size xdim x ydim x zdim */
+    void initialize(size_t xdim, size_t ydim, size_t zdim,
+                    double shiftX, double shiftY, double shiftZ = 0);
+
+    /** Multiply a Fourier transform (as given by FourierTransformer) by the ramp */
+    void apply(MultidimArray< std::complex<double> > &F) const;
+};
+
+/** Shift an array in Fourier space.
+ * @ingroup FourierOperations
+ *
+ * F is the Fourier transform (as given by FourierTransformer) of an array
+ * whose X size in real space is xdim. The result is the transform of the
+ * array shifted by (shiftX,shiftY,shiftZ) pixels with wrapping, i.e.,
+ * translate(..., WRAP) without interpolation errors.
+ */
+void shiftInFourier(MultidimArray< std::complex<double> > &F, size_t xdim,
+                    double shiftX, double shiftY, double shiftZ = 0);
+
+/** Rotate an image in Fourier space.
+ * @ingroup FourierOperations
+ *
+ * Fin is the Fourier transform (as given by FourierTransformer) of an image
+ * whose X size in real space is xdim. Fout is the transform of the image
+ * rotated ang degrees around its logical origin (the center of the image),
+ * as rotate(..., ang) would do. The coefficients are interpolated bilinearly
+ * after moving the rotation center to the origin of the transform. Pad the
+ * image (e.g. to twice its size) before transforming it if the result has
+ * to be close to the real space rotation, the interpolation error of an
+ * unpadded transform is of a few percent.
+ */
+void rotateInFourier(const MultidimArray< std::complex<double> > &Fin,
+                     MultidimArray< std::complex<double> > &Fout,
+                     size_t xdim, double ang);
 #endif
 /** @} */
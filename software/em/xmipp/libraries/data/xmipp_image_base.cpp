@@ -26,6 +26,7 @@
 #include "xmipp_image_base.h"
 #include "xmipp_image.h"
 #include "xmipp_error.h"
+#include "xmipp_profile.h"
 
 //This is needed for static memory allocation
 
@@ -682,6 +683,7 @@ void ImageBase::closeFile(ImageFHandler* hFile) const
 int ImageBase::_read(const FileName &name, ImageFHandler* hFile, DataMode datamode, size_t select_img,
                      bool mapData)
 {
+    XMIPP_PROFILE("image_read");
     // Temporary Error to find old select_img == -1
     if (select_img == (size_t) -1)
         REPORT_ERROR(ERR_DEBUG_TEST, "To select all images use ALL_IMAGES macro, or FIRST_IMAGE macro.");
@@ -779,6 +781,7 @@ int ImageBase::_read(const FileName &name, ImageFHandler* hFile, DataMode datamo
 void ImageBase::_write(const FileName &name, ImageFHandler* hFile, size_t select_img,
                        bool isStack, int mode, CastWriteMode castMode)
 {
+    XMIPP_PROFILE("image_write");
 
     // Temporary Error to find old select_img == -1
     if (select_img == (size_t) -1)
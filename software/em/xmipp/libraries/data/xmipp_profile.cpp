@@ -0,0 +1,205 @@
+/***************************************************************************
+ *
+ * Authors:     agent (agent@local)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <fstream>
+#include <vector>
+#include <unistd.h>
+#include "xmipp_profile.h"
+#include "xmipp_threads.h"
+#include "xmipp_error.h"
+
+bool Profiler::enabled = false;
+
+// Counters of one thread, indexed by section
+typedef std::vector<Profiler::Counter> ProfileTable;
+
+// Names of the sections and tables of all threads, protected by profileMutex
+static Mutex profileMutex;
+static std::vector<String> profileSections;
+static std::vector<ProfileTable *> profileTables;
+
+static pthread_key_t profileKey;
+static pthread_once_t profileKeyOnce = PTHREAD_ONCE_INIT;
+
+static void createProfileKey()
+{
+    // The tables are not freed when the threads exit, they are needed
+    // to write the profile
+    pthread_key_create(&profileKey, NULL);
+}
+
+int Profiler::section(const char *name)
+{
+    profileMutex.lock();
+    int id = -1;
+    for (size_t i = 0; i < profileSections.size(); ++i)
+        if (profileSections[i] == name)
+        {
+            id = i;
+            break;
+        }
+    if (id < 0)
+    {
+        id = profileSections.size();
+        profileSections.push_back(name);
+    }
+    profileMutex.unlock();
+    return id;
+}
+
+void Profiler::add(int section, double seconds, double amount)
+{
+    pthread_once(&profileKeyOnce, createProfileKey);
+    ProfileTable * table = (ProfileTable *) pthread_getspecific(profileKey);
+    if (table == NULL)
+    {
+        table = new ProfileTable;
+        pthread_setspecific(profileKey, table);
+        profileMutex.lock();
+        profileTables.push_back(table);
+        profileMutex.unlock();
+    }
+    if ((size_t) section >= table->size())
+    {
+        Counter empty;
+        empty.calls = 0;
+        empty.seconds = empty.amount = 0;
+        table->resize(section + 1, empty);
+    }
+    Counter &counter = (*table)[section];
+    ++counter.calls;
+    counter.seconds += seconds;
+    counter.amount += amount;
+}
+
+// Counter of a section in a table, or NULL if the thread did not use it
+static const Profiler::Counter * getCounter(const ProfileTable * table, size_t section)
+{
+    if (section < table->size() && (*table)[section].calls > 0)
+        return &((*table)[section]);
+    return NULL;
+}
+
+// Escape a string for JSON
+static String jsonString(const String &str)
+{
+    String result = "\"";
+    for (size_t i = 0; i < str.size(); ++i)
+    {
+        char c = str[i];
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if ((unsigned char) c >= 32)
+            result += c;
+    }
+    return result + "\"";
+}
+
+void Profiler::writeJSON(std::ostream &out, const String &program, double wallTime)
+{
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0)
+        host[0] = '\0';
+    host[sizeof(host) - 1] = '\0';
+
+    profileMutex.lock();
+    out << "{" << std::endl
+    << "  \"program\": " << jsonString(program) << "," << std::endl
+    << "  \"host\": " << jsonString(host) << "," << std::endl
+    << "  \"pid\": " << getpid() << "," << std::endl
+    << "  \"wall_seconds\": " << wallTime << "," << std::endl
+    << "  \"threads\": " << profileTables.size() << "," << std::endl
+    << "  \"sections\": [";
+    for (size_t s = 0; s < profileSections.size(); ++s)
+    {
+        size_t calls = 0;
+        double seconds = 0, amount = 0;
+        String threads;
+        for (size_t t = 0; t < profileTables.size(); ++t)
+        {
+            const Counter * counter = getCounter(profileTables[t], s);
+            double threadSeconds = 0;
+            if (counter != NULL)
+            {
+                calls += counter->calls;
+                seconds += counter->seconds;
+                amount += counter->amount;
+                threadSeconds = counter->seconds;
+            }
+            threads += formatString("%s%g", t ? ", " : "", threadSeconds);
+        }
+        out << (s ? "," : "") << std::endl
+        << "    {\"name\": " << jsonString(profileSections[s])
+        << ", \"calls\": " << calls
+        << ", \"seconds\": " << seconds
+        << ", \"amount\": " << amount
+        << ", \"thread_seconds\": [" << threads << "]}";
+    }
+    out << std::endl << "  ]" << std::endl << "}" << std::endl;
+    profileMutex.unlock();
+}
+
+void Profiler::writeSummary(std::ostream &out, double wallTime)
+{
+    profileMutex.lock();
+    out << "Profile (" << profileTables.size() << " threads, "
+    << wallTime << " s)" << std::endl
+    << formatString("%-32s %12s %12s %12s %14s", "section", "calls",
+                    "seconds", "ms/call", "amount") << std::endl;
+    for (size_t s = 0; s < profileSections.size(); ++s)
+    {
+        size_t calls = 0;
+        double seconds = 0, amount = 0;
+        for (size_t t = 0; t < profileTables.size(); ++t)
+        {
+            const Counter * counter = getCounter(profileTables[t], s);
+            if (counter != NULL)
+            {
+                calls += counter->calls;
+                seconds += counter->seconds;
+                amount += counter->amount;
+            }
+        }
+        if (calls == 0)
+            continue;
+        out << formatString("%-32s %12lu %12.3f %12.4f %14.0f",
+                            profileSections[s].c_str(), (unsigned long) calls,
+                            seconds, 1000 * seconds / calls, amount) << std::endl;
+    }
+    profileMutex.unlock();
+}
+
+void Profiler::write(const String &fn, const String &program, double wallTime)
+{
+    if (fn.empty())
+        writeSummary(std::cout, wallTime);
+    else
+    {
+        std::ofstream out(fn.c_str());
+        if (!out)
+            REPORT_ERROR(ERR_IO_NOWRITE, fn);
+        writeJSON(out, program, wallTime);
+    }
+}
@@ -0,0 +1,135 @@
+/***************************************************************************
+ *
+ * Authors:     agent (agent@local)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef XMIPP_PROFILE_H_
+#define XMIPP_PROFILE_H_
+
+#include <time.h>
+#include <iostream>
+#include "xmipp_strings.h"
+
+/** @defgroup Profiling Profiling
+ *  @ingroup DataLibrary
+ *
+ * Scoped timers and counters for the hot paths of the programs.
+ * Each section accumulates the number of calls, the time spent and an
+ * optional amount (e.g. bytes). Each thread has its own counters, so
+ * there is no locking while the program runs. They are only collected
+ * when the profile is written (see the --profile option of XmippProgram).
+ *
+ * Nothing is measured unless Profiler::enabled is set, and compiling
+ * with XMIPP_NO_PROFILE removes the instrumentation completely.
+ * @code
+ * void FourierTransformer::Transform(int sign)
+ * {
+ *     XMIPP_PROFILE("fftw");
+ *     ...
+ * }
+ * @endcode
+ * @{
+ */
+
+/** Collection of the profiling counters of all threads */
+class Profiler
+{
+public:
+    /** Counters of a section in one thread */
+    struct Counter
+    {
+        size_t calls;
+        double seconds;
+        double amount;
+    };
+
+    /** Measure or not (false by default) */
+    static bool enabled;
+
+    /** Identifier of a section, the section is created the first time */
+    static int section(const char *name);
+
+    /** Add a call to a section of the calling thread */
+    static void add(int section, double seconds, double amount = 0);
+
+    /** Time in seconds from an arbitrary origin */
+    static inline double now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + 1e-9 * ts.tv_nsec;
+    }
+
+    /** Write the profile in JSON format.
+     * For each section, the totals and the time of each thread are written.
+     */
+    static void writeJSON(std::ostream &out, const String &program, double wallTime);
+
+    /** Write the profile as a table */
+    static void writeSummary(std::ostream &out, double wallTime);
+
+    /** Write the profile. If fn is empty, a table is written to the
+     * standard output, otherwise it is written to fn in JSON format.
+     */
+    static void write(const String &fn, const String &program, double wallTime);
+};
+
+/** Timer of a section from its construction to its destruction */
+class ProfileScope
+{
+private:
+    int section;
+    double start;
+public:
+    ProfileScope(int _section): section(_section)
+    {
+        start = Profiler::enabled ? Profiler::now() : -1;
+    }
+
+    ~ProfileScope()
+    {
+        if (start >= 0)
+            Profiler::add(section, Profiler::now() - start);
+    }
+};
+
+#ifdef XMIPP_NO_PROFILE
+#define XMIPP_PROFILE(name)
+#define XMIPP_PROFILE_COUNT(name, amount)
+#else
+/** Measure the rest of the current scope as section name.
+ * Only one per scope, use braces to measure several parts of a function.
+ */
+#define XMIPP_PROFILE(name) \
+    static const int _xmippProfileSection = Profiler::section(name); \
+    ProfileScope _xmippProfileScope(_xmippProfileSection)
+
+/** Add a call with the given amount (and no time) to section name */
+#define XMIPP_PROFILE_COUNT(name, amount) \
+    do { if (Profiler::enabled) { \
+        static const int _xmippProfileCounter = Profiler::section(name); \
+        Profiler::add(_xmippProfileCounter, 0, amount); } } while (0)
+#endif
+
+/** @} */
+#endif /* XMIPP_PROFILE_H_ */
@@ -24,8 +24,10 @@
  ***************************************************************************/
 
 #include <stdlib.h>
+#include <algorithm>
 #include "xmipp_program.h"
 #include "metadata_extension.h"
+#include "transformations.h"
 #include "args.h"
 void XmippProgram::initComments()
 {
@@ -60,6 +62,8 @@ void XmippProgram::defineCommons()
     addParamsLine("alias --help;");
     addParamsLine("[--gui*]                 : Show a GUI to launch the program.");
     addParamsLine("[--more*]                : Show additional options.");
+    addParamsLine("[--profile+ <file=\"\">]  : Measure the time spent in I/O, FFTs, metadata and the main steps.");
+    addParamsLine("                         : The profile is written to file (JSON) or shown at the end.");
 
     ///This are a set of internal command for MetaProgram usage
     ///they should be hidden
@@ -259,6 +263,11 @@ void XmippProgram::read(int argc, const char ** argv, bool reportErrors)
                     verbose = getIntParam("--verbose");
                 this->readParams();
                 doRun = !checkParam("--xmipp_validate_params"); //just validation, not run
+                if (checkParam("--profile"))
+                {
+                    Profiler::enabled = true;
+                    profileFile = getParam("--profile");
+                }
             }
         }
         catch (XmippError &xe)
@@ -291,8 +300,10 @@ void XmippProgram::read(const String &argumentsLine)
 
 int XmippProgram::tryRun()
 {
+    double start = Profiler::now();
     try
     {
+        XMIPP_PROFILE("program_run");
         if (doRun)
             this->run();
     }
@@ -301,8 +312,25 @@ int XmippProgram::tryRun()
         std::cerr << xe;
         errorCode = xe.__errno;
     }
+    writeProfile(Profiler::now() - start);
     return errorCode;
 }
+
+void XmippProgram::writeProfile(double wallTime)
+{
+    if (!Profiler::enabled || !doRun)
+        return;
+    if (profileFile.empty() && !verbose)
+        return;
+    try
+    {
+        Profiler::write(profileFile, progDef->name, wallTime);
+    }
+    catch (XmippError &xe)
+    {
+        std::cerr << xe;
+    }
+}
 /** Init progress */
 void XmippProgram::initProgress(size_t total, size_t stepBin)
 {
@@ -491,6 +519,8 @@ XmippMetadataProgram::XmippMetadataProgram()
     produces_a_metadata = false;
     each_image_produces_an_output = false;
     allow_time_bar = true;
+    allow_threads = false;
+    imageThreads = 1;
     decompose_stacks = true;
     delete_output_stack = true;
     get_image_info = true;
@@ -566,6 +596,11 @@ void XmippMetadataProgram::defineParams()
     {
         addParamsLine("  [--dont_apply_geo]   : for 2D-images: do not apply transformation stored in metadata");
     }
+    if (allow_threads)
+    {
+        addParamsLine("  [--thr <N=1>]        : Number of images processed at the same time");
+        addParamsLine("                       :+ A single volume is transformed with N threads");
+    }
 }//function defineParams
 
 void XmippMetadataProgram::defineLabelParam()
@@ -589,6 +624,8 @@ void XmippMetadataProgram::readParams()
 
     if (allow_apply_geo)
         apply_geo = !checkParam("--dont_apply_geo");
+    if (allow_threads)
+        imageThreads = XMIPP_MAX(1, getIntParam("--thr"));
 
     // The following flags are an "advanced" options to allow save metadata
     // when the -o is an stack, each program can define its default value
@@ -758,15 +795,131 @@ void XmippMetadataProgram::wait()
 	// In the serial implementation, we don't have to wait. This will be useful for MPI programs
 }
 
+bool XmippMetadataProgram::prepareImageToProcess(size_t &objIndex, FileName &fnImg, FileName &fnImgOut,
+        MDRow &rowIn, MDRow &rowOut, const FileName &fullBaseName)
+{
+    size_t objId;
+    if (!getImageToProcess(objId, objIndex))
+        return false;
+
+    ++objIndex; //increment for composing starting at 1
+
+    mdIn->getRow(rowIn, objId);
+    rowIn.getValue(image_label, fnImg);
+
+    if (fnImg.empty())
+        return false;
+
+    fnImgOut = fnImg;
+
+    if (each_image_produces_an_output)
+    {
+        if (!oroot.empty()) // Compose out name to save as independent images
+        {
+            if (oext.empty()) // If oext is still empty, then use ext of indep input images
+            {
+                if (input_is_stack)
+                    oextBaseName = "spi";
+                else
+                    oextBaseName = fnImg.getFileFormat();
+            }
+
+            if (!baseName.empty() )
+                fnImgOut.compose(fullBaseName, objIndex, oextBaseName);
+            else if (fnImg.isInStack())
+                fnImgOut.compose(pathBaseName + (fnImg.withoutExtension()).getDecomposedFileName(), objIndex, oextBaseName);
+            else
+                fnImgOut = pathBaseName + fnImg.withoutExtension()+ "." + oextBaseName;
+        }
+        else if (!fn_out.empty() )
+        {
+            if (single_image)
+                fnImgOut = fn_out;
+            else
+                fnImgOut.compose(objIndex, fn_out); // Compose out name to save as stacks
+        }
+        else
+            fnImgOut = fnImg;
+        setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+    }
+    else if (produces_a_metadata)
+        setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+    return true;
+}
+
+/* Data shared by the threads processing images */
+struct ImagesThreadData
+{
+    FileName fullBaseName;
+    bool finished;
+    std::vector< std::pair<size_t, MDRow> > rowsOut;
+};
+
+void XmippMetadataProgram::processImagesThread(ThreadArgument &thArg)
+{
+    XmippMetadataProgram *self = (XmippMetadataProgram *) thArg.workClass;
+    ImagesThreadData *data = (ImagesThreadData *) thArg.data;
+    FileName fnImg, fnImgOut;
+    MDRow rowIn, rowOut;
+    size_t objIndex = 0;
+    bool saveRow = self->each_image_produces_an_output || self->produces_a_metadata;
+
+    while (true)
+    {
+        self->imagesMutex.lock();
+        bool process = !data->finished &&
+                       self->prepareImageToProcess(objIndex, fnImg, fnImgOut, rowIn, rowOut, data->fullBaseName);
+        if (!process)
+            data->finished = true;
+        self->imagesMutex.unlock();
+        if (!process)
+            break;
+
+        {
+            XMIPP_PROFILE("program_process_image");
+            self->processImage(fnImg, fnImgOut, rowIn, rowOut);
+        }
+
+        self->imagesMutex.lock();
+        if (saveRow)
+            data->rowsOut.push_back(std::make_pair(objIndex, rowOut));
+        self->showProgress();
+        self->imagesMutex.unlock();
+    }
+}
+
+/* Rows are sorted by image index */
+bool compareRowsOut(const std::pair<size_t, MDRow> &a, const std::pair<size_t, MDRow> &b)
+{
+    return a.first < b.first;
+}
+
+void XmippMetadataProgram::runThreads(const FileName &fullBaseName)
+{
+    ImagesThreadData data;
+    data.fullBaseName = fullBaseName;
+    data.finished = false;
+
+    ThreadManager thMgr(imageThreads, this);
+    thMgr.run(processImagesThread, &data);
+
+    // Keep the same order as when processing the images one by one
+    std::stable_sort(data.rowsOut.begin(), data.rowsOut.end(), compareRowsOut);
+    for (size_t i = 0; i < data.rowsOut.size(); ++i)
+        mdOut.addRow(data.rowsOut[i].second);
+}
+
 void XmippMetadataProgram::run()
 {
     FileName fnImg, fnImgOut, fullBaseName;
-    size_t objId;
     MDRow rowIn, rowOut;
     mdOut.clear(); //this allows multiple runs of the same Program object
 
     //Perform particular preprocessing
-    preProcess();
+    {
+        XMIPP_PROFILE("program_preprocess");
+        preProcess();
+    }
 
     startProcessing();
 
@@ -782,58 +935,31 @@ void XmippMetadataProgram::run()
         pathBaseName   = fullBaseName.getDir();
     }
 
-    //FOR_ALL_OBJECTS_IN_METADATA(mdIn)
-    while (getImageToProcess(objId, objIndex))
-    {
-        ++objIndex; //increment for composing starting at 1
-
-        mdIn->getRow(rowIn, objId);
-        rowIn.getValue(image_label, fnImg);
-
-        if (fnImg.empty())
-            break;
-
-        fnImgOut = fnImg;
+    // A single volume is processed with the threads of the geometrical
+    // transformations instead
+    if (imageThreads > 1 && single_image)
+        setGeometryThreads(imageThreads);
 
-        if (each_image_produces_an_output)
+    if (imageThreads > 1 && !single_image)
+        runThreads(fullBaseName);
+    else
+    {
+        //FOR_ALL_OBJECTS_IN_METADATA(mdIn)
+        while (prepareImageToProcess(objIndex, fnImg, fnImgOut, rowIn, rowOut, fullBaseName))
         {
-            if (!oroot.empty()) // Compose out name to save as independent images
-            {
-                if (oext.empty()) // If oext is still empty, then use ext of indep input images
-                {
-                    if (input_is_stack)
-                        oextBaseName = "spi";
-                    else
-                        oextBaseName = fnImg.getFileFormat();
-                }
-
-                if (!baseName.empty() )
-                    fnImgOut.compose(fullBaseName, objIndex, oextBaseName);
-                else if (fnImg.isInStack())
-                    fnImgOut.compose(pathBaseName + (fnImg.withoutExtension()).getDecomposedFileName(), objIndex, oextBaseName);
-                else
-                    fnImgOut = pathBaseName + fnImg.withoutExtension()+ "." + oextBaseName;
-            }
-            else if (!fn_out.empty() )
             {
-                if (single_image)
-                    fnImgOut = fn_out;
-                else
-                    fnImgOut.compose(objIndex, fn_out); // Compose out name to save as stacks
+                XMIPP_PROFILE("program_process_image");
+                processImage(fnImg, fnImgOut, rowIn, rowOut);
             }
-            else
-                fnImgOut = fnImg;
-            setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
-        }
-        else if (produces_a_metadata)
-            setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
-
-        processImage(fnImg, fnImgOut, rowIn, rowOut);
 
-        if (each_image_produces_an_output || produces_a_metadata)
-            mdOut.addRow(rowOut);
+            if (each_image_produces_an_output || produces_a_metadata)
+                mdOut.addRow(rowOut);
 
-        showProgress();
+            showProgress();
+        }
+        // Do not leave the threads to later geometrical transformations
+        if (imageThreads > 1 && single_image)
+            setGeometryThreads(1);
     }
     wait();
 
@@ -857,9 +983,15 @@ void XmippMetadataProgram::run()
             fn_out = fn_in;
     }
 
-    finishProcessing();
+    {
+        XMIPP_PROFILE("program_finish");
+        finishProcessing();
+    }
 
-    postProcess();
+    {
+        XMIPP_PROFILE("program_postprocess");
+        postProcess();
+    }
 
     /* Reset the default values of the program in case
      * to be reused.*/
@@ -32,6 +32,8 @@
 #include "metadata.h"
 #include "xmipp_image.h"
 #include "xmipp_program_sql.h"
+#include "xmipp_threads.h"
+#include "xmipp_profile.h"
 
 
 /** @defgroup Programs2 Basic structure for Xmipp programs
@@ -95,6 +97,12 @@ protected:
     int argc;
     const char ** argv;
 
+    /// Output of --profile, empty to show a summary
+    FileName profileFile;
+
+    /** Write the profile if --profile was given */
+    void writeProfile(double wallTime);
+
 public:
     /** Flag to check whether to run or not*/
     bool doRun;
@@ -336,6 +344,9 @@ protected:
     bool remove_disabled; // Default true
     /// Show process time bar
     bool allow_time_bar; // Default true
+    /// Provide the program with the param --thr to process several images
+    /// at the same time. processImage must not modify the program members.
+    bool allow_threads; // Default false
 
     // DEDUCED FLAGS
     /// Input is a metadata
@@ -348,6 +359,8 @@ protected:
     bool output_is_stack;
     // Create empty output stack file prior to process images
     bool create_empty_stackfile; //
+    /// Number of threads processing images (see allow_threads)
+    int imageThreads;
     //check whether to delete or not the input metadata
     bool delete_mdIn;
 
@@ -378,6 +391,20 @@ protected:
     /** Define the label param */
     virtual void defineLabelParam();
 
+    /** Get the next image to process, its input row and its output name and row.
+     * Return false if there are no more images.
+     */
+    bool prepareImageToProcess(size_t &objIndex, FileName &fnImg, FileName &fnImgOut,
+                               MDRow &rowIn, MDRow &rowOut, const FileName &fullBaseName);
+
+    /** Process the images with imageThreads threads.
+     * The images are taken with getImageToProcess under a mutex, so the
+     * task distribution (e.g. MPI) need not be thread safe.
+     */
+    void runThreads(const FileName &fullBaseName);
+    static void processImagesThread(ThreadArgument &thArg);
+    Mutex imagesMutex;
+
 public:
     XmippMetadataProgram();
 
@@ -25,10 +25,12 @@
 
 #include <stdio.h>
 #include <iostream>
+#include <algorithm>
 
 #include "xmipp_threads.h"
 #include "xmipp_error.h"
 #include "xmipp_log.h"
+#include "xmipp_macros.h"
 
 
 // ================= MUTEX ==========================
@@ -343,6 +345,73 @@ void ThreadTaskDistributor::unlock()
     mutex.unlock();
 }
 
+bool ThreadTaskDistributor::getTasks(size_t &first, size_t &last)
+{
+    first = last = 0;
+    if (guidedThreads <= 0)
+    {
+        // assignedTasks may go beyond numberOfTasks, it is not a problem
+        size_t bSize = blockSize;
+        size_t begin = __sync_fetch_and_add(&assignedTasks, bSize);
+        if (begin >= numberOfTasks)
+            return false;
+        first = begin;
+        last = XMIPP_MIN(begin + bSize, numberOfTasks) - 1;
+        return true;
+    }
+
+    size_t begin = __sync_fetch_and_add(&assignedTasks, 0);
+    while (begin < numberOfTasks)
+    {
+        size_t end = guidedBlockEnd(begin);
+        size_t current = __sync_val_compare_and_swap(&assignedTasks, begin, end);
+        if (current == begin)
+        {
+            first = begin;
+            last = end - 1;
+            return true;
+        }
+        begin = current;
+    }
+    return false;
+}
+
+size_t ThreadTaskDistributor::guidedBlockEnd(size_t first) const
+{
+    size_t chunks = 2 * guidedThreads;
+    size_t end;
+    if (accumulatedCost.empty())
+        end = first + (numberOfTasks - first + chunks - 1) / chunks;
+    else
+    {
+        // First task at which the cost of the block reaches its share
+        double target = accumulatedCost[first] +
+                        (accumulatedCost[numberOfTasks] - accumulatedCost[first]) / chunks;
+        end = std::lower_bound(accumulatedCost.begin() + first + 1,
+                               accumulatedCost.end(), target) - accumulatedCost.begin();
+    }
+    end = XMIPP_MAX(end, first + blockSize);
+    return XMIPP_MIN(end, numberOfTasks);
+}
+
+void ThreadTaskDistributor::setGuided(int nThreads)
+{
+    guidedThreads = XMIPP_MAX(nThreads, 0);
+}
+
+void ThreadTaskDistributor::setTaskCosts(const std::vector<double> &costs)
+{
+    accumulatedCost.clear();
+    if (costs.empty())
+        return;
+    if (costs.size() != numberOfTasks)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "There should be one cost per task");
+    accumulatedCost.resize(numberOfTasks + 1);
+    accumulatedCost[0] = 0;
+    for (size_t i = 0; i < numberOfTasks; ++i)
+        accumulatedCost[i + 1] = accumulatedCost[i] + XMIPP_MAX(costs[i], 0.);
+}
+
 bool ThreadTaskDistributor::distribute(size_t &first, size_t &last)
 {
     bool result = true;
@@ -362,6 +431,250 @@ bool ThreadTaskDistributor::distribute(size_t &first, size_t &last)
     return result;
 }
 
+// =================== THREAD POOL ============================
+
+void * _threadPoolMain(void * data)
+{
+    ThreadPool::Worker * worker = (ThreadPool::Worker *) data;
+    ThreadPool * pool = worker->pool;
+    pthread_setspecific(pool->workerKey, worker);
+
+    ThreadPool::Entry entry;
+    while (true)
+    {
+        if (pool->getEntry(worker, entry))
+        {
+            pool->execute(entry);
+            continue;
+        }
+        // Sleep until there are new tasks
+        pool->condition.lock();
+        while (pool->queued <= 0 && !pool->exiting)
+            pool->condition.wait();
+        bool leave = pool->exiting && pool->queued <= 0;
+        pool->condition.unlock();
+        if (leave)
+            break;
+    }
+    return NULL;
+}
+
+ThreadPool::ThreadPool(int numberOfThreads)
+{
+    threads = XMIPP_MAX(numberOfThreads, 1);
+    queued = 0;
+    exiting = false;
+    nextQueue = 0;
+    pthread_key_create(&workerKey, NULL);
+}
+
+ThreadPool::~ThreadPool()
+{
+    destroyThreads();
+    pthread_key_delete(workerKey);
+}
+
+void ThreadPool::setNumberOfThreads(int numberOfThreads)
+{
+    numberOfThreads = XMIPP_MAX(numberOfThreads, 1);
+    if (numberOfThreads != threads)
+    {
+        destroyThreads();
+        threads = numberOfThreads;
+    }
+}
+
+void ThreadPool::createThreads()
+{
+    exiting = false;
+    workers.resize(threads);
+    for (int i = 0; i < threads; ++i)
+    {
+        workers[i] = new Worker;
+        workers[i]->pool = this;
+        workers[i]->index = i;
+    }
+    for (int i = 0; i < threads; ++i)
+        if (pthread_create(&(workers[i]->id), NULL, _threadPoolMain, (void *) workers[i]) != 0)
+            REPORT_ERROR(ERR_THREADS_NOTINIT, "ThreadPool: can't create threads.");
+}
+
+void ThreadPool::destroyThreads()
+{
+    if (workers.empty())
+        return;
+    condition.lock();
+    exiting = true;
+    condition.broadcast();
+    condition.unlock();
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        pthread_join(workers[i]->id, NULL);
+        delete workers[i];
+    }
+    workers.clear();
+}
+
+int ThreadPool::getThreadId() const
+{
+    Worker * worker = (Worker *) pthread_getspecific(workerKey);
+    return (worker == NULL) ? -1 : worker->index;
+}
+
+void ThreadPool::submit(ThreadTask * task, ThreadTaskGroup &group, bool deleteTask)
+{
+    if (workers.empty())
+        createThreads();
+
+    Entry entry;
+    entry.task = task;
+    entry.group = &group;
+    entry.deleteTask = deleteTask;
+
+    condition.lock();
+    ++group.pending;
+    condition.unlock();
+
+    Worker * worker = (Worker *) pthread_getspecific(workerKey);
+    if (worker == NULL)
+    {
+        condition.lock();
+        worker = workers[nextQueue];
+        nextQueue = (nextQueue + 1) % workers.size();
+        condition.unlock();
+    }
+    worker->mutex.lock();
+    worker->queue.push_back(entry);
+    worker->mutex.unlock();
+
+    condition.lock();
+    ++queued;
+    condition.signal();
+    condition.unlock();
+}
+
+bool ThreadPool::getEntry(Worker * worker, Entry &entry)
+{
+    bool found = false;
+    // Newest task of its own queue
+    worker->mutex.lock();
+    if (!worker->queue.empty())
+    {
+        entry = worker->queue.back();
+        worker->queue.pop_back();
+        found = true;
+    }
+    worker->mutex.unlock();
+
+    // Oldest task of other queues
+    size_t n = workers.size();
+    for (size_t k = 1; !found && k < n; ++k)
+    {
+        Worker * victim = workers[(worker->index + k) % n];
+        victim->mutex.lock();
+        if (!victim->queue.empty())
+        {
+            entry = victim->queue.front();
+            victim->queue.pop_front();
+            found = true;
+        }
+        victim->mutex.unlock();
+    }
+
+    if (found)
+    {
+        condition.lock();
+        --queued;
+        condition.unlock();
+    }
+    return found;
+}
+
+void ThreadPool::execute(Entry &entry)
+{
+    try
+    {
+        entry.task->run();
+    }
+    catch (XmippError &xe)
+    {
+        std::cerr << xe << std::endl
+        << "In thread " << getThreadId() << std::endl;
+        exit(-1);
+    }
+    if (entry.deleteTask)
+        delete entry.task;
+
+    condition.lock();
+    if (--(entry.group->pending) == 0)
+        condition.broadcast();
+    condition.unlock();
+}
+
+void ThreadPool::wait(ThreadTaskGroup &group)
+{
+    Worker * worker = (Worker *) pthread_getspecific(workerKey);
+    Entry entry;
+    while (true)
+    {
+        condition.lock();
+        bool done = group.pending == 0;
+        condition.unlock();
+        if (done)
+            return;
+
+        // A pool thread helps with the pending tasks
+        if (worker != NULL && getEntry(worker, entry))
+        {
+            execute(entry);
+            continue;
+        }
+
+        condition.lock();
+        while (group.pending > 0 && (worker == NULL || queued <= 0))
+            condition.wait();
+        condition.unlock();
+    }
+}
+
+/** Block of tasks of ThreadPool::parallelFor */
+class ThreadLoopTask: public ThreadTask
+{
+public:
+    ThreadPool * pool;
+    ThreadLoopFunction function;
+    void * data;
+    size_t first, last;
+
+    void run()
+    {
+        function(first, last, pool->getThreadId(), data);
+    }
+};
+
+void ThreadPool::parallelFor(size_t nTasks, size_t blockSize,
+                             ThreadLoopFunction function, void * data)
+{
+    if (nTasks == 0)
+        return;
+    blockSize = XMIPP_MAX(blockSize, 1);
+    size_t nBlocks = (nTasks + blockSize - 1) / blockSize;
+    std::vector<ThreadLoopTask> tasks(nBlocks);
+    ThreadTaskGroup group;
+    // Submitted in reverse order so that the owner starts with the first block
+    for (size_t b = nBlocks; b-- > 0;)
+    {
+        ThreadLoopTask &task = tasks[b];
+        task.pool = this;
+        task.function = function;
+        task.data = data;
+        task.first = b * blockSize;
+        task.last = XMIPP_MIN(task.first + blockSize, nTasks) - 1;
+        submit(&task, group);
+    }
+    wait(group);
+}
+
 // =================== OLD THREADS IMPLEMENTATION ============================
 int barrier_init(barrier_t *barrier,int needed)
 {
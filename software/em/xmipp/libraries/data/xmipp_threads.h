@@ -29,6 +29,8 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
+#include <deque>
 
 class ThreadManager;
 class ThreadArgument;
@@ -424,7 +426,7 @@ public:
      *  }
      *  @endcode
      */
-    bool getTasks(size_t &first, size_t &last); // False = no more jobs, true = more jobs
+    virtual bool getTasks(size_t &first, size_t &last); // False = no more jobs, true = more jobs
     /* This function set the number of completed tasks.
      * Usually this not need to be called. Its more useful
      * for restarting work, when usually the master detect
@@ -445,27 +447,241 @@ protected:
 ;//class ParallelTaskDistributor
 
 /** This class is a concrete implementation of ParallelTaskDistributor for POSIX threads.
- * It use mutex as the locking mechanism
- * and distributes tasks from 0 to numberOfTasks.
+ * It distributes tasks from 0 to numberOfTasks. getTasks does not take
+ * any lock, the next task is taken with an atomic operation.
+ *
+ * By default all blocks have blockSize tasks. With setGuided, the blocks
+ * are large at the beginning and shrink as the distribution gets to
+ * its end, so that threads finish at about the same time. With
+ * setTaskCosts the guided blocks have similar cost instead of a similar
+ * number of tasks.
+ * @code
+ * ThreadTaskDistributor td(nParticles, 1);
+ * td.setGuided(nThreads);
+ * td.setTaskCosts(particleCosts);
+ * @endcode
  */
 class ThreadTaskDistributor: public ParallelTaskDistributor
 {
 public:
-    ThreadTaskDistributor(size_t nTasks, size_t bSize):ParallelTaskDistributor(nTasks, bSize)
+    ThreadTaskDistributor(size_t nTasks, size_t bSize):ParallelTaskDistributor(nTasks, bSize),
+        guidedThreads(0)
     {}
     virtual ~ThreadTaskDistributor()
     {}
     ;
 protected:
     Mutex mutex; ///< Mutex to synchronize access to critical region
+    int guidedThreads; ///< Number of threads for the guided distribution, 0 if fixed blocks
+    std::vector<double> accumulatedCost; ///< Cost of the tasks before each task
     virtual void lock();
     virtual void unlock();
     virtual bool distribute(size_t &first, size_t &last);
+    /** End (not included) of the guided block starting at first */
+    size_t guidedBlockEnd(size_t first) const;
 public:
     virtual void reset() { setAssignedTasks(0); };
+
+    /** Lock free version of getTasks */
+    virtual bool getTasks(size_t &first, size_t &last);
+
+    /** Guided distribution for nThreads workers.
+     * Each block has the pending tasks divided by twice the number of
+     * threads, but never less than blockSize tasks. Set nThreads to 0
+     * to go back to fixed blocks.
+     */
+    void setGuided(int nThreads);
+
+    /** Relative cost of each task, used by the guided distribution.
+     * It should have numberOfTasks elements, an empty vector removes
+     * the costs.
+     */
+    void setTaskCosts(const std::vector<double> &costs);
 }
 ;//end of class ThreadTaskDistributor
 
+/** Task to be executed by a ThreadPool.
+ * Subclasses implement run() with the work to do.
+ */
+class ThreadTask
+{
+public:
+    /** Destructor */
+    virtual ~ThreadTask()
+    {}
+
+    /** Work of the task */
+    virtual void run() = 0;
+};
+
+/** Group of tasks submitted to a ThreadPool.
+ * It plays the role of a future: ThreadPool::wait(group) returns
+ * when all the tasks submitted with this group have finished.
+ */
+class ThreadTaskGroup
+{
+private:
+    size_t pending; ///< Tasks submitted and not finished yet
+    friend class ThreadPool;
+public:
+    ThreadTaskGroup(): pending(0)
+    {}
+};
+
+/** Prototype of the functions run by ThreadPool::parallelFor.
+ * The tasks first to last (both included) are processed by
+ * the pool thread thread_id.
+ */
+typedef void (*ThreadLoopFunction) (size_t first, size_t last, int thread_id, void * data);
+
+/** This function is used in ThreadPool as the main function of its threads.
+ */
+void * _threadPoolMain(void * data);
+
+/** Pool of threads with work stealing.
+ * The threads are created on the first use and live until the pool
+ * is destroyed, so that a program can submit work many times without
+ * creating threads again. Each thread has its own queue of tasks.
+ * Tasks submitted from a pool thread go to its own queue, the rest are
+ * distributed among the queues in round robin. A thread takes the
+ * last task of its queue and, when it is empty, steals the first task
+ * of the queue of another thread.
+ *
+ * A pool thread waiting for a group executes pending tasks in the
+ * meanwhile, so that tasks can submit and wait for other tasks
+ * (nested parallelism). Threads that do not belong to the pool just
+ * sleep until the group is done.
+ * @code
+ * void processImages(size_t first, size_t last, int thread_id, void * data)
+ * {
+ *     for (size_t image = first; image <= last; ++image)
+ *         processOneImage(image);
+ * }
+ *
+ * ThreadPool pool(4);
+ * //Process 1000 images in tasks of 10 images
+ * pool.parallelFor(1000, 10, processImages);
+ * @endcode
+ */
+class ThreadPool
+{
+private:
+    /// Entry of a queue
+    struct Entry
+    {
+        ThreadTask * task;
+        ThreadTaskGroup * group;
+        bool deleteTask;
+    };
+
+    /// Queue of each thread
+    struct Worker
+    {
+        ThreadPool * pool;
+        int index;
+        pthread_t id;
+        Mutex mutex;
+        std::deque<Entry> queue;
+    };
+
+    int threads; ///< Number of threads
+    std::vector<Worker *> workers; ///< Threads and their queues
+    Condition condition; ///< Protects queued, exiting and the groups
+    long queued; ///< Number of tasks in all the queues
+    bool exiting; ///< Threads should exit
+    size_t nextQueue; ///< Queue for the next external submission
+    pthread_key_t workerKey; ///< Worker of the calling thread
+
+    ThreadPool(const ThreadPool &);
+    ThreadPool & operator=(const ThreadPool &);
+
+    /// Create the threads
+    void createThreads();
+
+    /// Destroy the threads
+    void destroyThreads();
+
+    /// Take a task for the given worker (own queue first, then steal)
+    bool getEntry(Worker * worker, Entry &entry);
+
+    /// Run a task and update its group
+    void execute(Entry &entry);
+
+    friend void * _threadPoolMain(void * data);
+
+public:
+    /** Constructor, the threads are created on the first use */
+    ThreadPool(int numberOfThreads = 1);
+
+    /** Destructor, waits for the queued tasks and exits the threads */
+    ~ThreadPool();
+
+    /** Change the number of threads.
+     * It should only be called when the pool is not working.
+     */
+    void setNumberOfThreads(int numberOfThreads);
+
+    /** Get number of threads */
+    int getNumberOfThreads() const
+    {
+        return threads;
+    }
+
+    /** Index of the pool thread calling this function, -1 for other threads */
+    int getThreadId() const;
+
+    /** Submit a task to the pool.
+     * The task is added to the group, use wait(group) to know when it has
+     * finished. If deleteTask, the pool deletes the task after running it.
+     */
+    void submit(ThreadTask * task, ThreadTaskGroup &group, bool deleteTask = false);
+
+    /** Wait until all the tasks of the group have finished */
+    void wait(ThreadTaskGroup &group);
+
+    /** Process nTasks tasks in blocks of blockSize tasks.
+     * The function receives the first and last task of each block and
+     * the index of the pool thread processing it. The call returns when
+     * all the tasks are done.
+     */
+    void parallelFor(size_t nTasks, size_t blockSize,
+                     ThreadLoopFunction function, void * data = NULL);
+
+    /** Run function(args + i) for i from 0 to n-1 and wait for all.
+     * This replaces the creation and join of n threads with the same
+     * function. The calls may synchronize among them (e.g. with barriers)
+     * only if the pool has at least n threads and it is not running other
+     * tasks.
+     */
+    template <class T>
+    void runAll(void * (*function)(void *), T * args, int n)
+    {
+        std::vector<FunctionTask> tasks(n);
+        ThreadTaskGroup group;
+        for (int i = 0; i < n; ++i)
+        {
+            tasks[i].function = function;
+            tasks[i].args = (void *) (args + i);
+            submit(&tasks[i], group);
+        }
+        wait(group);
+    }
+
+private:
+    /// Task calling a thread function
+    class FunctionTask: public ThreadTask
+    {
+    public:
+        void * (*function)(void *);
+        void * args;
+        void run()
+        {
+            function(args);
+        }
+    };
+}
+;//end of class ThreadPool
+
 /** @name Old parallel stuff. */
 /** Barrier structure */
 //@{
@@ -332,58 +332,11 @@ void ProgMPIRecFourier::run()
                     //a posibility is a non-blocking send
                     MPI_Recv(0, 0, MPI_INT, 0, TAG_COLLECT_FOR_FSC, MPI_COMM_WORLD, &status);
 
+                    // Sum the partial volumes of all workers in rank 1
+                    reduceDataInChunks( fourierVolume, 2*sizeout, BUFFSIZE, new_comm );
+
                     if( node->rank == 1 )
                     {
-                        // Reserve memory for the receive buffer
-                        double * recBuffer = (double *) malloc (sizeof(double)*BUFFSIZE);
-                        int receivedSize;
-                        double * pointer;
-                        pointer = fourierVolume;
-                        int currentSource;
-
-                        if ( nProcs > 2 )
-                        {
-                            // Receive from other workers
-                            for ( size_t i = 2 ; i <= nProcs ; i++)
-                            {
-                                MPI_Recv(0,0, MPI_INT, MPI_ANY_SOURCE, TAG_FREEWORKER,
-                                         MPI_COMM_WORLD, &status);
-
-                                currentSource = status.MPI_SOURCE;
-
-                                pointer = fourierVolume;
-
-                                while (1)
-                                {
-                                    MPI_Probe( currentSource, MPI_ANY_TAG, MPI_COMM_WORLD, &status );
-
-                                    if ( status.MPI_TAG == TAG_FREEWORKER )
-                                    {
-                                        MPI_Recv(0,0, MPI_INT, currentSource, TAG_FREEWORKER, MPI_COMM_WORLD, &status );
-                                        break;
-                                    }
-
-                                    MPI_Recv( recBuffer,
-                                              BUFFSIZE,
-                                              MPI_DOUBLE,
-                                              currentSource,
-                                              MPI_ANY_TAG,
-                                              MPI_COMM_WORLD,
-                                              &status );
-
-                                    MPI_Get_count( &status, MPI_DOUBLE, &receivedSize );
-
-                                    for ( int i = 0 ; i < receivedSize ; i ++ )
-                                    {
-                                        pointer[i] += recBuffer[i];
-                                    }
-
-                                    pointer += receivedSize;
-                                }
-                            }
-                        }
-                        free( recBuffer );
-
                         Image<double> auxVolume1;
                         auxVolume1().alias( FourierWeights );
                         auxVolume1.write((std::string)fn_fsc + "_1_Weights.vol");
@@ -406,13 +359,6 @@ void ProgMPIRecFourier::run()
                     }
                     else
                     {
-
-                        MPI_Send( 0,0,MPI_INT,1,TAG_FREEWORKER, MPI_COMM_WORLD );
-
-                        sendDataInChunks( fourierVolume, 1, 2*sizeout, BUFFSIZE, MPI_COMM_WORLD );
-
-                        MPI_Send( 0,0,MPI_INT,1,TAG_FREEWORKER, MPI_COMM_WORLD );
-
                         Vout().initZeros(volPadSizeZ, volPadSizeY, volPadSizeX);
                         transformerVol.setReal(Vout());
                         Vout().clear();
@@ -457,62 +403,16 @@ void ProgMPIRecFourier::run()
                         break;
                 }*/
 
+                    gettimeofday(&start_time,NULL);
+                    reduceDataInChunks( fourierVolume, 2*sizeout, BUFFSIZE, new_comm );
+                    gettimeofday(&end_time,NULL);
+
                     if ( node->rank == 1 )
                     {
-                        // Reserve memory for the receive buffer
-                        double * recBuffer = (double *) malloc (sizeof(double)*BUFFSIZE);
-                        int receivedSize;
-                        double * pointer;
-                        pointer = fourierVolume;
-                        int currentSource;
-
-                        gettimeofday(&start_time,NULL);
-
-                        if ( nProcs > 1 )
-                        {
-                            // Receive from other workers
-
-                            for (size_t i = 0 ; i <= (nProcs-2) ; i++)
-                            {
-                                MPI_Recv(0,0, MPI_INT, MPI_ANY_SOURCE, TAG_FREEWORKER,
-                                         MPI_COMM_WORLD, &status);
-
-                                currentSource = status.MPI_SOURCE;
-
-                                pointer = fourierVolume;
-
-                                while (1)
-                                {
-                                    MPI_Probe( currentSource, MPI_ANY_TAG, MPI_COMM_WORLD, &status );
+                        total_usecs = (end_time.tv_sec-start_time.tv_sec) * 1000000 + (end_time.tv_usec-start_time.tv_usec);
+                        if (verbose > 0)
+                            std::cout << "Reduction time: " << (double)total_usecs/(double)1000000 << " secs." << std::endl;
 
-                                    if ( status.MPI_TAG == TAG_FREEWORKER )
-                                    {
-                                        MPI_Recv(0,0, MPI_INT, currentSource, TAG_FREEWORKER, MPI_COMM_WORLD, &status );
-
-                                        break;
-                                    }
-
-                                    MPI_Recv( recBuffer,
-                                              BUFFSIZE,
-                                              MPI_DOUBLE,
-                                              currentSource,
-                                              MPI_ANY_TAG,
-                                              MPI_COMM_WORLD,
-                                              &status );
-
-                                    MPI_Get_count( &status, MPI_DOUBLE, &receivedSize );
-
-                                    for ( int i = 0 ; i < receivedSize ; i ++ )
-                                    {
-                                        pointer[i] += recBuffer[i];
-                                    }
-
-                                    pointer += receivedSize;
-                                }
-                            }
-                        }
-
-                        free( recBuffer );
                         if (iter==0)
                         {
                             VoutFourierTmp=VoutFourier;
@@ -605,18 +505,8 @@ void ProgMPIRecFourier::run()
                             // Normalize global volume and store data
                             finishComputations(fn_out);
                         }
-                        break;
-                    }
-                    else
-                    {
-                        MPI_Send( 0,0,MPI_INT,1,TAG_FREEWORKER, MPI_COMM_WORLD );
-
-                        sendDataInChunks( fourierVolume, 1, 2 * sizeout, BUFFSIZE, MPI_COMM_WORLD);
-
-                        MPI_Send( 0,0,MPI_INT,1,TAG_FREEWORKER, MPI_COMM_WORLD );
-
-                        break;
                     }
+                    break;
                 }
                 else if (status.MPI_TAG == TAG_WORKFORWORKER)
                 {
@@ -663,35 +553,26 @@ void ProgMPIRecFourier::run()
     while(iter<NiterWeight);
 }
 
-int  ProgMPIRecFourier::sendDataInChunks( double * pointer, int dest, int totalSize, int buffSize, MPI_Comm comm )
+int ProgMPIRecFourier::reduceDataInChunks( double * pointer, size_t totalSize, int buffSize, MPI_Comm comm )
 {
-    double * localPointer = pointer;
-
-    int numChunks =(int)ceil((double)totalSize/(double)buffSize);
-    int packetSize;
-    int err=0;
+    int rank, err=MPI_SUCCESS;
+    MPI_Comm_rank(comm, &rank);
 
-    for ( int i = 0 ; i < numChunks ; i ++ )
+    // The result is left in place in the first process of the communicator.
+    // MPI_Reduce sums with a tree, so the time does not grow linearly with
+    // the number of workers as when all the volumes were sent to rank 1
+    for ( size_t offset = 0 ; offset < totalSize ; offset += buffSize )
     {
-        if ( i == (numChunks-1))
-            packetSize = totalSize-i*buffSize;
+        int packetSize = (int)XMIPP_MIN((size_t)buffSize, totalSize - offset);
+        if (rank == 0)
+            err = MPI_Reduce( MPI_IN_PLACE, pointer + offset, packetSize,
+                              MPI_DOUBLE, MPI_SUM, 0, comm );
         else
-            packetSize = buffSize;
-
-        if ( (err = MPI_Send( localPointer, packetSize,
-                              MPI_DOUBLE, dest, 0, MPI_COMM_WORLD ))
-             != MPI_SUCCESS )
-        {
+            err = MPI_Reduce( pointer + offset, NULL, packetSize,
+                              MPI_DOUBLE, MPI_SUM, 0, comm );
+        if ( err != MPI_SUCCESS )
             break;
-        }
-
-        localPointer += packetSize;
     }
 
     return err;
 }
-
-
-
-
-
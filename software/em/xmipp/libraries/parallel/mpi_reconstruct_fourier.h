@@ -96,7 +96,11 @@ public:
     /* Run --------------------------------------------------------------------- */
     void run();
 
-    int  sendDataInChunks( double * pointer, int dest, int totalSize, int buffSize, MPI_Comm comm );
+    /** Sum the array pointer of all the processes in comm into the
+     * process with rank 0 in comm. The reduction is done in pieces of
+     * buffSize elements.
+     */
+    int  reduceDataInChunks( double * pointer, size_t totalSize, int buffSize, MPI_Comm comm );
 
 };
 //@}
@@ -23,6 +23,7 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <iomanip>
 #include "xmipp_mpi.h"
 #include "data/xmipp_log.h"
 
@@ -32,35 +33,221 @@ MpiTaskDistributor::MpiTaskDistributor(size_t nTasks, size_t bSize,
         ThreadTaskDistributor(nTasks, bSize)
 {
     this->node = node;
+    minBlockSize = 1;
+    masterWorks = false;
+    showStats = false;
+    initialized = false;
+    requestPending = false;
+}
+
+void MpiTaskDistributor::setMinBlockSize(size_t bSize)
+{
+    minBlockSize = XMIPP_MAX(1, XMIPP_MIN(bSize, blockSize));
+}
+
+void MpiTaskDistributor::setMasterWorks(bool masterWorks)
+{
+    this->masterWorks = masterWorks;
+}
+
+void MpiTaskDistributor::setTaskGroups(const std::vector<size_t> &groups)
+{
+    if (groups.size() != numberOfTasks)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "MpiTaskDistributor: there should be one group per task");
+    taskGroups = groups;
+}
+
+void MpiTaskDistributor::setShowStats(bool showStats)
+{
+    this->showStats = showStats;
+}
+
+size_t MpiTaskDistributor::getAssignedTasks() const
+{
+    return assignedTasks;
+}
+
+bool MpiTaskDistributor::getTasks(size_t &first, size_t &last)
+{
+    return ParallelTaskDistributor::getTasks(first, last);
+}
+
+void MpiTaskDistributor::reset()
+{
+    ThreadTaskDistributor::reset();
+    initialized = false;
 }
 
 bool MpiTaskDistributor::distribute(size_t &first, size_t &last)
 {
-    return node->isMaster() ? distributeMaster() : distributeSlaves(first, last);
+    return node->isMaster() ? distributeMaster(first, last) : distributeSlaves(first, last);
+}
+
+size_t MpiTaskDistributor::alignToGroup(size_t pos, size_t lo, size_t hi) const
+{
+    if (taskGroups.empty())
+        return pos;
+    // Look for the closest group change, not further than a quarter of [lo, hi]
+    size_t maxDist = (hi - lo) / 4;
+    for (size_t d = 0; d <= maxDist; ++d)
+    {
+        if (pos + d <= hi && pos + d > 0 && pos + d < numberOfTasks &&
+            taskGroups[pos + d] != taskGroups[pos + d - 1])
+            return pos + d;
+        if (pos >= lo + d && pos - d > 0 && taskGroups[pos - d] != taskGroups[pos - d - 1])
+            return pos - d;
+    }
+    return pos;
+}
+
+void MpiTaskDistributor::initDistribution()
+{
+    size_t size = node->size;
+    size_t firstNode = masterWorks ? 0 : 1;
+    size_t nNodes = size - firstNode;
+
+    rangeBegin.assign(size, 0);
+    rangeEnd.assign(size, 0);
+    tasksPerNode.assign(size, 0);
+    blocksPerNode.assign(size, 0);
+    stealsPerNode.assign(size, 0);
+    finishTime.assign(size, 0);
+
+    size_t begin = 0;
+    for (size_t n = firstNode; n < size; ++n)
+    {
+        size_t end = numberOfTasks * (n - firstNode + 1) / nNodes;
+        if (n + 1 < size)
+            end = alignToGroup(end, begin, end + numberOfTasks / nNodes);
+        end = XMIPP_MAX(begin, XMIPP_MIN(end, numberOfTasks));
+        rangeBegin[n] = begin;
+        rangeEnd[n] = end;
+        begin = end;
+    }
+    rangeEnd[size - 1] = numberOfTasks;
+
+    pendingTasks = numberOfTasks;
+    assignedTasks = 0;
+    finalizedWorkers = 0;
+    initialized = true;
+    timer.tic();
+}
+
+bool MpiTaskDistributor::assignTasks(int rank, size_t &first, size_t &last)
+{
+    first = last = 0;
+    if (pendingTasks == 0)
+        return false;
+
+    if (rangeBegin[rank] == rangeEnd[rank])
+    {
+        // Take the second half of the largest pending range
+        size_t victim = 0, maxPending = 0;
+        for (size_t n = 0; n < rangeBegin.size(); ++n)
+            if (rangeEnd[n] - rangeBegin[n] > maxPending)
+            {
+                maxPending = rangeEnd[n] - rangeBegin[n];
+                victim = n;
+            }
+        size_t split = rangeEnd[victim] - maxPending / 2;
+        if (maxPending > 1)
+            split = alignToGroup(split, rangeBegin[victim] + 1, rangeEnd[victim] - 1);
+        else
+            split = rangeBegin[victim];
+        rangeBegin[rank] = split;
+        rangeEnd[rank] = rangeEnd[victim];
+        rangeEnd[victim] = split;
+        stealsPerNode[rank]++;
+    }
+
+    // Guided block size
+    size_t nNodes = masterWorks ? node->size : node->size - 1;
+    size_t block = (pendingTasks + 2 * nNodes - 1) / (2 * nNodes);
+    block = XMIPP_MAX(minBlockSize, XMIPP_MIN(block, blockSize));
+    if (rank == 0)
+        block = 1; // The master must answer the workers between tasks
+    block = XMIPP_MIN(block, rangeEnd[rank] - rangeBegin[rank]);
+
+    first = rangeBegin[rank];
+    last = first + block - 1;
+    rangeBegin[rank] += block;
+    pendingTasks -= block;
+    assignedTasks += block;
+    tasksPerNode[rank] += block;
+    blocksPerNode[rank]++;
+    return true;
 }
 
-bool MpiTaskDistributor::distributeMaster()
+void MpiTaskDistributor::serveRequests(bool wait)
 {
     int size = node->size;
-    size_t workBuffer[3];
+    size_t buffer[4];
     MPI_Status status;
-    int finalizedWorkers = 0;
+    int flag;
 
     while (finalizedWorkers < size - 1)
     {
+        if (!wait)
+        {
+            MPI_Iprobe(MPI_ANY_SOURCE, TAG_WORK_REQUEST, MPI_COMM_WORLD, &flag, &status);
+            if (!flag)
+                break;
+        }
         //wait for request form workers
         MPI_Recv(0, 0, MPI_INT, MPI_ANY_SOURCE, TAG_WORK_REQUEST, MPI_COMM_WORLD, &status);
 
-        workBuffer[0] = ThreadTaskDistributor::distribute(workBuffer[1], workBuffer[2]) ? 1 : 0;
+        buffer[0] = assignTasks(status.MPI_SOURCE, buffer[1], buffer[2]) ? 1 : 0;
+        buffer[3] = assignedTasks;
 
-        if (workBuffer[0] == 0) //no more jobs, count finalized workers
+        if (buffer[0] == 0) //no more jobs, count finalized workers
+        {
             finalizedWorkers++;
+            finishTime[status.MPI_SOURCE] = timer.elapsed();
+        }
         //send response (either task or finish answer)
-        MPI_Send(workBuffer, 3, MPI_LONG_LONG_INT, status.MPI_SOURCE, TAG_WORK_RESPONSE, MPI_COMM_WORLD);
+        MPI_Send(buffer, 4, MPI_LONG_LONG_INT, status.MPI_SOURCE, TAG_WORK_RESPONSE, MPI_COMM_WORLD);
+    }
+}
+
+bool MpiTaskDistributor::distributeMaster(size_t &first, size_t &last)
+{
+    if (!initialized)
+        initDistribution();
+
+    if (masterWorks)
+    {
+        serveRequests(false);
+        if (assignTasks(0, first, last))
+            return true;
+        finishTime[0] = timer.elapsed();
     }
+    serveRequests(true);
+    finalizedWorkers = 0; // Further requests are answered with no more tasks
+    if (showStats)
+        printStats(std::cout);
     return false;
 }
 
+void MpiTaskDistributor::printStats(std::ostream &out) const
+{
+    // Workers ask for a block before processing the previous one, so the
+    // time of their last request is close to the time they run out of work
+    size_t firstNode = masterWorks ? 0 : 1;
+    size_t nNodes = tasksPerNode.size() - firstNode;
+    size_t maxTasks = 0;
+    out << "MPI task distribution (" << numberOfTasks << " tasks)" << std::endl
+    << "   node    tasks   blocks   steals  last request(s)" << std::endl;
+    for (size_t n = firstNode; n < tasksPerNode.size(); ++n)
+    {
+        out << std::setw(7) << n << std::setw(9) << tasksPerNode[n]
+        << std::setw(9) << blocksPerNode[n] << std::setw(9) << stealsPerNode[n]
+        << std::setw(17) << std::fixed << std::setprecision(2) << finishTime[n] / 1000. << std::endl;
+        maxTasks = XMIPP_MAX(maxTasks, tasksPerNode[n]);
+    }
+    out << "Task imbalance (max/mean): " << std::setprecision(3)
+    << maxTasks * nNodes / (double)numberOfTasks << std::endl;
+}
+
 bool MpiTaskDistributor::distributeSlaves(size_t &first, size_t &last)
 {
   // Worker nodes should ask for task to master
@@ -68,16 +255,31 @@ bool MpiTaskDistributor::distributeSlaves(size_t &first, size_t &last)
   //   workBuffer[0] = 0 if no more jobs, 1 otherwise
   //   workBuffer[1] = first
   //   workBuffer[2] = last
-  size_t workBuffer[3];
+  //   workBuffer[3] = tasks handed out by the master so far
+  // The next block is asked for before returning the current one,
+  // so the answer is already there when it is needed
   MPI_Status status;
-  //any message from the master, is tag is TAG_STOP then stop
-  MPI_Send(0, 0, MPI_INT, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD);
-  MPI_Recv(workBuffer, 3, MPI_LONG_LONG_INT, 0, TAG_WORK_RESPONSE, MPI_COMM_WORLD, &status);
+  if (!requestPending)
+  {
+      MPI_Send(0, 0, MPI_INT, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD);
+      MPI_Irecv(workBuffer, 4, MPI_LONG_LONG_INT, 0, TAG_WORK_RESPONSE, MPI_COMM_WORLD, &request);
+  }
+  MPI_Wait(&request, &status);
+  requestPending = false;
 
   first = workBuffer[1];
   last = workBuffer[2];
+  assignedTasks = workBuffer[3];
+  bool moreTasks = (workBuffer[0] == 1);
+
+  if (moreTasks)
+  {
+      MPI_Send(0, 0, MPI_INT, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD);
+      MPI_Irecv(workBuffer, 4, MPI_LONG_LONG_INT, 0, TAG_WORK_RESPONSE, MPI_COMM_WORLD, &request);
+      requestPending = true;
+  }
 
-  return (workBuffer[0] == 1);
+  return moreTasks;
 }
 
 void MpiTaskDistributor::wait()
@@ -141,7 +343,7 @@ MpiFileMutex::~MpiFileMutex()
 //------------ MPI ---------------------------
 MpiNode::MpiNode(int &argc, char **& argv)
 {
-    MPI_Init(&argc, &argv);
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &threadLevel);
     int irank, isize;
     MPI_Comm_rank(MPI_COMM_WORLD, &irank);
     MPI_Comm_size(MPI_COMM_WORLD, &isize);
@@ -198,35 +400,52 @@ void MpiNode::gatherMetadatas(MetaData &MD, const FileName &rootname)
     if (size == 1)
         return;
 
-    FileName fn;
-
-    if (!isMaster()) //workers just write down partial results
+    // Each worker sends its partial metadata serialized in memory,
+    // the master receives them in rank order and joins them
+    std::vector<char> buffer;
+    size_t bufferSize = 0;
+    if (!isMaster())
     {
-        fn = formatString("%s_node%d.xmd", rootname.c_str(), rank);
-        MD.write(fn);
+        MD.writeBuffer(buffer);
+        bufferSize = buffer.size();
     }
-    ///Wait for all workers write results
-    barrierWait();
-    if (isMaster()) //master should collect and join workers results
+    std::vector<size_t> sizes(size);
+    MPI_Gather(&bufferSize, 1, XMIPP_MPI_SIZE_T, &sizes[0], 1, XMIPP_MPI_SIZE_T, 0, MPI_COMM_WORLD);
+
+    if (isMaster())
     {
         MetaData mdAll(MD), mdSlave;
         for (size_t nodeRank = 1; nodeRank < size; nodeRank++)
         {
-            fn = formatString("%s_node%d.xmd", rootname.c_str(), nodeRank);
-            mdSlave.read(fn);
-            //make sure file is not empty
+            buffer.resize(sizes[nodeRank]);
+            recvBuffer(&buffer[0], sizes[nodeRank], nodeRank);
+            mdSlave.readBuffer(&buffer[0], buffer.size());
+            //make sure metadata is not empty
             if (!mdSlave.isEmpty())
                 mdAll.unionAll(mdSlave);
-            //Remove blockname
-            fn = fn.removeBlockName();
-            remove(fn.c_str());
         }
-        //remove first metadata
-        fn = formatString("%s_node%d.xmd", rootname.c_str(), 1);
-        fn = fn.removeBlockName();
-        remove(fn.c_str());
         MD=mdAll;
     }
+    else
+        sendBuffer(&buffer[0], bufferSize, 0);
+}
+
+/* Messages are sent in pieces of at most INT_MAX bytes since MPI counts are int */
+#define MPI_MAX_CHUNK ((size_t)INT_MAX)
+
+void MpiNode::sendBuffer(const char *buffer, size_t bufferSize, int dest)
+{
+    for (size_t offset = 0; offset < bufferSize; offset += MPI_MAX_CHUNK)
+        MPI_Send((void *)(buffer + offset), (int)XMIPP_MIN(MPI_MAX_CHUNK, bufferSize - offset),
+                 MPI_CHAR, dest, TAG_GATHER_MD, MPI_COMM_WORLD);
+}
+
+void MpiNode::recvBuffer(char *buffer, size_t bufferSize, int source)
+{
+    MPI_Status status;
+    for (size_t offset = 0; offset < bufferSize; offset += MPI_MAX_CHUNK)
+        MPI_Recv(buffer + offset, (int)XMIPP_MIN(MPI_MAX_CHUNK, bufferSize - offset),
+                 MPI_CHAR, source, TAG_GATHER_MD, MPI_COMM_WORLD, &status);
 }
 
 /* -------------------- XmippMPIProgram ---------------------- */
@@ -257,6 +476,8 @@ void XmippMpiProgram::read(int argc, char **argv)
     }
 
     XmippProgram::read(argc, (const char **)argv);
+    if (!profileFile.empty() && node->size > 1)
+        profileFile = profileFile.insertBeforeExtension(formatString("_rank%03d", (int)node->rank));
 }
 
 void XmippMpiProgram::setNode(MpiNode *node)
@@ -268,8 +489,10 @@ void XmippMpiProgram::setNode(MpiNode *node)
 
 int XmippMpiProgram::tryRun()
 {
+    double start = Profiler::now();
     try
     {
+        XMIPP_PROFILE("program_run");
         if (doRun)
             this->run();
     }
@@ -279,6 +502,10 @@ int XmippMpiProgram::tryRun()
         errorCode = xe.__errno;
         MPI_Abort(MPI_COMM_WORLD, xe.__errno);
     }
+    // Every rank writes its own profile file, but only the master
+    // prints the summary on screen
+    if (!profileFile.empty() || node->isMaster())
+        writeProfile(Profiler::now() - start);
     return errorCode;
 }
 
@@ -287,6 +514,8 @@ MpiMetadataProgram::MpiMetadataProgram()
 {
     node = NULL;
     distributor = NULL;
+    masterWorks = false;
+    showStats = false;
 }
 
 MpiMetadataProgram::~MpiMetadataProgram()
@@ -304,12 +533,17 @@ void MpiMetadataProgram::read(int argc, char **argv)
 void MpiMetadataProgram::defineParams()
 {
     addParamsLine("== MPI ==");
-    addParamsLine(" [--mpi_job_size <size=0>]     : Number of images sent simultaneously to a mpi node");
+    addParamsLine(" [--mpi_job_size <size=0>]     : Maximum number of images sent simultaneously to a mpi node");
+    addParamsLine("                               : The blocks get smaller as the job gets to its end");
+    addParamsLine(" [--mpi_master_works]          : The master node also processes images");
+    addParamsLine(" [--mpi_stats]                 : Show the number of images processed by each node");
 }
 
 void MpiMetadataProgram::readParams()
 {
     blockSize = getIntParam("--mpi_job_size");
+    masterWorks = checkParam("--mpi_master_works");
+    showStats = checkParam("--mpi_stats");
 }
 
 void MpiMetadataProgram::createTaskDistributor(MetaData &mdIn,
@@ -323,6 +557,26 @@ void MpiMetadataProgram::createTaskDistributor(MetaData &mdIn,
 
     mdIn.findObjects(imgsId);
     distributor = new MpiTaskDistributor(size, blockSize, node);
+    distributor->setMasterWorks(masterWorks);
+    distributor->setShowStats(showStats);
+
+    // Images from the same stack are given to the same node
+    if (node->isMaster() && mdIn.containsLabel(MDL_IMAGE))
+    {
+        std::vector<size_t> groups(size);
+        FileName fnImg, fnStack, fnPrevious;
+        size_t i = 0, group = 0;
+        FOR_ALL_OBJECTS_IN_METADATA(mdIn)
+        {
+            mdIn.getValue(MDL_IMAGE, fnImg, __iter.objId);
+            fnStack = fnImg.getDecomposedFileName();
+            if (i > 0 && fnStack != fnPrevious)
+                ++group;
+            groups[i++] = group;
+            fnPrevious = fnStack;
+        }
+        distributor->setTaskGroups(groups);
+    }
 }
 
 //Now use the distributor to grasp images
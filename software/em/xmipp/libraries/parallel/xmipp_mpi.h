@@ -52,6 +52,9 @@ public:
 
     //MPI_Comm *comm;
     size_t rank, size, active;//, activeNodes;
+    /** Thread support given by the MPI library.
+     * Threads may call MPI one at a time if it is at least MPI_THREAD_SERIALIZED */
+    int threadLevel;
     MpiNode(int &argc, char **& argv);
     ~MpiNode();
 
@@ -61,9 +64,19 @@ public:
     /** Wait on a barrier for the other MPI nodes */
     void barrierWait();
 
-    /** Gather metadatas */
+    /** Gather metadatas.
+     * The partial metadatas of the workers are sent in memory to the
+     * master (see MetaData::writeBuffer), which joins them in rank order.
+     * The result is only valid in the master.
+     */
     void gatherMetadatas(MetaData &MD, const FileName &rootName);
 
+    /** Send a buffer of any size to another node */
+    void sendBuffer(const char *buffer, size_t bufferSize, int dest);
+
+    /** Receive a buffer of known size from another node */
+    void recvBuffer(char *buffer, size_t bufferSize, int source);
+
     /** Update the MPI communicator to connect the currently active nodes */
 //    void updateComm();
 
@@ -80,11 +93,21 @@ protected:
 
 #define TAG_WORK_REQUEST 100
 #define TAG_WORK_RESPONSE 101
+#define TAG_GATHER_MD 102
 
 /** This class is another implementation of ParallelTaskDistributor with MPI workers.
  * It extends from ThreadTaskDistributor and adds the MPI call
  * for making the distribution and extra locking mechanisms among
  * MPI nodes.
+ *
+ * The tasks are initially split in one contiguous range per node.
+ * Each node is given blocks from the front of its own range, so that
+ * consecutive images (usually from the same stack file) go to the same
+ * node. The block size is guided: it starts at bSize and shrinks as the
+ * job gets to its end, down to minBlockSize. When the range of a node
+ * is exhausted it takes the second half of the largest pending range.
+ * Workers ask for their next block before processing the current one,
+ * so they do not wait for the master's answer.
  */
 class MpiTaskDistributor: public ThreadTaskDistributor
 {
@@ -95,19 +118,75 @@ protected:
 
 public:
     MpiTaskDistributor(size_t nTasks, size_t bSize, MpiNode *node);
+
+    /** Tasks are assigned by distribute, under the lock */
+    virtual bool getTasks(size_t &first, size_t &last);
     /** All nodes wait until distribution is done.
      * In particular, the master node should wait for the distribution thread.
      */
     void wait();
 
+    /** Restart the distribution */
+    virtual void reset();
+
+    /** Minimum number of tasks given in each request (1 by default) */
+    void setMinBlockSize(size_t bSize);
+
+    /** The master also processes tasks.
+     * The master will get tasks (one at a time) from getTasks and it will
+     * answer the workers' requests in between. It must be set in all nodes.
+     */
+    void setMasterWorks(bool masterWorks);
+
+    /** Group of each task (e.g. the stack file of each image).
+     * The initial ranges and the stolen ranges are cut at group changes
+     * whenever possible. Only used in the master.
+     */
+    void setTaskGroups(const std::vector<size_t> &groups);
+
+    /** Show the load balance statistics in the master after the distribution */
+    void setShowStats(bool showStats);
+
+    /** Number of tasks handed out to all the nodes.
+     * In the workers, it is the number known at their last request.
+     */
+    size_t getAssignedTasks() const;
+
 private:
+    size_t minBlockSize;
+    bool masterWorks, showStats;
+    std::vector<size_t> taskGroups;
+
+    // Master side
+    bool initialized;
+    int finalizedWorkers;
+    size_t pendingTasks;
+    std::vector<size_t> rangeBegin, rangeEnd;
+    std::vector<size_t> tasksPerNode, blocksPerNode, stealsPerNode, finishTime;
+    Timer timer;
+
+    // Worker side
+    size_t workBuffer[4];
+    MPI_Request request;
+    bool requestPending;
+
     /** Method that should be called in the master only.
      * It will listen for job requests from nodes, assign tasks and
      * sent the response back
      */
-    bool distributeMaster();
+    bool distributeMaster(size_t &first, size_t &last);
     /** Workers should ask for jobs from master. */
     bool distributeSlaves(size_t &first, size_t &last);
+    /** Split the tasks among the working nodes */
+    void initDistribution();
+    /** Answer the requests of the workers. If wait, until all of them have finished */
+    void serveRequests(bool wait);
+    /** Give a block of tasks to a node */
+    bool assignTasks(int rank, size_t &first, size_t &last);
+    /** Move pos to a close group change in [lo, hi] */
+    size_t alignToGroup(size_t pos, size_t lo, size_t hi) const;
+    /** Show the load balance statistics */
+    void printStats(std::ostream &out) const;
 }
 ;//end of class MpiTaskDistributor
 
@@ -189,6 +268,10 @@ class MpiMetadataProgram: public XmippMpiProgram
 protected:
     /** Divide the job in this number block with this number of images */
     int blockSize;
+    /** The master also processes images */
+    bool masterWorks;
+    /** Show load balance statistics */
+    bool showStats;
     MpiTaskDistributor *distributor;
     std::vector<size_t> imgsId;
     size_t first, last;
@@ -235,6 +318,12 @@ public:\
     }\
     void preProcess()\
     {\
+        if (imageThreads > 1 && node->threadLevel < MPI_THREAD_SERIALIZED)\
+        {\
+            if (node->isMaster())\
+                std::cerr << "Warning: the MPI library does not support threads, using 1 thread" << std::endl;\
+            imageThreads = 1;\
+        }\
         baseClassName::preProcess();\
         MetaData &mdIn = *getInputMd();\
         mdIn.addLabel(MDL_GATHER_ID);\
@@ -254,7 +343,7 @@ public:\
     {\
         if (node->rank==1)\
         {\
-            time_bar_done=first+1;\
+            time_bar_done=XMIPP_MIN(distributor->getAssignedTasks(), distributor->numberOfTasks);\
             baseClassName::showProgress();\
         }\
     }\
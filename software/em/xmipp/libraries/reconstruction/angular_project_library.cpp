@@ -93,6 +93,7 @@ void ProgAngularProjectLibrary::readParams()
         FnexperimentalImages = getParam("--experimental_images");
     fn_groups = getParam("--groups");
     only_winner = checkParam("--only_winner");
+    fn_sampling_cache = checkParam("--sampling_cache") ? getParam("--sampling_cache") : "";
 }
 
 /* Usage ------------------------------------------------------------------- */
@@ -140,6 +141,10 @@ void ProgAngularProjectLibrary::defineParams()
     addParamsLine("  [--groups <selfile=\"\">]     : selfile with groups");
     addParamsLine("  [--only_winner]               : if set each experimental");
     addParamsLine("                                : point will have a unique neighbor");
+    addParamsLine("  [--sampling_cache <file>]     : binary cache with the sampling points not redundant by symmetry.");
+    addParamsLine("                                : It is read if it was computed with the same sampling rate,");
+    addParamsLine("                                : neighborhood and symmetry, and written otherwise.");
+    addParamsLine("                                : Ignored with --perturb or a limited tilt range");
 
     addExampleLine("Sample at 2 degrees and use c6 symmetry:", false);
     addExampleLine("xmipp_angular_project_library -i in.vol -o out.stk --sym c6 --sampling_rate 2");
@@ -281,23 +286,12 @@ void ProgAngularProjectLibrary::run()
     }
     if(angular_distance_bool!=0)
         mysampling.setNeighborhoodRadius(angular_distance);//irrelevant
-    //true -> half_sphere
-    mysampling.computeSamplingPoints(false,max_tilt_angle,min_tilt_angle);
-    //only rank 0
-    //mysampling.createSymFile(fn_sym,symmetry, sym_order);
-    //all nodes
-    mysampling.SL.readSymmetryFile(fn_sym);
-    //store symmetry matrices, this is faster than computing them each time
-    mysampling.fillLRRepository();
     //mpi_barrier here
     //all working nodes must read symmetry file
     //and experimental docfile if apropiate
     //symmetry_file = symmetry + ".sym";
     //SL.readSymmetryFile(symmetry_file)
-    // We first sample The  whole sphere
-    // Then we remove point redundant due to sampling symmetry
-    // use old symmetry, this is geometric does not use L_R
-    mysampling.removeRedundantPoints(symmetry, sym_order);
+    computeNonRedundantSampling();
 
     //=========================
     //======================
@@ -408,6 +402,31 @@ void ProgAngularProjectLibrary::run()
         createGroupSamplingFiles();
 }
 
+void ProgAngularProjectLibrary::computeNonRedundantSampling(bool writeCache)
+{
+    // The cache key does not include the tilt range nor the noise
+    bool useCache = !fn_sampling_cache.empty() &&
+                    perturb_projection_vector == 0 &&
+                    max_tilt_angle >= 180 && min_tilt_angle <= 0;
+
+    mysampling.SL.readSymmetryFile(fn_sym);
+    //store symmetry matrices, this is faster than computing them each time
+    mysampling.fillLRRepository();
+    if (useCache && mysampling.isValidSamplingCache(fn_sampling_cache, fn_sym))
+    {
+        mysampling.readSamplingCache(fn_sampling_cache);
+        return;
+    }
+    //true -> half_sphere
+    mysampling.computeSamplingPoints(false,max_tilt_angle,min_tilt_angle);
+    // We first sample The  whole sphere
+    // Then we remove point redundant due to sampling symmetry
+    // use old symmetry, this is geometric does not use L_R
+    mysampling.removeRedundantPoints(symmetry, sym_order);
+    if (useCache && writeCache)
+        mysampling.saveSamplingCache(fn_sampling_cache, fn_sym);
+}
+
 void ProgAngularProjectLibrary::createGroupSamplingFiles(void)
 {
 
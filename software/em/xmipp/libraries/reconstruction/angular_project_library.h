@@ -120,6 +120,9 @@ public:
     /// symmetry file for heighbors computation
      FileName        fn_sym_neigh;
 
+    /// binary cache with the sampling points not redundant by symmetry
+    FileName        fn_sampling_cache;
+
     /** For infinite groups symmetry order*/
     int sym_order;
     
@@ -169,6 +172,12 @@ public:
     /** Run. */
     void run();
 
+    /** Sample the whole sphere and remove the points redundant by symmetry.
+        The result is read from the sampling cache if it was computed
+        with the same sampling rate, neighborhood and symmetry, and it is
+        written otherwise if writeCache is true. */
+    void computeNonRedundantSampling(bool writeCache = true);
+
 	/** Create separate sampling files for subsets of the -experimental_images docfile */
     void createGroupSamplingFiles(void);
     
@@ -58,6 +58,7 @@ void ProgAngularProjectionMatching::readParams()
         fn_ctf  = getParam("--ctf");
     phase_flipped = checkParam("--phase_flipped");
     threads = getIntParam("--thr");
+    threadPool.setNumberOfThreads(threads);
 
     do_scale = checkParam("--scale");
     if (checkParam("--append"))
@@ -1011,7 +1012,6 @@ void ProgAngularProjectionMatching::processSomeImages(const std::vector<size_t>
     size_t idNew, imgid;
     FileName fn;
     // Call threads to calculate the rotational alignment of each image in the selfile
-    pthread_t * th_ids = (pthread_t *)malloc( threads * sizeof( pthread_t));
     opt_refno = (int *)malloc (sizeof(int)*numOrientations);
     opt_psi   = (double *)calloc (numOrientations, sizeof(double));
     opt_flip = (bool *)calloc (numOrientations, sizeof(bool));
@@ -1057,11 +1057,9 @@ void ProgAngularProjectionMatching::processSomeImages(const std::vector<size_t>
             	opt_scale[i] = 1;
             	opt_refno[i] = -1;
             }
-            pthread_create( (th_ids+c), NULL, threadRotationallyAlignOneImage, (void *)(threads_d+c) );
         }
-        // Wait for threads to finish
-        for( int c = 0 ; c < threads ; c++ )
-            pthread_join(*(th_ids+c),NULL);
+        // The threads synchronize with a barrier, so all of them run at the same time
+        threadPool.runAll(threadRotationallyAlignOneImage, threads_d, threads);
 
         //Get optimal refno, psi, flip and maxcorr
         int * indexThreads = (int *) calloc(threads,sizeof(int));
@@ -1181,7 +1179,6 @@ void ProgAngularProjectionMatching::processSomeImages(const std::vector<size_t>
         //#endif
         //DFo.write("/dev/stderr");
     }//loop over images
-    free(th_ids);
 
     for( int c = 0 ; c < threads ; c++ )
     {
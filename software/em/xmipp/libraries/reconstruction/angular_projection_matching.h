@@ -133,6 +133,8 @@ public:
     bool phase_flipped;
     /** Threads */
     int threads;
+    /** Pool of threads, created once for all images */
+    ThreadPool threadPool;
     //Numbre of possible orientations
     int numOrientations;
     /** Number of translations in 5D search */
@@ -144,6 +144,8 @@ void ARTReconsBase::iterations(GridVolume &vol_basis, int rank)
     // Now iterate ..........................................................
     ProcessorTimeStamp time0;                    // For measuring the elapsed time
     annotate_processor_time(&time0);
+    Timer wallTime, iterationTime;               // Wall clock time
+    wallTime.tic();
     int images=0;
     double mean_error_2ndblock,pow_residual_imgs;
     bool iv_launched=false;
@@ -154,6 +156,7 @@ void ARTReconsBase::iterations(GridVolume &vol_basis, int rank)
         global_mean_error_1stblock = 0;
         POCS.newIteration();
         VC.newIteration();
+        iterationTime.tic();
         if (rank==-1)
         {
             std::cout << "Running iteration " << it << " with lambda= " << artPrm.lambda(it)<< "\n" << std::endl;
@@ -161,8 +164,13 @@ void ARTReconsBase::iterations(GridVolume &vol_basis, int rank)
                 init_progress_bar(artPrm.numIMG);
         }
 
+        // The whole iteration may be run at once by the children
+        bool iterationDone = blockIteration(vol_basis, *ptr_vol_out,
+                                            ART_numIMG, artPrm.lambda(it),
+                                            global_mean_error, images);
+
         // For each projection -----------------------------------------------
-        for (int act_proj = 0; act_proj < artPrm.numIMG ; act_proj++)
+        for (int act_proj = 0; !iterationDone && act_proj < artPrm.numIMG ; act_proj++)
         {
             POCS.newProjection();
 
@@ -503,6 +511,13 @@ void ARTReconsBase::iterations(GridVolume &vol_basis, int rank)
                 *artPrm.fh_hist << "   Global mean squared error: "
                 << global_mean_error/artPrm.numIMG << std::endl;
 
+            double iterationSecs = iterationTime.elapsed()/1000.0;
+            std::cout << "   Iteration time: " << iterationSecs << " secs.";
+            if (iterationSecs > 0)
+                std::cout << " (" << 1.0/iterationSecs << " iterations/sec)";
+            std::cout << std::endl;
+            *artPrm.fh_hist << "   Iteration time: " << iterationSecs << " secs." << std::endl;
+
             if (POCS.apply_POCS)
             {
                 std::cout        << "   POCS Global mean squared error: "
@@ -577,6 +592,7 @@ void ARTReconsBase::iterations(GridVolume &vol_basis, int rank)
     {
         std::cout << "\nTime of " << artPrm.no_it << " iterations: \n";
         print_elapsed_time(time0);
+        wallTime.toc("Wall clock ");
     }
 
     // Finish variability analysis
@@ -598,6 +614,13 @@ void ARTReconsBase::iterations(GridVolume &vol_basis, int rank)
 void ARTReconsBase::singleStep(GridVolume & vol_in, GridVolume *vol_out, Projection & theo_proj, Projection & read_proj, int sym_no, Projection & diff_proj, Projection & corr_proj, Projection & alig_proj, double & mean_error, int numIMG, double lambda, int act_proj, const FileName & fn_ctf, const MultidimArray<int> *maskPtr, bool refine)
 {}
 
+bool ARTReconsBase::blockIteration(GridVolume &vol_in, GridVolume &vol_out,
+                                   int numIMG, double lambda,
+                                   double &global_mean_error, int &images)
+{
+    return false;
+}
+
 void ARTReconsBase::postProcess(GridVolume &vol_basis)
 {}
 
@@ -794,9 +817,38 @@ void SinPartARTRecons::preProcess(GridVolume & vol_basis0, int level, int rank)
 {
     ARTReconsBase::preProcess(vol_basis0, level, rank);
 
+    // SIRT can process several projections in parallel as long as nothing
+    // has to be done to the volume between two projections
+    blockSIRT = artPrm.threads > 1 && artPrm.parallel_mode == BasicARTParameters::SIRT &&
+                !artPrm.threads_per_projection && !artPrm.WLS &&
+                !artPrm.noisy_reconstruction && !artPrm.variability_analysis &&
+                !artPrm.refine && !artPrm.print_system_matrix &&
+                artPrm.goldmask >= 1e6 && !artPrm.shiftedTomograms &&
+                artPrm.diffusionWeight <= -1 &&
+                artPrm.surface_mask == NULL && !artPrm.positivity &&
+                artPrm.force_sym == 0 && artPrm.known_volume == -1 &&
+                !(artPrm.tell & (TELL_MANUAL_ORDER | TELL_ONLY_SYM |
+                                 TELL_SAVE_AT_EACH_STEP | TELL_STATS)) &&
+                !((artPrm.tell & (TELL_SAVE_INTERMIDIATE | TELL_IV)) &&
+                  artPrm.save_intermidiate_every != 0);
+    for (int i = 0; blockSIRT && i < artPrm.numIMG; i++)
+        if (artPrm.IMG_Inf[i].fn_ctf != "")
+            blockSIRT = false;
+    projectThreads = blockSIRT ? 1 : artPrm.threads;
+
+    if (blockSIRT)
+    {
+        thMgr = new ThreadManager(artPrm.threads, this);
+        blockCorrections.resize(artPrm.threads);
+        int blockSize = XMIPP_MAX(artPrm.block_size, 4 * artPrm.threads);
+        blockProjections.resize(blockSize);
+        blockImages.resize(blockSize);
+        blockErrors.resize(blockSize);
+    }
+
     // As this is a threaded implementation, create structures for threads, and
     // create threads
-    if( artPrm.threads > 1 )
+    if( projectThreads > 1 )
     {
         th_ids = (pthread_t *)malloc( artPrm.threads * sizeof( pthread_t));
 
@@ -898,7 +950,7 @@ void SinPartARTRecons::singleStep(GridVolume &vol_in, GridVolume *vol_out,
     project_GridVolume(vol_in, artPrm.basis, theo_proj,
                        corr_proj, YSIZE(read_proj()), XSIZE(read_proj()),
                        read_proj.rot(), read_proj.tilt(), read_proj.psi(), FORWARD, artPrm.eq_mode,
-                       artPrm.GVNeq, A, maskPtr, artPrm.ray_length, artPrm.threads);
+                       artPrm.GVNeq, A, maskPtr, artPrm.ray_length, projectThreads);
 
     if (fn_ctf != "" && artPrm.unmatched)
     {
@@ -1008,7 +1060,7 @@ void SinPartARTRecons::singleStep(GridVolume &vol_in, GridVolume *vol_out,
     project_GridVolume(*vol_out, artPrm.basis, theo_proj,
                        corr_proj, YSIZE(read_proj()), XSIZE(read_proj()),
                        read_proj.rot(), read_proj.tilt(), read_proj.psi(), BACKWARD, artPrm.eq_mode,
-                       artPrm.GVNeq, NULL, maskPtr, artPrm.ray_length, artPrm.threads);
+                       artPrm.GVNeq, NULL, maskPtr, artPrm.ray_length, projectThreads);
 
     // Remove footprints if necessary
     if (remove_footprints)
@@ -1019,13 +1071,131 @@ void SinPartARTRecons::singleStep(GridVolume &vol_in, GridVolume *vol_out,
 }
 
 
+void SinPartARTRecons::blockSIRTThread(ThreadArgument &thArg)
+{
+    SinPartARTRecons *self = (SinPartARTRecons *) thArg.workClass;
+    BasicARTParameters &artPrm = self->artPrm;
+    GridVolume *vol_corr = &(self->blockCorrections[thArg.thread_id]);
+    Projection theo_proj, diff_proj, corr_proj, alig_proj;
+
+    size_t first, last;
+    while (self->blockDistributor->getTasks(first, last))
+        for (size_t n = first; n <= last; ++n)
+        {
+            ReconsInfo &imgInfo = artPrm.IMG_Inf[self->blockImages[n]];
+            self->singleStep(*(self->blockVolIn), vol_corr,
+                             theo_proj, self->blockProjections[n], imgInfo.sym,
+                             diff_proj, corr_proj, alig_proj,
+                             self->blockErrors[n], self->blockNumIMG, self->blockLambda,
+                             (int)n, imgInfo.fn_ctf, NULL, false);
+        }
+}
+
+bool SinPartARTRecons::blockIteration(GridVolume &vol_in, GridVolume &vol_out,
+                                      int numIMG, double lambda,
+                                      double &global_mean_error, int &images)
+{
+    if (!blockSIRT)
+        return false;
+
+    blockVolIn = &vol_in;
+    blockNumIMG = numIMG;
+    blockLambda = lambda;
+    for (size_t t = 0; t < blockCorrections.size(); t++)
+    {
+        blockCorrections[t] = vol_in;
+        blockCorrections[t].initZeros();
+    }
+
+    // For each block of projections
+    int blockSize = blockProjections.size();
+    bool stop = false;
+    int act_proj = 0;
+    while (act_proj < artPrm.numIMG && !stop)
+    {
+        // Read the block
+        int N = 0;
+        for (; N < blockSize && act_proj < artPrm.numIMG; act_proj++)
+        {
+            int iact_proj = artPrm.ordered_list(act_proj);
+            ReconsInfo &imgInfo = artPrm.IMG_Inf[iact_proj];
+            Projection &read_proj = blockProjections[N];
+            read_proj.read(imgInfo.fn_proj, artPrm.apply_shifts, DATA, &imgInfo.row);
+            read_proj().setXmippOrigin();
+            read_proj.setEulerAngles(imgInfo.rot, imgInfo.tilt, imgInfo.psi);
+
+            //skipping if  tilt greater than max_tilt
+            //tilt is in between 0 and 360
+            double aux_tilt=read_proj.tilt();
+            if((aux_tilt > artPrm.max_tilt && aux_tilt < 180.-artPrm.max_tilt) ||
+               (aux_tilt > artPrm.max_tilt + 180 && aux_tilt < 360.-artPrm.max_tilt))
+            {
+                std::cout << "Skipping Proj no: " << iact_proj
+                << "tilt=" << read_proj.tilt()  << std::endl;
+                continue;
+            }
+
+            // Projection extension? .........................................
+            if (artPrm.proj_ext!=0)
+                read_proj().selfWindow(
+                    STARTINGY (read_proj())-artPrm.proj_ext,
+                    STARTINGX (read_proj())-artPrm.proj_ext,
+                    FINISHINGY(read_proj())+artPrm.proj_ext,
+                    FINISHINGX(read_proj())+artPrm.proj_ext);
+
+            blockImages[N++] = iact_proj;
+
+            // Check if algorithm must stop via stop_at
+            if (++images==artPrm.stop_at)
+            {
+                stop = true;
+                act_proj++;
+                break;
+            }
+        }
+
+        // Project and backproject the block
+        ThreadTaskDistributor td(N, 1);
+        blockDistributor = &td;
+        thMgr->run(blockSIRTThread);
+        blockDistributor = NULL;
+
+        // Show results ..................................................
+        for (int n = 0; n < N; n++)
+        {
+            ReconsInfo &imgInfo = artPrm.IMG_Inf[blockImages[n]];
+            global_mean_error += blockErrors[n];
+            *artPrm.fh_hist << imgInfo.fn_proj << ", sym="
+            << imgInfo.sym << "\t\t" << blockErrors[n] << std::endl;
+            if (artPrm.tell&TELL_SHOW_ERROR)
+                std::cout << imgInfo.fn_proj << ", sym="
+                << imgInfo.sym << "\t\t" << blockErrors[n] << std::endl;
+        }
+        if (!(artPrm.tell&TELL_SHOW_ERROR))
+            progress_bar(act_proj);
+    }
+
+    // Add the corrections of all threads
+    for (size_t t = 0; t < blockCorrections.size(); t++)
+        for (size_t i = 0; i < vol_out.VolumesNo(); i++)
+            vol_out(i)() += blockCorrections[t](i)();
+
+    return true;
+}
+
 void SinPartARTRecons::postProcess(GridVolume & vol_basis)
 {
+    if (thMgr != NULL)
+    {
+        delete thMgr;
+        thMgr = NULL;
+    }
+
     // Destroy created threads. This is done in a tricky way. At this point, threads
     // are "slept" waiting for a barrier to be reached by the master thread to continue
     // projecting/backprojecting a new projection. Here we set the flag destroy=true so
     // the threads won't process a projections but will return.
-    if( artPrm.threads > 1 )
+    if( projectThreads > 1 )
     {
         for( int c = 0 ; c < artPrm.threads ; c++ )
         {
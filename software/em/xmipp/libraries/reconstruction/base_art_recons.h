@@ -95,6 +95,18 @@ public:
                             const FileName &fn_ctf, const MultidimArray<int> *maskPtr,
                             bool refine);
 
+    /** Run all the steps of an iteration at once.
+        Children may implement this function to process all the projections
+        of an iteration together (for instance, in parallel blocks). In that
+        case they must update vol_out, accumulate the error of each
+        projection in global_mean_error, increase images with the number of
+        processed projections and return true. If false is returned, the
+        iteration is run projection by projection through singleStep.
+        This default implementation returns false. */
+    virtual bool blockIteration(GridVolume &vol_in, GridVolume &vol_out,
+                                int numIMG, double lambda,
+                                double &global_mean_error, int &images);
+
     /** Finish iterations.
         For WLS: delete residual images
         Else: do nothing. */
@@ -148,9 +160,42 @@ class SinPartARTRecons : public ARTReconsBase
 {
     pthread_t *th_ids;
 
+    /* Block SIRT with threads ------------------------------------------- */
+    // True if the projections of each SIRT iteration are processed in
+    // parallel blocks, each thread with its own correction volume
+    bool blockSIRT;
+    // Threads used inside project_GridVolume by singleStep
+    int projectThreads;
+    // Thread pool for block SIRT
+    ThreadManager *thMgr;
+    // Distributor of the projections of the current block
+    ThreadTaskDistributor *blockDistributor;
+    // Correction accumulated by each thread
+    std::vector<GridVolume> blockCorrections;
+    // Projections of the current block, index in IMG_Inf and error
+    std::vector<Projection> blockProjections;
+    std::vector<int> blockImages;
+    std::vector<double> blockErrors;
+    // Volume being projected, normalizing factor and lambda
+    GridVolume *blockVolIn;
+    int blockNumIMG;
+    double blockLambda;
+
+    /* Thread function of block SIRT */
+    static void blockSIRTThread(ThreadArgument &thArg);
+
 public:
     SinPartARTRecons()
-    {}
+    {
+        th_ids = NULL;
+        blockSIRT = false;
+        projectThreads = 1;
+        thMgr = NULL;
+        blockDistributor = NULL;
+        blockVolIn = NULL;
+        blockNumIMG = 1;
+        blockLambda = 0;
+    }
 
     virtual ~SinPartARTRecons()
     {}
@@ -165,6 +210,18 @@ public:
                             const FileName &fn_ctf, const MultidimArray<int> *maskPtr,
                             bool refine);
 
+    /** Block SIRT.
+        If the reconstruction is a plain SIRT with several threads, the
+        projections are read in blocks and each thread projects and
+        backprojects whole images, accumulating its correction in a volume
+        of its own. The thread corrections are added to vol_out at the end
+        of the iteration. This is mathematically the same as SIRT but scales
+        better than splitting the voxels of every single image among the
+        threads. */
+    bool blockIteration(GridVolume &vol_in, GridVolume &vol_out,
+                        int numIMG, double lambda,
+                        double &global_mean_error, int &images);
+
     void postProcess(GridVolume &vol_basis);
 }
 ;
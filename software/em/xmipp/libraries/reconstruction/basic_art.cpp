@@ -108,6 +108,7 @@ void BasicARTParameters::defaultValues()
     fn_control         = "";
 
     threads            = 1;
+    threads_per_projection = false;
 }
 
 void BasicARTParameters::defineParams(XmippProgram * program, bool mpiMode)
@@ -228,7 +229,9 @@ void BasicARTParameters::defineParams(XmippProgram * program, bool mpiMode)
     program->addParamsLine("   pAVSP                       : Parallel (MPI) Average Strings");
     program->addParamsLine("   pBiCAV                      : Parallel (MPI) Block Iterative CAV");
     program->addParamsLine("   pCAV                        : Parallel (MPI) CAV");
-    program->addParamsLine("   [--block_size <n=1>]        : Number of projections for each block (SART and BiCAV)");
+    program->addParamsLine("   [--block_size <n=1>]        : Number of projections for each block (SART, BiCAV and SIRT with threads)");
+    program->addParamsLine("   [--thr_per_projection]      : In SIRT with threads, project each image with all threads instead of");
+    program->addParamsLine("                               : processing blocks of images in parallel");
 
     program->addParamsLine("==+ Debugging options ==");
     program->addParamsLine("  [--print_system_matrix]      : Print the matrix of the system Ax=b. The format is:");
@@ -398,6 +401,7 @@ void BasicARTParameters::readParams(XmippProgram * program)
         parallel_mode=ART;
 
     block_size = program->getIntParam("--block_size");
+    threads_per_projection = program->checkParam("--thr_per_projection");
     //    fn_control = program->getParam("--control");
 
     // Debugging parameters
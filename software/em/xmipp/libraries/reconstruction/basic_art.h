@@ -263,6 +263,10 @@ public:
     /// Number of threads to use. Can not be different than 1 when using MPI.
     int threads;
 
+    /** In SIRT, use the threads to project each image instead of
+        processing blocks of images in parallel */
+    bool threads_per_projection;
+
 #define TELL_IV                    0x100
 #define TELL_ONLY_SYM              0x80
 #define TELL_USE_INPUT_BASISVOLUME 0x40
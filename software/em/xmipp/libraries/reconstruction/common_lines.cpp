@@ -51,6 +51,7 @@ void ProgCommonLine::readParams() {
 	stepAng = getDoubleParam("--stepAng");
 	mem = getDoubleParam("--mem");
 	Nthr = getIntParam("--thr");
+	threadPool.setNumberOfThreads(Nthr);
 	scaleDistance = checkParam("--scaleDistance");
 	outlierFraction = getDoubleParam("--outlierFraction");
 	Nmpi = 1;
@@ -231,7 +232,6 @@ void ProgCommonLine::getAndPrepareBlock(int i,
 	}
 
 	// Read and preprocess the images
-	pthread_t * th_ids = new pthread_t[Nthr];
 	ThreadPrepareImages * th_args = new ThreadPrepareImages[Nthr];
 	for (int nt = 0; nt < Nthr; nt++) {
 		// Passing parameters to each thread
@@ -240,16 +240,10 @@ void ProgCommonLine::getAndPrepareBlock(int i,
 		th_args[nt].SFi = &SFi;
 		th_args[nt].blockRTFs = &blockRTFs;
 		th_args[nt].blockRTs = &blockRTs;
-		pthread_create((th_ids + nt), NULL, threadPrepareImages,
-				(void *) (th_args + nt));
 	}
-
-	// Waiting for threads to finish
-	for (int nt = 0; nt < Nthr; nt++)
-		pthread_join(*(th_ids + nt), NULL);
+	threadPool.runAll(threadPrepareImages, th_args, Nthr);
 
     // Threads structures are not needed any more
-    delete []th_ids;
     delete []th_args;
 }
 
@@ -366,7 +360,6 @@ void ProgCommonLine::processBlock(int i, int j)
 
 	// Compare all versus all
 	// Read and preprocess the images
-	pthread_t * th_ids = new pthread_t[Nthr];
 	ThreadCompareImages * th_args = new ThreadCompareImages[Nthr];
 	for (int nt = 0; nt < Nthr; nt++) {
 		// Passing parameters to each thread
@@ -386,17 +379,11 @@ void ProgCommonLine::processBlock(int i, int j)
 			th_args[nt].RTFsj = &RTFsi;
 			th_args[nt].RTsj = &RTsi;
 		}
-		pthread_create((th_ids + nt), NULL, threadCompareImages,
-				(void *) (th_args + nt));
 	}
-
-    // Waiting for threads to finish
-    for (int nt = 0; nt < Nthr; nt++)
-        pthread_join(*(th_ids + nt), NULL);
+	threadPool.runAll(threadCompareImages, th_args, Nthr);
 
     // Threads structures are not needed any more
-    delete (th_ids);
-    delete (th_args);
+    delete []th_args;
 }
 
 /* Qualify common lines ---------------------------------------------------- */
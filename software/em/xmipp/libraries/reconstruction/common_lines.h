@@ -83,6 +83,8 @@ public:
     double          mem;
     /// Number of threads
     int             Nthr;
+    /// Pool of threads, created once for all blocks
+    ThreadPool      threadPool;
     /// Number of processors
     int             Nmpi;
     /// MPI Rank
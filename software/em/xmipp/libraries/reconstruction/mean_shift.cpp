@@ -313,7 +313,7 @@ void MeanShiftFilter::apply(MultidimArray<double> &input)
 {
     MultidimArray<double> output(input);
 
-    pthread_t * th_ids = new pthread_t[numThreads];
+    ThreadPool threadPool(numThreads);
     ThreadProcessPlaneArgs * th_args = new ThreadProcessPlaneArgs[numThreads];
 
     for( int iter = 0 ; iter < iters ; ++iter )
@@ -330,14 +330,8 @@ void MeanShiftFilter::apply(MultidimArray<double> &input)
             th_args[nt].input = &input;
             th_args[nt].output = &output;
             th_args[nt].fast = fast;
-
-            pthread_create( (th_ids+nt), NULL, thread_process_plane, (void *)(th_args+nt));
-        }
-
-        for( int nt = 0; nt < numThreads ; nt++ )
-        {
-            pthread_join( *(th_ids+nt), NULL);
         }
+        threadPool.runAll(thread_process_plane, th_args, numThreads);
 
         if( save_iters )
         {
@@ -70,7 +70,7 @@
 //For MPI
 #define IS_MASTER (rank == 0)
 //threads tasks
-typedef enum { TH_EXIT, TH_ESI_REFNO, TH_ESI_UPDATE_REFNO, TH_RR_REFNO, TH_RRR_REFNO, TH_PFS_REFNO } ThreadTask;
+typedef enum { TH_EXIT, TH_ESI_REFNO, TH_ESI_UPDATE_REFNO, TH_RR_REFNO, TH_RRR_REFNO, TH_PFS_REFNO } ML2DThreadTask;
 //output types constants
 typedef enum { OUT_BLOCK, OUT_ITER, OUT_FINAL, OUT_REFS, OUT_IMGS } OutputType;
 
@@ -37,6 +37,8 @@ ProgML2D::ProgML2D()
 {
     do_ML3D = false;
     refs_per_class = 1;
+    prune_mass = 0;
+    prune_full = 5;
 }
 
 
@@ -69,6 +71,17 @@ void ProgML2D::defineParams()
     addExampleLine("xmipp_ml_align2d -i input/images_some.stk --ref input/seeds2.stk --oroot output/ml2d --fast --mirror");
 }
 
+void ProgML2D::defineAdditionalParams(XmippProgram * prog, const char * sectionLine)
+{
+    ML2DBaseProgram::defineAdditionalParams(prog, sectionLine);
+    prog->addParamsLine(" [ --prune <mass=0> <full=5>]   : Skip, for each image, the references with the smallest probabilities");
+    prog->addParamsLine("                                : in the previous iteration, up to this probability mass (e.g. 0.001).");
+    prog->addParamsLine("                                : All references are searched every full iterations.");
+    prog->addParamsLine(":++ With many references most of them have a negligible probability for a given image. Searching");
+    prog->addParamsLine(":++ only the references that accumulated 1-mass of the probability of the image in the previous");
+    prog->addParamsLine(":++ iteration reduces the cost of the expectation step proportionally.");
+}
+
 // Read arguments ==========================================================
 void ProgML2D::readParams()
 {
@@ -140,6 +153,10 @@ void ProgML2D::readParams()
     fix_sigma_noise = checkParam("--fix_sigma_noise");
 
     C_fast = getDoubleParam("-C");
+    prune_mass = getDoubleParam("--prune", 0);
+    prune_full = getIntParam("--prune", 1);
+    if (prune_mass < 0 || prune_mass >= 1 || prune_full < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "--prune: the mass should be in [0,1) and full >= 1");
     save_mem1 = checkParam("--save_memA");
 
     zero_offsets = checkParam("--zero_offsets");
@@ -238,6 +255,10 @@ void ProgML2D::show()
         if (search_rot < 180.)
             std::cout << formatString("    + Limit orientational search to +/- %f degrees", search_rot) << std::endl;
 
+        if (prune_mass > 0)
+            std::cout << formatString("  -> Skip references up to a probability mass of %g (all every %d iterations)",
+                                      prune_mass, prune_full) << std::endl;
+
         if (save_mem1)
             std::cout << "  -> Save_memory A: recalculate real-space rotations in -fast" << std::endl;
 
@@ -438,6 +459,7 @@ void ProgML2D::produceSideInfo2()
     imgs_offsets.clear();
     imgs_oldphi.clear();
     imgs_oldtheta.clear();
+    imgs_significant_refno.clear();
     model.scale.clear();
 
     if (model.do_norm)
@@ -459,6 +481,8 @@ void ProgML2D::produceSideInfo2()
         imgs_optrefno.push_back(0);
         imgs_trymindiff.push_back(-1.);
         imgs_offsets.push_back(Vdum);
+        if (prune_mass > 0)
+            imgs_significant_refno.push_back(std::vector<int>());
         for (int refno = 0; refno < idum; refno++)
         {
             imgs_offsets[IMG_LOCAL_INDEX].push_back(offx);
@@ -668,6 +692,47 @@ void ProgML2D::preselectLimitedDirections(double &phi, double &theta)
 
 }
 
+void ProgML2D::preselectSignificantReferences(const std::vector<int> &significant)
+{
+    if (significant.empty())
+        return;
+    std::vector<double> searched(model.n_ref, 0.);
+    for (size_t i = 0; i < significant.size(); ++i)
+        if (significant[i] < model.n_ref)
+            searched[significant[i]] = pdf_directions[significant[i]];
+    pdf_directions = searched;
+}
+
+void ProgML2D::storeSignificantReferences(std::vector<int> &significant)
+{
+    significant.clear();
+    // In the first iteration, when generating the references, all the
+    // references are still needed for each image
+    if (factor_nref > 1 || sum_refw <= 0)
+        return;
+
+    std::vector<std::pair<double, int> > mass;
+    for (int refno = 0; refno < model.n_ref; refno++)
+    {
+        int output_refno = mygroup * model.n_ref + refno;
+        if (pdf_directions[refno] > 0.)
+            mass.push_back(std::make_pair(-(refw[output_refno] + refw_mirror[output_refno]) / sum_refw, refno));
+    }
+    std::sort(mass.begin(), mass.end());
+
+    // Keep the most probable references until the rest add up to prune_mass
+    double kept = 0.;
+    bool optimal = false;
+    for (size_t i = 0; i < mass.size() && kept < 1. - prune_mass; ++i)
+    {
+        kept -= mass[i].first;
+        significant.push_back(mass[i].second);
+        optimal = optimal || mass[i].second == opt_refno % model.n_ref;
+    }
+    if (!optimal)
+        significant.push_back(opt_refno % model.n_ref);
+}
+
 // Pre-selection of significant refno and ipsi, based on current optimal translation =======
 
 
@@ -1043,7 +1108,7 @@ int ProgML2D::getThreadRefnoJob(int &refno)
 }//close function getThreadRefnoJob
 
 ///Function for awake threads for different tasks
-void ProgML2D::awakeThreads(ThreadTask task, int start_refno, int load)
+void ProgML2D::awakeThreads(ML2DThreadTask task, int start_refno, int load)
 {
     threadTask = task;
     refno_index = start_refno;
@@ -1062,9 +1127,10 @@ void ProgML2D::doThreadRotateReferenceRefno()
 #endif
 
     double AA, stdAA=0., psi, dum, avg;
-    MultidimArray<double> Maux(dim, dim);
+    MultidimArray<double> Maux(dim, dim), Mcoeffs;
     MultidimArray<std::complex<double> > Faux;
     FourierTransformer local_transformer;
+    Matrix2D<double> R;
     int refnoipsi;
 
     Maux.setXmippOrigin();
@@ -1073,12 +1139,15 @@ void ProgML2D::doThreadRotateReferenceRefno()
     {
         computeStats_within_binary_mask(omask, model.Iref[refno](), dum,
                                         dum, avg, dum);
+        // All the rotations of the reference use the same spline coefficients
+        produceSplineCoefficients(BSPLINE3, Mcoeffs, model.Iref[refno]());
         for (size_t ipsi = 0; ipsi < nr_psi; ipsi++)
         {
             refnoipsi = refno * nr_psi + ipsi;
             // Add arbitrary number (small_angle) to avoid 0-degree rotation (lacking interpolation)
             psi = (double) (ipsi * psi_max / nr_psi) + SMALLANGLE;
-            rotate(BSPLINE3, Maux, model.Iref[refno](), -psi, 'Z', WRAP);
+            rotation2DMatrix(-psi, R);
+            applyGeometry(BSPLINE3, Maux, model.Iref[refno](), R, IS_NOT_INV, WRAP, 0., &Mcoeffs);
             apply_binary_mask(mask, Maux, Maux, avg);
             // Normalize the magnitude of the rotated references to 1st rot of that ref
             // This is necessary because interpolation due to rotation can lead to lower overall Fref
@@ -1184,7 +1253,7 @@ void ProgML2D::doThreadPreselectFastSignificantRefno()
     // A. Translate image and calculate probabilities for every rotation
     FOR_ALL_THREAD_REFNO()
     {
-        if (!limit_rot || pdf_directions[refno] > 0.)
+        if (pdf_directions[refno] > 0.)
         {
             A2_plus_Xi2 = 0.5 * (A2[refno] + Xi2);
             for (int imirror = 0; imirror < nr_mirror; imirror++)
@@ -1239,7 +1308,7 @@ void ProgML2D::doThreadPreselectFastSignificantRefno()
     FOR_ALL_THREAD_REFNO_NODECL()
     {
 
-        if (!limit_rot || pdf_directions[refno] > 0.)
+        if (pdf_directions[refno] > 0.)
         {
             for (int imirror = 0; imirror < nr_mirror; imirror++)
             {
@@ -1327,17 +1396,19 @@ void ProgML2D::doThreadExpectationSingleImageRefno()
         local_maxweight = -99.e99;
         local_mindiff = 99.e99;
         local_wsum_sc = local_wsum_sc2 = local_wsum_corr = local_wsum_offset = 0;
-        // Initialize my weighted sums
-        for (size_t ipsi = 0; ipsi < nr_psi; ipsi++)
-        {
-            output_refnoipsi = output_refno * nr_psi + ipsi;
-            mysumimgs[output_refnoipsi] = Fzero;
-            sumw_refpsi[output_refnoipsi] = 0.;
-        }
 
-        // This if is for limited rotation options
-        if (!limit_rot || pdf_directions[refno] > 0.)
+        // This if is for limited rotation options and pruned references,
+        // their weighted sums are not used by doThreadESIUpdateRefno
+        if (pdf_directions[refno] > 0.)
         {
+            // Initialize my weighted sums
+            for (size_t ipsi = 0; ipsi < nr_psi; ipsi++)
+            {
+                output_refnoipsi = output_refno * nr_psi + ipsi;
+                mysumimgs[output_refnoipsi] = Fzero;
+                sumw_refpsi[output_refnoipsi] = 0.;
+            }
+
             if (model.do_norm)
                 ref_scale = opt_scale / model.scale[refno];
 
@@ -1623,7 +1694,8 @@ void ProgML2D::doThreadESIUpdateRefno()
     {
         int output_refno = mygroup * model.n_ref + refno;
 
-        if (fast_mode)
+        // The optimal offsets of the references that were not searched are kept
+        if (fast_mode && pdf_directions[refno] > 0.)
         {
             for (int group = 0; group < factor_nref; group++)
             {
@@ -1654,7 +1726,7 @@ void ProgML2D::doThreadESIUpdateRefno()
             }
         }
 
-        if (!limit_rot || pdf_directions[refno] > 0.)
+        if (pdf_directions[refno] > 0.)
         {
             sumw[output_refno] += (refw[output_refno] + refw_mirror[output_refno]) / sum_refw;
             sumw2[output_refno] += refw2[output_refno] / sum_refw;
@@ -1756,6 +1828,9 @@ void ProgML2D::expectation()
 
     Msignificant.resizeNoCopy(model.n_ref, nr_psi * nr_flip);
 
+    // Every prune_full iterations all references are searched again
+    bool prune = prune_mass > 0 && iter % prune_full != 0;
+
     static size_t img_done;
     if (current_block == 0) //when not iem current block is always 0
     {
@@ -1823,6 +1898,10 @@ void ProgML2D::expectation()
             // For limited orientational search: preselect relevant directions
             preselectLimitedDirections(old_phi, old_theta);
 
+            // Skip the references that were not significant in the previous iteration
+            if (prune)
+                preselectSignificantReferences(imgs_significant_refno[IMG_LOCAL_INDEX]);
+
             // Use a maximum-likelihood target function in real space
             // with complete or reduced-space translational searches (-fast)
             if (fast_mode)
@@ -1844,6 +1923,10 @@ void ProgML2D::expectation()
             // Store opt_refno for next iteration
             imgs_optrefno[IMG_LOCAL_INDEX] = opt_refno;
 
+            // Store the significant references for next iteration
+            if (prune_mass > 0)
+                storeSignificantReferences(imgs_significant_refno[IMG_LOCAL_INDEX]);
+
             // Store optimal phi and theta in memory
             if (limit_rot)
             {
@@ -106,6 +106,17 @@ public:
     /** Sum of squared amplitudes of the experimental image */
     double Xi2;
 
+    /** Probability mass of the references that can be skipped for each image.
+     * 0 means that all references are always searched.
+     */
+    double prune_mass;
+    /** Search all references every prune_full iterations */
+    int prune_full;
+    /** References with significant probability for each image in
+     * the previous iteration (empty means all references)
+     */
+    std::vector<std::vector<int> > imgs_significant_refno;
+
     //These are for refno work assigns to threads
     size_t refno_index, refno_load_param;
     int refno_load, refno_count;
@@ -115,6 +126,8 @@ public:
     void readParams();
     /// Params definition
     void defineParams();
+    /// Add the pruning options to the additional params
+    virtual void defineAdditionalParams(XmippProgram * prog, const char * sectionLine);
 
 public:
     ProgML2D();
@@ -135,9 +148,17 @@ public:
     void reverseRotateReference();
 
     /** Calculate which references have projection directions close to
-        phi and theta */
+        phi and theta. Only references with pdf_directions > 0 are searched. */
     void preselectLimitedDirections(double &phi, double &theta);
 
+    /** Skip the references that are not in the significant list of the image
+        (see prune_mass). An empty list does not skip any reference. */
+    void preselectSignificantReferences(const std::vector<int> &significant);
+
+    /** Store the smallest set of references that accumulate 1-prune_mass of
+        the probability of the current image */
+    void storeSignificantReferences(std::vector<int> &significant);
+
     /** Pre-calculate which model and phi have significant probabilities
        without taking translations into account! */
     void preselectFastSignificant();
@@ -156,7 +177,7 @@ public:
     int getThreadRefnoJob(int &refno);
 
     /// Awake threads for different tasks
-    void awakeThreads(ThreadTask task, int start_refno, int load = 1);
+    void awakeThreads(ML2DThreadTask task, int start_refno, int load = 1);
 
     /// Thread code to parallelize refno loop in rotateReference
     void doThreadRotateReferenceRefno();
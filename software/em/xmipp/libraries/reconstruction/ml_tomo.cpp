@@ -113,6 +113,8 @@ ProgMLTomo::defineParams()
         " [ --maxres <float=0.5> ]       : Maximum resolution (in pixel^-1) to use ");
     addParamsLine(
         " [ --thr <int=1> ]              : Number of shared-memory threads to use in parallel ");
+    addParamsLine(
+        " [ --rotation_cache <MB=1024> ] : Memory to keep the rotated references for all images ");
 
     addParamsLine("==+ Additional options: ==");
     addParamsLine(
@@ -382,6 +384,8 @@ ProgMLTomo::readParams()
 
     // Number of threads
     threads = getIntParam("--thr");
+    threadPool.setNumberOfThreads(threads);
+    rotation_cache = getDoubleParam("--rotation_cache");
 
 }
 
@@ -1458,6 +1462,7 @@ ProgMLTomo::readMissingInfo()
                                      emptyMissingInfo.tgF_y = 0.;
         emptyMissingInfo.nr_pixels = 0.;
         all_missing_info.assign(nr_miss, emptyMissingInfo);
+        all_missing_masks.resize(nr_miss);
 
         int missno = 0;
         String missingType;
@@ -1509,6 +1514,7 @@ ProgMLTomo::readMissingInfo()
             }
 
             getMissingRegion(Mmissing, I, missno);
+            all_missing_masks[missno] = Mmissing;
 
             FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Mcomplete)
             {
@@ -1873,113 +1879,115 @@ ProgMLTomo::postProcessVolume(Image<double> &Vin, double resolution)
 }
 
 // Calculate FT of each reference and calculate A2 =============
+// Sum of squares of the volume of size xdim^3 whose Fourier transform
+// (as given by FourierTransformer) is F, restricted to mask (Parseval)
+static double maskedPower(const MultidimArray<std::complex<double> > &F,
+                          const MultidimArray<unsigned char> &mask, int xdim)
+{
+    double sum = 0.;
+    bool evenX = (xdim % 2 == 0);
+    size_t xlast = xdim / 2;
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(F)
+    if (DIRECT_A3D_ELEM(mask, k, i, j))
+    {
+        // Except for the first (and last) plane, each coefficient also
+        // stands for its Hermitian symmetric
+        double w = (j == 0 || (evenX && j == xlast)) ? 1. : 2.;
+        sum += w * norm(DIRECT_A3D_ELEM(F, k, i, j));
+    }
+    return sum * MULTIDIM_SIZE(F) / XSIZE(F) * xdim;
+}
+
+// Data shared by the threads of precalculateA2
+struct PrecalculateA2Data
+{
+    ProgMLTomo * prm;
+    std::vector<Image<double> > * Iref;
+    std::vector<double> stdAA;
+};
+
+// Rotate the references for a block of (refno, angno) pairs
+static void threadPrecalculateA2(size_t first, size_t last, int thread_id, void * data)
+{
+    PrecalculateA2Data * d = (PrecalculateA2Data *) data;
+    ProgMLTomo * prm = d->prm;
+    int nr_ang = prm->nr_ang, nr_miss = prm->nr_miss;
+    bool need_fourier = !prm->all_Fref_rot.empty() || (prm->do_ml && prm->do_missing);
+    MultidimArray<double> Maux(prm->dim, prm->dim, prm->dim);
+    MultidimArray<std::complex<double> > Faux;
+    FourierTransformer local_transformer;
+    Maux.setXmippOrigin();
+
+    for (size_t rotno = first; rotno <= last; ++rotno)
+    {
+        int refno = rotno / nr_ang, angno = rotno % nr_ang;
+        MultidimArray<double> &Iref_refno = (*d->Iref)[refno]();
+        // use DONT_WRAP and put density of first element outside
+        // i.e. assume volume has been processed with omask
+        Matrix2D<double> A_rot_inv = ((prm->all_angle_info[angno]).A).inv();
+        applyGeometry(LINEAR, Maux, Iref_refno, A_rot_inv, IS_NOT_INV,
+                      DONT_WRAP, DIRECT_MULTIDIM_ELEM(Iref_refno,0));
+
+        double AA = Maux.sum2();
+        double corr = (AA > 0) ? sqrt(d->stdAA[refno] / AA) : 1.;
+        if (need_fourier)
+            local_transformer.FourierTransform(Maux, Faux, false);
+        if (prm->do_ml)
+        {
+            prm->corrA2[rotno] = corr;
+            if (prm->do_missing)
+                for (int missno = 0; missno < nr_miss; ++missno)
+                    prm->A2[rotno * nr_miss + missno] = corr * corr *
+                                                        maskedPower(Faux, prm->all_missing_masks[missno], prm->dim);
+            else
+                prm->A2[rotno] = corr * corr * AA;
+        }
+        if (!prm->all_Fref_rot.empty())
+            prm->all_Fref_rot[rotno] = Faux;
+    }
+}
+
 void
 ProgMLTomo::precalculateA2(std::vector<Image<double> > &Iref)
 {
-
 #ifdef DEBUG
     std::cerr<<"start precalculateA2"<<std::endl;
     TimeStamp t0;
     time_config();
     annotate_time(&t0);
 #endif
-#ifdef DEBUG_JM
 
-    std::cerr << "DEBUG_JM: entering ProgMLTomo::precalculateA2" <<std::endl;
-#endif
+    size_t nr_rot = nr_ref * nr_ang;
+    double cache_size = nr_rot * (double) dim * dim * (hdim + 1)
+                        * sizeof(std::complex<double>) / (1024. * 1024.);
+    all_Fref_rot.clear();
+    if (cache_size <= rotation_cache)
+        all_Fref_rot.resize(nr_rot);
+    corrA2.assign(do_ml ? nr_rot : 0, 1.);
+    A2.assign(do_ml ? nr_rot * (do_missing ? nr_miss : 1) : 0, 0.);
+
+    // Without ML there are no A2 values, the rotations are only kept in the cache
+    if (!do_ml && all_Fref_rot.empty())
+        return;
 
-    double AA, stdAA, corr;
-    Matrix2D<double> A_rot_inv(4, 4), I(4, 4);
+    // The rotated references are normalized to the power of the reference
+    // at the first angle
+    PrecalculateA2Data data;
+    data.prm = this;
+    data.Iref = &Iref;
     MultidimArray<double> Maux(dim, dim, dim);
-    MultidimArray<unsigned char> Mmissing;
-    MultidimArray<std::complex<double> > Faux, Faux2;
-
-    A2.clear();
-    corrA2.clear();
-    I.initIdentity();
     Maux.setXmippOrigin();
     for (int refno = 0; refno < nr_ref; refno++)
     {
         MultidimArray<double> &Iref_refno=Iref[refno]();
-        // Calculate A2 for all different orientations
-        for (int angno = 0; angno < nr_ang; angno++)
-        {
-            A_rot_inv = ((all_angle_info[angno]).A).inv();
-            // use DONT_WRAP and put density of first element outside
-            // i.e. assume volume has been processed with omask
-            applyGeometry(LINEAR, Maux, Iref_refno, A_rot_inv, IS_NOT_INV,
-                          DONT_WRAP, DIRECT_MULTIDIM_ELEM(Iref_refno,0));
-            //#define DEBUG_PRECALC_A2_ROTATE
-#ifdef DEBUG_PRECALC_A2_ROTATE
-
-            Image<double> Vt;
-            Vt()=Maux;
-            Vt.write("rot.vol");
-            Vt()=Iref[refno]();
-            Vt.write("ref.vol");
-            std::cerr<<" angles= "<<(all_angle_info[angno]).rot<<" "<<(all_angle_info[angno]).tilt<<" "<<(all_angle_info[angno]).psi<<std::endl;
-            std::cerr<<" Written volume rot.vol and ref.vol, press any key to continue ..."<<std::endl;
-            char c;
-            std::cin >> c;
-#endif
-
-            AA = Maux.sum2();
-            if (angno == 0)
-                stdAA = AA;
-            if (AA > 0)
-            {
-                corr = sqrt(stdAA / AA);
-                Maux *= corr;
-            }
-            else
-                corr = 1.;
-            corrA2.push_back(corr);
-            if (do_missing)
-            {
-                transformer.FourierTransform(Maux, Faux, false);
-                // Save original copy of Faux in Faux2
-                Faux2=Faux;
-
-                for (int missno = 0; missno < nr_miss; ++missno)
-                {
-                    getMissingRegion(Mmissing, I, missno);
-                    Faux.initZeros();
-                    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
-                    if (DIRECT_MULTIDIM_ELEM(Mmissing,n))
-                        DIRECT_MULTIDIM_ELEM(Faux,n) = DIRECT_MULTIDIM_ELEM(Faux2,n);
-                    transformer.inverseFourierTransform();
-                    A2.push_back(Maux.sum2());
-                    //#define DEBUG_PRECALC_A2
-#ifdef DEBUG_PRECALC_A2
-
-                    std::cerr<<"rot= "<<all_angle_info[angno].rot<<" tilt= "<<all_angle_info[angno].tilt<<" psi= "<<all_angle_info[angno].psi<<std::endl;
-                    std::cerr<<"refno= "<<refno<<" angno= "<<angno<<" missno= "<<missno<<" A2= "<<Maux.sum2()<<" corrA2= "<<corr<<std::endl;
-                    //#define DEBUG_PRECALC_A2_b
-#ifdef DEBUG_PRECALC_A2_b
-
-                    Image<double> tt;
-                    tt()=Maux;
-                    tt.write("refrotwedge.vol");
-                    std::cerr<<"press any key"<<std::endl;
-                    char c;
-                    std::cin >> c;
-#endif
-#endif
-
-                }
-            }
-            else
-            {
-                A2.push_back(Maux.sum2());
-#ifdef DEBUG_PRECALC_A2
-
-                std::cerr<<"refno= "<<refno<<" angno= "<<angno<<" A2= "<<Maux.sum2()<<std::endl;
-#endif
-
-            }
-        }
+        applyGeometry(LINEAR, Maux, Iref_refno, ((all_angle_info[0]).A).inv(), IS_NOT_INV,
+                      DONT_WRAP, DIRECT_MULTIDIM_ELEM(Iref_refno,0));
+        data.stdAA.push_back(Maux.sum2());
     }
 
+    threadPool.parallelFor(nr_rot, XMIPP_MAX(1, nr_rot / (4 * threads)),
+                           threadPrecalculateA2, &data);
+
 #ifdef DEBUG
     std::cerr<<"finished precalculateA2"<<std::endl;
     print_elapsed_time(t0);
@@ -2082,7 +2090,7 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
     if (do_missing)
     {
         // Enforce missing wedge
-        getMissingRegion(Mmissing, I, missno);
+        Mmissing = all_missing_masks[missno];
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
         if (!DIRECT_MULTIDIM_ELEM(Mmissing,n))
             DIRECT_MULTIDIM_ELEM(Faux,n) = complex_zero;
@@ -2175,6 +2183,8 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
             {
                 A_rot = (all_angle_info[angno]).A;
                 A_rot_inv = A_rot.inv();
+                // The rotated missing region is the same for all references
+                bool is_rotated_missing = false;
 
                 // Start the loop over all refno at old_optrefno (=opt_refno from the previous iteration).
                 // This will speed-up things because we will find Pmax probably right away,
@@ -2187,23 +2197,35 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
                         refno -= nr_ref;
 
                     fracpdf = alpha_k(refno) * (1. / nr_ang);
-                    // Now (inverse) rotate the reference and calculate its Fourier transform
-                    // Use DONT_WRAP and assume map has been omasked
-                    applyGeometry(LINEAR, Maux2, Iref[refno](), A_rot_inv, IS_NOT_INV,
-                                  DONT_WRAP, DIRECT_MULTIDIM_ELEM(Iref[refno](),0));
                     mycorrAA = corrA2[refno * nr_ang + angno];
-                    Maux = Maux2 * mycorrAA;
-                    local_transformer.FourierTransform();
+                    if (all_Fref_rot.empty())
+                    {
+                        // Now (inverse) rotate the reference and calculate its Fourier transform
+                        // Use DONT_WRAP and assume map has been omasked
+                        applyGeometry(LINEAR, Maux2, Iref[refno](), A_rot_inv, IS_NOT_INV,
+                                      DONT_WRAP, DIRECT_MULTIDIM_ELEM(Iref[refno](),0));
+                        Maux = Maux2 * mycorrAA;
+                        local_transformer.FourierTransform();
+                        // A. Backward FFT to calculate weights in real-space
+                        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Faux)
+                        {
+                            dAkij(Faux,k,i,j) = dAkij(Fimg0,k,i,j) * conj(dAkij(Faux,k,i,j));
+                        }
+                    }
+                    else
+                    {
+                        // A. The same with the transform of the rotated reference
+                        const MultidimArray<std::complex<double> > &Fref_rot = all_Fref_rot[refno * nr_ang + angno];
+                        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Faux)
+                        {
+                            dAkij(Faux,k,i,j) = dAkij(Fimg0,k,i,j) * conj(dAkij(Fref_rot,k,i,j)) * mycorrAA;
+                        }
+                    }
                     if (do_missing)
                         myA2 = A2[refno * nr_ang * nr_miss + angno * nr_miss + missno];
                     else
                         myA2 = A2[refno * nr_ang + angno];
                     A2_plus_Xi2 = 0.5 * (myA2 + myXi2);
-                    // A. Backward FFT to calculate weights in real-space
-                    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Faux)
-                    {
-                        dAkij(Faux,k,i,j) = dAkij(Fimg0,k,i,j) * conj(dAkij(Faux,k,i,j));
-                    }
                     local_transformer.inverseFourierTransform();
                     CenterFFT(Maux, true);
 
@@ -2304,7 +2326,11 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
                         if (do_missing)
                         {
                             // Store sum of wedges!
-                            getMissingRegion(Mmissing, A_rot, missno);
+                            if (!is_rotated_missing)
+                            {
+                                getMissingRegion(Mmissing, A_rot, missno);
+                                is_rotated_missing = true;
+                            }
                             MultidimArray<double> &mysumweds_refno=mysumweds[refno];
                             FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mmissing)
                             if (DIRECT_MULTIDIM_ELEM(Mmissing,n))
@@ -2373,6 +2399,9 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
     int iran_fsc = ROUND(rnd_unif());
     for (int refno = 0; refno < nr_ref; refno++)
     {
+        // Nothing was accumulated for the references without significant weights
+        if (refw(refno) == 0.)
+            continue;
         sumw(refno) += refw(refno) / sum_refw;
         // Sum mysumimgs to the global weighted sum
         wsumimgs[iran_fsc * nr_ref + refno] += (mysumimgs[refno]) / sum_refw;
@@ -2479,7 +2508,7 @@ ProgMLTomo::maxConstrainedCorrSingleImage(MultidimArray<double> &Mimg,
     if (do_missing)
     {
         // Enforce missing wedge
-        getMissingRegion(Mmissing, I, missno);
+        Mmissing = all_missing_masks[missno];
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mmissing)
         if (!DIRECT_MULTIDIM_ELEM(Mmissing,n))
             DIRECT_MULTIDIM_ELEM(Faux,n)=complex_zero;
@@ -2570,11 +2599,20 @@ ProgMLTomo::maxConstrainedCorrSingleImage(MultidimArray<double> &Mimg,
                     if (refno >= nr_ref)
                         refno -= nr_ref;
 
-                    // Now (inverse) rotate the reference and calculate its Fourier transform
-                    // Use DONT_WRAP because the reference has been omasked
-                    applyGeometry(LINEAR, Maux, Iref[refno](), A_rot_inv, IS_NOT_INV,
-                                  DONT_WRAP, DIRECT_MULTIDIM_ELEM(Iref[refno](),0));
-                    local_transformer.FourierTransform();
+                    if (all_Fref_rot.empty())
+                    {
+                        // Now (inverse) rotate the reference and calculate its Fourier transform
+                        // Use DONT_WRAP because the reference has been omasked
+                        applyGeometry(LINEAR, Maux, Iref[refno](), A_rot_inv, IS_NOT_INV,
+                                      DONT_WRAP, DIRECT_MULTIDIM_ELEM(Iref[refno](),0));
+                        local_transformer.FourierTransform();
+                    }
+                    else
+                    {
+                        const MultidimArray<std::complex<double> > &Fref_rot = all_Fref_rot[refno * nr_ang + angno];
+                        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
+                        DIRECT_MULTIDIM_ELEM(Faux,n) = DIRECT_MULTIDIM_ELEM(Fref_rot,n);
+                    }
                     if (do_missing)
                     {
                         // Enforce wedge on the reference
@@ -2856,14 +2894,13 @@ ProgMLTomo::expectation(MetaData &MDimg, std::vector<Image<double> > &Iref,
     if (do_perturb)
         perturbAngularSampling();
 
-    if (do_ml)
-    {
-        // Precalculate A2-values for all references
+    // Rotate the references (and precalculate A2-values) for all images
+    if (do_ml || !do_only_average)
         precalculateA2(Iref);
 
-        // Pre-calculate pdf of all in-plane transformations
+    // Pre-calculate pdf of all in-plane transformations
+    if (do_ml)
         calculatePdfTranslations();
-    }
 
     // Initialize weighted sums
     LL = 0.;
@@ -2882,7 +2919,6 @@ ProgMLTomo::expectation(MetaData &MDimg, std::vector<Image<double> > &Iref,
     wsumimgs.assign(2 * nr_ref, Mzero2);
     wsumweds.assign(2 * nr_ref, Mzero);
     // Call threads to calculate the expectation of each image in the selfile
-    pthread_t * th_ids = (pthread_t *) malloc(threads * sizeof(pthread_t));
     structThreadExpectationSingleImage * threads_d =
         (structThreadExpectationSingleImage *) malloc(
             threads * sizeof(structThreadExpectationSingleImage));
@@ -2903,15 +2939,11 @@ ProgMLTomo::expectation(MetaData &MDimg, std::vector<Image<double> > &Iref,
         threads_d[c].sumw = &sumw;
         threads_d[c].imgs_id = &imgs_id;
         threads_d[c].distributor = distributor;
-        pthread_create(
-            (th_ids + c), NULL, threadMLTomoExpectationSingleImage, (void *)(threads_d+c) );
     }
     // Wait for threads to finish and get joined MetaData
-    for (int c = 0; c < threads; c++)
-    {
-        pthread_join(*(th_ids + c), NULL);
-    }
+    threadPool.runAll(threadMLTomoExpectationSingleImage, threads_d, threads);
     //Free some memory
+    free(threads_d);
     delete distributor;
 
     //FIXME
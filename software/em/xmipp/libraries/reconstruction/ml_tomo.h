@@ -123,6 +123,13 @@ public:
     MultidimArray<double > docfiledata;
     /** Sum of squared amplitudes of the references */
     std::vector<double> A2, corrA2;
+    /** Fourier transforms of the rotated references (index refno * nr_ang + angno).
+     * They are shared by all the images and computed in precalculateA2, unless
+     * they take more than rotation_cache MB.
+     */
+    std::vector<MultidimArray<std::complex<double> > > all_Fref_rot;
+    /** Maximum memory (in MB) for the rotated references */
+    double rotation_cache;
     /** Stopping criterium */
     double eps;
     /** SelFile images, references and missingregions */
@@ -202,6 +209,8 @@ public:
     int nr_miss;
     /** vector to store all missing info */
     std::vector<MissingInfo> all_missing_info;
+    /** Unrotated missing region of each missing data structure */
+    std::vector<MultidimArray<unsigned char> > all_missing_masks;
 
     // Angular sampling information
     struct AnglesInfo
@@ -242,6 +251,9 @@ public:
     /** Threads */
     int threads;
 
+    /** Pool of threads, created once for all iterations */
+    ThreadPool threadPool;
+
     /** FFTW objects */
     FourierTransformer transformer;
 
@@ -303,7 +315,10 @@ public:
 
     void postProcessVolume(Image<double> &Vin, double resolution = -1.);
 
-    /// Fill vector of matrices with all rotations of reference
+    /** Rotate all references for all angles, in parallel.
+     * Compute A2 and corrA2 (only for ML) and keep the Fourier transforms of
+     * the rotated references in all_Fref_rot if they fit in memory.
+     */
     void precalculateA2(std::vector< Image<double> > &Iref);
 
     /// ML-integration over all hidden parameters
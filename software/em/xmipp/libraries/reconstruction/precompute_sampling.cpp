@@ -96,6 +96,8 @@ void Prog_Sampling_Parameters::run()
     mysampling.SL.isSymmetryGroup(fn_sym, symmetry, sym_order);
     mysampling.removeRedundantPoints(symmetry, sym_order);
     mysampling.createAsymUnitFile(sampling_file_root);
+    //binary copy so that other programs do not need to remove redundant points again
+    mysampling.saveSamplingCache(sampling_file_root + "_sampling.cache", fn_sym);
     //mysampling.computeNeighbors();
     //#define DEBUG6
 #ifdef DEBUG6
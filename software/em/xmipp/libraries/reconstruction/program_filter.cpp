@@ -47,6 +47,10 @@ void ProgFilter::defineParams()
     MedianFilter::defineParams(this);
     BasisFilter::defineParams(this);
     LogFilter::defineParams(this);
+    addParamsLine("== Large images ==");
+    addParamsLine("  [--tile <size=0>]  : Filter each image by tiles of this size, with bounded memory.");
+    addParamsLine("                     : Only for local filters (--median, --log and --background rollingball with radius<=10)");
+    addParamsLine("  [--thr <N=1>]      : Number of threads filtering the tiles, or the image with --median");
 
     //examples
     addExampleLine("Filter a volume using a mask =volumeMask.vol= to remove bad pixels:", false);
@@ -64,6 +68,10 @@ void ProgFilter::defineParams()
     addExampleLine("xmipp_transform_filter  --fourier wedge  -60 60 0 0 10 -i ico.spi -o kk0.spi --verbose --save mask.spi");
     addExampleLine("Preprocess image optained in the nikon coolscan",false);
     addExampleLine("xmipp_transform_filter  --log  -i ico.spi -o kk0.spi --fa 4.431 --fb 0.4018 --fc 336.6");
+    addExampleLine("5x5 median of a gain reference with 8 threads",false);
+    addExampleLine("xmipp_transform_filter  --median --median_radius 2 --thr 8 -i gain.mrc -o gainMedian.mrc");
+    addExampleLine("Median filter of a large micrograph by tiles of 1024x1024 pixels with 8 threads",false);
+    addExampleLine("xmipp_transform_filter  --median -i micrograph.mrc -o filtered.mrc --tile 1024 --thr 8");
 }
 
 void ProgFilter::readParams()
@@ -98,6 +106,14 @@ void ProgFilter::readParams()
         REPORT_ERROR(ERR_ARG_MISSING, "You should provide some filter");
     //Read params
     filter->readParams(this);
+
+    tileSize = getIntParam("--tile");
+    numThreads = getIntParam("--thr");
+    if (tileSize > 0 && filter->tileHalo() < 0)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "This filter cannot be applied by tiles");
+    // By tiles, the threads are used for the tiles
+    if (checkParam("--median") && tileSize <= 0)
+        ((MedianFilter *)filter)->numThreads = numThreads;
 }
 
 void ProgFilter::preProcess()
@@ -108,6 +124,11 @@ void ProgFilter::preProcess()
 
 void ProgFilter::processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut)
 {
+    if (tileSize > 0)
+    {
+        applyFilterByTiles(*filter, fnImg, fnImgOut, tileSize, numThreads);
+        return;
+    }
     Image<double> img;
     img.read(fnImg);
     if (readCTF)
@@ -36,6 +36,12 @@ private:
     // Read CTF
     bool readCTF;
 
+    // Size of the tiles (0 to filter whole images)
+    int tileSize;
+
+    // Threads filtering the tiles, or the image for the median
+    int numThreads;
+
 protected:
     void defineParams();
     void readParams();
@@ -40,6 +40,8 @@ ProgReconsADMM::ProgReconsADMM(): XmippProgram()
 {
 	rank=0;
 	Nprocs=1;
+	Nthreads=1;
+	timeHtb=timeHtKH=timeCG=timePOCS=timeUD=0;
 }
 
 void ProgReconsADMM::defineParams()
@@ -67,6 +69,7 @@ void ProgReconsADMM::defineParams()
     addParamsLine(" [--positivity]: Positivity constraint");
     addParamsLine(" [--sym <s=c1>]: Symmetry constraint");
     addParamsLine(" [--saveIntermediate]: Save Htb and HtKH volumes for posterior calls");
+    addParamsLine(" [--thr <N=1>]: Number of threads for the Fourier transforms");
 
     mask.defineParams(this,INT_MASK);
 }
@@ -96,6 +99,7 @@ void ProgReconsADMM::readParams()
 	Nadmmiter=getIntParam("--admmiter");
 	positivity=checkParam("--positivity");
 	saveIntermediate=checkParam("--saveIntermediate");
+	Nthreads=XMIPP_MAX(1,getIntParam("--thr"));
 
 	applyMask=checkParam("--mask");
 	if (applyMask)
@@ -141,6 +145,8 @@ void ProgReconsADMM::produceSideInfo()
 	kernel.convolveKernelWithItself(0.005);
 
 	// Get Htb reconstruction
+	Timer timer;
+	timer.tic();
 	if (fnHtb=="")
 	{
 		constructHtb();
@@ -152,6 +158,7 @@ void ProgReconsADMM::produceSideInfo()
 		CHtb.read(fnHtb);
 		CHtb().setXmippOrigin();
 	}
+	timeHtb=timer.elapsed();
 
 	// Adjust regularization weights
 	//double Nimgs=mdIn.size();
@@ -171,6 +178,7 @@ void ProgReconsADMM::produceSideInfo()
 
 	// Compute H'*K*H+mu*L^T*L+lambda_1 I
 	Image<double> kernelV;
+	timer.tic();
 	if (fnHtKH=="")
 	{
 		computeHtKH(kernelV());
@@ -182,7 +190,16 @@ void ProgReconsADMM::produceSideInfo()
 		kernelV.read(fnHtKH);
 		kernelV().setXmippOrigin();
 	}
+	timeHtKH=timer.elapsed();
+
+	// All the FFTW plans from here on are multithreaded
 	FourierTransformer transformer;
+	if (Nthreads>1)
+	{
+		transformer.setThreadsNumber(Nthreads);
+		transformerPaddedx.setThreadsNumber(Nthreads);
+		transformerL.setThreadsNumber(Nthreads);
+	}
 	transformer.FourierTransform(kernelV(),fourierKernelV,true);
 
 	// Add regularization in Fourier space
@@ -210,6 +227,15 @@ void ProgReconsADMM::produceSideInfo()
 	ud=ux;
 	transformerL.setReal(ud);
 
+	// Allocate the buffers of the conjugate gradient once
+	paddedx.initZeros(2*ZSIZE(ux)-1,2*YSIZE(ux)-1,2*XSIZE(ux)-1);
+	paddedx.setXmippOrigin();
+	transformerPaddedx.setReal(paddedx);
+	cgR.initZeros(ux);
+	cgP.initZeros(ux);
+	cgAtAp.initZeros(ux);
+	LCk.initZeros(ux);
+
 	// Prepare mask
 	if (applyMask)
 		mask.generate_mask(CHtb());
@@ -228,20 +254,39 @@ void ProgReconsADMM::run()
 	{
 		std::cout << "Running ADMM iterations ..." << std::endl;
 		init_progress_bar(Nadmmiter);
+		Timer timer;
 		for (int iter=0; iter<Nadmmiter; ++iter)
 		{
+			timer.tic();
 			applyConjugateGradient();
+			timeCG+=timer.elapsed();
+			timer.tic();
 			doPOCSProjection();
+			timePOCS+=timer.elapsed();
+			timer.tic();
 			updateUD();
+			timeUD+=timer.elapsed();
 			progress_bar(iter);
 		}
 		progress_bar(Nadmmiter);
 		produceVolume();
 		Vk.write(fnRoot+".vol");
+		if (verbose>0)
+			showTimes();
 	}
 	synchronize();
 }
 
+void ProgReconsADMM::showTimes()
+{
+	std::cout << "Time per phase (secs):" << std::endl
+	<< "   Htb:     " << timeHtb/1000.0 << std::endl
+	<< "   HtKH:    " << timeHtKH/1000.0 << std::endl
+	<< "   CG:      " << timeCG/1000.0 << std::endl
+	<< "   POCS:    " << timePOCS/1000.0 << std::endl
+	<< "   updateUD:" << timeUD/1000.0 << std::endl;
+}
+
 void ProgReconsADMM::constructHtb()
 {
 	size_t xdim, ydim, zdim, ndim;
@@ -491,7 +536,9 @@ void ProgReconsADMM::addRegularizationTerms()
 
 void ProgReconsADMM::applyKernel3D(MultidimArray<double> &x, MultidimArray<double> &AtAx)
 {
-	paddedx.initZeros(2*ZSIZE(x)-1,2*YSIZE(x)-1,2*XSIZE(x)-1);
+	// paddedx is allocated once, so that the FFTW plans are reused
+	paddedx.resizeNoCopy(2*ZSIZE(x)-1,2*YSIZE(x)-1,2*XSIZE(x)-1);
+	paddedx.initZeros();
 	paddedx.setXmippOrigin();
 
 	// Copy Vk into paddedx
@@ -505,10 +552,12 @@ void ProgReconsADMM::applyKernel3D(MultidimArray<double> &x, MultidimArray<doubl
 
 	// Apply kernel
 	double K=MULTIDIM_SIZE(paddedx);
+	std::complex<double> *ptrFourier=MULTIDIM_ARRAY(transformerPaddedx.fFourier);
+	const std::complex<double> *ptrKernel=MULTIDIM_ARRAY(fourierKernelV);
 	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(transformerPaddedx.fFourier)
 	{
-		DIRECT_MULTIDIM_ELEM(transformerPaddedx.fFourier,n)*=DIRECT_MULTIDIM_ELEM(fourierKernelV,n);
-		DIRECT_MULTIDIM_ELEM(transformerPaddedx.fFourier,n)*=K;
+		ptrFourier[n]*=ptrKernel[n];
+		ptrFourier[n]*=K;
 	}
 
 	// Inverse Fourier transform
@@ -550,7 +599,8 @@ void ProgReconsADMM::applyConjugateGradient()
 	//       L the gradient operator
 
 	// Compute H^tb+mu*L^t(u-d)
-	MultidimArray<double> r;
+	// The buffers are members to avoid allocating them at every iteration
+	MultidimArray<double> &r=cgR;
 	applyLtFilter(fourierLx,ux,dx);
 	r=ud;
 	applyLtFilter(fourierLy,uy,dy);
@@ -562,15 +612,15 @@ void ProgReconsADMM::applyConjugateGradient()
 	r+=CHtb();
 
 	// Apply A^tA to the current estimate of the reconstruction
-	MultidimArray<double> AtAVk;
-	applyKernel3D(Ck(),AtAVk);
+	MultidimArray<double> &AtAp=cgAtAp;
+	applyKernel3D(Ck(),AtAp);
 
 	// Compute first residual. This is the negative gradient of ||Ax-b||^2
-	r-=AtAVk;
+	r-=AtAp;
 	double d=r.sum2();
 
 	// Search direction
-	MultidimArray<double> p, AtAp;
+	MultidimArray<double> &p=cgP;
 	p=r;
 
 	// Perform CG iterations
@@ -660,7 +710,6 @@ void ProgReconsADMM::updateUD()
 //	std::cout << "lambda=" << lambda << std::endl;
 //	std::cout << "mu=" << mu << std::endl;
 //	std::cout << "Threshold=" << threshold << std::endl;
-	MultidimArray<double> LCk;
 
 	// Update gradient and Lagrange parameters
 	ud=Ck(); applyLFilter(fourierLx); LCk=ud;
@@ -95,6 +95,7 @@ public:
 	bool saveIntermediate;
 	size_t Nprocs;
 	size_t rank;
+	int Nthreads; // Number of threads for the FFTs
 public:
 	ProgReconsADMM();
     void defineParams();
@@ -141,6 +142,9 @@ public:
     /** Convert from coefficients to voxel volume */
     void produceVolume();
 
+    /** Show the time spent in each phase */
+    void showTimes();
+
     // Share a volume among nodes
     virtual void shareVolume(MultidimArray<double> &V) {}
 
@@ -159,6 +163,12 @@ public:
 	MultidimArray<double> ux, uy, uz, dx, dy, dz, ud;
 	MultidimArray< std::complex<double> > fourierLx, fourierLy, fourierLz;
 	SymList SL;
+
+	// Conjugate gradient and updateUD buffers, allocated once
+	MultidimArray<double> cgR, cgP, cgAtAp, LCk;
+
+	// Time (in ms) spent in each phase
+	size_t timeHtb, timeHtKH, timeCG, timePOCS, timeUD;
 };
 
 //@}
@@ -29,11 +29,16 @@
 ProgRecWbp::ProgRecWbp()
 {
     iter = NULL;
+    thMgr = NULL;
+    blockDistributor = NULL;
+    TSINC = NULL;
+    numThreads = 1;
 }
 
 ProgRecWbp::~ProgRecWbp()
 {
     delete iter;
+    delete thMgr;
 }
 
 // Read arguments ==========================================================
@@ -48,6 +53,7 @@ void ProgRecWbp::readParams()
     sampling = getDoubleParam("--filsam");
     do_all_matrices = checkParam("--use_each_image");
     do_weights = checkParam("--weight");
+    numThreads = XMIPP_MAX(1, getIntParam("--thr"));
 }
 
 // Show ====================================================================
@@ -82,6 +88,8 @@ void ProgRecWbp::show()
         if (do_weights)
             std::cerr << " --> Use weights stored in the image headers"
             << std::endl;
+        if (numThreads > 1)
+            std::cerr << " Number of threads         : " << numThreads << std::endl;
         std::cerr
         << " -----------------------------------------------------------------"
         << std::endl;
@@ -158,7 +166,14 @@ void ProgRecWbp::defineParams()
         "                               :+option of using representative projection directions");
     addParamsLine(
         " [ --weight]                   : Use weights stored in image headers or the input metadata");
+    addParamsLine(
+        " [ --thr <N=1>]                : Number of threads");
+    addParamsLine(
+        "                               :+Images are filtered in parallel and the volume is split");
+    addParamsLine(
+        "                               :+in slices among threads for the backprojection.");
     addExampleLine("xmipp_reconstruct_wbp -i images.sel -o reconstruction.vol");
+    addExampleLine("xmipp_reconstruct_wbp -i images.sel -o reconstruction.vol --thr 4");
 }
 
 void ProgRecWbp::run()
@@ -363,7 +378,8 @@ void ProgRecWbp::getAllMatrices(MetaData &SF)
 
 // Simple backprojection of a single image
 void ProgRecWbp::simpleBackprojection(Projection &img,
-                                      MultidimArray<double> &vol, int diameter)
+                                      MultidimArray<double> &vol, int diameter,
+                                      int firstSlice, int sliceStep)
 {
 	//this should be int not size_t ROB
     int i, j, k, l, m;
@@ -390,7 +406,7 @@ void ProgRecWbp::simpleBackprojection(Projection &img,
     const MultidimArray<double> mImg = img();
     int idim;
     idim = dim;//cast to int from size_t
-    for (i = 0; i < idim; i++)
+    for (i = firstSlice; i < idim; i += sliceStep)
     {
         z = -i + dim2; /*** Z points upwards ***/
         z2 = z * z;
@@ -438,6 +454,12 @@ void ProgRecWbp::simpleBackprojection(Projection &img,
 
 // Calculate the filter in 2D and apply ======================================
 void ProgRecWbp::filterOneImage(Projection &proj, Tabsinc &TSINC)
+{
+    filterOneImage(proj, TSINC, mat_f, count_thr);
+}
+
+void ProgRecWbp::filterOneImage(Projection &proj, Tabsinc &TSINC,
+                                WBPInfo *matF, int &countThr)
 {
     MultidimArray<std::complex<double> > IMG;
     Matrix2D<double> A(3, 3);
@@ -460,8 +482,8 @@ void ProgRecWbp::filterOneImage(Projection &proj, Tabsinc &TSINC)
     double a21 = MAT_ELEM(A,2,1);
     for (int k = 0; k < no_mats; k++)
     {
-        mat_f[k].x = a00 * mat_g[k].x + a10 * mat_g[k].y + a20 * mat_g[k].z;
-        mat_f[k].y = a01 * mat_g[k].x + a11 * mat_g[k].y + a21 * mat_g[k].z;
+        matF[k].x = a00 * mat_g[k].x + a10 * mat_g[k].y + a20 * mat_g[k].z;
+        matF[k].y = a01 * mat_g[k].x + a11 * mat_g[k].y + a21 * mat_g[k].z;
     }
 
     double K = ((double) diameter) / dim;
@@ -472,7 +494,7 @@ void ProgRecWbp::filterOneImage(Projection &proj, Tabsinc &TSINC)
         weight = 0.;
         for (int k = 0; k < no_mats; k++)
         {
-            argum = x * mat_f[k].x + y * mat_f[k].y;
+            argum = x * matF[k].x + y * matF[k].y;
             double daux;
             TSINCVALUE(TSINC, argum, daux);
             weight += mat_g[k].count * daux;
@@ -480,7 +502,7 @@ void ProgRecWbp::filterOneImage(Projection &proj, Tabsinc &TSINC)
 
         if (fabs(weight) < threshold)
         {
-            count_thr++;
+            countThr++;
             A2D_ELEM(IMG, i, j) /= SGN(weight) * (threshold * factor);
         }
         else
@@ -512,15 +534,53 @@ void ProgRecWbp::showProgress()
         progress_bar(time_bar_done);
 }
 
+void ProgRecWbp::threadFilterBlock(ThreadArgument &thArg)
+{
+    ProgRecWbp *self = (ProgRecWbp *) thArg.workClass;
+    WBPInfo *matF = self->mat_f + thArg.thread_id * self->no_mats;
+    int &countThr = self->threadCountThr[thArg.thread_id];
+    Matrix2D<double> A;
+
+    size_t first, last;
+    while (self->blockDistributor->getTasks(first, last))
+        for (size_t n = first; n <= last; ++n)
+        {
+            const WBPImage &info = self->blockInfo[n];
+            Projection &proj = self->blockProj[n];
+            self->readMutex.lock();
+            proj.read(info.fn_img, false);
+            self->readMutex.unlock();
+            proj.setRot(info.rot);
+            proj.setTilt(info.tilt);
+            proj.setPsi(info.psi);
+            proj.setShifts(info.xoff, info.yoff);
+            proj.setFlip(info.flip);
+            proj.setWeight(info.weight);
+            proj.getTransformationMatrix(A, true);
+            if (!A.isIdentity())
+                selfApplyGeometry(BSPLINE3, proj(), A, IS_INV, WRAP);
+            if (self->do_weights)
+                proj() *= proj.weight();
+            proj().setXmippOrigin();
+            self->filterOneImage(proj, *(self->TSINC), matF, countThr);
+        }
+}
+
+void ProgRecWbp::threadBackprojectBlock(ThreadArgument &thArg)
+{
+    ProgRecWbp *self = (ProgRecWbp *) thArg.workClass;
+    MultidimArray<double> &mReconstructedVolume = self->reconstructedVolume();
+    // Each thread owns the slices thread_id, thread_id+threads, ... so that
+    // every voxel receives the images in the same order as sequentially
+    size_t N = self->blockDistributor->numberOfTasks;
+    for (size_t n = 0; n < N; ++n)
+        self->simpleBackprojection(self->blockProj[n], mReconstructedVolume,
+                                   self->diameter, thArg.thread_id, thArg.threads);
+}
+
 // Calculate the filter in 2D and apply ======================================
 void ProgRecWbp::apply2DFilterArbitraryGeometry()
 {
-    double rot, tilt, psi, xoff, yoff, weight;
-    bool flip;
-    Projection proj;
-    Matrix2D<double> L(4, 4), R(4, 4), A;
-    FileName fn_img;
-
     MultidimArray<double> &mReconstructedVolume = reconstructedVolume();
     mReconstructedVolume.initZeros(dim, dim, dim);
     mReconstructedVolume.setXmippOrigin();
@@ -533,32 +593,44 @@ void ProgRecWbp::apply2DFilterArbitraryGeometry()
         init_progress_bar(time_bar_size);
     }
 
-    mat_f = (WBPInfo*) malloc(no_mats * sizeof(WBPInfo));
-    Tabsinc TSINC(0.0001, dim);
-
+    // Auxiliary matrices and threshold counters for each thread
+    mat_f = (WBPInfo*) malloc(numThreads * no_mats * sizeof(WBPInfo));
+    threadCountThr.assign(numThreads, 0);
+    Tabsinc tsinc(0.0001, dim);
+    TSINC = &tsinc;
+    if (thMgr == NULL)
+        thMgr = new ThreadManager(numThreads, this);
+
+    // Images are processed in blocks: first they are read and filtered
+    // in parallel, then they are backprojected in parallel over slices
+    size_t blockSize = 4 * numThreads;
+    blockInfo.resize(blockSize);
+    blockProj.resize(blockSize);
     size_t objId, objIndex;
-    while (getImageToProcess(objId, objIndex))
+    bool moreImages = true;
+    while (moreImages)
     {
-        SF.getValue(MDL_IMAGE, fn_img, objId);
-        proj.read(fn_img, false);
-        getAnglesForImage(objId, rot, tilt, psi, xoff, yoff, flip, weight);
-        proj.setRot(rot);
-        proj.setTilt(tilt);
-        proj.setPsi(psi);
-        proj.setShifts(xoff, yoff);
-        proj.setFlip(flip);
-        proj.setWeight(weight);
-        proj.getTransformationMatrix(A, true);
-        if (!A.isIdentity())
-            selfApplyGeometry(BSPLINE3, proj(), A, IS_INV, WRAP);
-        if (do_weights)
-            proj() *= proj.weight();
-        proj().setXmippOrigin();
-        filterOneImage(proj, TSINC);
-        simpleBackprojection(proj, mReconstructedVolume, diameter);
-
-        showProgress();
+        size_t N = 0;
+        while (N < blockSize && (moreImages = getImageToProcess(objId, objIndex)))
+        {
+            WBPImage &info = blockInfo[N++];
+            SF.getValue(MDL_IMAGE, info.fn_img, objId);
+            getAnglesForImage(objId, info.rot, info.tilt, info.psi,
+                              info.xoff, info.yoff, info.flip, info.weight);
+            showProgress();
+        }
+        if (N == 0)
+            break;
+
+        ThreadTaskDistributor td(N, 1);
+        blockDistributor = &td;
+        thMgr->run(threadFilterBlock);
+        thMgr->run(threadBackprojectBlock);
+        blockDistributor = NULL;
     }
+    for (int t = 0; t < numThreads; ++t)
+        count_thr += threadCountThr[t];
+    TSINC = NULL;
     if (verbose > 0)
         progress_bar(time_bar_size);
 
@@ -48,6 +48,16 @@ typedef struct
 }
 WBPInfo;
 
+typedef struct
+{
+    FileName fn_img; // Image file and its geometry
+    double rot, tilt, psi;
+    double xoff, yoff;
+    bool flip;
+    double weight;
+}
+WBPImage;
+
 /** WBP parameters. */
 class ProgRecWbp: public ProgReconsBase
 {
@@ -85,6 +95,21 @@ public:
     MDIterator * iter;
     /// Reconstructed volume
     Image<double> reconstructedVolume;
+    /// Number of threads
+    int numThreads;
+    /// Thread manager
+    ThreadManager *thMgr;
+    /// Mutex for reading images
+    Mutex readMutex;
+    /// Images of the block being processed
+    std::vector<WBPImage> blockInfo;
+    std::vector<Projection> blockProj;
+    /// Distributor of the images of the block among threads
+    ThreadTaskDistributor *blockDistributor;
+    /// Counter of thresholded pixels of each thread
+    std::vector<int> threadCountThr;
+    /// Table of sinc values for the filter
+    Tabsinc *TSINC;
 public:
 
     ProgRecWbp();
@@ -129,12 +154,24 @@ public:
     void getSampledMatrices(MetaData &SF) ;
 
     // Simple (i.e. unfiltered) backprojection of a single image
+    // Only the slices firstSlice, firstSlice+sliceStep, ... are updated
     void simpleBackprojection(Projection &img, MultidimArray<double> &vol,
-                               int diameter) ;
+                               int diameter, int firstSlice = 0, int sliceStep = 1) ;
 
     // Calculate the filter and apply it to a projection
     void filterOneImage(Projection &proj, Tabsinc &TSINC);
 
+    // Same as above using the given auxiliary matrices and threshold counter
+    void filterOneImage(Projection &proj, Tabsinc &TSINC,
+                        WBPInfo *matF, int &countThr);
+
+    // Thread function: read and filter the images of the block
+    static void threadFilterBlock(ThreadArgument &thArg);
+
+    // Thread function: backproject the images of the block on the
+    // slices of this thread
+    static void threadBackprojectBlock(ThreadArgument &thArg);
+
     // Calculate the filter for arbitrary tilt geometry in 2D and apply
     void apply2DFilterArbitraryGeometry() ;
 };
@@ -343,7 +343,6 @@ void setupAffineFitness(AffineFitness &fitness, const MultidimArray<double> &I1,
     fitness.maxAllowed(4)=fitness.maxAllowed(5)= maxShift;
 }
 
-static pthread_mutex_t globalAffineMutex = PTHREAD_MUTEX_INITIALIZER;
 double computeAffineTransformation(const MultidimArray<unsigned char> &I1,
                                    const MultidimArray<unsigned char> &I2, int maxShift, int maxIterDE,
                                    Matrix2D<double> &A12, Matrix2D<double> &A21, bool show,
@@ -388,8 +387,8 @@ double computeAffineTransformation(const MultidimArray<unsigned char> &I1,
             else
             {
                 // Initialize with cross correlation
+                // (the creation of the FFTW plans is already serialized)
                 double tx, ty;
-                pthread_mutex_lock( &globalAffineMutex );
                 CorrelationAux aux;
                 if (!isMirror)
                     bestShift(I1d,I2d,tx,ty,aux);
@@ -402,7 +401,6 @@ double computeAffineTransformation(const MultidimArray<unsigned char> &I1,
                     bestShift(I1d,auxI2d,tx,ty,aux);
                     ty=-ty;
                 }
-                pthread_mutex_unlock( &globalAffineMutex );
                 A(4)=-tx;
                 A(5)=-ty;
             }
@@ -486,6 +484,7 @@ void ProgTomographAlignment::readParams()
     numThreads = getIntParam("--thr");
     if (numThreads<1)
         numThreads = 1;
+    threadPool.setNumberOfThreads(numThreads);
     lastStep=getIntParam("--lastStep");
 }
 
@@ -577,20 +576,13 @@ void ProgTomographAlignment::defineParams()
 
 /* Produce side info ------------------------------------------------------- */
 static pthread_mutex_t printingMutex = PTHREAD_MUTEX_INITIALIZER;
-struct ThreadComputeTransformParams
-{
-    int myThreadID;
-    ProgTomographAlignment * parent;
-};
 
-void * threadComputeTransform( void * args )
+// Each task is a pair of consecutive images (jj-1,jj). The tasks are
+// taken dynamically by the threads of the pool because the cost of the
+// optimization varies a lot from pair to pair.
+void threadComputeTransform(size_t first, size_t last, int thread_id, void * data)
 {
-    ThreadComputeTransformParams * master =
-        (ThreadComputeTransformParams *) args;
-
-    ProgTomographAlignment * parent = master->parent;
-    int thread_id = master->myThreadID;
-    int localnumThreads = parent->numThreads;
+    ProgTomographAlignment * parent = (ProgTomographAlignment *) data;
     bool isCapillar = parent->isCapillar;
     int Nimg = parent->Nimg;
     double maxShiftPercentage = parent->maxShiftPercentage;
@@ -606,11 +598,10 @@ void * threadComputeTransform( void * args )
     if (isCapillar)
         initjj=0;
 
-    initjj += thread_id;
-
     double cost;
-    for (int jj=initjj; jj<Nimg; jj+= localnumThreads)
+    for (size_t task=first; task<=last; ++task)
     {
+        int jj=initjj+(int)task;
         int jj_1;
         if (isCapillar)
             jj_1=intWRAP(jj-1,0,Nimg-1);
@@ -665,12 +656,10 @@ void * threadComputeTransform( void * args )
             pthread_mutex_lock( &printingMutex );
             std::cout << "Cost for [" << jj_1 << "] - ["
             << jj << "] = " << cost << std::endl;
-            pthread_mutex_unlock( &printingMutex );
             parent->iteration++;
+            pthread_mutex_unlock( &printingMutex );
         }
     }
-
-    return NULL;
 }
 
 void ProgTomographAlignment::computeAffineTransformations(
@@ -679,24 +668,9 @@ void ProgTomographAlignment::computeAffineTransformations(
     bool oldglobalAffine=globalAffine;
     globalAffine=globalAffineToUse;
 
-    pthread_t * th_ids = new pthread_t[numThreads];
-    ThreadComputeTransformParams * th_args = new ThreadComputeTransformParams[numThreads];
-
-    for( int nt = 0 ; nt < numThreads ; nt ++ )
-    {
-        // Passing parameters to each thread
-        th_args[nt].parent = this;
-        th_args[nt].myThreadID = nt;
-        pthread_create( (th_ids+nt) , NULL, threadComputeTransform, (void *)(th_args+nt) );
-    }
-
-    // Waiting for threads to finish
-    for( int nt = 0 ; nt < numThreads ; nt ++ )
-        pthread_join(*(th_ids+nt), NULL);
-
-    // Threads structures are not needed any more
-    delete[] th_ids;
-    delete[] th_args;
+    int Npairs=isCapillar ? Nimg : Nimg-1;
+    if (Npairs>0)
+        threadPool.parallelFor(Npairs, 1, threadComputeTransform, this);
     globalAffine=oldglobalAffine;
 }
 
@@ -1038,353 +1012,346 @@ void ProgTomographAlignment::produceSideInfo()
 
 /* Generate landmark set --------------------------------------------------- */
 //#define DEBUG
+/* The landmarks are tracked from independent starting points (the points
+   of a grid or the images for critical points). Each starting point is a
+   task of the thread pool and its chains are kept apart, so that the final
+   list of chains does not depend on the number of threads. */
 struct ThreadGenerateLandmarkSetParams
 {
-    int myThreadID;
     ProgTomographAlignment * parent;
 
-    std::vector<LandmarkChain> *chainList;
+    // Chains found from each starting point
+    std::vector< std::vector<LandmarkChain> > chainList;
+
+    // Number of starting points already processed
+    size_t done;
 };
 
-void * threadgenerateLandmarkSetGrid( void * args )
+/* Count a processed starting point, the progress is shown by the first
+   thread */
+static void landmarkPointDone(ThreadGenerateLandmarkSetParams * master, int thread_id)
+{
+    size_t done=__sync_add_and_fetch(&master->done, 1);
+    if (thread_id==0)
+        progress_bar(done);
+}
+
+void threadgenerateLandmarkSetGrid(size_t first, size_t last, int thread_id, void * data)
 {
     ThreadGenerateLandmarkSetParams * master =
-        (ThreadGenerateLandmarkSetParams *) args;
+        (ThreadGenerateLandmarkSetParams *) data;
     ProgTomographAlignment * parent = master->parent;
-    int thread_id = master->myThreadID;
     int Nimg=parent->Nimg;
-    int numThreads=parent->numThreads;
     const std::vector< std::vector< Matrix2D<double> > > &affineTransformations=
         parent->affineTransformations;
     int gridSamples=parent->gridSamples;
 
     int deltaShift=(int)floor(XSIZE(*(parent->img)[0])/gridSamples);
-    master->chainList=new std::vector<LandmarkChain>;
     Matrix1D<double> rii(3), rjj(3);
     ZZ(rii)=1;
     ZZ(rjj)=1;
-    if (thread_id==0)
-        init_progress_bar(gridSamples);
     int includedPoints=0;
     Matrix1D<int> visited(Nimg);
-    for (int nx=thread_id; nx<gridSamples; nx+=numThreads)
+    for (size_t n=first; n<=last; ++n)
     {
+        int nx=n/gridSamples;
+        int ny=n%gridSamples;
+        std::vector<LandmarkChain> &chainList=master->chainList[n];
         XX(rii)=STARTINGX(*(parent->img)[0])+ROUND(deltaShift*(0.5+nx));
-        for (int ny=0; ny<gridSamples; ny+=1)
+        YY(rii)=STARTINGY(*(parent->img)[0])+ROUND(deltaShift*(0.5+ny));
+        for (int ii=0; ii<=Nimg-1; ++ii)
         {
-            YY(rii)=STARTINGY(*(parent->img)[0])+ROUND(deltaShift*(0.5+ny));
-            for (int ii=0; ii<=Nimg-1; ++ii)
-            {
-                // Check if inside the mask
-                if (!(*(parent->maskImg[ii]))((int)YY(rii),(int)XX(rii)))
-                    continue;
-                if (parent->isOutlier(ii))
-                    continue;
-
-                LandmarkChain chain;
-                chain.clear();
-                Landmark l;
-                l.x=XX(rii);
-                l.y=YY(rii);
-                l.imgIdx=ii;
-                chain.push_back(l);
-                visited.initZeros();
-                visited(ii)=1;
+            // Check if inside the mask
+            if (!(*(parent->maskImg[ii]))((int)YY(rii),(int)XX(rii)))
+                continue;
+            if (parent->isOutlier(ii))
+                continue;
 
-                // Follow this landmark backwards
-                bool acceptLandmark=true;
-                int jj;
+            LandmarkChain chain;
+            chain.clear();
+            Landmark l;
+            l.x=XX(rii);
+            l.y=YY(rii);
+            l.imgIdx=ii;
+            chain.push_back(l);
+            visited.initZeros();
+            visited(ii)=1;
+
+            // Follow this landmark backwards
+            bool acceptLandmark=true;
+            int jj;
+            if (parent->isCapillar)
+                jj=intWRAP(ii-1,0,Nimg-1);
+            else
+                jj=ii-1;
+            Matrix2D<double> Aij, Aji;
+            Matrix1D<double> rcurrent=rii;
+            while (jj>=0 && acceptLandmark && !visited(jj) &&
+                   !parent->isOutlier(jj))
+            {
+                // Compute the affine transformation between ii and jj
+                int jj_1;
                 if (parent->isCapillar)
-                    jj=intWRAP(ii-1,0,Nimg-1);
+                    jj_1=intWRAP(jj+1,0,Nimg-1);
                 else
-                    jj=ii-1;
-                Matrix2D<double> Aij, Aji;
-                Matrix1D<double> rcurrent=rii;
-                while (jj>=0 && acceptLandmark && !visited(jj) &&
-                       !parent->isOutlier(jj))
+                    jj_1=jj+1;
+                visited(jj)=1;
+                Aij=affineTransformations[jj][jj_1];
+                Aji=affineTransformations[jj_1][jj];
+                rjj=Aji*rcurrent;
+                double corr;
+                acceptLandmark=parent->refineLandmark(jj_1,jj,rcurrent,rjj,
+                                                      corr,true);
+                if (acceptLandmark)
                 {
-                    // Compute the affine transformation between ii and jj
-                    int jj_1;
+                    l.x=XX(rjj);
+                    l.y=YY(rjj);
+                    l.imgIdx=jj;
+                    chain.push_back(l);
                     if (parent->isCapillar)
-                        jj_1=intWRAP(jj+1,0,Nimg-1);
+                        jj=intWRAP(jj-1,0,Nimg-1);
                     else
-                        jj_1=jj+1;
-                    visited(jj)=1;
-                    Aij=affineTransformations[jj][jj_1];
-                    Aji=affineTransformations[jj_1][jj];
-                    rjj=Aji*rcurrent;
-                    double corr;
-                    acceptLandmark=parent->refineLandmark(jj_1,jj,rcurrent,rjj,
-                                                          corr,true);
-                    if (acceptLandmark)
-                    {
-                        l.x=XX(rjj);
-                        l.y=YY(rjj);
-                        l.imgIdx=jj;
-                        chain.push_back(l);
-                        if (parent->isCapillar)
-                            jj=intWRAP(jj-1,0,Nimg-1);
-                        else
-                            jj=jj-1;
-                        rcurrent=rjj;
-                    }
+                        jj=jj-1;
+                    rcurrent=rjj;
                 }
+            }
 
-                // Follow this landmark forward
-                acceptLandmark=true;
+            // Follow this landmark forward
+            acceptLandmark=true;
+            if (parent->isCapillar)
+                jj=intWRAP(ii+1,0,Nimg-1);
+            else
+                jj=ii+1;
+            rcurrent=rii;
+            while (jj<Nimg && acceptLandmark && !visited(jj) &&
+                   !parent->isOutlier(jj))
+            {
+                // Compute the affine transformation between ii and jj
+                int jj_1;
                 if (parent->isCapillar)
-                    jj=intWRAP(ii+1,0,Nimg-1);
+                    jj_1=intWRAP(jj-1,0,Nimg-1);
                 else
-                    jj=ii+1;
-                rcurrent=rii;
-                while (jj<Nimg && acceptLandmark && !visited(jj) &&
-                       !parent->isOutlier(jj))
+                    jj_1=jj-1;
+                visited(jj)=1;
+                Aij=affineTransformations[jj_1][jj];
+                Aji=affineTransformations[jj][jj_1];
+                rjj=Aij*rcurrent;
+                double corr;
+                acceptLandmark=parent->refineLandmark(jj_1,jj,rcurrent,rjj,
+                                                      corr,true);
+                if (acceptLandmark)
                 {
-                    // Compute the affine transformation between ii and jj
-                    int jj_1;
+                    l.x=XX(rjj);
+                    l.y=YY(rjj);
+                    l.imgIdx=jj;
+                    chain.push_back(l);
                     if (parent->isCapillar)
-                        jj_1=intWRAP(jj-1,0,Nimg-1);
+                        jj=intWRAP(jj+1,0,Nimg-1);
                     else
-                        jj_1=jj-1;
-                    visited(jj)=1;
-                    Aij=affineTransformations[jj_1][jj];
-                    Aji=affineTransformations[jj][jj_1];
-                    rjj=Aij*rcurrent;
-                    double corr;
-                    acceptLandmark=parent->refineLandmark(jj_1,jj,rcurrent,rjj,
-                                                          corr,true);
-                    if (acceptLandmark)
-                    {
-                        l.x=XX(rjj);
-                        l.y=YY(rjj);
-                        l.imgIdx=jj;
-                        chain.push_back(l);
-                        if (parent->isCapillar)
-                            jj=intWRAP(jj+1,0,Nimg-1);
-                        else
-                            jj=jj+1;
-                        rcurrent=rjj;
-                    }
+                        jj=jj+1;
+                    rcurrent=rjj;
                 }
+            }
 
 #ifdef DEBUG
-                std::cout << "img=" << ii << " chain length="
-                << chain.size() << " [" << jjleft
-                << " - " << jjright << "]";
+            std::cout << "img=" << ii << " chain length="
+            << chain.size() << " [" << jjleft
+            << " - " << jjright << "]";
 #endif
 
-                if (chain.size()>parent->seqLength)
+            if (chain.size()>parent->seqLength)
+            {
+                double corrChain;
+                bool accepted=parent->refineChain(chain,corrChain);
+                if (accepted)
                 {
-                    double corrChain;
-                    bool accepted=parent->refineChain(chain,corrChain);
-                    if (accepted)
-                    {
 #ifdef DEBUG
-                        std::cout << " Accepted with length= "
-                        << chain.size()
-                        << " [" << chain[0].imgIdx << " - "
-                        << chain[chain.size()-1].imgIdx << "]= ";
-                        for (int i=0; i<chain.size(); i++)
-                            std::cout << chain[i].imgIdx << " ";
+                    std::cout << " Accepted with length= "
+                    << chain.size()
+                    << " [" << chain[0].imgIdx << " - "
+                    << chain[chain.size()-1].imgIdx << "]= ";
+                    for (int i=0; i<chain.size(); i++)
+                        std::cout << chain[i].imgIdx << " ";
 #endif
 
-                        master->chainList->push_back(chain);
-                        includedPoints+=chain.size();
-                    }
+                    chainList.push_back(chain);
+                    includedPoints+=chain.size();
                 }
+            }
 #ifdef DEBUG
-                std::cout << std::endl;
+            std::cout << std::endl;
 #endif
 
-            }
+        }
 #ifdef DEBUG
-            std::cout << "Point nx=" << nx << " ny=" << ny
-            << " Number of points="
-            << includedPoints
-            << " Number of chains=" << master->chainList->size()
-            << " ( " << ((double) includedPoints)/
-            master->chainList->size() << " )\n";
+        std::cout << "Point nx=" << nx << " ny=" << ny
+        << " Number of points="
+        << includedPoints
+        << " Number of chains=" << chainList.size()
+        << " ( " << ((double) includedPoints)/
+        chainList.size() << " )\n";
 #endif
 
-        }
-        if (thread_id==0)
-            progress_bar(nx);
+        landmarkPointDone(master, thread_id);
     }
-    if (thread_id==0)
-        progress_bar(gridSamples);
-    return NULL;
 }
 
-void * threadgenerateLandmarkSetBlind( void * args )
+void threadgenerateLandmarkSetBlind(size_t first, size_t last, int thread_id, void * data)
 {
     ThreadGenerateLandmarkSetParams * master =
-        (ThreadGenerateLandmarkSetParams *) args;
+        (ThreadGenerateLandmarkSetParams *) data;
     ProgTomographAlignment * parent = master->parent;
-    int thread_id = master->myThreadID;
     int Nimg=parent->Nimg;
-    int numThreads=parent->numThreads;
     const std::vector< std::vector< Matrix2D<double> > > &affineTransformations=
         parent->affineTransformations;
     int gridSamples=parent->gridSamples;
 
     int deltaShift=(int)floor(XSIZE(*(parent->img)[0])/gridSamples);
-    master->chainList=new std::vector<LandmarkChain>;
     Matrix1D<double> rii(3), rjj(3);
     ZZ(rii)=1;
     ZZ(rjj)=1;
-    if (thread_id==0)
-        init_progress_bar(gridSamples);
     int includedPoints=0;
     int maxSideLength=(parent->blindSeqLength-1)/2;
-    for (int nx=thread_id; nx<gridSamples; nx+=numThreads)
+    for (size_t n=first; n<=last; ++n)
     {
+        int nx=n/gridSamples;
+        int ny=n%gridSamples;
+        std::vector<LandmarkChain> &chainList=master->chainList[n];
         XX(rii)=STARTINGX(*(parent->img)[0])+ROUND(deltaShift*(0.5+nx));
-        for (int ny=0; ny<gridSamples; ny+=1)
+        YY(rii)=STARTINGY(*(parent->img)[0])+ROUND(deltaShift*(0.5+ny));
+        for (int ii=0; ii<=Nimg-1; ++ii)
         {
-            YY(rii)=STARTINGY(*(parent->img)[0])+ROUND(deltaShift*(0.5+ny));
-            for (int ii=0; ii<=Nimg-1; ++ii)
-            {
-                // Check if inside the mask
-                if (!(*(parent->maskImg[ii]))((int)YY(rii),(int)XX(rii)))
-                    continue;
-                if (parent->isOutlier(ii))
-                    continue;
-
-                LandmarkChain chain;
-                chain.clear();
-                Landmark l;
-                l.x=XX(rii);
-                l.y=YY(rii);
-                l.imgIdx=ii;
-                chain.push_back(l);
+            // Check if inside the mask
+            if (!(*(parent->maskImg[ii]))((int)YY(rii),(int)XX(rii)))
+                continue;
+            if (parent->isOutlier(ii))
+                continue;
+
+            LandmarkChain chain;
+            chain.clear();
+            Landmark l;
+            l.x=XX(rii);
+            l.y=YY(rii);
+            l.imgIdx=ii;
+            chain.push_back(l);
 
-                // Follow this landmark backwards
-                bool acceptLandmark=true;
-                int jj;
-                int sideLength=0;
+            // Follow this landmark backwards
+            bool acceptLandmark=true;
+            int jj;
+            int sideLength=0;
+            if (parent->isCapillar)
+                jj=intWRAP(ii-1,0,Nimg-1);
+            else
+                jj=ii-1;
+            Matrix2D<double> Aij, Aji;
+            Matrix1D<double> rcurrent=rii;
+            while (jj>=0 && acceptLandmark && sideLength<maxSideLength &&
+                   !parent->isOutlier(jj))
+            {
+                // Compute the affine transformation between ii and jj
+                int jj_1;
                 if (parent->isCapillar)
-                    jj=intWRAP(ii-1,0,Nimg-1);
+                    jj_1=intWRAP(jj+1,0,Nimg-1);
+                else
+                    jj_1=jj+1;
+                Aij=affineTransformations[jj][jj_1];
+                Aji=affineTransformations[jj_1][jj];
+                rjj=Aji*rcurrent;
+                int iYYrjj=(int)YY(rjj);
+                int iXXrjj=(int)XX(rjj);
+                if (!(*(parent->maskImg[jj])).outside(iYYrjj,iXXrjj))
+                    acceptLandmark=(*(parent->maskImg[jj]))(iYYrjj,iXXrjj);
                 else
-                    jj=ii-1;
-                Matrix2D<double> Aij, Aji;
-                Matrix1D<double> rcurrent=rii;
-                while (jj>=0 && acceptLandmark && sideLength<maxSideLength &&
-                       !parent->isOutlier(jj))
+                    acceptLandmark=false;
+                if (acceptLandmark)
                 {
-                    // Compute the affine transformation between ii and jj
-                    int jj_1;
+                    l.x=XX(rjj);
+                    l.y=YY(rjj);
+                    l.imgIdx=jj;
+                    chain.push_back(l);
                     if (parent->isCapillar)
-                        jj_1=intWRAP(jj+1,0,Nimg-1);
+                        jj=intWRAP(jj-1,0,Nimg-1);
                     else
-                        jj_1=jj+1;
-                    Aij=affineTransformations[jj][jj_1];
-                    Aji=affineTransformations[jj_1][jj];
-                    rjj=Aji*rcurrent;
-                    int iYYrjj=(int)YY(rjj);
-                    int iXXrjj=(int)XX(rjj);
-                    if (!(*(parent->maskImg[jj])).outside(iYYrjj,iXXrjj))
-                        acceptLandmark=(*(parent->maskImg[jj]))(iYYrjj,iXXrjj);
-                    else
-                        acceptLandmark=false;
-                    if (acceptLandmark)
-                    {
-                        l.x=XX(rjj);
-                        l.y=YY(rjj);
-                        l.imgIdx=jj;
-                        chain.push_back(l);
-                        if (parent->isCapillar)
-                            jj=intWRAP(jj-1,0,Nimg-1);
-                        else
-                            jj=jj-1;
-                        rcurrent=rjj;
-                        sideLength++;
-                    }
+                        jj=jj-1;
+                    rcurrent=rjj;
+                    sideLength++;
                 }
+            }
 
-                // Follow this landmark forward
-                acceptLandmark=true;
+            // Follow this landmark forward
+            acceptLandmark=true;
+            if (parent->isCapillar)
+                jj=intWRAP(ii+1,0,Nimg-1);
+            else
+                jj=ii+1;
+            rcurrent=rii;
+            sideLength=0;
+            while (jj<Nimg && acceptLandmark && sideLength<maxSideLength &&
+                   !parent->isOutlier(jj))
+            {
+                // Compute the affine transformation between ii and jj
+                int jj_1;
                 if (parent->isCapillar)
-                    jj=intWRAP(ii+1,0,Nimg-1);
+                    jj_1=intWRAP(jj-1,0,Nimg-1);
+                else
+                    jj_1=jj-1;
+                Aij=affineTransformations[jj_1][jj];
+                Aji=affineTransformations[jj][jj_1];
+                rjj=Aij*rcurrent;
+                int iYYrjj=(int)YY(rjj);
+                int iXXrjj=(int)XX(rjj);
+                if (!(*(parent->maskImg[jj])).outside(iYYrjj,iXXrjj))
+                    acceptLandmark=(*(parent->maskImg[jj]))(iYYrjj,iXXrjj);
                 else
-                    jj=ii+1;
-                rcurrent=rii;
-                sideLength=0;
-                while (jj<Nimg && acceptLandmark && sideLength<maxSideLength &&
-                       !parent->isOutlier(jj))
+                    acceptLandmark=false;
+                if (acceptLandmark)
                 {
-                    // Compute the affine transformation between ii and jj
-                    int jj_1;
+                    l.x=XX(rjj);
+                    l.y=YY(rjj);
+                    l.imgIdx=jj;
+                    chain.push_back(l);
                     if (parent->isCapillar)
-                        jj_1=intWRAP(jj-1,0,Nimg-1);
-                    else
-                        jj_1=jj-1;
-                    Aij=affineTransformations[jj_1][jj];
-                    Aji=affineTransformations[jj][jj_1];
-                    rjj=Aij*rcurrent;
-                    int iYYrjj=(int)YY(rjj);
-                    int iXXrjj=(int)XX(rjj);
-                    if (!(*(parent->maskImg[jj])).outside(iYYrjj,iXXrjj))
-                        acceptLandmark=(*(parent->maskImg[jj]))(iYYrjj,iXXrjj);
+                        jj=intWRAP(jj+1,0,Nimg-1);
                     else
-                        acceptLandmark=false;
-                    if (acceptLandmark)
-                    {
-                        l.x=XX(rjj);
-                        l.y=YY(rjj);
-                        l.imgIdx=jj;
-                        chain.push_back(l);
-                        if (parent->isCapillar)
-                            jj=intWRAP(jj+1,0,Nimg-1);
-                        else
-                            jj=jj+1;
-                        rcurrent=rjj;
-                        sideLength++;
-                    }
+                        jj=jj+1;
+                    rcurrent=rjj;
+                    sideLength++;
                 }
+            }
 
 #ifdef DEBUG
-                std::cout << "img=" << ii << " chain length="
-                << chain.size() << " [" << jjleft
-                << " - " << jjright << "]\n";
+            std::cout << "img=" << ii << " chain length="
+            << chain.size() << " [" << jjleft
+            << " - " << jjright << "]\n";
 #endif
 
-                master->chainList->push_back(chain);
-                includedPoints+=chain.size();
-            }
+            chainList.push_back(chain);
+            includedPoints+=chain.size();
+        }
 #ifdef DEBUG
-            std::cout << "Point nx=" << nx << " ny=" << ny
-            << " Number of points="
-            << includedPoints
-            << " Number of chains=" << master->chainList->size()
-            << " ( " << ((double) includedPoints)/
-            master->chainList->size() << " )\n";
+        std::cout << "Point nx=" << nx << " ny=" << ny
+        << " Number of points="
+        << includedPoints
+        << " Number of chains=" << chainList.size()
+        << " ( " << ((double) includedPoints)/
+        chainList.size() << " )\n";
 #endif
 
-        }
-        if (thread_id==0)
-            progress_bar(nx);
+        landmarkPointDone(master, thread_id);
     }
-    if (thread_id==0)
-        progress_bar(gridSamples);
-    return NULL;
 }
 
 //#define DEBUG
-void * threadgenerateLandmarkSetCriticalPoints( void * args )
+void threadgenerateLandmarkSetCriticalPoints(size_t first, size_t last, int thread_id, void * data)
 {
     ThreadGenerateLandmarkSetParams * master =
-        (ThreadGenerateLandmarkSetParams *) args;
+        (ThreadGenerateLandmarkSetParams *) data;
     ProgTomographAlignment * parent = master->parent;
-    int thread_id = master->myThreadID;
     int Nimg=parent->Nimg;
-    int numThreads=parent->numThreads;
     const std::vector< std::vector< Matrix2D<double> > > &affineTransformations=
         parent->affineTransformations;
 
-    master->chainList=new std::vector<LandmarkChain>;
     std::vector<LandmarkChain> candidateChainList;
-    if (thread_id==0)
-        init_progress_bar(Nimg);
     int halfSeqLength=parent->seqLength/2;
 
     // Design a mask for the dilation
@@ -1395,10 +1362,14 @@ void * threadgenerateLandmarkSetCriticalPoints( void * args )
     BinaryCircularMask(mask,4,OUTSIDE_MASK);
 
     Image<double> I;
-    for (int ii=thread_id; ii<=Nimg-1; ii+=numThreads)
+    for (int ii=(int)first; ii<=(int)last; ++ii)
     {
         if (parent->isOutlier(ii))
+        {
+            landmarkPointDone(master, thread_id);
             continue;
+        }
+        std::vector<LandmarkChain> &chainList=master->chainList[ii];
         I.read(parent->name_list[ii]);
 
         // Generate mask
@@ -1550,8 +1521,7 @@ void * threadgenerateLandmarkSetCriticalPoints( void * args )
             parent->refineChain(chain,corrQ(q));
             candidateChainList.push_back(chain);
         }
-        if (thread_id==0)
-            progress_bar(ii);
+        landmarkPointDone(master, thread_id);
 
         // Sort all chains according to its correlation
         MultidimArray<int> idx;
@@ -1562,7 +1532,7 @@ void * threadgenerateLandmarkSetCriticalPoints( void * args )
             int q=idx(XSIZE(idx)-1-iq)-1;
             if (corrQ(q)>0.5)
             {
-                master->chainList->push_back(candidateChainList[q]);
+                chainList.push_back(candidateChainList[q]);
 #ifdef DEBUG
 
                 std::cout << "Corr " << iq << ": " << corrQ(q) << ":";
@@ -1614,9 +1584,6 @@ void * threadgenerateLandmarkSetCriticalPoints( void * args )
 #endif
 
     }
-    if (thread_id==0)
-        progress_bar(Nimg);
-    return NULL;
 }
 #undef DEBUG
 
@@ -1638,65 +1605,54 @@ ProgTomographAlignment::~ProgTomographAlignment()
     }
 }
 
+// Add the chains of all starting points to the list, in order
+static void appendChains(const std::vector< std::vector<LandmarkChain> > &pointChains,
+                         std::vector<LandmarkChain> &chainList, int &includedPoints)
+{
+    for (size_t n=0; n<pointChains.size(); n++)
+        for (size_t i=0; i<pointChains[n].size(); i++)
+        {
+            chainList.push_back(pointChains[n][i]);
+            includedPoints+=pointChains[n][i].size();
+        }
+}
+
 void ProgTomographAlignment::generateLandmarkSet()
 {
     FileName fn_tmp = fnRoot+"_landmarks.txt";
     if (!fn_tmp.exists())
     {
-        pthread_t * th_ids = new pthread_t[numThreads];
-        ThreadGenerateLandmarkSetParams * th_args=
-            new ThreadGenerateLandmarkSetParams[numThreads];
-        for( int nt = 0 ; nt < numThreads ; nt ++ )
-        {
-            th_args[nt].parent = this;
-            th_args[nt].myThreadID = nt;
-            if (useCriticalPoints)
-                pthread_create( (th_ids+nt) , NULL, threadgenerateLandmarkSetCriticalPoints, (void *)(th_args+nt) );
-            else
-                pthread_create( (th_ids+nt) , NULL, threadgenerateLandmarkSetGrid, (void *)(th_args+nt) );
-        }
-
         std::vector<LandmarkChain> chainList;
         int includedPoints=0;
-        for( int nt = 0 ; nt < numThreads ; nt ++ )
+        ThreadGenerateLandmarkSetParams th_args;
+        th_args.parent = this;
+        th_args.done = 0;
+        if (useCriticalPoints)
         {
-            pthread_join(*(th_ids+nt), NULL);
-            int imax=th_args[nt].chainList->size();
-            for (int i=0; i<imax; i++)
-            {
-                chainList.push_back((*th_args[nt].chainList)[i]);
-                includedPoints+=(*th_args[nt].chainList)[i].size();
-            }
-            delete th_args[nt].chainList;
+            th_args.chainList.resize(Nimg);
+            init_progress_bar(Nimg);
+            threadPool.parallelFor(Nimg, 1, threadgenerateLandmarkSetCriticalPoints, &th_args);
+            progress_bar(Nimg);
+        }
+        else
+        {
+            th_args.chainList.resize(gridSamples*gridSamples);
+            init_progress_bar(gridSamples*gridSamples);
+            threadPool.parallelFor(gridSamples*gridSamples, 1, threadgenerateLandmarkSetGrid, &th_args);
+            progress_bar(gridSamples*gridSamples);
         }
-        delete( th_ids );
-        delete( th_args );
+        appendChains(th_args.chainList, chainList, includedPoints);
 
         // Add blind landmarks
         if (blindSeqLength>0)
         {
-            th_ids  = new pthread_t[numThreads];
-            th_args = new ThreadGenerateLandmarkSetParams[numThreads];
-            for( int nt = 0 ; nt < numThreads ; nt ++ )
-            {
-                th_args[nt].parent = this;
-                th_args[nt].myThreadID = nt;
-                pthread_create( (th_ids+nt) , NULL, threadgenerateLandmarkSetBlind, (void *)(th_args+nt) );
-            }
-
-            for( int nt = 0 ; nt < numThreads ; nt ++ )
-            {
-                pthread_join(*(th_ids+nt), NULL);
-                int imax=th_args[nt].chainList->size();
-                for (int i=0; i<imax; i++)
-                {
-                    chainList.push_back((*th_args[nt].chainList)[i]);
-                    includedPoints+=(*th_args[nt].chainList)[i].size();
-                }
-                delete th_args[nt].chainList;
-            }
-            delete( th_ids );
-            delete( th_args );
+            th_args.chainList.clear();
+            th_args.chainList.resize(gridSamples*gridSamples);
+            th_args.done = 0;
+            init_progress_bar(gridSamples*gridSamples);
+            threadPool.parallelFor(gridSamples*gridSamples, 1, threadgenerateLandmarkSetBlind, &th_args);
+            progress_bar(gridSamples*gridSamples);
+            appendChains(th_args.chainList, chainList, includedPoints);
         }
 
         // Generate the landmark "matrix"
@@ -2243,6 +2199,87 @@ void ProgTomographAlignment::writeTransformations(
 }
 
 /* Align images ------------------------------------------------------------ */
+/* Apply M to an image, set to 0 the pixels that come from outside of it and,
+   unless dontNormalize, subtract the average of the rest */
+static void correctImage(MultidimArray<double> &I, const Matrix2D<double> &M,
+                         bool dontNormalize)
+{
+    MultidimArray<double> mask;
+    MultidimArray<int> iMask;
+    mask.initZeros(I);
+    FOR_ALL_ELEMENTS_IN_ARRAY2D(I)
+    if (I(i,j)!=0)
+        mask(i,j)=1;
+    selfApplyGeometry(BSPLINE3,I,M,IS_NOT_INV,DONT_WRAP);
+    selfApplyGeometry(LINEAR,mask,M,IS_NOT_INV,DONT_WRAP);
+    mask.binarize(0.5);
+    typeCast(mask,iMask);
+    double minval, maxval, avg, stddev;
+    computeStats_within_binary_mask(iMask,I,minval, maxval, avg, stddev);
+    FOR_ALL_ELEMENTS_IN_ARRAY2D(iMask)
+    if (iMask(i,j)==0)
+        I(i,j)=0;
+    else if (!dontNormalize)
+        I(i,j)-=avg;
+}
+
+/* Data shared by the threads of alignImages */
+struct AlignImagesParams
+{
+    ProgTomographAlignment * parent;
+    const Alignment * alignment;
+
+    // Height of the landmarks at 0 degrees
+    double z0;
+
+    // Index of the first image of the current block
+    int first;
+
+    // Corrected images of the block, and their originals
+    std::vector< Image<double> > corrected, correctedOrig;
+
+    // Filenames of the originals of the block
+    std::vector<FileName> fnOrig;
+};
+
+/* Each task corrects an image of the current block of alignImages, and its
+   original if there are originals */
+void threadAlignImages(size_t first, size_t last, int thread_id, void * data)
+{
+    AlignImagesParams * master = (AlignImagesParams *) data;
+    ProgTomographAlignment * parent = master->parent;
+    const Alignment &alignment = *(master->alignment);
+    Matrix2D<double> M, M1, M2, M3;
+    for (size_t b=first; b<=last; ++b)
+    {
+        int n=master->first+b;
+        double tilt=parent->tiltList[n];
+
+        // Align the normal image
+        Image<double> &I=master->corrected[b];
+        I.read(parent->name_list[n]);
+        translation2DMatrix(vectorR2(-master->z0*sin(DEG2RAD(tilt)),0),M1);
+        rotation2DMatrix(90-alignment.rot+alignment.psi(n),M2);
+        translation2DMatrix(-(alignment.di[n]+alignment.diaxis[n]),M3);
+        M=M1*M2*M3;
+        correctImage(I(),M,parent->dontNormalize);
+        I.setEulerAngles(0, tilt, 0);
+
+        // Align the original image
+        if (!parent->fnSelOrig.empty())
+        {
+            Image<double> &Iorig=master->correctedOrig[b];
+            Iorig.read(master->fnOrig[b]);
+            double scale=((double)XSIZE(Iorig()))/XSIZE(I());
+            translation2DMatrix(vectorR2(-master->z0*sin(DEG2RAD(tilt))*scale,0),M1);
+            translation2DMatrix(-(alignment.di[n]+alignment.diaxis[n])*scale,M3);
+            M=M1*M2*M3;
+            correctImage(Iorig(),M,parent->dontNormalize);
+            Iorig.setEulerAngles(0, tilt, 0);
+        }
+    }
+}
+
 //#define DEBUG
 void ProgTomographAlignment::alignImages(const Alignment &alignment)
 {
@@ -2291,83 +2328,46 @@ void ProgTomographAlignment::alignImages(const Alignment &alignment)
     }
     DF.setComment("First shift by -(shiftX,shiftY), then rotate by psi");
 
-    MultidimArray<double> mask;
-    MultidimArray<int> iMask;
-    Image<double> I;
-    Matrix2D<double> M, M1, M2, M3;
+    // The images are corrected in parallel, in blocks of numThreads
+    // images, and written in order
+    AlignImagesParams th_args;
+    th_args.parent=this;
+    th_args.alignment=&alignment;
+    th_args.z0=z0;
+    th_args.corrected.resize(numThreads);
+    th_args.correctedOrig.resize(numThreads);
+    th_args.fnOrig.resize(numThreads);
     FileName fn_corrected;
-
-    for (int n=0;n<Nimg; n++)
+    for (int n0=0; n0<Nimg; n0+=numThreads)
     {
-        // Align the normal image
-        I.read(name_list[n]);
-        mask.initZeros(I());
-        FOR_ALL_ELEMENTS_IN_ARRAY2D(I())
-        if (I(i,j)!=0)
-            mask(i,j)=1;
-        translation2DMatrix(vectorR2(-z0*sin(DEG2RAD(tiltList[n])),0),M1);
-        rotation2DMatrix(90-alignment.rot+alignment.psi(n),M2);
-        translation2DMatrix(-(alignment.di[n]+alignment.diaxis[n]),M3);
-        M=M1*M2*M3;
-        selfApplyGeometry(BSPLINE3,I(),M,IS_NOT_INV,DONT_WRAP);
-        selfApplyGeometry(LINEAR,mask,M,IS_NOT_INV,DONT_WRAP);
-        mask.binarize(0.5);
-        typeCast(mask,iMask);
-        double minval, maxval, avg, stddev;
-        computeStats_within_binary_mask(iMask,I(),minval, maxval, avg, stddev);
-        FOR_ALL_ELEMENTS_IN_ARRAY2D(iMask)
-        if (iMask(i,j)==0)
-            I(i,j)=0;
-        else if (!dontNormalize)
-            I(i,j)-=avg;
-        double rot=0;
-        double tilt=tiltList[n];
-        double psi=0;
-        I.setEulerAngles(rot, tilt, psi);
-        fn_corrected.compose(n+1, fnRoot+"_corrected_", "stk");
-        I.write(fn_corrected);
+        int nBlock=XMIPP_MIN(numThreads,Nimg-n0);
+        th_args.first=n0;
+        if (!fnSelOrig.empty())
+            for (int b=0; b<nBlock; b++)
+            {
+                SForig.getValue(MDL_IMAGE, th_args.fnOrig[b], iter->objId);
+                iter->moveNext();
+            }
+        threadPool.parallelFor(nBlock, 1, threadAlignImages, &th_args);
 
-        // Align the original image
-        if (fnSelOrig!="")
+        for (int b=0; b<nBlock; b++)
         {
-            FileName auxFn;
-            SForig.getValue( MDL_IMAGE, auxFn, iter->objId);
-            Image<double> Iorig;
-            Iorig.read( auxFn );
-            //SForig.nextObject();
-            iter->moveNext();
-            mask.initZeros(Iorig());
-            FOR_ALL_ELEMENTS_IN_ARRAY2D(Iorig())
-            if (Iorig(i,j)!=0)
-                mask(i,j)=1;
-            translation2DMatrix(vectorR2(-z0*sin(DEG2RAD(tiltList[n]))*
-                                         (((double)XSIZE(Iorig()))/XSIZE(I())),0),M1);
-            rotation2DMatrix(90-alignment.rot+alignment.psi(n),M2);
-            translation2DMatrix(-(alignment.di[n]+alignment.diaxis[n])*
-                                (((double)XSIZE(Iorig()))/XSIZE(I())),M3);
-            M=M1*M2*M3;
-            selfApplyGeometry(BSPLINE3,Iorig(),M,IS_NOT_INV,DONT_WRAP);
-            selfApplyGeometry(LINEAR,mask,M,IS_NOT_INV,DONT_WRAP);
-            mask.binarize(0.5);
-            typeCast(mask,iMask);
-            computeStats_within_binary_mask(iMask,Iorig(),minval, maxval,
-                                            avg, stddev);
-            FOR_ALL_ELEMENTS_IN_ARRAY2D(iMask)
-            if (iMask(i,j)==0)
-                Iorig(i,j)=0;
-            else if (!dontNormalize)
-                Iorig(i,j)-=avg;
-            Iorig.setEulerAngles(rot, tilt, psi);
-            fn_corrected.compose(n+1, fnRoot+"_corrected_originalsize_", "stk");
-            Iorig.write(fn_corrected);
-        }
+            int n=n0+b;
+            fn_corrected.compose(n+1, fnRoot+"_corrected_", "stk");
+            th_args.corrected[b].write(fn_corrected);
+            if (!fnSelOrig.empty())
+            {
+                fn_corrected.compose(n+1, fnRoot+"_corrected_originalsize_", "stk");
+                th_args.correctedOrig[b].write(fn_corrected);
+            }
 
-        // Prepare data for the docfile
-        size_t id = DF.addObject();
-        DF.setValue(MDL_IMAGE, fn_corrected, id);
-        DF.setValue(MDL_ANGLE_PSI, 90.-alignment.rot+alignment.psi(n), id);
-        DF.setValue(MDL_SHIFT_X, XX(alignment.di[n]+alignment.diaxis[n]), id);
-        DF.setValue(MDL_SHIFT_Y, YY(alignment.di[n]+alignment.diaxis[n]), id);
+            // Prepare data for the docfile
+            size_t id = DF.addObject();
+            DF.setValue(MDL_IMAGE, fn_corrected, id);
+            DF.setValue(MDL_ANGLE_PSI, 90.-alignment.rot+alignment.psi(n), id);
+            DF.setValue(MDL_SHIFT_X, XX(alignment.di[n]+alignment.diaxis[n]), id);
+            DF.setValue(MDL_SHIFT_Y, YY(alignment.di[n]+alignment.diaxis[n]), id);
+        }
     }
     DF.write(fnRoot+"_correction_parameters.txt");
     delete iter;
@@ -2517,6 +2517,26 @@ double wrapperError(double *p, void *prm)
     return alignment.optimizeGivenAxisDirection();
 }
 
+// Each task is one of the rot angles of the exhaustive search
+struct ThreadExhaustiveRotParams
+{
+    const ProgTomographAlignment * parent;
+    std::vector<double> rotList;
+    std::vector<double> errorList;
+};
+
+void threadExhaustiveRot(size_t first, size_t last, int thread_id, void * data)
+{
+    ThreadExhaustiveRotParams * master = (ThreadExhaustiveRotParams *) data;
+    Alignment alignment(master->parent);
+    for (size_t n=first; n<=last; ++n)
+    {
+        alignment.clear();
+        alignment.rot=master->rotList[n];
+        master->errorList[n]=alignment.optimizeGivenAxisDirection();
+    }
+}
+
 #define DEBUG
 void ProgTomographAlignment::run()
 {
@@ -2526,15 +2546,20 @@ void ProgTomographAlignment::run()
     std::cerr << "produceInformationFromLandmarks" << std::endl;
     produceInformationFromLandmarks();
     std::cerr << "alignment" << std::endl;
-    Alignment *alignment=new Alignment(this);
 
-    // Exhaustive search for rot
-    double bestError=0, bestRot=-1;
+    // Exhaustive search for rot, the directions are independent
+    ThreadExhaustiveRotParams th_args;
+    th_args.parent = this;
     for (double rot=0; rot<=180-deltaRot; rot+=deltaRot)
+        th_args.rotList.push_back(rot);
+    th_args.errorList.resize(th_args.rotList.size());
+    threadPool.parallelFor(th_args.rotList.size(), 1, threadExhaustiveRot, &th_args);
+
+    double bestError=0, bestRot=-1;
+    for (size_t n=0; n<th_args.rotList.size(); n++)
     {
-        alignment->clear();
-        alignment->rot=rot;
-        double error=alignment->optimizeGivenAxisDirection();
+        double rot=th_args.rotList[n];
+        double error=th_args.errorList[n];
 #ifdef DEBUG
 
         std::cout << "rot= " << rot
@@ -2545,10 +2570,15 @@ void ProgTomographAlignment::run()
         {
             bestRot=rot;
             bestError=error;
-            *bestPreviousAlignment=*alignment;
         }
     }
-    delete alignment;
+
+    // The optimization is deterministic, so the best alignment is
+    // computed again instead of keeping the alignments of all directions
+    Alignment alignment(this);
+    alignment.rot=bestRot;
+    alignment.optimizeGivenAxisDirection();
+    *bestPreviousAlignment=alignment;
     std::cout << "Best rot=" << bestRot
     << " Best error=" << bestError << std::endl;
 
@@ -2714,20 +2744,27 @@ void Alignment::computeGeometryDependentOfRotation()
 /* Compute error ----------------------------------------------------------- */
 double Alignment::computeError() const
 {
-    Matrix1D<double> pijp;
     double error=0;
     double N=0;
     for (int i=0; i<Nimg; i++)
     {
+        // pij'=Ai*rj+di+diaxis, without temporary matrices
+        const Matrix2D<double> &A=Ai[i];
+        double a00=MAT_ELEM(A,0,0), a01=MAT_ELEM(A,0,1), a02=MAT_ELEM(A,0,2);
+        double a10=MAT_ELEM(A,1,0), a11=MAT_ELEM(A,1,1), a12=MAT_ELEM(A,1,2);
+        double dx=XX(di[i])+XX(diaxis[i]);
+        double dy=YY(di[i])+YY(diaxis[i]);
         int jjmax=prm->Vseti[i].size();
         for (int jj=0; jj<jjmax; jj++)
         {
             int j=prm->Vseti[i][jj];
-            pijp=Ai[i]*rj[j]+di[i]+diaxis[i];
-            MAT_ELEM(allLandmarksPredictedX,j,i)=XX(pijp);
-            MAT_ELEM(allLandmarksPredictedY,j,i)=YY(pijp);
-            double diffx=MAT_ELEM(prm->allLandmarksX,j,i)-XX(pijp);
-            double diffy=MAT_ELEM(prm->allLandmarksY,j,i)-YY(pijp);
+            const Matrix1D<double> &r=rj[j];
+            double px=a00*XX(r)+a01*YY(r)+a02*ZZ(r)+dx;
+            double py=a10*XX(r)+a11*YY(r)+a12*ZZ(r)+dy;
+            MAT_ELEM(allLandmarksPredictedX,j,i)=px;
+            MAT_ELEM(allLandmarksPredictedY,j,i)=py;
+            double diffx=MAT_ELEM(prm->allLandmarksX,j,i)-px;
+            double diffy=MAT_ELEM(prm->allLandmarksY,j,i)-py;
             error+=diffx*diffx+diffy*diffy;
             N++;
         }
@@ -2741,18 +2778,17 @@ void Alignment::computeErrorForLandmarks()
     errorLandmark.initZeros(Nlandmark);
     for (int j=0; j<Nlandmark; j++)
     {
-        int counterj=0;
-        for (int i=0; i<Nimg; i++)
+        // Only the images in which the landmark is seen
+        const std::vector<int> &Vj=prm->Vsetj[j];
+        int counterj=Vj.size();
+        for (int ii=0; ii<counterj; ii++)
         {
-            if (prm->allLandmarksX(j,i)!=XSIZE(*(prm->img[0])))
-            {
-                double diffx=MAT_ELEM(prm->allLandmarksX,j,i)-
-                             MAT_ELEM(allLandmarksPredictedX,j,i);
-                double diffy=MAT_ELEM(prm->allLandmarksY,j,i)-
-                             MAT_ELEM(allLandmarksPredictedY,j,i);
-                errorLandmark(j)+=sqrt(diffx*diffx+diffy*diffy);
-                counterj++;
-            }
+            int i=Vj[ii];
+            double diffx=MAT_ELEM(prm->allLandmarksX,j,i)-
+                         MAT_ELEM(allLandmarksPredictedX,j,i);
+            double diffy=MAT_ELEM(prm->allLandmarksY,j,i)-
+                         MAT_ELEM(allLandmarksPredictedY,j,i);
+            errorLandmark(j)+=sqrt(diffx*diffx+diffy*diffy);
         }
         errorLandmark(j)/=counterj;
     }
@@ -2762,8 +2798,7 @@ void Alignment::computeErrorForLandmarks()
 //#define DEBUG
 void Alignment::updateModel()
 {
-    Matrix1D<double> pij(2), piN(2);
-    Matrix2D<double> A(3,3), AitAi;
+    Matrix2D<double> A(3,3), Ainv;
     Matrix1D<double> b(3);
 
 #ifdef DEBUG
@@ -2774,21 +2809,40 @@ void Alignment::updateModel()
     // Update the 3D positions of the landmarks
     for (int j=0; j<Nlandmark; j++)
     {
-        A.initZeros();
-        b.initZeros();
-        // Compute the part corresponding to Vj
+        // Compute the part corresponding to Vj:
+        // A=sum Ait*Ai, b=sum Ait*(pij-(di+diaxis))
+        double A00=0, A01=0, A02=0, A11=0, A12=0, A22=0;
+        double b0=0, b1=0, b2=0;
         int iimax=prm->Vsetj[j].size();
         for (int ii=0; ii<iimax; ii++)
         {
             int i=prm->Vsetj[j][ii];
-            XX(pij)=MAT_ELEM(prm->allLandmarksX,j,i);
-            YY(pij)=MAT_ELEM(prm->allLandmarksY,j,i);
-            A+=Ait[i]*Ai[i];
-            b+=Ait[i]*(pij-(di[i]+diaxis[i]));
+            const Matrix2D<double> &Aii=Ai[i];
+            double a00=MAT_ELEM(Aii,0,0), a01=MAT_ELEM(Aii,0,1), a02=MAT_ELEM(Aii,0,2);
+            double a10=MAT_ELEM(Aii,1,0), a11=MAT_ELEM(Aii,1,1), a12=MAT_ELEM(Aii,1,2);
+            double ex=MAT_ELEM(prm->allLandmarksX,j,i)-(XX(di[i])+XX(diaxis[i]));
+            double ey=MAT_ELEM(prm->allLandmarksY,j,i)-(YY(di[i])+YY(diaxis[i]));
+            A00+=a00*a00+a10*a10;
+            A01+=a00*a01+a10*a11;
+            A02+=a00*a02+a10*a12;
+            A11+=a01*a01+a11*a11;
+            A12+=a01*a02+a11*a12;
+            A22+=a02*a02+a12*a12;
+            b0+=a00*ex+a10*ey;
+            b1+=a01*ex+a11*ey;
+            b2+=a02*ex+a12*ey;
         }
+        MAT_ELEM(A,0,0)=A00;
+        MAT_ELEM(A,0,1)=MAT_ELEM(A,1,0)=A01;
+        MAT_ELEM(A,0,2)=MAT_ELEM(A,2,0)=A02;
+        MAT_ELEM(A,1,1)=A11;
+        MAT_ELEM(A,1,2)=MAT_ELEM(A,2,1)=A12;
+        MAT_ELEM(A,2,2)=A22;
+        VECTOR_R3(b,b0,b1,b2);
 
         // Update rj[j]
-        rj[j]=A.inv()*b;
+        A.inv(Ainv);
+        rj[j]=Ainv*b;
     }
 #ifdef DEBUG
     std::cout << "Step 1: error=" << computeError() << std::endl;
@@ -2846,26 +2900,30 @@ void Alignment::updateModel()
     // Update rotations
     if (prm->psiMax>0)
     {
-        Matrix2D<double> Ri(2,2);
-        Matrix2D<double> Aiprj(2,1), Aiprjt(1,2), dim(2,1), Pij(2,1);
         for (int i=0; i<Nimg; i++)
         {
-            Ri.initZeros();
-            dim.fromVector(di[i]+diaxis[i]);
+            // Ri=sum (di+diaxis-pij)*(Aip*rj)^t
+            double R00=0, R01=0, R10=0, R11=0;
+            const Matrix2D<double> &A=Aip[i];
+            double a00=MAT_ELEM(A,0,0), a01=MAT_ELEM(A,0,1), a02=MAT_ELEM(A,0,2);
+            double a10=MAT_ELEM(A,1,0), a11=MAT_ELEM(A,1,1), a12=MAT_ELEM(A,1,2);
+            double dx=XX(di[i])+XX(diaxis[i]);
+            double dy=YY(di[i])+YY(diaxis[i]);
             for (int jj=0; jj<prm->ni(i); jj++)
             {
                 int j=prm->Vseti[i][jj];
-                Aiprj.fromVector(Aip[i]*rj[j]);
-                Aiprjt=Aiprj.transpose();
-
-                MAT_ELEM(Pij,0,0)=MAT_ELEM(prm->allLandmarksX,j,i);
-                MAT_ELEM(Pij,1,0)=MAT_ELEM(prm->allLandmarksY,j,i);
-                Ri+=(dim-Pij)*Aiprjt;
+                const Matrix1D<double> &r=rj[j];
+                double qx=a00*XX(r)+a01*YY(r)+a02*ZZ(r);
+                double qy=a10*XX(r)+a11*YY(r)+a12*ZZ(r);
+                double ex=dx-MAT_ELEM(prm->allLandmarksX,j,i);
+                double ey=dy-MAT_ELEM(prm->allLandmarksY,j,i);
+                R00+=ex*qx;
+                R01+=ex*qy;
+                R10+=ey*qx;
+                R11+=ey*qy;
             }
-            psi(i)=CLIP(RAD2DEG(atan(((Ri(0,1)-Ri(1,0))/(Ri(0,0)+Ri(1,1))))),
+            psi(i)=CLIP(RAD2DEG(atan(((R01-R10)/(R00+R11)))),
                         -(prm->psiMax),prm->psiMax);
-            Matrix2D<double> Rinplane;
-            rotation3DMatrix(-psi(i),'Z',Rinplane,false);
         }
     }
 #ifdef DEBUG
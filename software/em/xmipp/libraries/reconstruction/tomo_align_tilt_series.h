@@ -89,6 +89,9 @@ public:
     /// Number of threads to use for parallel computing
     int numThreads;
 
+    /// Pool of threads, created once for all the parallel steps
+    ThreadPool threadPool;
+
     /// Look for local affine transformation
     bool globalAffine;
 
@@ -23,6 +23,7 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 #include "tomo_extract_subvolume.h"
+#include <algorithm>
 
 //#define DEBUG
 
@@ -48,6 +49,7 @@ void ProgTomoExtractSubvolume::defineParams()
     addParamsLine("[--mindist  <distance=-1>] : Minimum distance between subvolume centers, useful to avoid repetition of subvolumes place at simmetry axis");
     addParamsLine("                           : If set to -1 minsdist will be size/4");
     addParamsLine("--center  <x> <y> <z>   :  position of center of subvolume to be extracted");
+    addParamsLine("[--thr <N=1>]           : Number of threads extracting the subvolumes of each volume");
     addExampleLine("Extract 12 vertices (subvolumes) in boxes of size 21x21x21 pixels from each subtomogram in the data set: ", false);
     addExampleLine("xmipp_extract_subvolume -i align/mltomo_1deg_it000001.doc -center 0 0 59 -size 21 -sym i3 -o vertices");
 
@@ -119,6 +121,10 @@ void ProgTomoExtractSubvolume::readParams()
     mindist = getDoubleParam("--mindist");
     if (mindist == -1)
         mindist = size/4.;
+    numThreads = getIntParam("--thr");
+    if (numThreads < 1)
+        numThreads = 1;
+    threadPool.setNumberOfThreads(numThreads);
 }
 
 // Usage ===================================================================
@@ -144,6 +150,7 @@ void ProgTomoExtractSubvolume::show()
         std::cout << "Size subvolume       " <<  size         << std::endl;
         std::cout << "Symmetry group       " <<  fn_sym       << std::endl;
         std::cout << "Minimum distance between subvolumes " << mindist << std::endl;
+        std::cout << "Number of threads    " <<  numThreads   << std::endl;
     }
 #ifdef DEBUG
     std::cerr << "end show" <<std::endl;
@@ -219,6 +226,52 @@ void ProgTomoExtractSubvolume::preProcess()
     I.initIdentity();
 }
 
+// Margin of the window read around each subvolume. The B-spline
+// coefficients of a voxel depend on its neighbours with a weight that
+// decays as 0.268^distance, so 16 voxels are enough to get the same
+// values as with the whole volume.
+#define SUBVOLUME_MARGIN 16
+
+void ProgTomoExtractSubvolume::extractSubvolume(const Matrix1D<double> &shift,
+        MultidimArray<double> &subvolume) const
+{
+    // The subvolume is volout(r)=vol(r-shift) for r in [x0,xF]. The integer
+    // part of the shift is a window of vol, the fractional part is
+    // interpolated in the window
+    int nx = ROUND(XX(shift));
+    int ny = ROUND(YY(shift));
+    int nz = ROUND(ZZ(shift));
+    Matrix1D<double> fraction(3);
+    VECTOR_R3(fraction, XX(shift) - nx, YY(shift) - ny, ZZ(shift) - nz);
+
+    int margin = SUBVOLUME_MARGIN;
+    if (fraction.sum2() == 0)
+        margin = 0;
+    MultidimArray<double> window;
+    vol()._window(window, x0 - nz - margin, x0 - ny - margin, x0 - nx - margin,
+                  xF - nz + margin, xF - ny + margin, xF - nx + margin);
+    window.setXmippOrigin();
+    if (margin > 0)
+    {
+        translate(BSPLINE3, subvolume, window, fraction);
+        subvolume.selfWindow(x0, x0, x0, xF, xF, xF);
+    }
+    else
+        subvolume = window;
+}
+
+// Each task is a subvolume of the current volume. They are taken in the
+// order of their slices, so that a mapped volume is read sequentially
+void threadExtractSubvolumes(size_t first, size_t last, int thread_id, void * data)
+{
+    ProgTomoExtractSubvolume * prm = (ProgTomoExtractSubvolume *) data;
+    for (size_t n = first; n <= last; ++n)
+    {
+        size_t i = prm->subvolumeOrder[n];
+        prm->extractSubvolume(prm->subvolumeShifts[i], prm->subvolumes[i]);
+    }
+}
+
 void ProgTomoExtractSubvolume::processImage(const FileName &fnImg2
 		                                  , const FileName &fnImgOut
 		                                  , const MDRow &rowIn
@@ -242,8 +295,9 @@ void ProgTomoExtractSubvolume::processImage(const FileName &fnImg2
     rowIn.getValue(MDL_ORIGIN_Z,auxD);
     ZZ(doccenter) = auxD;
 
-    // Read volume
-    vol.read(fnImg2);
+    // Map the volume (only the pages of the subvolumes are read), it is
+    // read normally if its format cannot be mapped
+    vol.read(fnImg2, DATA, ALL_IMAGES, true);
     vol().setXmippOrigin();
     FileName fnImg;
     fnImg = fnImg2.removeFileFormat().removeLastExtension();
@@ -297,23 +351,38 @@ void ProgTomoExtractSubvolume::processImage(const FileName &fnImg2
      // Tomo_Extract each of the unique subvolumes
     size_t oId;
     SPEED_UP_temps012;
-    for (size_t i = 0; i < centers_subvolumes.size(); i++)
+    size_t nSubvolumes = centers_subvolumes.size();
+    subvolumeShifts.resize(nSubvolumes);
+    subvolumes.resize(nSubvolumes);
+    Euler_angles2matrix(-psi,-tilt,-rot,A,false);
+    for (size_t i = 0; i < nSubvolumes; i++)
     {
         center=centers_subvolumes[i];
-
         // 1. rotate center
-        Euler_angles2matrix(-psi,-tilt,-rot,A,false);
         M3x3_BY_V3x1(center, A, center);
         // 2. translate center
         center -= doccenter;
-        // 3. Apply possible non-integer center to volume
-        //translations may be non-integer
-        translate(BSPLINE3,volout(),vol(),center);
-
-        //vol().translate(-center, volout(), DONT_WRAP);
-        //4. Window operation and write subvolume to disc
-        volout().selfWindow(x0,x0,x0,xF,xF,xF);
-        //remove type if present
+        subvolumeShifts[i] = center;
+    }
+    // The first slice of subvolume i is x0-ZZ(shift)
+    std::vector< std::pair<double, size_t> > zOrder(nSubvolumes);
+    for (size_t i = 0; i < nSubvolumes; i++)
+        zOrder[i] = std::make_pair(-ZZ(subvolumeShifts[i]), i);
+    std::sort(zOrder.begin(), zOrder.end());
+    subvolumeOrder.resize(nSubvolumes);
+    for (size_t i = 0; i < nSubvolumes; i++)
+        subvolumeOrder[i] = zOrder[i].second;
+
+    // 3. Apply possible non-integer center to volume
+    //translations may be non-integer. The subvolumes are independent,
+    //they are extracted in parallel
+    threadPool.parallelFor(nSubvolumes, 1, threadExtractSubvolumes, this);
+
+    for (size_t i = 0; i < nSubvolumes; i++)
+    {
+        center = subvolumeShifts[i];
+        //4. Write subvolume to disc
+        volout() = subvolumes[i];
         fnOutStack.compose(i+1,fn_aux,"stk");
         volout.write(fnOutStack);
 
@@ -338,6 +407,7 @@ void ProgTomoExtractSubvolume::processImage(const FileName &fnImg2
     DFout.setComment("shift keeps the center of the box in the original virus");
     DFout.write(fnOutMd);
     DFout.clear();
+    subvolumes.clear();
 
 
 
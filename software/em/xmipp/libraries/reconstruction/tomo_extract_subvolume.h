@@ -32,6 +32,8 @@
 #include <data/xmipp_funcs.h>
 #include <data/metadata.h>
 #include <data/xmipp_image.h>
+#include <data/xmipp_image_generic.h>
+#include <data/xmipp_threads.h>
 #include <data/geometry.h>
 #include <data/filters.h>
 #include <data/mask.h>
@@ -78,13 +80,27 @@ public:
     /** Minimum distance between unique subvolumes */
     double mindist;
 
+    /** Number of threads extracting the subvolumes of each volume */
+    int numThreads;
+
+    /** Pool of threads */
+    ThreadPool threadPool;
+
     // Symmetry setup
     int symmetry, sym_order;
     SymList SL;
 
     //Some local variables
     FileName fn_out;
-    Image<double> vol, volout;
+    /** Input volume, mapped to memory if possible */
+    ImageGeneric vol;
+    Image<double> volout;
+    /** Subvolumes extracted from the current input volume */
+    std::vector< MultidimArray<double> > subvolumes;
+    /** Translation applied to each subvolume */
+    std::vector< Matrix1D<double> > subvolumeShifts;
+    /** Subvolumes sorted by their first slice in the input volume */
+    std::vector<size_t> subvolumeOrder;
     Matrix1D<double> center, doccenter;
     Matrix2D<double> A, R, I;
     double rot, tilt, psi, rotp, tiltp, psip;
@@ -106,6 +122,12 @@ public:
     void postProcess();
     void preProcess();
 
+    /** Extract the subvolume of vol translated by shift.
+     * Only a window of the input volume around the subvolume is read,
+     * so the whole volume need not be in memory when it is mapped.
+     */
+    void extractSubvolume(const Matrix1D<double> &shift, MultidimArray<double> &subvolume) const;
+
 
     //void processImage(int imgno_start, int imgno_end);
 
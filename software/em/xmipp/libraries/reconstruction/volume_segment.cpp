@@ -66,6 +66,7 @@ void ProgVolumeSegment::readParams()
         do_prob = true;
         wang_radius = getIntParam("--method", 1);
     }
+    dilate_radius = getDoubleParam("--dilate");
 }
 
 // Show ====================================================================
@@ -83,6 +84,7 @@ void ProgVolumeSegment::show() const
     << "Otsu         : " << otsu          << std::endl
     << "Wang radius  : " << wang_radius   << std::endl
     << "Probabilistic: " << do_prob       << std::endl
+    << "Dilation     : " << dilate_radius << std::endl
     ;
 }
 
@@ -102,6 +104,8 @@ void ProgVolumeSegment::defineParams()
     addParamsLine("            otsu                      : Otsu's method segmentation");
     addParamsLine("            prob        <radius=-1>   : Probabilistic solvent mask (typical value 3)");
     addParamsLine("                                      : Radius [pix] is used for B.C. Wang cone smoothing");
+    addParamsLine("  [--dilate <r=0>]          : Dilate the output mask by r pixels (Euclidean distance).");
+    addParamsLine("                            : Not used with prob");
 }
 
 // Produce side information ================================================
@@ -289,6 +293,18 @@ void probabilistic_solvent(Image<double> *V_in, Image<double> *V_out)
     }
 }
 
+// Dilate a binary mask ====================================================
+// The voxels closer than radius to the mask are added to it
+void dilate_mask(MultidimArray<double> &mask, double radius)
+{
+    MultidimArray<int> binary;
+    MultidimArray<double> distance;
+    typeCast(mask, binary);
+    euclideanDistanceTransform(binary, distance);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mask)
+    DIRECT_MULTIDIM_ELEM(mask, n) = DIRECT_MULTIDIM_ELEM(distance, n) <= radius;
+}
+
 // Really segment ==========================================================
 void ProgVolumeSegment::segment(Image<double> &mask)
 {
@@ -359,6 +375,9 @@ void ProgVolumeSegment::segment(Image<double> &mask)
         probabilistic_solvent(&V, &mask);
     }
 
+    if (dilate_radius > 0 && ok && !do_prob)
+        dilate_mask(mask(), dilate_radius);
+
     // Save mask if necessary
     if (fn_mask != "" && (ok || do_prob))
         mask.write(fn_mask);
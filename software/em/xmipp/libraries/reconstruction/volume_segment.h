@@ -65,6 +65,9 @@ public:
     /// radius for B.C. Wang-like smoothing procedure
     int wang_radius;
 
+    /// Dilate the output mask by this distance (in pixels)
+    double dilate_radius;
+
 public:
     // Input volume
     Image<double> V;